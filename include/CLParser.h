@@ -4,7 +4,7 @@
 //    Файл CLParser.h   - содержит объявление класса ParserСommandLine, который инкапсулирует
 //                        функциональность разбора командной строки.
 //
-//    Версия файла 1.01  - внесены незначительные изменения
+//    Версия файла 1.02  - разбор реентерабелен и работает с представлениями строк (string_view)
 //
 //
 
@@ -162,7 +162,8 @@ class OptionArray //Эмуляция массива, представляюще
             else
             {
                   ItemArgEmpty.NameOption = Ch;
-                  ItemArgEmpty.ParamOption.push_back(_T(""));
+                  if (ItemArgEmpty.ParamOption.empty())
+                        ItemArgEmpty.ParamOption.push_back(_T(""));
                   return ItemArgEmpty;
             }
       }
@@ -218,6 +219,9 @@ class ParserCommandLine
 {
       GetOpt* GetOptObject;
 
+      // Разбор ARGV, подготовленного одной из функций Parser()
+      void ParseArgs();
+
   public:
       //Список не опций
       TOptionArray<Tstring::tstring> NonOption;
@@ -242,11 +246,14 @@ class ParserCommandLine
       // Добавим формат для очередной длинной опции
       void AddFormatOfArg(Tstring::tstring name, _argtype has_arg, TCHAR val);
 
-      // Две функции Parser() с разными входными параметрами
+      // Функции Parser() с разными входными параметрами.
+      // Каждый вызов разбирает новую командную строку: результаты прошлого разбора сбрасываются.
+      // Разбор не использует статических данных, поэтому разные объекты ParserCommandLine
+      // можно использовать из разных потоков одновременно; один объект - только из одного потока.
       template <class _Elem>
       void Parser(int argc, _Elem* argv[]);
 
-      void Parser(vector<Tstring::tstring>& ArgV_p);
+      void Parser(const vector<Tstring::tstring>& ArgV_p);
 
       // Еще одна функция Parser(), которая принимает для разбора  строку
       // bProgramName, этот параметр задает правила интерпретации первой опции в строке ArgV_str:
@@ -257,6 +264,9 @@ class ParserCommandLine
       //void Parser(Tstring::tstring& ArgV_str, bool bProgramName=true);
       template <class _Elem>
       void Parser(const std::basic_string<_Elem>& ArgV_str, bool bProgramName = true);
+
+      // То же для строки, заданной представлением: строка разбивается на месте, без копирования аргументов
+      void Parser(Tstring::tstring_view ArgV_str, bool bProgramName = true);
 };
 
 extern template void ParserCommandLine::Parser(int argc, char* argv[]);
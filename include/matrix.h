@@ -1,10 +1,20 @@
-﻿#include <unordered_map>
+﻿#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <type_traits>
 #include <functional>
 #include <cassert>
 #include <initializer_list>
 #include <tuple>
 #include <array>
 #include <iterator>
+#include <algorithm>
+#include <cstdint>
+
+#include "matrix_counters.h"
+#include "matrix_zorder.h"
+#include "matrix_parallel.h"
 
 namespace roro_lib
 {
@@ -32,15 +42,21 @@ namespace roro_lib
                         ++it;
                   };
 
+                  explicit key(const coordinates_t& coordinates_arg) : coordinates(coordinates_arg),
+                                                                       it(coordinates.end())
+                  {
+                  };
+
                   key(const key& key_arg) : coordinates(key_arg.coordinates)
                   {
                         it = coordinates.begin();
                         it += std::distance(const_cast<key&>(key_arg).coordinates.begin(), key_arg.it);
                   };
 
-                  key(key&& key_arg) : it(key_arg.it)
+                  key(key&& key_arg) : coordinates(key_arg.coordinates)
                   {
-                        coordinates.swap(key_arg.coordinates);
+                        it = coordinates.begin();
+                        it += std::distance(key_arg.coordinates.begin(), key_arg.it);
                   };
 
                   void push_back(std::size_t coordinate)
@@ -67,6 +83,58 @@ namespace roro_lib
             {
                   return (arg1.coordinates == arg2.coordinates);
             }
+
+            //! Хеш для набора координат, например координат строки или блока ячеек
+            template <std::size_t N>
+            struct array_hash
+            {
+                  std::size_t operator()(const std::array<std::size_t, N>& coordinates) const noexcept
+                  {
+                        std::size_t h_value = 0;
+                        for (std::size_t shift = 0; shift < N; ++shift)
+                              h_value ^= std::hash<std::size_t>{}(coordinates[shift]) << shift;
+                        return h_value;
+                  }
+            };
+
+            //! Финализатор splitmix64: каждый бит результата зависит от каждого бита x
+            inline std::uint64_t mix64(std::uint64_t x) noexcept
+            {
+                  x ^= x >> 30;
+                  x *= 0xbf58476d1ce4e5b9ULL;
+                  x ^= x >> 27;
+                  x *= 0x94d049bb133111ebULL;
+                  x ^= x >> 31;
+                  return x;
+            }
+
+            //! Хорошо перемешанный хеш координат: младшие биты годятся для выбора страницы
+            template <std::size_t Dimension>
+            std::uint64_t mixed_hash(const std::array<std::size_t, Dimension>& c) noexcept
+            {
+                  std::uint64_t h = 0x9E3779B97F4A7C15ULL;
+                  for (std::size_t d = 0; d < Dimension; ++d)
+                        h = mix64(h ^ c[d]);
+                  return h;
+            }
+
+            //! Подсказка процессору заранее загрузить в кеш строку с адресом p
+            inline void prefetch(const void* p) noexcept
+            {
+#if defined(__GNUC__) || defined(__clang__)
+                  __builtin_prefetch(p);
+#else
+                  (void)p;
+#endif
+            }
+
+            /*!   \brief  Координаты ячейки в элементе итерации хранилищ, у которых нет явного ключа
+            */
+            template <std::size_t Dimension>
+            struct coordinates_holder
+            {
+                  std::array<std::size_t, Dimension> coordinates;
+            };
       }
 }
 
@@ -94,14 +162,673 @@ namespace std
 
 namespace roro_lib
 {
+      /*!   \brief  Запись журнала изменений матрицы.
+
+                    Описывает итоговое изменение одной ячейки с момента последней контрольной точки:
+                    ячейка появилась (inserted), изменила значение (updated) или была удалена (erased).
+                    old_value - значение ячейки в контрольной точке, new_value - текущее значение.
+      */
+      template <typename T, std::size_t Dimension>
+      struct change_record
+      {
+            enum kind_t
+            {
+                  inserted,
+                  updated,
+                  erased
+            };
+
+            kind_t kind;
+            std::array<std::size_t, Dimension> coordinates;
+            T old_value;
+            T new_value;
+      };
+
+      /*!   \brief  Журнал изменений матрицы (dirty-set).
+
+                    Для каждой измененной ячейки хранится ровно одна запись, повторные записи в ту же ячейку
+                    схлопываются: сохраняется значение на момент контрольной точки и последнее записанное значение.
+                    Запись того же значения не попадает в журнал, а если ячейка вернулась к состоянию
+                    контрольной точки (например, была добавлена и затем удалена), запись исчезает из журнала.
+
+             \tparam  T             -тип данных ячейки матрицы
+             \tparam  default_value -значение по умолчанию для ячеек матрицы
+             \tparam  Dimension     -размерность матицы
+      */
+      template <typename T, T default_value, std::size_t Dimension>
+      class change_journal
+      {
+        public:
+            using record_t = change_record<T, Dimension>;
+            using records_t = std::vector<record_t>;
+            using size_type = typename records_t::size_type;
+
+            void record(const internal::key<Dimension>& key, bool was_present, T old_value, bool is_present, T new_value)
+            {
+                  auto it = index.find(key);
+                  if (it == index.end())
+                  {
+                        if (same_state(was_present, old_value, is_present, new_value))
+                              return;
+
+                        index.emplace(key, records.size());
+                        records.push_back({ kind_of(was_present, is_present), key.coordinates, old_value, new_value });
+                        initial_presence.push_back(was_present);
+                        return;
+                  }
+
+                  // ячейка вернулась к состоянию контрольной точки - изменения нет
+                  size_type pos = it->second;
+                  if (same_state(initial_presence[pos], records[pos].old_value, is_present, new_value))
+                  {
+                        remove_at(pos);
+                        index.erase(it);
+                        return;
+                  }
+
+                  records[pos].kind = kind_of(initial_presence[pos], is_present);
+                  records[pos].new_value = new_value;
+            }
+
+            //! Возвращает изменения с момента последней контрольной точки и ставит новую контрольную точку
+            records_t drain()
+            {
+                  records_t result;
+                  result.swap(records);
+                  checkpoint();
+                  return result;
+            }
+
+            //! Ставит контрольную точку, отбрасывая накопленные изменения
+            void checkpoint() noexcept
+            {
+                  records.clear();
+                  initial_presence.clear();
+                  index.clear();
+            }
+
+            const records_t& pending() const noexcept
+            {
+                  return records;
+            }
+
+            size_type size() const noexcept
+            {
+                  return records.size();
+            }
+
+            bool empty() const noexcept
+            {
+                  return records.empty();
+            }
+
+        private:
+            static bool same_state(bool was_present, const T& old_value, bool is_present, const T& new_value)
+            {
+                  return was_present == is_present && (!is_present || old_value == new_value);
+            }
+
+            static typename record_t::kind_t kind_of(bool was_present, bool is_present) noexcept
+            {
+                  if (!was_present)
+                        return record_t::inserted;
+                  if (!is_present)
+                        return record_t::erased;
+                  return record_t::updated;
+            }
+
+            void remove_at(size_type pos)
+            {
+                  size_type last = records.size() - 1;
+                  if (pos != last)
+                  {
+                        records[pos] = records[last];
+                        initial_presence[pos] = initial_presence[last];
+                        index.find(internal::key<Dimension>(records[pos].coordinates))->second = pos;
+                  }
+                  records.pop_back();
+                  initial_presence.pop_back();
+            }
+
+            records_t records;
+            std::vector<bool> initial_presence;
+            std::unordered_map<internal::key<Dimension>, size_type> index;
+      };
+
+      /*!   \brief  Статистика использования памяти хранилищем матрицы.
+
+                    Байты посчитаны по размерам типов и устройству хранилища, поэтому это оценка, а не замер:
+                    overhead_bytes учитывает служебные поля узлов и заголовки блоков аллокатора.
+      */
+      struct storage_stats
+      {
+            std::size_t size = 0;           //!< количество занятых ячеек (nnz)
+            std::size_t key_bytes = 0;      //!< байты, занятые ключами (координатами)
+            std::size_t value_bytes = 0;    //!< байты, занятые значениями
+            std::size_t bucket_bytes = 0;   //!< байты массива бакетов / управляющих байтов
+            std::size_t overhead_bytes = 0; //!< служебные поля узлов и накладные расходы аллокатора
+            std::size_t bucket_count = 0;
+            double load_factor = 0.0;
+            double max_load_factor = 1.0;
+            std::size_t longest_chain = 0;                 //!< длина самой длинной цепочки пробирования
+            std::vector<std::size_t> occupancy_histogram; //!< [k] - число бакетов с k элементами, последний столбец - k и больше
+
+            std::size_t bytes_per_entry = 0; //!< стоимость одной ячейки, без учета бакетов
+            std::size_t bytes_per_bucket = 0;
+            std::size_t fixed_bytes = 0;     //!< память, не зависящая от числа ячеек
+
+            std::size_t total_bytes() const noexcept
+            {
+                  return key_bytes + value_bytes + bucket_bytes + overhead_bytes;
+            }
+
+            //! Оценка памяти, если в хранилище будет target_size занятых ячеек (в текущем представлении)
+            std::size_t projected_bytes(std::size_t target_size) const noexcept
+            {
+                  std::size_t buckets = 0;
+                  if (bytes_per_bucket != 0)
+                  {
+                        double mlf = max_load_factor > 0.0 ? max_load_factor : 1.0;
+                        buckets = static_cast<std::size_t>(static_cast<double>(target_size) / mlf) + 1;
+                        if (buckets < bucket_count && target_size >= size)
+                              buckets = bucket_count;
+                  }
+                  return fixed_bytes + target_size * bytes_per_entry + buckets * bytes_per_bucket;
+            }
+      };
+
+      namespace internal
+      {
+            constexpr std::size_t histogram_bins = 8;
+
+            //! Размер блока с учетом заголовка и выравнивания типичного malloc
+            constexpr std::size_t allocated_block_size(std::size_t bytes) noexcept
+            {
+                  constexpr std::size_t align = 2 * sizeof(void*);
+                  std::size_t with_header = bytes + sizeof(std::size_t);
+                  return (with_header + align - 1) / align * align;
+            }
+
+            /*!   \brief  Статистика для хранилища на основе std::unordered_map.
+
+                          Каждый элемент - отдельный узел односвязного списка: указатель next и пара ключ-значение.
+            */
+            template <typename Key, typename Value, typename Hash, typename Eq, typename Alloc>
+            storage_stats collect_stats(const std::unordered_map<Key, Value, Hash, Eq, Alloc>& um)
+            {
+                  using node_value_t = typename std::unordered_map<Key, Value, Hash, Eq, Alloc>::value_type;
+
+                  storage_stats st;
+                  st.size = um.size();
+                  st.bucket_count = um.bucket_count();
+                  st.load_factor = um.load_factor();
+                  st.max_load_factor = um.max_load_factor();
+
+                  std::size_t node_bytes = sizeof(void*) + sizeof(node_value_t);
+                  st.bytes_per_entry = allocated_block_size(node_bytes);
+                  st.bytes_per_bucket = sizeof(void*);
+
+                  st.key_bytes = st.size * sizeof(Key);
+                  st.value_bytes = st.size * sizeof(Value);
+                  st.bucket_bytes = st.bucket_count * st.bytes_per_bucket;
+                  st.overhead_bytes = st.size * (st.bytes_per_entry - sizeof(Key) - sizeof(Value));
+
+                  st.occupancy_histogram.assign(histogram_bins, 0);
+                  for (std::size_t b = 0; b < st.bucket_count; ++b)
+                  {
+                        std::size_t n = um.bucket_size(b);
+                        if (n > st.longest_chain)
+                              st.longest_chain = n;
+                        ++st.occupancy_histogram[n < histogram_bins ? n : histogram_bins - 1];
+                  }
+
+                  return st;
+            }
+      }
+
+      namespace internal
+      {
+            /*!   \brief  Хранилище ячеек матрицы на основе std::unordered_map.
+
+                          Хранилище - это точка расширения матрицы: политика выбирает его через шаблон storage.
+                          Любое хранилище предоставляет одинаковый набор операций:
+                          get/find/set/insert/erase по ключу, size/clear, итерацию по занятым ячейкам
+                          (элемент итерации имеет поля first.coordinates и second), capacity/probe_length для
+                          счетчиков горячего пути и stats() для учета памяти.
+            */
+            template <typename T, T default_value, std::size_t Dimension>
+            class hash_storage
+            {
+              public:
+                  using key_t = key<Dimension>;
+                  using map_t = std::unordered_map<key_t, T>;
+                  using size_type = typename map_t::size_type;
+                  using iterator = typename map_t::iterator;
+                  using const_iterator = typename map_t::const_iterator;
+                  using coordinates_t = std::array<std::size_t, Dimension>;
+
+                  //! Запросов в группе пакетной операции: столько промахов кеша перекрываются друг с другом
+                  static constexpr std::size_t batch_group = 16;
+
+                  T get(const key_t& key) const
+                  {
+                        auto it = um.find(key);
+                        return it == um.end() ? default_value : it->second;
+                  }
+
+                  /*!   \brief  Пакетное чтение out[i] = get(coords[i]) с групповой предвыборкой.
+
+                                Запросы обрабатываются группами по batch_group: сначала для всей группы считаются
+                                хеши и номера бакетов, затем читаются головы бакетов и для первого узла каждой
+                                цепочки выдается prefetch, и только потом ищутся ключи. Промахи кеша запросов одной
+                                группы независимы и идут одновременно, а не по очереди, как при подряд идущих find().
+                  */
+                  void get_batch(const coordinates_t* coords, std::size_t n, T* out) const
+                  {
+                        size_type buckets[batch_group];
+                        typename map_t::const_local_iterator heads[batch_group];
+
+                        for (std::size_t first = 0; first < n; first += batch_group)
+                        {
+                              const std::size_t count = std::min(batch_group, n - first);
+
+                              for (std::size_t i = 0; i < count; ++i)
+                                    buckets[i] = um.bucket(key_t(coords[first + i]));
+
+                              for (std::size_t i = 0; i < count; ++i)
+                              {
+                                    heads[i] = um.cbegin(buckets[i]);
+                                    if (heads[i] != um.cend(buckets[i]))
+                                          prefetch(&*heads[i]);
+                              }
+
+                              for (std::size_t i = 0; i < count; ++i)
+                              {
+                                    T value = default_value;
+                                    for (auto it = heads[i]; it != um.cend(buckets[i]); ++it)
+                                    {
+                                          if (it->first.coordinates == coords[first + i])
+                                          {
+                                                value = it->second;
+                                                break;
+                                          }
+                                    }
+                                    out[first + i] = value;
+                              }
+                        }
+                  }
+
+                  /*!   \brief  Пакетная запись set(coords[i], values[i]) с той же групповой предвыборкой, что и get_batch.<br>
+                                Записи применяются по порядку: при повторе координат остается последнее значение.
+                                Каждая запись ищет ключ один раз и удаляет или меняет ячейку через найденный итератор.
+                  */
+                  void set_batch(const coordinates_t* coords, std::size_t n, const T* values)
+                  {
+                        size_type buckets[batch_group];
+
+                        for (std::size_t first = 0; first < n; first += batch_group)
+                        {
+                              const std::size_t count = std::min(batch_group, n - first);
+
+                              for (std::size_t i = 0; i < count; ++i)
+                                    buckets[i] = um.bucket(key_t(coords[first + i]));
+
+                              for (std::size_t i = 0; i < count; ++i)
+                              {
+                                    auto head = um.cbegin(buckets[i]);
+                                    if (head != um.cend(buckets[i]))
+                                          prefetch(&*head);
+                              }
+
+                              // номера бакетов нужны только для предвыборки, поэтому перехеширование внутри группы безопасно
+                              for (std::size_t i = 0; i < count; ++i)
+                                    set(key_t(coords[first + i]), values[first + i]);
+                        }
+                  }
+
+                  T* find(const key_t& key)
+                  {
+                        auto it = um.find(key);
+                        return it == um.end() ? nullptr : &it->second;
+                  }
+
+                  const T* find(const key_t& key) const
+                  {
+                        auto it = um.find(key);
+                        return it == um.end() ? nullptr : &it->second;
+                  }
+
+                  //! Запись значения: значение по умолчанию удаляет ячейку
+                  void set(const key_t& key, T value)
+                  {
+                        if (value != default_value)
+                        {
+                              auto [it, inserted] = um.try_emplace(key, value);
+                              if (!inserted)
+                                    it->second = value;
+                        }
+                        else
+                        {
+                              auto it = um.find(key);
+                              if (it != um.end())
+                                    um.erase(it);
+                        }
+                  }
+
+                  //! Добавление ячейки, которой еще нет в хранилище
+                  void insert(const key_t& key, T value)
+                  {
+                        um.emplace(key, value);
+                  }
+
+                  void erase(const key_t& key)
+                  {
+                        um.erase(key);
+                  }
+
+                  //! Удаляет за один проход ячейки, для которых pred(coordinates, value) == true
+                  template <typename Pred>
+                  size_type erase_if(Pred pred)
+                  {
+                        size_type removed = 0;
+                        for (auto it = um.begin(); it != um.end();)
+                        {
+                              if (pred(it->first.coordinates, it->second))
+                              {
+                                    it = um.erase(it);
+                                    ++removed;
+                              }
+                              else
+                              {
+                                    ++it;
+                              }
+                        }
+                        return removed;
+                  }
+
+                  //! Уменьшает массив бакетов до минимума для текущего числа ячеек; узлы не перевыделяются
+                  void shrink_to_fit()
+                  {
+                        um.rehash(0);
+                  }
+
+                  size_type size() const noexcept
+                  {
+                        return um.size();
+                  }
+
+                  void clear() noexcept
+                  {
+                        um.clear();
+                  }
+
+                  iterator begin() noexcept
+                  {
+                        return um.begin();
+                  }
+
+                  iterator end() noexcept
+                  {
+                        return um.end();
+                  }
+
+                  const_iterator cbegin() const noexcept
+                  {
+                        return um.cbegin();
+                  }
+
+                  const_iterator cend() const noexcept
+                  {
+                        return um.cend();
+                  }
+
+                  //! Число бакетов: его изменение после вставки означает перехеширование
+                  size_type capacity() const noexcept
+                  {
+                        return um.bucket_count();
+                  }
+
+                  //! Длина цепочки бакета, в котором лежит (или лежал бы) ключ
+                  size_type probe_length(const key_t& key) const
+                  {
+                        return um.bucket_count() == 0 ? 0 : um.bucket_size(um.bucket(key));
+                  }
+
+                  storage_stats stats() const
+                  {
+                        return collect_stats(um);
+                  }
+
+                  /*!   \brief  Итератор по ячейкам диапазона бакетов [first, last)
+                  */
+                  class bucket_iterator
+                  {
+                    public:
+                        using value_type = typename map_t::value_type;
+                        using iterator_category = std::forward_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const value_type*;
+                        using reference = const value_type&;
+
+                        bucket_iterator() = default;
+                        bucket_iterator(const map_t* map, size_type bucket, size_type last) : map(map),
+                                                                                              bucket(bucket),
+                                                                                              last(last),
+                                                                                              it(map->cbegin(bucket != last ? bucket : 0))
+                        {
+                              if (bucket != last)
+                                    settle();
+                        }
+
+                        const value_type* operator->() const
+                        {
+                              return &*it;
+                        }
+
+                        const value_type& operator*() const
+                        {
+                              return *it;
+                        }
+
+                        bucket_iterator& operator++()
+                        {
+                              ++it;
+                              settle();
+                              return *this;
+                        }
+
+                        bucket_iterator operator++(int)
+                        {
+                              bucket_iterator old_iter = *this;
+                              ++*this;
+                              return old_iter;
+                        }
+
+                        bool operator==(const bucket_iterator& arg) const
+                        {
+                              return bucket == arg.bucket && (bucket == last || it == arg.it);
+                        }
+
+                        bool operator!=(const bucket_iterator& arg) const
+                        {
+                              return !(*this == arg);
+                        }
+
+                    private:
+                        void settle()
+                        {
+                              while (it == map->cend(bucket))
+                              {
+                                    if (++bucket == last)
+                                          return;
+                                    it = map->cbegin(bucket);
+                              }
+                        }
+
+                        const map_t* map = nullptr;
+                        size_type bucket = 0;
+                        size_type last = 0;
+                        typename map_t::const_local_iterator it;
+                  };
+
+                  //! Часть part из parts: равный диапазон бакетов, при хорошем хеше - примерно равное число ячеек
+                  std::pair<bucket_iterator, bucket_iterator> partition(std::size_t part, std::size_t parts) const
+                  {
+                        size_type buckets = um.bucket_count();
+                        size_type first = part * buckets / parts;
+                        size_type last = (part + 1) * buckets / parts;
+                        return { bucket_iterator(&um, first, last), bucket_iterator(&um, last, last) };
+                  }
+
+              private:
+                  map_t um;
+            };
+      }
+
+      namespace internal
+      {
+            //! Хранилище умеет делить ячейки на части без прохода по ним (метод partition(part, parts))
+            template <typename Storage, typename = void>
+            struct has_partition : std::false_type
+            {
+            };
+
+            template <typename Storage>
+            struct has_partition<Storage, std::void_t<decltype(std::declval<const Storage&>().partition(0, 1))>> : std::true_type
+            {
+            };
+
+            //! Хранилище умеет удалять ячейки по условию за один проход (метод erase_if(pred))
+            template <typename Storage, typename Pred, typename = void>
+            struct has_erase_if : std::false_type
+            {
+            };
+
+            template <typename Storage, typename Pred>
+            struct has_erase_if<Storage, Pred, std::void_t<decltype(std::declval<Storage&>().erase_if(std::declval<Pred&>()))>> : std::true_type
+            {
+            };
+
+            //! Хранилище умеет само отдавать лишнюю память (метод shrink_to_fit())
+            template <typename Storage, typename = void>
+            struct has_shrink_to_fit : std::false_type
+            {
+            };
+
+            template <typename Storage>
+            struct has_shrink_to_fit<Storage, std::void_t<decltype(std::declval<Storage&>().shrink_to_fit())>> : std::true_type
+            {
+            };
+
+            //! Хранилище умеет пакетные get_batch/set_batch
+            template <typename Storage, typename = void>
+            struct has_batch : std::false_type
+            {
+            };
+
+            template <typename Storage>
+            struct has_batch<Storage, std::void_t<decltype(std::declval<const Storage&>().get_batch(nullptr, 0, nullptr))>> : std::true_type
+            {
+            };
+      }
+
+      /*!   \brief  Политика матрицы по умолчанию.
+
+                    Политика задает необязательные возможности матрицы на этапе компиляции.
+                    Чтобы включить возможность, наследуйтесь от default_policy и переопределите нужный член.
+
+                    track_changes -вести журнал изменений ячеек (см. change_journal)
+                    instrument    -вести счетчики горячего пути (см. hot_path_counters)
+                    spatial_index -поддерживать индекс по Z-кривой для запросов range() по боксу
+                    storage       -шаблон хранилища ячеек (см. internal::hash_storage, bit_rows_policy)
+      */
+      struct default_policy
+      {
+            static constexpr bool track_changes = false;
+            static constexpr bool instrument = false;
+            static constexpr bool spatial_index = false;
+
+            template <typename T, T default_value, std::size_t Dimension>
+            using storage = internal::hash_storage<T, default_value, Dimension>;
+      };
+
+      //! Политика с включенным журналом изменений
+      struct tracking_policy : default_policy
+      {
+            static constexpr bool track_changes = true;
+      };
+
+      //! Политика с включенными счетчиками горячего пути
+      struct instrumented_policy : default_policy
+      {
+            static constexpr bool instrument = true;
+      };
+
+      //! Политика с индексом по Z-кривой для запросов range() по боксу
+      struct spatial_policy : default_policy
+      {
+            static constexpr bool spatial_index = true;
+      };
+
+      namespace internal
+      {
+            /*!   \brief  Хранилище журнала изменений.
+
+                          При выключенном журнале это пустой базовый класс, который не занимает места в матрице.
+            */
+            template <bool enabled, typename T, T default_value, std::size_t Dimension>
+            struct journal_holder
+            {
+            };
+
+            template <typename T, T default_value, std::size_t Dimension>
+            struct journal_holder<true, T, default_value, Dimension>
+            {
+                  change_journal<T, default_value, Dimension> changes;
+            };
+
+            /*!   \brief  Хранилище индекса по Z-кривой.
+
+                          Матрица сообщает индексу о каждой ячейке, которая действительно изменилась, и индекс
+                          обновляется сразу (см. zorder_index), так что запрос range() его не перестраивает.
+                          При выключенном индексе это пустой базовый класс.
+            */
+            template <bool enabled, typename T, std::size_t Dimension>
+            struct spatial_holder
+            {
+                  void index_assign(const std::array<std::size_t, Dimension>&, bool, const T&) noexcept {}
+                  void index_clear() noexcept {}
+            };
+
+            template <typename T, std::size_t Dimension>
+            struct spatial_holder<true, T, Dimension>
+            {
+                  using index_t = zorder_index<std::pair<coordinates_holder<Dimension>, T>, Dimension>;
+
+                  void index_assign(const std::array<std::size_t, Dimension>& c, bool present, const T& value)
+                  {
+                        index.assign(c, present, value);
+                  }
+
+                  void index_clear() noexcept
+                  {
+                        index.clear();
+                  }
+
+                  index_t index;
+            };
+      }
+
       /*!   \brief  Это шаблонный класс N-мерной бесконечной разряженной матрицы.
 
              \tparam  T             -тип данных ячейки матрицы
              \tparam  default_value -значение по умолчанию для ячеек матрицы
              \tparam  Dimension     -размерность матицы
+             \tparam  Policy        -политика, включающая необязательные возможности (см. default_policy)
       */
-      template <typename T, T default_value = 0, std::size_t Dimension = 2>
-      class matrix
+      template <typename T, T default_value = 0, std::size_t Dimension = 2, typename Policy = default_policy>
+      class matrix : private internal::journal_holder<Policy::track_changes, T, default_value, Dimension>,
+                     private internal::spatial_holder<Policy::spatial_index, T, Dimension>
       {
             static_assert(Dimension != 0, "Dimension shoudn't be zero");
 
@@ -109,12 +836,14 @@ namespace roro_lib
             template <std::size_t> struct indexation_matrix;
             template <typename> class matrix_iterator;
 
-            using iternal_data_t = std::unordered_map<internal::key<Dimension>, T>;
+            using iternal_data_t = typename Policy::template storage<T, default_value, Dimension>;
+            using journal_t = change_journal<T, default_value, Dimension>;
 
             using value_type = T;
             using size_type = typename iternal_data_t::size_type;
             using iterator = matrix_iterator<typename iternal_data_t::iterator>;
             using const_iterator = matrix_iterator<typename iternal_data_t::const_iterator>;
+            using coordinates_t = std::array<std::size_t, Dimension>;
 
 
             matrix() = default;
@@ -126,14 +855,26 @@ namespace roro_lib
 
             auto operator[](std::size_t row)
             {
-                  return indexation_matrix<1>(um, row);
+                  return indexation_matrix<1>(*this, row);
             }
 
-            size_type size() noexcept
+            size_type size() const noexcept
             {
                   return um.size();
             }
 
+            //! Удаляет все занятые ячейки матрицы
+            void clear()
+            {
+                  if constexpr (Policy::track_changes)
+                  {
+                        for (auto it = um.cbegin(); it != um.cend(); ++it)
+                              this->changes.record(internal::key<Dimension>(it->first.coordinates), true, it->second, false, default_value);
+                  }
+                  this->index_clear();
+                  um.clear();
+            }
+
             iterator begin() noexcept
             {
                   return iterator(um.begin());
@@ -154,7 +895,343 @@ namespace roro_lib
                   return const_iterator(um.cend());
             }
 
+            //! Статистика использования памяти хранилищем матрицы
+            storage_stats stats() const
+            {
+                  return um.stats();
+            }
+
+            /*!   \brief  Ленивый поток занятых ячеек: кортежи (координаты..., значение) читаются прямо из хранилища.<br>
+                          Адаптеры конвейера (filter, map, batch, async) - в matrix_stream.h.
+            */
+            auto stream() const
+            {
+                  using stream_iterator = matrix_iterator<typename iternal_data_t::const_iterator>;
+                  return internal::range_view<stream_iterator>(stream_iterator(um.cbegin()), stream_iterator(um.cend()));
+            }
+
+            /*!   \brief  Удаляет все ячейки, для которых pred(node) == true, за один проход по хранилищу.
+
+                          node - тот же кортеж (координаты..., значение), что и при итерации. Хеш-таблица и
+                          хранилище с размерами на этапе компиляции удаляют ячейки прямо во время обхода, другие
+                          хранилища сначала собирают координаты. Память не возвращается, см. shrink_to_fit().
+
+                   \return  число удаленных ячеек
+            */
+            template <typename Pred>
+            size_type erase_if(Pred pred)
+            {
+                  auto erase_test = [&](const coordinates_t& c, const T& value) {
+                        if (!pred(std::tuple_cat(c, std::make_tuple(value))))
+                              return false;
+                        if constexpr (Policy::track_changes)
+                              this->changes.record(internal::key<Dimension>(c), true, value, false, default_value);
+                        this->index_assign(c, false, default_value);
+                        return true;
+                  };
+
+                  size_type removed = 0;
+                  if constexpr (internal::has_erase_if<iternal_data_t, decltype(erase_test)>::value)
+                  {
+                        removed = um.erase_if(erase_test);
+                  }
+                  else
+                  {
+                        std::vector<coordinates_t> doomed;
+                        for (auto it = um.cbegin(); it != um.cend(); ++it)
+                        {
+                              if (erase_test(it->first.coordinates, it->second))
+                                    doomed.push_back(it->first.coordinates);
+                        }
+                        for (const auto& c : doomed)
+                              um.erase(internal::key<Dimension>(c));
+                        removed = doomed.size();
+                  }
+
+                  return removed;
+            }
+
+            /*!   \brief  Удаляет все ячейки внутри бокса [lo, hi] (границы включаются).<br>
+                          При включенном spatial_index ячейки бокса находятся через Z-индекс, без прохода
+                          по всей матрице.
+
+                   \return  число удаленных ячеек
+            */
+            size_type erase_range(const coordinates_t& lo, const coordinates_t& hi)
+            {
+                  if constexpr (Policy::spatial_index)
+                  {
+                        std::vector<std::pair<coordinates_t, T>> doomed;
+                        for (auto&& node : range(lo, hi))
+                              doomed.emplace_back(internal::node_coordinates<Dimension>(node, std::make_index_sequence<Dimension>()), std::get<Dimension>(node));
+
+                        for (const auto& [c, value] : doomed)
+                        {
+                              internal::key<Dimension> key(c);
+                              if constexpr (Policy::track_changes)
+                                    this->changes.record(key, true, value, false, default_value);
+                              this->index_assign(c, false, default_value);
+                              um.erase(key);
+                        }
+                        return doomed.size();
+                  }
+                  else
+                  {
+                        return erase_if([&](const auto& node) {
+                              return internal::in_box(internal::node_coordinates<Dimension>(node, std::make_index_sequence<Dimension>()), lo, hi);
+                        });
+                  }
+            }
+
+            /*!   \brief  Удаляет срез: все ячейки, у которых координата по измерению Axis равна k.
+
+                   \return  число удаленных ячеек
+            */
+            template <std::size_t Axis>
+            size_type clear_slice(std::size_t k)
+            {
+                  static_assert(Axis < Dimension, "Error using clear_slice(): axis is out of the matrix dimensions.");
+
+                  return erase_if([k](const auto& node) { return std::get<Axis>(node) == k; });
+            }
+
+            /*!   \brief  Перестраивает хранилище под текущее число ячеек, чтобы после массового удаления
+                          освободилась память. Итераторы матрицы становятся недействительными.
+
+                          Хеш-таблица уменьшает массив бакетов без перевыделения узлов, другие хранилища без
+                          своего shrink_to_fit() копируются в новое хранилище.
+            */
+            void shrink_to_fit()
+            {
+                  if constexpr (internal::has_shrink_to_fit<iternal_data_t>::value)
+                  {
+                        um.shrink_to_fit();
+                  }
+                  else
+                  {
+                        iternal_data_t rebuilt;
+                        for (auto it = um.cbegin(); it != um.cend(); ++it)
+                              rebuilt.insert(internal::key<Dimension>(it->first.coordinates), it->second);
+                        um = std::move(rebuilt);
+                  }
+            }
+
+            /*!   \brief  Пакетное чтение: out[i] - значение ячейки coords[i], i = 0 .. n-1.
+
+                          Хеш-таблица обрабатывает пакет группами с предвыборкой бакетов, так что промахи кеша
+                          независимых запросов перекрываются. Другие хранилища и матрица со счетчиками читают
+                          ячейки по одной.
+            */
+            void get_batch(const coordinates_t* coords, std::size_t n, T* out) const
+            {
+                  if constexpr (internal::has_batch<iternal_data_t>::value && !Policy::instrument)
+                  {
+                        um.get_batch(coords, n, out);
+                  }
+                  else
+                  {
+                        for (std::size_t i = 0; i < n; ++i)
+                              out[i] = get_value(internal::key<Dimension>(coords[i]));
+                  }
+            }
+
+            //! Пакетное чтение для непрерывных контейнеров (std::vector, std::array): out не короче coords
+            template <typename Coordinates, typename Values>
+            void get_batch(const Coordinates& coords, Values& out) const
+            {
+                  assert(std::size(out) >= std::size(coords));
+                  get_batch(std::data(coords), std::size(coords), std::data(out));
+            }
+
+            /*!   \brief  Пакетная запись: ячейке coords[i] присваивается values[i], i = 0 .. n-1.<br>
+                          Записи применяются по порядку; при включенном журнале, счетчиках или Z-индексе каждая
+                          запись проходит обычным путем, чтобы быть учтенной.
+            */
+            void set_batch(const coordinates_t* coords, std::size_t n, const T* values)
+            {
+                  if constexpr (internal::has_batch<iternal_data_t>::value && !Policy::track_changes && !Policy::instrument && !Policy::spatial_index)
+                  {
+                        um.set_batch(coords, n, values);
+                  }
+                  else
+                  {
+                        for (std::size_t i = 0; i < n; ++i)
+                              set_value(internal::key<Dimension>(coords[i]), values[i]);
+                  }
+            }
+
+            //! Пакетная запись для непрерывных контейнеров: values не короче coords
+            template <typename Coordinates, typename Values>
+            void set_batch(const Coordinates& coords, const Values& values)
+            {
+                  assert(std::size(values) >= std::size(coords));
+                  set_batch(std::data(coords), std::size(coords), std::data(values));
+            }
+
+            /*!   \brief  Занятые ячейки внутри бокса [lo, hi] (границы включаются), в порядке Z-кривой.<br>
+                          Доступно только при включенной политике spatial_index.
+
+                          Индекс обновляется при каждой записи (см. zorder_index), запрос стоит O((k + s) log nnz),
+                          где k - число найденных ячеек, s - число отрезков Z-кривой, на которые распадается бокс.
+                          Запрос не меняет матрицу, его можно выполнять из нескольких потоков, пока матрица не
+                          меняется. Результат - снимок: он остается действительным и после изменения матрицы.
+            */
+            auto range(const coordinates_t& lo, const coordinates_t& hi) const
+            {
+                  static_assert(Policy::spatial_index,
+                      "Error using range(): spatial index is disabled by the matrix policy.");
+
+                  using index_t = typename internal::spatial_holder<true, T, Dimension>::index_t;
+                  using range_iterator = matrix_iterator<typename index_t::cursor>;
+
+                  auto bounds = this->index.query(lo, hi);
+                  return internal::range_view<range_iterator>(range_iterator(bounds.first), range_iterator(bounds.second));
+            }
+
+            /*!   \brief  Делит занятые ячейки на parts непересекающихся диапазонов примерно равного размера.<br>
+                          Диапазоны можно обходить одновременно из разных потоков, пока матрица не меняется.
+
+                          Если хранилище умеет делиться само (хеш-таблица - по диапазонам бакетов, хранилище с
+                          размерами на этапе компиляции - по диапазонам ячеек), деление стоит O(parts), иначе
+                          границы находятся одним проходом по ячейкам.
+            */
+            auto partitions(std::size_t parts) const
+            {
+                  parts = std::max<std::size_t>(parts, 1);
+
+                  if constexpr (internal::has_partition<iternal_data_t>::value)
+                  {
+                        using part_iterator = matrix_iterator<decltype(um.partition(0, 1).first)>;
+
+                        std::vector<internal::range_view<part_iterator>> result;
+                        result.reserve(parts);
+                        for (std::size_t part = 0; part < parts; ++part)
+                        {
+                              auto range = um.partition(part, parts);
+                              result.emplace_back(part_iterator(range.first), part_iterator(range.second));
+                        }
+                        return result;
+                  }
+                  else
+                  {
+                        using part_iterator = matrix_iterator<typename iternal_data_t::const_iterator>;
+
+                        std::vector<internal::range_view<part_iterator>> result;
+                        result.reserve(parts);
+                        auto it = um.cbegin();
+                        std::size_t passed = 0;
+                        for (std::size_t part = 0; part < parts; ++part)
+                        {
+                              auto first = it;
+                              for (std::size_t bound = (part + 1) * um.size() / parts; passed < bound; ++passed)
+                                    ++it;
+                              result.emplace_back(part_iterator(first), part_iterator(it));
+                        }
+                        return result;
+                  }
+            }
+
+            //! Хранилище ячеек, для алгоритмов, которым нужен доступ к его представлению
+            const iternal_data_t& storage() const noexcept
+            {
+                  return um;
+            }
+
+            /*!   \brief  Журнал изменений ячеек с момента последней контрольной точки.<br>
+                          Доступен только при включенной политике track_changes
+            */
+            journal_t& journal() noexcept
+            {
+                  static_assert(Policy::track_changes,
+                      "Error using journal(): change tracking is disabled by the matrix policy.");
+
+                  return this->changes;
+            }
+
         private:
+            template <typename Matrix, typename F>
+            friend void parallel_transform(Matrix& m, F f, std::size_t threads);
+
+            T get_value(const internal::key<Dimension>& key) const
+            {
+                  if constexpr (Policy::instrument)
+                  {
+                        const T* slot = um.find(key);
+                        count_lookup(key, slot != nullptr);
+                        return slot ? *slot : default_value;
+                  }
+                  else
+                  {
+                        return um.get(key);
+                  }
+            }
+
+            void set_value(const internal::key<Dimension>& key, T value)
+            {
+                  if constexpr (Policy::track_changes || Policy::instrument || Policy::spatial_index)
+                  {
+                        T* slot = um.find(key);
+                        bool was_present = slot != nullptr;
+                        T old_value = was_present ? *slot : default_value;
+                        count_lookup(key, was_present);
+
+                        if (value != default_value)
+                        {
+                              if (was_present)
+                              {
+                                    *slot = value;
+                                    count(internal::thread_counters::updates);
+                              }
+                              else
+                              {
+                                    auto capacity = um.capacity();
+                                    um.insert(key, value);
+                                    count(internal::thread_counters::inserts);
+                                    if (capacity != um.capacity())
+                                          count(internal::thread_counters::rehashes);
+                              }
+                        }
+                        else
+                        {
+                              count(internal::thread_counters::default_writes);
+                              if (was_present)
+                              {
+                                    um.erase(key);
+                                    count(internal::thread_counters::default_erases);
+                              }
+                        }
+
+                        if constexpr (Policy::track_changes)
+                              this->changes.record(key, was_present, old_value, value != default_value, value);
+                        if (was_present != (value != default_value) || (was_present && old_value != value))
+                              this->index_assign(key.coordinates, value != default_value, value);
+                  }
+                  else
+                  {
+                        um.set(key, value);
+                  }
+            }
+
+            void count(internal::thread_counters::id_t id) const noexcept
+            {
+                  if constexpr (Policy::instrument)
+                        internal::local_counters().add(id);
+            }
+
+            void count_lookup(const internal::key<Dimension>& key, bool hit) const
+            {
+                  if constexpr (Policy::instrument)
+                  {
+                        auto& counters = internal::local_counters();
+                        counters.add(internal::thread_counters::lookups);
+                        counters.add(hit ? internal::thread_counters::hits : internal::thread_counters::misses);
+
+                        std::size_t probe = um.probe_length(key);
+                        counters.add(internal::thread_counters::probe_total, probe);
+                        counters.update_max(internal::thread_counters::probe_max, probe);
+                  }
+            }
+
             iternal_data_t um;
 
         public:
@@ -167,13 +1244,13 @@ namespace roro_lib
             class indexation_matrix
             {
               public:
-                  indexation_matrix(iternal_data_t& um, std::size_t row) : um(um),
-                                                                           key(row)
+                  indexation_matrix(matrix& owner, std::size_t row) : owner(owner),
+                                                                      key(row)
                   {
                   }
 
                   template <std::size_t U>
-                  indexation_matrix(const indexation_matrix<U>& arg) : um(arg.um),
+                  indexation_matrix(const indexation_matrix<U>& arg) : owner(arg.owner),
                                                                        key(arg.key)
                   {
                   }
@@ -192,14 +1269,7 @@ namespace roro_lib
                         static_assert(I == Dimension,
                             "Error using operator[]: class 'matrix' has more dimensions.");
 
-                        if (value != default_value)
-                        {
-                              um[key] = value;
-                        }
-                        else if (um.count(key) == 1)
-                        {
-                              um.erase(key);
-                        }
+                        owner.set_value(key, value);
 
                         return indexation_matrix<I>(*this);
                   }
@@ -209,21 +1279,14 @@ namespace roro_lib
                         static_assert(I == Dimension,
                             "Error using operator[]: class 'matrix' has more dimensions.");
 
-                        if (um.count(key) == 0)
-                        {
-                              return default_value;
-                        }
-                        else
-                        {
-                              return um[key];
-                        }
+                        return owner.get_value(key);
                   }
 
                   template <std::size_t U>
                   friend class indexation_matrix;
 
               private:
-                  iternal_data_t& um;
+                  matrix& owner;
                   internal::key<Dimension> key;
             };
 
@@ -308,4 +1371,19 @@ namespace roro_lib
                   }
             };
       };
+
+      namespace internal
+      {
+            template <typename T, T default_value_, std::size_t Dimension, typename Policy_>
+            struct matrix_traits<matrix<T, default_value_, Dimension, Policy_>>
+            {
+                  using value_type = T;
+                  using key_type = key<Dimension>;
+                  using policy = Policy_;
+                  static constexpr T default_value = default_value_;
+                  static constexpr std::size_t dimension = Dimension;
+            };
+      }
 }
+
+#include "matrix_bool.h"
@@ -0,0 +1,463 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <deque>
+#include <unordered_map>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+
+#include "matrix.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            //! Длина ребра блока: степень двойки, при которой в блоке не больше 4096 ячеек
+            constexpr std::size_t adaptive_tile_edge(std::size_t dimension) noexcept
+            {
+                  std::size_t edge = 4096;
+                  for (;;)
+                  {
+                        std::size_t cells = 1;
+                        for (std::size_t d = 0; d < dimension && cells <= 4096; ++d)
+                              cells *= edge;
+                        if (cells <= 4096 || edge == 2)
+                              return edge;
+                        edge /= 2;
+                  }
+            }
+
+            /*!   \brief  Адаптивное хранилище: разреженная хеш-таблица плюс плотные блоки для заполненных областей.
+
+                          Пространство координат делится на блоки (tile) с ребром tile_edge. Для каждой непустой
+                          области хранится число занятых ячеек. Когда доля занятых ячеек области превышает
+                          PromotePercent, для нее заводится плотный блок, когда падает ниже DemotePercent -
+                          блок расформировывается обратно в хеш-таблицу.
+
+                          Перенос ячеек идет постепенно: каждая запись переносит не больше migration_step ячеек
+                          одной мигрирующей области, поэтому ни одна запись не платит за полное преобразование.
+                          Пока область мигрирует, ее ячейки лежат частично в блоке и частично в хеш-таблице, но каждая
+                          ячейка - ровно в одном месте: поиск проверяет блок, затем хеш-таблицу.
+            */
+            template <typename T, T default_value, std::size_t Dimension, std::size_t PromotePercent, std::size_t DemotePercent>
+            class adaptive_storage
+            {
+                  static_assert(DemotePercent < PromotePercent && PromotePercent <= 100, "Adaptive thresholds: DemotePercent < PromotePercent <= 100");
+
+              public:
+                  using key_t = key<Dimension>;
+                  using coordinates_t = std::array<std::size_t, Dimension>;
+                  using size_type = std::size_t;
+                  using sparse_t = std::unordered_map<key_t, T>;
+
+                  static constexpr std::size_t tile_edge = adaptive_tile_edge(Dimension);
+                  static constexpr std::size_t migration_step = 64;
+
+                  static constexpr std::size_t tile_cells() noexcept
+                  {
+                        std::size_t cells = 1;
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                              cells *= tile_edge;
+                        return cells;
+                  }
+
+                  enum class region_state
+                  {
+                        sparse,    //!< все ячейки области в хеш-таблице
+                        promoting, //!< ячейки переносятся в блок, новые ячейки пишутся в блок
+                        dense,     //!< все ячейки области в блоке
+                        demoting   //!< ячейки переносятся в хеш-таблицу, новые ячейки пишутся в хеш-таблицу
+                  };
+
+                  struct region
+                  {
+                        std::size_t count = 0;
+                        region_state state = region_state::sparse;
+                        std::size_t cursor = 0;
+                        std::vector<T> tile;
+                  };
+
+                  using regions_t = std::unordered_map<coordinates_t, region, array_hash<Dimension>>;
+
+                  class const_iterator;
+                  using iterator = const_iterator;
+
+                  T get(const key_t& key) const
+                  {
+                        const T* slot = find(key);
+                        return slot ? *slot : default_value;
+                  }
+
+                  T* find(const key_t& key)
+                  {
+                        return const_cast<T*>(static_cast<const adaptive_storage&>(*this).find(key));
+                  }
+
+                  const T* find(const key_t& key) const
+                  {
+                        if (tiles != 0)
+                        {
+                              auto r = regions.find(region_of(key.coordinates));
+                              if (r == regions.end())
+                                    return nullptr;
+
+                              if (!r->second.tile.empty())
+                              {
+                                    const T& value = r->second.tile[tile_index(key.coordinates)];
+                                    if (value != default_value)
+                                          return &value;
+                                    if (r->second.state == region_state::dense)
+                                          return nullptr;
+                              }
+                        }
+
+                        auto it = sparse.find(key);
+                        return it == sparse.end() ? nullptr : &it->second;
+                  }
+
+                  void set(const key_t& key, T value)
+                  {
+                        if (T* slot = find(key))
+                        {
+                              if (value != default_value)
+                                    *slot = value;
+                              else
+                                    erase(key);
+                        }
+                        else if (value != default_value)
+                        {
+                              insert(key, value);
+                        }
+                  }
+
+                  void insert(const key_t& key, T value)
+                  {
+                        coordinates_t rc = region_of(key.coordinates);
+                        region& r = regions[rc];
+
+                        if (!r.tile.empty() && r.state != region_state::demoting)
+                              r.tile[tile_index(key.coordinates)] = value;
+                        else
+                              sparse.emplace(key, value);
+
+                        ++r.count;
+                        ++count;
+
+                        if (r.state == region_state::sparse && r.count * 100 > tile_cells() * PromotePercent)
+                              start_migration(rc, r, region_state::promoting);
+
+                        migrate_step();
+                  }
+
+                  void erase(const key_t& key)
+                  {
+                        coordinates_t rc = region_of(key.coordinates);
+                        auto it = regions.find(rc);
+                        if (it == regions.end())
+                              return;
+
+                        region& r = it->second;
+                        if (!r.tile.empty())
+                        {
+                              T& value = r.tile[tile_index(key.coordinates)];
+                              if (value != default_value)
+                              {
+                                    value = default_value;
+                                    removed(it);
+                                    return;
+                              }
+                        }
+
+                        if (sparse.erase(key))
+                              removed(it);
+                  }
+
+                  size_type size() const noexcept
+                  {
+                        return count;
+                  }
+
+                  void clear() noexcept
+                  {
+                        sparse.clear();
+                        regions.clear();
+                        migrating.clear();
+                        tiles = 0;
+                        count = 0;
+                  }
+
+                  //! Число плотных блоков, включая мигрирующие
+                  size_type tile_count() const noexcept
+                  {
+                        return tiles;
+                  }
+
+                  //! Число областей, перенос ячеек которых еще не закончен
+                  size_type migrating_count() const noexcept
+                  {
+                        return migrating.size();
+                  }
+
+                  const_iterator begin() const
+                  {
+                        return const_iterator(this, sparse.begin(), regions.begin());
+                  }
+
+                  const_iterator end() const
+                  {
+                        return const_iterator(this, sparse.end(), regions.end());
+                  }
+
+                  const_iterator cbegin() const
+                  {
+                        return begin();
+                  }
+
+                  const_iterator cend() const
+                  {
+                        return end();
+                  }
+
+                  size_type capacity() const noexcept
+                  {
+                        return sparse.bucket_count();
+                  }
+
+                  size_type probe_length(const key_t& key) const
+                  {
+                        return sparse.bucket_count() == 0 ? 0 : sparse.bucket_size(sparse.bucket(key));
+                  }
+
+                  storage_stats stats() const
+                  {
+                        storage_stats st = collect_stats(sparse);
+                        storage_stats rs = collect_stats(regions);
+
+                        std::size_t tile_bytes = tiles * tile_cells() * sizeof(T);
+                        st.size = count;
+                        st.value_bytes += tile_bytes;
+                        st.overhead_bytes += rs.total_bytes();
+                        st.fixed_bytes = tile_bytes + rs.total_bytes();
+                        return st;
+                  }
+
+                  /*!   \brief  Итератор: сначала ячейки хеш-таблицы, затем непустые ячейки плотных блоков
+                  */
+                  class const_iterator
+                  {
+                    public:
+                        using value_type = std::pair<coordinates_holder<Dimension>, T>;
+                        using iterator_category = std::forward_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const value_type*;
+                        using reference = const value_type&;
+
+                        const_iterator() = default;
+                        const_iterator(const adaptive_storage* owner, typename sparse_t::const_iterator sparse_it, typename regions_t::const_iterator region_it)
+                            : owner(owner), sparse_it(sparse_it), region_it(region_it)
+                        {
+                              settle();
+                        }
+
+                        const value_type* operator->()
+                        {
+                              if (sparse_it != owner->sparse.end())
+                              {
+                                    current.first.coordinates = sparse_it->first.coordinates;
+                                    current.second = sparse_it->second;
+                              }
+                              else
+                              {
+                                    current.first.coordinates = cell_of(region_it->first, cell);
+                                    current.second = region_it->second.tile[cell];
+                              }
+                              return &current;
+                        }
+
+                        const value_type& operator*()
+                        {
+                              return *operator->();
+                        }
+
+                        const_iterator& operator++()
+                        {
+                              if (sparse_it != owner->sparse.end())
+                                    ++sparse_it;
+                              else
+                                    ++cell;
+                              settle();
+                              return *this;
+                        }
+
+                        const_iterator operator++(int)
+                        {
+                              const_iterator old_iter = *this;
+                              ++*this;
+                              return old_iter;
+                        }
+
+                        bool operator==(const const_iterator& arg) const
+                        {
+                              return sparse_it == arg.sparse_it && region_it == arg.region_it && cell == arg.cell;
+                        }
+
+                        bool operator!=(const const_iterator& arg) const
+                        {
+                              return !(*this == arg);
+                        }
+
+                    private:
+                        void settle()
+                        {
+                              if (sparse_it != owner->sparse.end())
+                                    return;
+
+                              for (; region_it != owner->regions.end(); ++region_it, cell = 0)
+                              {
+                                    const auto& tile = region_it->second.tile;
+                                    for (; cell < tile.size(); ++cell)
+                                    {
+                                          if (tile[cell] != default_value)
+                                                return;
+                                    }
+                              }
+                              cell = 0;
+                        }
+
+                        const adaptive_storage* owner = nullptr;
+                        typename sparse_t::const_iterator sparse_it;
+                        typename regions_t::const_iterator region_it;
+                        std::size_t cell = 0;
+                        value_type current;
+                  };
+
+              private:
+                  static coordinates_t region_of(const coordinates_t& c) noexcept
+                  {
+                        coordinates_t rc;
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                              rc[d] = c[d] / tile_edge;
+                        return rc;
+                  }
+
+                  static std::size_t tile_index(const coordinates_t& c) noexcept
+                  {
+                        std::size_t index = 0;
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                              index = index * tile_edge + c[d] % tile_edge;
+                        return index;
+                  }
+
+                  static coordinates_t cell_of(const coordinates_t& rc, std::size_t index) noexcept
+                  {
+                        coordinates_t c;
+                        for (std::size_t d = Dimension; d-- > 0;)
+                        {
+                              c[d] = rc[d] * tile_edge + index % tile_edge;
+                              index /= tile_edge;
+                        }
+                        return c;
+                  }
+
+                  void removed(typename regions_t::iterator it)
+                  {
+                        region& r = it->second;
+                        --r.count;
+                        --count;
+
+                        if (r.count == 0 && r.tile.empty())
+                              regions.erase(it);
+                        else if (r.state == region_state::dense && r.count * 100 < tile_cells() * DemotePercent)
+                              start_migration(it->first, r, region_state::demoting);
+
+                        migrate_step();
+                  }
+
+                  void start_migration(const coordinates_t& rc, region& r, region_state state)
+                  {
+                        if (state == region_state::promoting)
+                        {
+                              r.tile.assign(tile_cells(), default_value);
+                              ++tiles;
+                        }
+                        r.state = state;
+                        r.cursor = 0;
+                        migrating.push_back(rc);
+                  }
+
+                  //! Переносит не больше migration_step ячеек первой мигрирующей области
+                  void migrate_step()
+                  {
+                        if (migrating.empty())
+                              return;
+
+                        auto it = regions.find(migrating.front());
+                        region& r = it->second;
+                        std::size_t last = std::min(r.cursor + migration_step, tile_cells());
+
+                        for (; r.cursor < last; ++r.cursor)
+                        {
+                              if (r.state == region_state::promoting)
+                              {
+                                    auto cell = sparse.find(key_t(cell_of(it->first, r.cursor)));
+                                    if (cell != sparse.end())
+                                    {
+                                          r.tile[r.cursor] = cell->second;
+                                          sparse.erase(cell);
+                                    }
+                              }
+                              else if (r.tile[r.cursor] != default_value)
+                              {
+                                    sparse.emplace(key_t(cell_of(it->first, r.cursor)), r.tile[r.cursor]);
+                                    r.tile[r.cursor] = default_value;
+                              }
+                        }
+
+                        if (r.cursor < tile_cells())
+                              return;
+
+                        migrating.pop_front();
+                        if (r.state == region_state::promoting)
+                        {
+                              r.state = region_state::dense;
+                              if (r.count * 100 < tile_cells() * DemotePercent)
+                                    start_migration(it->first, r, region_state::demoting);
+                        }
+                        else
+                        {
+                              r.state = region_state::sparse;
+                              r.tile = std::vector<T>();
+                              --tiles;
+                              if (r.count == 0)
+                                    regions.erase(it);
+                              else if (r.count * 100 > tile_cells() * PromotePercent)
+                                    start_migration(it->first, r, region_state::promoting);
+                        }
+                  }
+
+                  sparse_t sparse;
+                  regions_t regions;
+                  std::deque<coordinates_t> migrating;
+                  std::size_t tiles = 0;
+                  std::size_t count = 0;
+            };
+      }
+
+      /*!   \brief  Политика адаптивного представления: заполненные области переводятся в плотные блоки.
+
+                    Пример:
+                    ~~~{.cpp}
+                    matrix<int, 0, 2, adaptive_policy> m;
+                    ~~~
+      */
+      template <std::size_t PromotePercent, std::size_t DemotePercent>
+      struct adaptive_with_thresholds : default_policy
+      {
+            template <typename T, T default_value, std::size_t Dimension>
+            using storage = internal::adaptive_storage<T, default_value, Dimension, PromotePercent, DemotePercent>;
+      };
+
+      using adaptive_policy = adaptive_with_thresholds<30, 10>;
+}
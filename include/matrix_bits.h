@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            /*!   \brief  Число единичных битов в слове.
+
+                          С -mpopcnt (или -march=native) это одна инструкция popcnt. Без нее используется
+                          SWAR-вариант, который в циклах ниже компилятор векторизует, в отличие от вызова
+                          библиотечной __popcountdi2, в который превращается __builtin_popcountll.
+            */
+            inline unsigned popcount64(std::uint64_t word) noexcept
+            {
+#if defined(__POPCNT__) || defined(_MSC_VER)
+#if defined(_MSC_VER)
+                  return static_cast<unsigned>(__popcnt64(word));
+#else
+                  return static_cast<unsigned>(__builtin_popcountll(word));
+#endif
+#else
+                  word = word - ((word >> 1) & 0x5555555555555555ULL);
+                  word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+                  word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+                  return static_cast<unsigned>((word * 0x0101010101010101ULL) >> 56);
+#endif
+            }
+
+            inline unsigned countr_zero64(std::uint64_t word) noexcept
+            {
+#if defined(__GNUC__) || defined(__clang__)
+                  return static_cast<unsigned>(__builtin_ctzll(word));
+#else
+                  unsigned n = 0;
+                  for (; !(word & 1); word >>= 1)
+                        ++n;
+                  return n;
+#endif
+            }
+
+#if defined(__AVX2__)
+            //! Число единичных битов в 256-битном векторе, по 64-битным частям (Mula, поиск по таблице тетрад)
+            inline __m256i popcount256(__m256i v) noexcept
+            {
+                  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+                  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+
+                  __m256i lo = _mm256_and_si256(v, low_mask);
+                  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+                  __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+                  return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+            }
+
+            inline std::size_t horizontal_sum(__m256i v) noexcept
+            {
+                  return static_cast<std::size_t>(_mm256_extract_epi64(v, 0)) + static_cast<std::size_t>(_mm256_extract_epi64(v, 1)) +
+                         static_cast<std::size_t>(_mm256_extract_epi64(v, 2)) + static_cast<std::size_t>(_mm256_extract_epi64(v, 3));
+            }
+#endif
+
+            /*!   \brief  Ядра подсчета битов над массивами слов.
+
+                          При сборке с AVX2 используется векторный popcount, иначе - цикл по словам с
+                          четырьмя независимыми аккумуляторами.
+            */
+            template <typename Combine>
+            std::size_t popcount_combined(const std::uint64_t* a, const std::uint64_t* b, std::size_t words, Combine combine) noexcept
+            {
+                  const std::size_t unrolled = words - words % 4;
+                  std::size_t w = 0;
+                  std::size_t total = 0;
+
+#if defined(__AVX2__)
+                  __m256i acc = _mm256_setzero_si256();
+                  for (; w < unrolled; w += 4)
+                  {
+                        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + w));
+                        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + w));
+                        acc = _mm256_add_epi64(acc, popcount256(combine(va, vb)));
+                  }
+                  total = horizontal_sum(acc);
+#else
+                  std::size_t acc[4] = { 0, 0, 0, 0 };
+                  for (; w < unrolled; w += 4)
+                  {
+                        acc[0] += popcount64(combine(a[w], b[w]));
+                        acc[1] += popcount64(combine(a[w + 1], b[w + 1]));
+                        acc[2] += popcount64(combine(a[w + 2], b[w + 2]));
+                        acc[3] += popcount64(combine(a[w + 3], b[w + 3]));
+                  }
+                  total = acc[0] + acc[1] + acc[2] + acc[3];
+#endif
+
+                  for (; w < words; ++w)
+                        total += popcount64(combine(a[w], b[w]));
+                  return total;
+            }
+
+            struct bit_and
+            {
+                  std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const noexcept { return a & b; }
+#if defined(__AVX2__)
+                  __m256i operator()(__m256i a, __m256i b) const noexcept { return _mm256_and_si256(a, b); }
+#endif
+            };
+
+            struct bit_or
+            {
+                  std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const noexcept { return a | b; }
+#if defined(__AVX2__)
+                  __m256i operator()(__m256i a, __m256i b) const noexcept { return _mm256_or_si256(a, b); }
+#endif
+            };
+
+            //! |a & b| для битовых массивов из words слов
+            inline std::size_t popcount_and(const std::uint64_t* a, const std::uint64_t* b, std::size_t words) noexcept
+            {
+                  return popcount_combined(a, b, words, bit_and());
+            }
+
+            //! |a| для битового массива из words слов
+            inline std::size_t popcount_words(const std::uint64_t* a, std::size_t words) noexcept
+            {
+                  return popcount_combined(a, a, words, bit_and());
+            }
+
+            //! |a | b| для битовых массивов из words слов
+            inline std::size_t popcount_or(const std::uint64_t* a, const std::uint64_t* b, std::size_t words) noexcept
+            {
+                  return popcount_combined(a, b, words, bit_or());
+            }
+      }
+}
@@ -0,0 +1,718 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <type_traits>
+
+#include "matrix.h"
+#include "matrix_bits.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            /*!   \brief  Множество номеров столбцов одной строки в стиле roaring bitmap.
+
+                          Номер столбца делится на старшую часть (high = column >> 16) и младшие 16 бит. Для каждой
+                          старшей части заводится контейнер: отсортированный массив младших частей, пока в нем не
+                          больше array_limit элементов, иначе - битовая карта из 2^16 бит. Контейнеры упорядочены по
+                          high, поэтому обход идет по возрастанию столбцов.
+            */
+            class roaring_row
+            {
+              public:
+                  static constexpr std::size_t array_limit = 4096;
+                  static constexpr std::size_t bitmap_words = 1024;
+
+                  struct container
+                  {
+                        std::size_t high = 0;
+                        std::size_t cardinality = 0;
+                        std::vector<std::uint16_t> array;
+                        std::vector<std::uint64_t> bitmap;
+
+                        bool is_bitmap() const noexcept
+                        {
+                              return !bitmap.empty();
+                        }
+
+                        bool contains(std::uint16_t low) const noexcept
+                        {
+                              if (is_bitmap())
+                                    return bitmap[low >> 6] >> (low & 63) & 1;
+                              return std::binary_search(array.begin(), array.end(), low);
+                        }
+
+                        bool insert(std::uint16_t low)
+                        {
+                              if (is_bitmap())
+                              {
+                                    std::uint64_t mask = std::uint64_t(1) << (low & 63);
+                                    if (bitmap[low >> 6] & mask)
+                                          return false;
+                                    bitmap[low >> 6] |= mask;
+                              }
+                              else
+                              {
+                                    auto it = std::lower_bound(array.begin(), array.end(), low);
+                                    if (it != array.end() && *it == low)
+                                          return false;
+                                    array.insert(it, low);
+                                    if (array.size() > array_limit)
+                                          to_bitmap();
+                              }
+                              ++cardinality;
+                              return true;
+                        }
+
+                        bool erase(std::uint16_t low)
+                        {
+                              if (is_bitmap())
+                              {
+                                    std::uint64_t mask = std::uint64_t(1) << (low & 63);
+                                    if (!(bitmap[low >> 6] & mask))
+                                          return false;
+                                    bitmap[low >> 6] &= ~mask;
+                                    if (--cardinality < array_limit / 2)
+                                          to_array();
+                              }
+                              else
+                              {
+                                    auto it = std::lower_bound(array.begin(), array.end(), low);
+                                    if (it == array.end() || *it != low)
+                                          return false;
+                                    array.erase(it);
+                                    --cardinality;
+                              }
+                              return true;
+                        }
+
+                        //! Первый занятый младший номер, не меньше from; 2^16, если такого нет
+                        std::size_t next(std::size_t from) const noexcept
+                        {
+                              if (!is_bitmap())
+                              {
+                                    auto it = std::lower_bound(array.begin(), array.end(), from);
+                                    return it == array.end() ? 65536 : *it;
+                              }
+
+                              std::size_t word = from >> 6;
+                              if (word >= bitmap_words)
+                                    return 65536;
+                              std::uint64_t current = bitmap[word] & (~std::uint64_t(0) << (from & 63));
+                              while (current == 0)
+                              {
+                                    if (++word == bitmap_words)
+                                          return 65536;
+                                    current = bitmap[word];
+                              }
+                              return word * 64 + countr_zero64(current);
+                        }
+
+                        void to_bitmap()
+                        {
+                              bitmap.assign(bitmap_words, 0);
+                              for (std::uint16_t low : array)
+                                    bitmap[low >> 6] |= std::uint64_t(1) << (low & 63);
+                              array = std::vector<std::uint16_t>();
+                        }
+
+                        void to_array()
+                        {
+                              std::vector<std::uint16_t> values;
+                              values.reserve(cardinality);
+                              for (std::size_t low = next(0); low < 65536; low = next(low + 1))
+                                    values.push_back(static_cast<std::uint16_t>(low));
+                              array.swap(values);
+                              bitmap = std::vector<std::uint64_t>();
+                        }
+
+                        std::size_t payload_bytes() const noexcept
+                        {
+                              return array.capacity() * sizeof(std::uint16_t) + bitmap.capacity() * sizeof(std::uint64_t);
+                        }
+                  };
+
+                  bool contains(std::size_t column) const noexcept
+                  {
+                        const container* c = find_container(column >> 16);
+                        return c && c->contains(static_cast<std::uint16_t>(column));
+                  }
+
+                  bool insert(std::size_t column)
+                  {
+                        std::size_t high = column >> 16;
+                        auto it = std::lower_bound(items.begin(), items.end(), high,
+                            [](const container& c, std::size_t h) { return c.high < h; });
+                        if (it == items.end() || it->high != high)
+                        {
+                              it = items.insert(it, container());
+                              it->high = high;
+                        }
+
+                        bool inserted = it->insert(static_cast<std::uint16_t>(column));
+                        count += inserted;
+                        return inserted;
+                  }
+
+                  bool erase(std::size_t column)
+                  {
+                        std::size_t high = column >> 16;
+                        auto it = std::lower_bound(items.begin(), items.end(), high,
+                            [](const container& c, std::size_t h) { return c.high < h; });
+                        if (it == items.end() || it->high != high || !it->erase(static_cast<std::uint16_t>(column)))
+                              return false;
+
+                        if (it->cardinality == 0)
+                              items.erase(it);
+                        --count;
+                        return true;
+                  }
+
+                  std::size_t size() const noexcept
+                  {
+                        return count;
+                  }
+
+                  bool empty() const noexcept
+                  {
+                        return count == 0;
+                  }
+
+                  const std::vector<container>& containers() const noexcept
+                  {
+                        return items;
+                  }
+
+                  //! Обход столбцов по возрастанию
+                  template <typename F>
+                  void for_each(F&& f) const
+                  {
+                        for (const auto& c : items)
+                        {
+                              for (std::size_t low = c.next(0); low < 65536; low = c.next(low + 1))
+                                    f((c.high << 16) | low);
+                        }
+                  }
+
+                  std::size_t memory_bytes() const noexcept
+                  {
+                        std::size_t bytes = items.capacity() * sizeof(container);
+                        for (const auto& c : items)
+                              bytes += c.payload_bytes();
+                        return bytes;
+                  }
+
+                  //! |a ∩ b|: контейнеры сопоставляются по high, битовые карты сравниваются векторным popcount
+                  static std::size_t intersection_count(const roaring_row& a, const roaring_row& b) noexcept
+                  {
+                        std::size_t total = 0;
+                        auto ia = a.items.begin();
+                        auto ib = b.items.begin();
+                        while (ia != a.items.end() && ib != b.items.end())
+                        {
+                              if (ia->high < ib->high)
+                                    ++ia;
+                              else if (ib->high < ia->high)
+                                    ++ib;
+                              else
+                                    total += intersection_count(*ia++, *ib++);
+                        }
+                        return total;
+                  }
+
+                  static std::size_t union_count(const roaring_row& a, const roaring_row& b) noexcept
+                  {
+                        return a.size() + b.size() - intersection_count(a, b);
+                  }
+
+                  static roaring_row intersect(const roaring_row& a, const roaring_row& b)
+                  {
+                        roaring_row result;
+                        auto ia = a.items.begin();
+                        auto ib = b.items.begin();
+                        while (ia != a.items.end() && ib != b.items.end())
+                        {
+                              if (ia->high < ib->high)
+                                    ++ia;
+                              else if (ib->high < ia->high)
+                                    ++ib;
+                              else
+                                    result.append(combine(*ia++, *ib++, bit_and()));
+                        }
+                        return result;
+                  }
+
+                  static roaring_row unite(const roaring_row& a, const roaring_row& b)
+                  {
+                        roaring_row result;
+                        auto ia = a.items.begin();
+                        auto ib = b.items.begin();
+                        while (ia != a.items.end() || ib != b.items.end())
+                        {
+                              if (ib == b.items.end() || (ia != a.items.end() && ia->high < ib->high))
+                                    result.append(*ia++);
+                              else if (ia == a.items.end() || ib->high < ia->high)
+                                    result.append(*ib++);
+                              else
+                                    result.append(combine(*ia++, *ib++, bit_or()));
+                        }
+                        return result;
+                  }
+
+              private:
+                  const container* find_container(std::size_t high) const noexcept
+                  {
+                        auto it = std::lower_bound(items.begin(), items.end(), high,
+                            [](const container& c, std::size_t h) { return c.high < h; });
+                        return it != items.end() && it->high == high ? &*it : nullptr;
+                  }
+
+                  void append(container c)
+                  {
+                        if (c.cardinality == 0)
+                              return;
+                        count += c.cardinality;
+                        items.push_back(std::move(c));
+                  }
+
+                  static std::size_t intersection_count(const container& a, const container& b) noexcept
+                  {
+                        if (a.is_bitmap() && b.is_bitmap())
+                              return popcount_and(a.bitmap.data(), b.bitmap.data(), bitmap_words);
+
+                        if (a.is_bitmap() || b.is_bitmap())
+                        {
+                              const container& arr = a.is_bitmap() ? b : a;
+                              const container& bmp = a.is_bitmap() ? a : b;
+                              std::size_t total = 0;
+                              for (std::uint16_t low : arr.array)
+                                    total += bmp.bitmap[low >> 6] >> (low & 63) & 1;
+                              return total;
+                        }
+
+                        std::size_t total = 0;
+                        auto pa = a.array.begin();
+                        auto pb = b.array.begin();
+                        while (pa != a.array.end() && pb != b.array.end())
+                        {
+                              if (*pa < *pb)
+                                    ++pa;
+                              else if (*pb < *pa)
+                                    ++pb;
+                              else
+                              {
+                                    ++total;
+                                    ++pa;
+                                    ++pb;
+                              }
+                        }
+                        return total;
+                  }
+
+                  //! Пересечение или объединение двух контейнеров с одинаковым high
+                  template <typename Op>
+                  static container combine(const container& a, const container& b, Op op)
+                  {
+                        container result;
+                        result.high = a.high;
+
+                        if (!a.is_bitmap() && !b.is_bitmap())
+                        {
+                              if constexpr (std::is_same_v<Op, bit_and>)
+                                    std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+                              else
+                                    std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+
+                              result.cardinality = result.array.size();
+                              if (result.array.size() > array_limit)
+                                    result.to_bitmap();
+                              return result;
+                        }
+
+                        std::vector<std::uint64_t> wa = a.is_bitmap() ? a.bitmap : as_bitmap(a);
+                        const std::vector<std::uint64_t> wb = b.is_bitmap() ? b.bitmap : as_bitmap(b);
+                        for (std::size_t w = 0; w < bitmap_words; ++w)
+                              wa[w] = op(wa[w], wb[w]);
+
+                        result.bitmap.swap(wa);
+                        result.cardinality = popcount_words(result.bitmap.data(), bitmap_words);
+                        if (result.cardinality <= array_limit)
+                              result.to_array();
+                        return result;
+                  }
+
+                  static std::vector<std::uint64_t> as_bitmap(const container& c)
+                  {
+                        std::vector<std::uint64_t> words(bitmap_words, 0);
+                        for (std::uint16_t low : c.array)
+                              words[low >> 6] |= std::uint64_t(1) << (low & 63);
+                        return words;
+                  }
+
+                  std::vector<container> items;
+                  std::size_t count = 0;
+            };
+
+            /*!   \brief  Хранилище матрицы bool: хранится только факт занятости ячейки, без массива значений.
+
+                          Строка - это первые Dimension - 1 координат, для каждой непустой строки хранится
+                          roaring_row с номерами занятых столбцов (последней координаты). Занятая ячейка имеет
+                          значение !default_value.
+            */
+            template <bool default_value, std::size_t Dimension>
+            class bit_storage
+            {
+              public:
+                  using key_t = key<Dimension>;
+                  using row_t = std::array<std::size_t, Dimension - 1>;
+                  using rows_t = std::unordered_map<row_t, roaring_row, array_hash<Dimension - 1>>;
+                  using size_type = std::size_t;
+
+                  class const_iterator;
+                  using iterator = const_iterator;
+
+                  static row_t row_of(const key_t& key) noexcept
+                  {
+                        row_t row;
+                        std::copy(key.coordinates.begin(), key.coordinates.end() - 1, row.begin());
+                        return row;
+                  }
+
+                  bool get(const key_t& key) const
+                  {
+                        return contains(key) ? !default_value : default_value;
+                  }
+
+                  bool* find(const key_t& key)
+                  {
+                        return contains(key) ? &present_value : nullptr;
+                  }
+
+                  const bool* find(const key_t& key) const
+                  {
+                        return contains(key) ? &present_value : nullptr;
+                  }
+
+                  void set(const key_t& key, bool value)
+                  {
+                        if (value != default_value)
+                              insert(key, value);
+                        else
+                              erase(key);
+                  }
+
+                  void insert(const key_t& key, bool)
+                  {
+                        count += rows[row_of(key)].insert(key.coordinates[Dimension - 1]);
+                  }
+
+                  void erase(const key_t& key)
+                  {
+                        auto it = rows.find(row_of(key));
+                        if (it == rows.end() || !it->second.erase(key.coordinates[Dimension - 1]))
+                              return;
+
+                        --count;
+                        if (it->second.empty())
+                              rows.erase(it);
+                  }
+
+                  size_type size() const noexcept
+                  {
+                        return count;
+                  }
+
+                  void clear() noexcept
+                  {
+                        rows.clear();
+                        count = 0;
+                  }
+
+                  //! Множество столбцов строки, nullptr для пустой строки
+                  const roaring_row* row(const row_t& row_arg) const
+                  {
+                        auto it = rows.find(row_arg);
+                        return it == rows.end() ? nullptr : &it->second;
+                  }
+
+                  const rows_t& all_rows() const noexcept
+                  {
+                        return rows;
+                  }
+
+                  const_iterator begin() const
+                  {
+                        return const_iterator(rows.begin(), rows.end());
+                  }
+
+                  const_iterator end() const
+                  {
+                        return const_iterator(rows.end(), rows.end());
+                  }
+
+                  const_iterator cbegin() const
+                  {
+                        return begin();
+                  }
+
+                  const_iterator cend() const
+                  {
+                        return end();
+                  }
+
+                  size_type capacity() const noexcept
+                  {
+                        return rows.bucket_count();
+                  }
+
+                  size_type probe_length(const key_t& key) const
+                  {
+                        return rows.bucket_count() == 0 ? 0 : rows.bucket_size(rows.bucket(row_of(key)));
+                  }
+
+                  storage_stats stats() const
+                  {
+                        storage_stats st = collect_stats(rows);
+
+                        std::size_t payload = 0;
+                        for (const auto& [row_arg, columns] : rows)
+                              payload += columns.memory_bytes();
+
+                        // Значений нет: столбцы в контейнерах - это часть ключей, заголовки строк - накладные расходы
+                        st.overhead_bytes += st.value_bytes;
+                        st.value_bytes = 0;
+                        st.key_bytes += payload;
+                        st.size = count;
+                        st.bytes_per_entry = count ? (st.key_bytes + st.overhead_bytes) / count : 0;
+                        st.bytes_per_bucket = 0;
+                        st.fixed_bytes = st.bucket_bytes;
+                        return st;
+                  }
+
+                  /*!   \brief  Итератор по занятым ячейкам: строки в порядке хеш-таблицы, столбцы по возрастанию
+                  */
+                  class const_iterator
+                  {
+                    public:
+                        using rows_iterator = typename rows_t::const_iterator;
+                        using value_type = std::pair<coordinates_holder<Dimension>, bool>;
+                        using iterator_category = std::forward_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const value_type*;
+                        using reference = const value_type&;
+
+                        const_iterator() = default;
+                        const_iterator(rows_iterator it, rows_iterator end) : it(it), end(end)
+                        {
+                              settle();
+                        }
+
+                        const value_type* operator->()
+                        {
+                              const auto& c = it->second.containers()[container_index];
+                              std::copy(it->first.begin(), it->first.end(), current.first.coordinates.begin());
+                              current.first.coordinates[Dimension - 1] = (c.high << 16) | low_part();
+                              current.second = !default_value;
+                              return &current;
+                        }
+
+                        const value_type& operator*()
+                        {
+                              return *operator->();
+                        }
+
+                        const_iterator& operator++()
+                        {
+                              ++position;
+                              settle();
+                              return *this;
+                        }
+
+                        const_iterator operator++(int)
+                        {
+                              const_iterator old_iter = *this;
+                              ++*this;
+                              return old_iter;
+                        }
+
+                        bool operator==(const const_iterator& arg) const
+                        {
+                              return it == arg.it && container_index == arg.container_index && position == arg.position;
+                        }
+
+                        bool operator!=(const const_iterator& arg) const
+                        {
+                              return !(*this == arg);
+                        }
+
+                    private:
+                        std::size_t low_part() const
+                        {
+                              const auto& c = it->second.containers()[container_index];
+                              return c.is_bitmap() ? position : c.array[position];
+                        }
+
+                        //! Переходит к ближайшей занятой ячейке, начиная с текущей позиции
+                        void settle()
+                        {
+                              for (; it != end; ++it, container_index = 0, position = 0)
+                              {
+                                    const auto& containers = it->second.containers();
+                                    for (; container_index < containers.size(); ++container_index, position = 0)
+                                    {
+                                          const auto& c = containers[container_index];
+                                          if (!c.is_bitmap())
+                                          {
+                                                if (position < c.array.size())
+                                                      return;
+                                          }
+                                          else if ((position = c.next(position)) < 65536)
+                                          {
+                                                return;
+                                          }
+                                    }
+                              }
+                        }
+
+                        rows_iterator it;
+                        rows_iterator end;
+                        std::size_t container_index = 0;
+                        std::size_t position = 0;
+                        value_type current;
+                  };
+
+              private:
+                  bool contains(const key_t& key) const
+                  {
+                        auto it = rows.find(row_of(key));
+                        return it != rows.end() && it->second.contains(key.coordinates[Dimension - 1]);
+                  }
+
+                  rows_t rows;
+                  std::size_t count = 0;
+                  bool present_value = !default_value;
+            };
+
+            template <typename T, T default_value, std::size_t Dimension>
+            struct bit_storage_for
+            {
+                  static_assert(std::is_same_v<T, bool>, "bit_rows_policy is only for matrix<bool, ...>");
+                  using type = bit_storage<default_value, Dimension>;
+            };
+
+            template <bool default_value, std::size_t Dimension, typename Policy>
+            const bit_storage<default_value, Dimension>& bit_rows(const matrix<bool, default_value, Dimension, Policy>& m)
+            {
+                  static_assert(std::is_same_v<typename matrix<bool, default_value, Dimension, Policy>::iternal_data_t, bit_storage<default_value, Dimension>>,
+                      "Row set operations need a bool matrix with bit_rows_policy");
+                  return m.storage();
+            }
+      }
+
+      /*!   \brief  Политика матрицы bool с хранилищем битовых строк (см. internal::bit_storage).
+
+                    Хранит только факт занятости ячейки и дает операции над строками как над множествами
+                    (row_intersection_count и др.). По умолчанию matrix<bool> хранится в хеш-таблице,
+                    битовые строки включаются явно:
+                    ~~~{.cpp}
+                    matrix<bool, false, 2, bit_rows_policy> adjacency;
+                    ~~~
+      */
+      struct bit_rows_policy : default_policy
+      {
+            template <typename T, T default_value, std::size_t Dimension>
+            using storage = typename internal::bit_storage_for<T, default_value, Dimension>::type;
+      };
+
+      /*!   \brief  Операции над строками матрицы bool как над множествами столбцов.
+
+                    Строка задается первыми Dimension - 1 координатами, для двумерной матрицы - номером строки.
+                    Например, число треугольников, содержащих ребро (u, v) графа смежности, это
+                    row_intersection_count(adjacency, u, v).
+      */
+      template <bool default_value, std::size_t Dimension, typename Policy>
+      std::size_t row_size(const matrix<bool, default_value, Dimension, Policy>& m, const std::array<std::size_t, Dimension - 1>& row)
+      {
+            const internal::roaring_row* r = internal::bit_rows(m).row(row);
+            return r ? r->size() : 0;
+      }
+
+      template <bool default_value, std::size_t Dimension, typename Policy>
+      std::size_t row_intersection_count(const matrix<bool, default_value, Dimension, Policy>& m,
+          const std::array<std::size_t, Dimension - 1>& a, const std::array<std::size_t, Dimension - 1>& b)
+      {
+            const internal::roaring_row* ra = internal::bit_rows(m).row(a);
+            const internal::roaring_row* rb = internal::bit_rows(m).row(b);
+            return ra && rb ? internal::roaring_row::intersection_count(*ra, *rb) : 0;
+      }
+
+      template <bool default_value, std::size_t Dimension, typename Policy>
+      std::size_t row_union_count(const matrix<bool, default_value, Dimension, Policy>& m,
+          const std::array<std::size_t, Dimension - 1>& a, const std::array<std::size_t, Dimension - 1>& b)
+      {
+            return row_size(m, a) + row_size(m, b) - row_intersection_count(m, a, b);
+      }
+
+      //! Столбцы, занятые в обеих строках, по возрастанию
+      template <bool default_value, std::size_t Dimension, typename Policy>
+      std::vector<std::size_t> row_intersection(const matrix<bool, default_value, Dimension, Policy>& m,
+          const std::array<std::size_t, Dimension - 1>& a, const std::array<std::size_t, Dimension - 1>& b)
+      {
+            std::vector<std::size_t> columns;
+            const internal::roaring_row* ra = internal::bit_rows(m).row(a);
+            const internal::roaring_row* rb = internal::bit_rows(m).row(b);
+            if (ra && rb)
+                  internal::roaring_row::intersect(*ra, *rb).for_each([&](std::size_t c) { columns.push_back(c); });
+            return columns;
+      }
+
+      //! Столбцы, занятые хотя бы в одной из строк, по возрастанию
+      template <bool default_value, std::size_t Dimension, typename Policy>
+      std::vector<std::size_t> row_union(const matrix<bool, default_value, Dimension, Policy>& m,
+          const std::array<std::size_t, Dimension - 1>& a, const std::array<std::size_t, Dimension - 1>& b)
+      {
+            static const internal::roaring_row empty;
+            const internal::roaring_row* ra = internal::bit_rows(m).row(a);
+            const internal::roaring_row* rb = internal::bit_rows(m).row(b);
+
+            std::vector<std::size_t> columns;
+            internal::roaring_row::unite(ra ? *ra : empty, rb ? *rb : empty).for_each([&](std::size_t c) { columns.push_back(c); });
+            return columns;
+      }
+
+      template <bool default_value, typename Policy>
+      std::size_t row_size(const matrix<bool, default_value, 2, Policy>& m, std::size_t row)
+      {
+            return row_size(m, std::array<std::size_t, 1> { row });
+      }
+
+      template <bool default_value, typename Policy>
+      std::size_t row_intersection_count(const matrix<bool, default_value, 2, Policy>& m, std::size_t a, std::size_t b)
+      {
+            return row_intersection_count(m, std::array<std::size_t, 1> { a }, std::array<std::size_t, 1> { b });
+      }
+
+      template <bool default_value, typename Policy>
+      std::size_t row_union_count(const matrix<bool, default_value, 2, Policy>& m, std::size_t a, std::size_t b)
+      {
+            return row_union_count(m, std::array<std::size_t, 1> { a }, std::array<std::size_t, 1> { b });
+      }
+
+      template <bool default_value, typename Policy>
+      std::vector<std::size_t> row_intersection(const matrix<bool, default_value, 2, Policy>& m, std::size_t a, std::size_t b)
+      {
+            return row_intersection(m, std::array<std::size_t, 1> { a }, std::array<std::size_t, 1> { b });
+      }
+
+      template <bool default_value, typename Policy>
+      std::vector<std::size_t> row_union(const matrix<bool, default_value, 2, Policy>& m, std::size_t a, std::size_t b)
+      {
+            return row_union(m, std::array<std::size_t, 1> { a }, std::array<std::size_t, 1> { b });
+      }
+}
@@ -0,0 +1,317 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+#include "matrix.h"
+
+namespace roro_lib
+{
+      /*!   \brief  Матрица, разбитая на Shards независимых матриц со своими мьютексами.
+
+                    Ячейка попадает в шард по перемешанному хешу координат, так что соседние ячейки одной
+                    строки расходятся по разным шардам. Каждая операция блокирует только свой шард. Для
+                    частых записей в одни и те же горячие ячейки лучше писать через buffered_writer: он
+                    захватывает мьютекс шарда один раз на пакет, а не на каждую запись.
+
+             \tparam  Shards -число шардов
+      */
+      template <typename T, T default_value = 0, std::size_t Dimension = 2, typename Policy = default_policy, std::size_t Shards = 16>
+      class sharded_matrix
+      {
+            static_assert(Shards != 0, "Sharded matrix should have at least one shard");
+
+        public:
+            using matrix_t = matrix<T, default_value, Dimension, Policy>;
+            using value_type = T;
+            using size_type = std::size_t;
+            using coordinates_t = std::array<std::size_t, Dimension>;
+
+            static constexpr std::size_t shard_count = Shards;
+
+            static std::size_t shard_of(const coordinates_t& c) noexcept
+            {
+                  return shard_of_hash(internal::mixed_hash(c));
+            }
+
+            //! Шард по уже посчитанному internal::mixed_hash(c)
+            static std::size_t shard_of_hash(std::uint64_t hash) noexcept
+            {
+                  return static_cast<std::size_t>(hash % Shards);
+            }
+
+            T get(const coordinates_t& c) const
+            {
+                  const shard& s = shards[shard_of(c)];
+                  std::lock_guard<std::mutex> lock(s.guard);
+                  T value;
+                  s.cells.get_batch(&c, 1, &value);
+                  return value;
+            }
+
+            //! Запись значения: значение по умолчанию удаляет ячейку
+            void set(const coordinates_t& c, const T& value)
+            {
+                  shard& s = shards[shard_of(c)];
+                  std::lock_guard<std::mutex> lock(s.guard);
+                  s.cells.set_batch(&c, 1, &value);
+            }
+
+            //! Число занятых ячеек; шарды опрашиваются по очереди, поэтому при параллельных записях это оценка
+            size_type size() const
+            {
+                  size_type total = 0;
+                  for (const shard& s : shards)
+                  {
+                        std::lock_guard<std::mutex> lock(s.guard);
+                        total += s.cells.size();
+                  }
+                  return total;
+            }
+
+            //! Вызывает f(matrix_t&) для шарда index под его мьютексом
+            template <typename F>
+            decltype(auto) with_shard(std::size_t index, F&& f)
+            {
+                  shard& s = shards[index];
+                  std::lock_guard<std::mutex> lock(s.guard);
+                  return f(s.cells);
+            }
+
+            //! Вызывает f(const matrix_t&) для каждого шарда под его мьютексом
+            template <typename F>
+            void for_each_shard(F&& f) const
+            {
+                  for (const shard& s : shards)
+                  {
+                        std::lock_guard<std::mutex> lock(s.guard);
+                        f(s.cells);
+                  }
+            }
+
+        private:
+            //! Шарды выровнены по строке кеша: мьютексы соседних шардов не делят одну строку
+            struct alignas(64) shard
+            {
+                  mutable std::mutex guard;
+                  matrix_t cells;
+            };
+
+            std::array<shard, Shards> shards;
+      };
+
+      //! Когда buffered_writer сбрасывает накопленные записи сам
+      struct buffer_options
+      {
+            //! Сброс, когда в буфере столько разных ячеек (0 - без ограничения)
+            std::size_t max_pending = 4096;
+            //! Сброс, если самой старой записи в буфере больше max_delay (0 - без ограничения)
+            std::chrono::milliseconds max_delay { 10 };
+      };
+
+      /*!   \brief  Буфер записей одного потока в общую sharded_matrix.
+
+                    Поток копит set() и add() (аналог +=) в собственной маленькой хеш-таблице с открытой
+                    адресацией, не трогая мьютексов. Повторы одной ячейки схлопываются сразу, в порядке записи:
+                    set, за которым следуют add, дает один set с суммой, одни add дают их сумму. Поэтому запись
+                    в горячую ячейку стоит одного поиска в таблице потока. Сброс сортирует ячейки по шарду и
+                    координатам и применяет каждую группу пакетом под одним захватом мьютекса ее шарда. add()
+                    читает текущее значение ячейки в момент сброса, так что приращения разных потоков
+                    складываются. Если результат равен значению по умолчанию, ячейка удаляется, как при обычной
+                    записи в matrix.
+
+                    Видимость: записи не видны другим потокам до сброса. После возврата из flush() все записи,
+                    сделанные этим буфером до него, видны. Сброс атомарен только в пределах шарда: читатель может
+                    увидеть новые значения одного шарда и старые другого. Для одной ячейки порядок записей
+                    одного буфера сохраняется; между буферами set() последнего сброса побеждает, а add()
+                    коммутируют. Возраст буфера проверяется раз в time_check_period записей - фонового потока нет,
+                    поэтому поток, который перестал писать, должен вызвать flush() или разрушить буфер.
+
+                    Буфер принадлежит одному потоку; деструктор сбрасывает оставшиеся записи.
+
+             \tparam  Target -sharded_matrix, в которую идут записи
+      */
+      template <typename Target>
+      class buffered_writer
+      {
+            using T = typename Target::value_type;
+            using coordinates_t = typename Target::coordinates_t;
+            using clock_t = std::chrono::steady_clock;
+
+        public:
+            //! Раз во столько записей сверяется возраст буфера с max_delay: часы дороже поиска в таблице
+            static constexpr std::size_t time_check_period = 64;
+
+            explicit buffered_writer(Target& target_matrix, buffer_options opts = buffer_options()) :
+                target(target_matrix), options(opts)
+            {
+                  std::size_t slot_count = 64;
+                  while (slot_count < 2 * options.max_pending)
+                        slot_count *= 2;
+                  slots.assign(slot_count, 0);
+                  pending_ops.reserve(slot_count / 2);
+            }
+
+            buffered_writer(const buffered_writer&) = delete;
+            buffered_writer& operator=(const buffered_writer&) = delete;
+
+            ~buffered_writer()
+            {
+                  flush();
+            }
+
+            //! Отложенная запись значения ячейки
+            void set(const coordinates_t& c, const T& value)
+            {
+                  operation& op = slot_for(c);
+                  op.value = value;
+                  op.add = false;
+                  after_write();
+            }
+
+            //! Отложенное приращение ячейки: при сбросе к ее значению прибавляется delta
+            void add(const coordinates_t& c, const T& delta)
+            {
+                  operation& op = slot_for(c);
+                  op.value += delta;
+                  after_write();
+            }
+
+            //! Число разных ячеек в буфере
+            std::size_t pending() const noexcept
+            {
+                  return pending_ops.size();
+            }
+
+            //! Применяет все накопленные записи к общей матрице
+            void flush()
+            {
+                  if (pending_ops.empty())
+                        return;
+
+                  std::sort(pending_ops.begin(), pending_ops.end(), [](const operation& a, const operation& b) {
+                        return a.shard != b.shard ? a.shard < b.shard : a.coordinates < b.coordinates;
+                  });
+
+                  std::size_t first = 0;
+                  while (first < pending_ops.size())
+                  {
+                        const std::size_t shard = pending_ops[first].shard;
+                        std::size_t last = first;
+                        bool has_adds = false;
+                        for (; last < pending_ops.size() && pending_ops[last].shard == shard; ++last)
+                              has_adds |= pending_ops[last].add;
+
+                        apply(shard, first, last, has_adds);
+                        first = last;
+                  }
+
+                  pending_ops.clear();
+                  std::fill(slots.begin(), slots.end(), 0);
+                  writes_since_check = 0;
+            }
+
+        private:
+            struct operation
+            {
+                  coordinates_t coordinates;
+                  T value;
+                  std::uint64_t hash;
+                  std::size_t shard;
+                  bool add;
+            };
+
+            Target& target;
+            buffer_options options;
+            clock_t::time_point oldest;
+            std::size_t writes_since_check = 0;
+
+            //! Ячейки буфера в порядке первой записи
+            std::vector<operation> pending_ops;
+            //! Таблица с линейным пробированием: номер ячейки в pending_ops + 1, 0 - свободный слот
+            std::vector<std::uint32_t> slots;
+            // пакет одного шарда; векторы переиспользуются между сбросами
+            std::vector<coordinates_t> batch_coordinates;
+            std::vector<T> batch_values;
+            std::vector<T> current_values;
+
+            //! Ячейка буфера для c; новая ячейка начинается как add нулевого приращения
+            operation& slot_for(const coordinates_t& c)
+            {
+                  const std::uint64_t h = internal::mixed_hash(c);
+                  const std::size_t mask = slots.size() - 1;
+                  std::size_t i = static_cast<std::size_t>(h) & mask;
+                  for (; slots[i] != 0; i = (i + 1) & mask)
+                  {
+                        operation& op = pending_ops[slots[i] - 1];
+                        if (op.hash == h && op.coordinates == c)
+                              return op;
+                  }
+
+                  if (pending_ops.empty() && options.max_delay.count() != 0)
+                        oldest = clock_t::now();
+
+                  pending_ops.push_back(operation { c, T(), h, Target::shard_of_hash(h), true });
+                  slots[i] = static_cast<std::uint32_t>(pending_ops.size());
+                  if (2 * pending_ops.size() > slots.size())
+                        grow();
+                  return pending_ops.back();
+            }
+
+            void grow()
+            {
+                  slots.assign(slots.size() * 2, 0);
+                  const std::size_t mask = slots.size() - 1;
+                  for (std::size_t n = 0; n < pending_ops.size(); ++n)
+                  {
+                        std::size_t i = static_cast<std::size_t>(pending_ops[n].hash) & mask;
+                        while (slots[i] != 0)
+                              i = (i + 1) & mask;
+                        slots[i] = static_cast<std::uint32_t>(n + 1);
+                  }
+            }
+
+            void after_write()
+            {
+                  if (options.max_pending && pending_ops.size() >= options.max_pending)
+                  {
+                        flush();
+                        return;
+                  }
+
+                  if (options.max_delay.count() != 0 && ++writes_since_check >= time_check_period)
+                  {
+                        writes_since_check = 0;
+                        if (clock_t::now() - oldest >= options.max_delay)
+                              flush();
+                  }
+            }
+
+            void apply(std::size_t shard, std::size_t first, std::size_t last, bool has_adds)
+            {
+                  batch_coordinates.clear();
+                  batch_values.clear();
+                  for (std::size_t n = first; n < last; ++n)
+                  {
+                        batch_coordinates.push_back(pending_ops[n].coordinates);
+                        batch_values.push_back(pending_ops[n].value);
+                  }
+
+                  target.with_shard(shard, [&](typename Target::matrix_t& cells) {
+                        if (has_adds)
+                        {
+                              current_values.resize(batch_coordinates.size());
+                              cells.get_batch(batch_coordinates, current_values);
+                              for (std::size_t n = first; n < last; ++n)
+                                    if (pending_ops[n].add)
+                                          batch_values[n - first] += current_values[n - first];
+                        }
+                        cells.set_batch(batch_coordinates, batch_values);
+                  });
+            }
+      };
+}
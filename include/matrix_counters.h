@@ -0,0 +1,204 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+
+namespace roro_lib
+{
+      /*!   \brief  Снимок счетчиков горячего пути матрицы.
+
+                    Счетчики ведутся только матрицами с политикой instrument == true (см. instrumented_policy).
+      */
+      struct hot_path_counters
+      {
+            std::uint64_t lookups = 0;        //!< поиски ячейки в хранилище (чтение и запись)
+            std::uint64_t hits = 0;           //!< поиск нашел ячейку
+            std::uint64_t misses = 0;         //!< поиск не нашел ячейку
+            std::uint64_t inserts = 0;        //!< добавлена новая ячейка
+            std::uint64_t updates = 0;        //!< перезаписано значение существующей ячейки
+            std::uint64_t default_writes = 0; //!< запись значения по умолчанию
+            std::uint64_t default_erases = 0; //!< запись значения по умолчанию, удалившая ячейку
+            std::uint64_t rehashes = 0;       //!< перестроения хеш-таблицы
+            std::uint64_t probe_total = 0;    //!< суммарная длина просмотренных цепочек
+            std::uint64_t probe_max = 0;      //!< самая длинная просмотренная цепочка
+
+            hot_path_counters& operator+=(const hot_path_counters& arg) noexcept
+            {
+                  lookups += arg.lookups;
+                  hits += arg.hits;
+                  misses += arg.misses;
+                  inserts += arg.inserts;
+                  updates += arg.updates;
+                  default_writes += arg.default_writes;
+                  default_erases += arg.default_erases;
+                  rehashes += arg.rehashes;
+                  probe_total += arg.probe_total;
+                  probe_max = std::max(probe_max, arg.probe_max);
+                  return *this;
+            }
+      };
+
+      namespace internal
+      {
+            /*!   \brief  Счетчики одного потока.
+
+                          Пишет в них только поток-владелец, поэтому инкремент - это relaxed load + store без
+                          блокирующих инструкций. Атомарность нужна лишь для того, чтобы экспорт мог читать
+                          счетчики из другого потока. Обнуление reset() из другого потока не согласовано с этим
+                          load + store: см. counters_reset().
+            */
+            struct thread_counters
+            {
+                  enum id_t
+                  {
+                        lookups,
+                        hits,
+                        misses,
+                        inserts,
+                        updates,
+                        default_writes,
+                        default_erases,
+                        rehashes,
+                        probe_total,
+                        probe_max,
+                        count_of_ids
+                  };
+
+                  std::atomic<std::uint64_t> values[count_of_ids] = {};
+
+                  thread_counters();
+                  ~thread_counters();
+
+                  void add(id_t id, std::uint64_t n = 1) noexcept
+                  {
+                        values[id].store(values[id].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+                  }
+
+                  void update_max(id_t id, std::uint64_t n) noexcept
+                  {
+                        if (values[id].load(std::memory_order_relaxed) < n)
+                              values[id].store(n, std::memory_order_relaxed);
+                  }
+
+                  hot_path_counters snapshot() const noexcept
+                  {
+                        hot_path_counters c;
+                        c.lookups = values[lookups].load(std::memory_order_relaxed);
+                        c.hits = values[hits].load(std::memory_order_relaxed);
+                        c.misses = values[misses].load(std::memory_order_relaxed);
+                        c.inserts = values[inserts].load(std::memory_order_relaxed);
+                        c.updates = values[updates].load(std::memory_order_relaxed);
+                        c.default_writes = values[default_writes].load(std::memory_order_relaxed);
+                        c.default_erases = values[default_erases].load(std::memory_order_relaxed);
+                        c.rehashes = values[rehashes].load(std::memory_order_relaxed);
+                        c.probe_total = values[probe_total].load(std::memory_order_relaxed);
+                        c.probe_max = values[probe_max].load(std::memory_order_relaxed);
+                        return c;
+                  }
+
+                  void reset() noexcept
+                  {
+                        for (auto& v : values)
+                              v.store(0, std::memory_order_relaxed);
+                  }
+            };
+
+            //! Реестр счетчиков всех живых потоков и сумма счетчиков завершившихся потоков
+            struct counters_registry
+            {
+                  std::mutex guard;
+                  std::vector<thread_counters*> alive;
+                  hot_path_counters retired;
+
+                  static counters_registry& instance()
+                  {
+                        static counters_registry registry;
+                        return registry;
+                  }
+            };
+
+            inline thread_counters::thread_counters()
+            {
+                  auto& registry = counters_registry::instance();
+                  std::lock_guard<std::mutex> lock(registry.guard);
+                  registry.alive.push_back(this);
+            }
+
+            inline thread_counters::~thread_counters()
+            {
+                  auto& registry = counters_registry::instance();
+                  std::lock_guard<std::mutex> lock(registry.guard);
+                  registry.retired += snapshot();
+                  registry.alive.erase(std::remove(registry.alive.begin(), registry.alive.end(), this), registry.alive.end());
+            }
+
+            inline thread_counters& local_counters() noexcept
+            {
+                  thread_local thread_counters counters;
+                  return counters;
+            }
+      }
+
+      //! Сумма счетчиков всех потоков, включая завершившиеся
+      inline hot_path_counters counters_snapshot()
+      {
+            auto& registry = internal::counters_registry::instance();
+            std::lock_guard<std::mutex> lock(registry.guard);
+
+            hot_path_counters total = registry.retired;
+            for (auto* c : registry.alive)
+                  total += c->snapshot();
+            return total;
+      }
+
+      /*!   \brief  Обнуляет счетчики всех потоков.
+
+                    Обнуление точное, только если в это время ни один поток не работает с инструментированными
+                    матрицами. Владелец обновляет свои счетчики через relaxed load + store без блокировки, поэтому
+                    его запись, пришедшаяся на обнуление, может вернуть счетчику прежнее значение (плюс приращение).
+                    Сброс на ходу - best-effort: вызывайте его между фазами измерения, когда потоки остановлены.
+      */
+      inline void counters_reset()
+      {
+            auto& registry = internal::counters_registry::instance();
+            std::lock_guard<std::mutex> lock(registry.guard);
+
+            registry.retired = hot_path_counters();
+            for (auto* c : registry.alive)
+                  c->reset();
+      }
+
+      //! Экспорт счетчиков в текстовом виде: одна строка "имя значение" на счетчик
+      inline void write_counters_text(std::ostream& os, const hot_path_counters& c)
+      {
+            os << "lookups " << c.lookups << "\n"
+               << "hits " << c.hits << "\n"
+               << "misses " << c.misses << "\n"
+               << "inserts " << c.inserts << "\n"
+               << "updates " << c.updates << "\n"
+               << "default_writes " << c.default_writes << "\n"
+               << "default_erases " << c.default_erases << "\n"
+               << "rehashes " << c.rehashes << "\n"
+               << "probe_total " << c.probe_total << "\n"
+               << "probe_max " << c.probe_max << "\n";
+      }
+
+      //! Экспорт счетчиков одним JSON-объектом
+      inline void write_counters_json(std::ostream& os, const hot_path_counters& c)
+      {
+            os << "{\"lookups\": " << c.lookups
+               << ", \"hits\": " << c.hits
+               << ", \"misses\": " << c.misses
+               << ", \"inserts\": " << c.inserts
+               << ", \"updates\": " << c.updates
+               << ", \"default_writes\": " << c.default_writes
+               << ", \"default_erases\": " << c.default_erases
+               << ", \"rehashes\": " << c.rehashes
+               << ", \"probe_total\": " << c.probe_total
+               << ", \"probe_max\": " << c.probe_max << "}";
+      }
+}
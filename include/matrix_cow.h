@@ -0,0 +1,511 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <atomic>
+#include <unordered_map>
+#include <iterator>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+
+#include "matrix.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            /*!   \brief  Разделяемая ссылка со своим счетчиком, как std::shared_ptr без слабых ссылок.
+
+                          Решение "объект больше никто не видит, его можно менять на месте" принимается по
+                          счетчику ссылок, поэтому он читается с memory_order_acquire, а уменьшается с
+                          memory_order_acq_rel: чтения другой копии, отпустившей объект, завершаются раньше записи.
+                          У std::shared_ptr::use_count() таких гарантий нет.
+            */
+            template <typename U>
+            class cow_ref
+            {
+                  struct counted
+                  {
+                        template <typename... Args>
+                        explicit counted(Args&&... args) : value(std::forward<Args>(args)...)
+                        {
+                        }
+
+                        std::atomic<long> refs { 1 };
+                        U value;
+                  };
+
+              public:
+                  cow_ref() noexcept = default;
+
+                  cow_ref(const cow_ref& arg) noexcept : ptr(arg.ptr)
+                  {
+                        if (ptr)
+                              ptr->refs.fetch_add(1, std::memory_order_relaxed);
+                  }
+
+                  cow_ref(cow_ref&& arg) noexcept : ptr(std::exchange(arg.ptr, nullptr))
+                  {
+                  }
+
+                  cow_ref& operator=(cow_ref arg) noexcept
+                  {
+                        std::swap(ptr, arg.ptr);
+                        return *this;
+                  }
+
+                  ~cow_ref()
+                  {
+                        reset();
+                  }
+
+                  template <typename... Args>
+                  static cow_ref make(Args&&... args)
+                  {
+                        cow_ref result;
+                        result.ptr = new counted(std::forward<Args>(args)...);
+                        return result;
+                  }
+
+                  void reset() noexcept
+                  {
+                        if (ptr && ptr->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                              delete ptr;
+                        ptr = nullptr;
+                  }
+
+                  //! Число ссылок; чтение с memory_order_acquire
+                  long use_count() const noexcept
+                  {
+                        return ptr ? ptr->refs.load(std::memory_order_acquire) : 0;
+                  }
+
+                  U* get() const noexcept
+                  {
+                        return ptr ? &ptr->value : nullptr;
+                  }
+
+                  U& operator*() const noexcept
+                  {
+                        return ptr->value;
+                  }
+
+                  U* operator->() const noexcept
+                  {
+                        return &ptr->value;
+                  }
+
+                  explicit operator bool() const noexcept
+                  {
+                        return ptr != nullptr;
+                  }
+
+              private:
+                  counted* ptr = nullptr;
+            };
+
+            /*!   \brief  Хранилище с копированием при записи: копия матрицы разделяет страницы с оригиналом.
+
+                          Ячейки разложены по страницам расширяемым хешированием (extendible hashing): каталог из
+                          2^depth ссылок на страницы выбирается младшими битами хеша, у страницы своя глубина, и
+                          на нее ссылаются 2^(depth - глубина страницы) элементов каталога. Переполненная страница
+                          делится надвое по следующему биту хеша, каталог удваивается, только когда делится
+                          страница полной глубины.
+
+                          Каталог и страницы - разделяемые объекты со счетчиками ссылок. Копирование хранилища
+                          копирует один указатель на каталог, то есть стоит O(1) при любом числе ячеек. Первая
+                          запись после копирования клонирует каталог (O(число страниц) указателей), а запись в
+                          страницу, которую видит другая копия, клонирует только эту страницу. Так память копии
+                          растет на размер измененных страниц, а не всей матрицы.
+
+                          Копии можно читать и изменять из разных потоков: счетчики ссылок каталога и страниц
+                          читаются с memory_order_acquire (см. cow_ref). Одну и ту же копию, как и обычную
+                          матрицу, одновременно изменять нельзя.
+
+                   \tparam  PageCells -число ячеек, после которого страница делится
+            */
+            template <typename T, T default_value, std::size_t Dimension, std::size_t PageCells>
+            class cow_storage
+            {
+                  static_assert(PageCells != 0, "Copy-on-write page should hold at least one cell");
+
+              public:
+                  using key_t = key<Dimension>;
+                  using coordinates_t = std::array<std::size_t, Dimension>;
+                  using size_type = std::size_t;
+                  using map_t = std::unordered_map<key_t, T>;
+
+                  static constexpr bool copy_on_write = true;
+                  static constexpr std::size_t page_cells = PageCells;
+                  //! Предел глубины: страница с совпадающими младшими битами хеша у всех ячеек не делится бесконечно
+                  static constexpr unsigned max_depth = 40;
+
+                  class const_iterator;
+                  using iterator = const_iterator;
+
+                  T get(const key_t& key) const
+                  {
+                        const T* slot = find(key);
+                        return slot ? *slot : default_value;
+                  }
+
+                  const T* find(const key_t& key) const
+                  {
+                        if (!data)
+                              return nullptr;
+                        const map_t& cells = data->slots[slot_of(mixed_hash(key.coordinates))]->cells;
+                        auto it = cells.find(key);
+                        return it == cells.end() ? nullptr : &it->second;
+                  }
+
+                  //! Указатель для записи: страница ячейки перестает быть общей с другими копиями
+                  T* find(const key_t& key)
+                  {
+                        if (!static_cast<const cow_storage&>(*this).find(key))
+                              return nullptr;
+                        return &writable_page(mixed_hash(key.coordinates))->cells.find(key)->second;
+                  }
+
+                  //! Запись значения: значение по умолчанию удаляет ячейку
+                  void set(const key_t& key, T value)
+                  {
+                        if (value != default_value)
+                        {
+                              std::uint64_t h = mixed_hash(key.coordinates);
+                              auto [it, inserted] = writable_page(h)->cells.insert_or_assign(key, value);
+                              if (inserted)
+                                    added(h);
+                        }
+                        else
+                        {
+                              erase(key);
+                        }
+                  }
+
+                  //! Добавление ячейки, которой еще нет в хранилище
+                  void insert(const key_t& key, T value)
+                  {
+                        std::uint64_t h = mixed_hash(key.coordinates);
+                        writable_page(h)->cells.emplace(key, value);
+                        added(h);
+                  }
+
+                  void erase(const key_t& key)
+                  {
+                        if (!static_cast<const cow_storage&>(*this).find(key))
+                              return;
+                        writable_page(mixed_hash(key.coordinates))->cells.erase(key);
+                        --data->count;
+                  }
+
+                  size_type size() const noexcept
+                  {
+                        return data ? data->count : 0;
+                  }
+
+                  //! Отпускает каталог; страницы, общие с другими копиями, остаются у них
+                  void clear() noexcept
+                  {
+                        data.reset();
+                  }
+
+                  const_iterator begin() const
+                  {
+                        return const_iterator(data.get(), 0, slot_count());
+                  }
+
+                  const_iterator end() const
+                  {
+                        return const_iterator(data.get(), slot_count(), slot_count());
+                  }
+
+                  const_iterator cbegin() const
+                  {
+                        return begin();
+                  }
+
+                  const_iterator cend() const
+                  {
+                        return end();
+                  }
+
+                  //! Размер каталога: его изменение после вставки означает деление страниц с удвоением каталога
+                  size_type capacity() const noexcept
+                  {
+                        return slot_count();
+                  }
+
+                  size_type probe_length(const key_t& key) const
+                  {
+                        if (!data)
+                              return 0;
+                        const map_t& cells = data->slots[slot_of(mixed_hash(key.coordinates))]->cells;
+                        return cells.bucket_size(cells.bucket(key));
+                  }
+
+                  //! Число страниц хранилища
+                  size_type page_count() const noexcept
+                  {
+                        size_type pages = 0;
+                        for_each_page([&](const page&, bool) { ++pages; });
+                        return pages;
+                  }
+
+                  //! Число страниц, которые хранилище делит с другими копиями матрицы
+                  size_type shared_page_count() const noexcept
+                  {
+                        size_type pages = 0;
+                        for_each_page([&](const page&, bool shared) { pages += shared; });
+                        return pages;
+                  }
+
+                  //! Память страниц считается целиком, в том числе общих с другими копиями
+                  storage_stats stats() const
+                  {
+                        storage_stats st;
+                        st.occupancy_histogram.assign(histogram_bins, 0);
+                        for_each_page([&](const page& p, bool) {
+                              storage_stats ps = collect_stats(p.cells);
+                              st.size += ps.size;
+                              st.key_bytes += ps.key_bytes;
+                              st.value_bytes += ps.value_bytes;
+                              st.bucket_bytes += ps.bucket_bytes;
+                              st.overhead_bytes += ps.overhead_bytes + allocated_block_size(sizeof(page) + 2 * sizeof(long));
+                              st.bucket_count += ps.bucket_count;
+                              st.longest_chain = std::max(st.longest_chain, ps.longest_chain);
+                              st.bytes_per_entry = ps.bytes_per_entry;
+                              st.bytes_per_bucket = ps.bytes_per_bucket;
+                              st.max_load_factor = ps.max_load_factor;
+                              for (std::size_t bin = 0; bin < histogram_bins; ++bin)
+                                    st.occupancy_histogram[bin] += ps.occupancy_histogram[bin];
+                        });
+
+                        st.load_factor = st.bucket_count ? static_cast<double>(st.size) / static_cast<double>(st.bucket_count) : 0.0;
+                        st.fixed_bytes = slot_count() * sizeof(cow_ref<page>);
+                        st.overhead_bytes += st.fixed_bytes;
+                        return st;
+                  }
+
+              private:
+                  struct page
+                  {
+                        unsigned depth = 0;
+                        map_t cells;
+                  };
+
+                  struct table
+                  {
+                        unsigned depth = 0;
+                        std::vector<cow_ref<page>> slots;
+                        size_type count = 0;
+                  };
+
+              public:
+                  /*!   \brief  Итератор по ячейкам диапазона элементов каталога [slot, last).<br>
+                                Страница обходится один раз - из своего первого элемента каталога.
+                  */
+                  class const_iterator
+                  {
+                    public:
+                        using value_type = typename map_t::value_type;
+                        using iterator_category = std::forward_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const value_type*;
+                        using reference = const value_type&;
+
+                        const_iterator() = default;
+                        const_iterator(const table* t, std::size_t slot, std::size_t last) : t(t), slot(slot), last(last)
+                        {
+                              settle();
+                        }
+
+                        const value_type* operator->() const
+                        {
+                              return &*it;
+                        }
+
+                        const value_type& operator*() const
+                        {
+                              return *it;
+                        }
+
+                        const_iterator& operator++()
+                        {
+                              ++it;
+                              settle();
+                              return *this;
+                        }
+
+                        const_iterator operator++(int)
+                        {
+                              const_iterator old_iter = *this;
+                              ++*this;
+                              return old_iter;
+                        }
+
+                        bool operator==(const const_iterator& arg) const
+                        {
+                              return slot == arg.slot && (slot == last || it == arg.it);
+                        }
+
+                        bool operator!=(const const_iterator& arg) const
+                        {
+                              return !(*this == arg);
+                        }
+
+                    private:
+                        void settle()
+                        {
+                              while (slot < last)
+                              {
+                                    const page& p = *t->slots[slot];
+                                    if (slot < (std::size_t(1) << p.depth))
+                                    {
+                                          if (!entered)
+                                          {
+                                                it = p.cells.begin();
+                                                entered = true;
+                                          }
+                                          if (it != p.cells.end())
+                                                return;
+                                    }
+                                    ++slot;
+                                    entered = false;
+                              }
+                        }
+
+                        const table* t = nullptr;
+                        std::size_t slot = 0;
+                        std::size_t last = 0;
+                        bool entered = false;
+                        typename map_t::const_iterator it {};
+                  };
+
+                  //! Часть part из parts: равный диапазон элементов каталога
+                  std::pair<const_iterator, const_iterator> partition(std::size_t part, std::size_t parts) const
+                  {
+                        std::size_t n = slot_count();
+                        std::size_t first = part * n / parts;
+                        std::size_t last = (part + 1) * n / parts;
+                        return { const_iterator(data.get(), first, last), const_iterator(data.get(), last, last) };
+                  }
+
+              private:
+                  std::size_t slot_count() const noexcept
+                  {
+                        return data ? data->slots.size() : 0;
+                  }
+
+                  std::size_t slot_of(std::uint64_t h) const noexcept
+                  {
+                        return static_cast<std::size_t>(h & ((std::uint64_t(1) << data->depth) - 1));
+                  }
+
+                  //! f(page, shared) для каждой страницы; shared - страницу видит другая копия матрицы
+                  template <typename F>
+                  void for_each_page(F&& f) const
+                  {
+                        if (!data)
+                              return;
+                        bool table_shared = data.use_count() > 1;
+                        for (std::size_t slot = 0; slot < data->slots.size(); ++slot)
+                        {
+                              const auto& p = data->slots[slot];
+                              if (slot < (std::size_t(1) << p->depth))
+                                    f(*p, table_shared || p.use_count() > static_cast<long>(std::size_t(1) << (data->depth - p->depth)));
+                        }
+                  }
+
+                  //! Страница для записи ячейки с хешем h: каталог и страница становятся собственными
+                  page* writable_page(std::uint64_t h)
+                  {
+                        if (!data)
+                        {
+                              data = cow_ref<table>::make();
+                              data->slots.push_back(cow_ref<page>::make());
+                        }
+                        else if (data.use_count() > 1)
+                        {
+                              // первая запись после копирования: O(число элементов каталога) ссылок
+                              data = cow_ref<table>::make(*data);
+                        }
+
+                        std::size_t slot = slot_of(h);
+                        cow_ref<page>& p = data->slots[slot];
+                        std::size_t stride = std::size_t(1) << p->depth;
+                        long references = static_cast<long>(std::size_t(1) << (data->depth - p->depth));
+                        if (p.use_count() > references)
+                        {
+                              auto copy = cow_ref<page>::make(*p);
+                              for (std::size_t s = slot & (stride - 1); s < data->slots.size(); s += stride)
+                                    data->slots[s] = copy;
+                        }
+                        return data->slots[slot].get();
+                  }
+
+                  //! Учет новой ячейки: переполненная страница делится
+                  void added(std::uint64_t h)
+                  {
+                        ++data->count;
+                        while (data->slots[slot_of(h)]->cells.size() > page_cells && data->slots[slot_of(h)]->depth < max_depth)
+                              split(slot_of(h));
+                  }
+
+                  //! Делит собственную (не общую) страницу элемента каталога slot по биту хеша номер depth
+                  void split(std::size_t slot)
+                  {
+                        cow_ref<page> old = data->slots[slot];
+                        const unsigned depth = old->depth;
+                        if (depth == data->depth)
+                        {
+                              std::size_t n = data->slots.size();
+                              data->slots.reserve(2 * n);
+                              for (std::size_t s = 0; s < n; ++s)
+                                    data->slots.push_back(data->slots[s]);
+                              ++data->depth;
+                        }
+
+                        auto low = cow_ref<page>::make();
+                        auto high = cow_ref<page>::make();
+                        low->depth = high->depth = depth + 1;
+
+                        // узлы переносятся без перевыделения: старая страница больше никому не видна
+                        while (!old->cells.empty())
+                        {
+                              auto node = old->cells.extract(old->cells.begin());
+                              auto& target = (mixed_hash(node.key().coordinates) >> depth) & 1 ? high : low;
+                              target->cells.insert(std::move(node));
+                        }
+
+                        std::size_t stride = std::size_t(1) << depth;
+                        for (std::size_t s = slot & (stride - 1); s < data->slots.size(); s += stride)
+                              data->slots[s] = (s >> depth) & 1 ? high : low;
+                  }
+
+                  cow_ref<table> data;
+            };
+      }
+
+      /*!   \brief  Политика матрицы с копированием при записи: копия матрицы стоит O(1), запись клонирует
+                    только затронутую страницу (см. internal::cow_storage).
+
+                    Первая запись в копию еще клонирует каталог - O(число страниц) ссылок, около
+                    nnz / PageCells; для частых копий с единичными записями выбирайте PageCells побольше.
+
+                    Пример:
+                    ~~~{.cpp}
+                    matrix<int, 0, 2, copy_on_write_policy> base;
+                    auto what_if = base;   // без копирования ячеек
+                    what_if[1][2] = 3;     // клонируется одна страница
+                    ~~~
+      */
+      template <std::size_t PageCells>
+      struct copy_on_write_pages : default_policy
+      {
+            template <typename T, T default_value, std::size_t Dimension>
+            using storage = internal::cow_storage<T, default_value, Dimension, PageCells>;
+      };
+
+      using copy_on_write_policy = copy_on_write_pages<1024>;
+}
@@ -0,0 +1,216 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <string>
+#include <ostream>
+#include <charconv>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+
+#include "matrix.h"
+
+namespace roro_lib
+{
+      //! Параметры выгрузки матрицы в текст
+      struct dump_options
+      {
+            //! Сколько байтов копится перед вызовом записи; буфер переиспользуется
+            std::size_t buffer_size = 1 << 20;
+            /*!   Потоков форматирования: 1 - вызывающий поток, 0 - все потоки текущего исполнителя.
+                  Порядок строк в выводе от числа потоков не зависит.
+            */
+            std::size_t threads = 1;
+            //! Разделитель координат в списке ячеек, например 'x' для "3x5 7"
+            char coordinate_separator = ' ';
+            //! Разделитель координат и значения, а также значений в строке окна
+            char value_separator = ' ';
+            //! Печатать координаты в обратном порядке (столбец, строка - как x, y)
+            bool reverse_coordinates = false;
+            //! Ставить value_separator и после последнего значения строки окна, перед '\n'
+            bool trailing_separator = false;
+      };
+
+      namespace internal
+      {
+            //! Наибольшая длина десятичной записи числа, с запасом для знака и чисел с плавающей точкой
+            constexpr std::size_t max_number_chars = 64;
+
+            //! Число в десятичной записи через std::to_chars, без локали и без выделения памяти; возвращает конец записи
+            template <typename T>
+            char* put_number(char* first, T value)
+            {
+                  if constexpr (std::is_same<T, bool>::value)
+                  {
+                        *first = value ? '1' : '0';
+                        return first + 1;
+                  }
+                  else
+                  {
+                        return std::to_chars(first, first + max_number_chars, value).ptr;
+                  }
+            }
+
+            //! Запись куска вывода: в std::ostream одним write, иначе вызовом write(data, size)
+            template <typename Write>
+            void write_chunk(Write& write, const std::string& chunk)
+            {
+                  if (chunk.empty())
+                        return;
+                  if constexpr (std::is_base_of<std::ostream, Write>::value)
+                        write.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+                  else
+                        write(chunk.data(), chunk.size());
+            }
+
+            /*!   \brief  Форматирует части 0 .. parts-1 функцией format(part, out) и пишет их строго по порядку частей.
+
+                          Один поток копит части в одном буфере и пишет его, когда набралось buffer_size байтов.
+                          Несколько потоков форматируют части раундами: в раунде каждая часть форматируется в свой
+                          буфер на исполнителе, затем буферы пишутся по порядку. Раунд ограничивает память числом
+                          частей в нем, буферы переиспользуются от раунда к раунду.
+            */
+            template <typename Format, typename Write>
+            void ordered_dump(std::size_t parts, const dump_options& options, Format&& format, Write& write)
+            {
+                  const std::size_t threads = thread_count(options.threads);
+                  if (threads == 1)
+                  {
+                        std::string buffer;
+                        buffer.reserve(options.buffer_size + options.buffer_size / 4);
+                        for (std::size_t part = 0; part < parts; ++part)
+                        {
+                              format(part, buffer);
+                              if (buffer.size() >= options.buffer_size)
+                              {
+                                    write_chunk(write, buffer);
+                                    buffer.clear();
+                              }
+                        }
+                        write_chunk(write, buffer);
+                        return;
+                  }
+
+                  std::vector<std::string> buffers(std::min(parts, threads * parts_per_thread));
+                  for (std::size_t first = 0; first < parts; first += buffers.size())
+                  {
+                        const std::size_t round = std::min(buffers.size(), parts - first);
+                        run_parts(round, [&](std::size_t k) {
+                              buffers[k].clear();
+                              format(first + k, buffers[k]);
+                        });
+                        for (std::size_t k = 0; k < round; ++k)
+                              write_chunk(write, buffers[k]);
+                  }
+            }
+
+            //! На сколько частей делить вывод, чтобы часть была около buffer_size байтов
+            inline std::size_t dump_part_count(std::size_t items, std::size_t bytes_per_item, const dump_options& options)
+            {
+                  const std::size_t per_part = std::max<std::size_t>(1, options.buffer_size / std::max<std::size_t>(1, bytes_per_item));
+                  return std::max<std::size_t>(1, (items + per_part - 1) / per_part);
+            }
+      }
+
+      /*!   \brief  Выгружает занятые ячейки списком: строка "c0 c1 ... value" на ячейку.
+
+                    Числа форматируются через std::to_chars в большие буферы, запись - один вызов write на
+                    buffer_size байтов, без сброса на каждой строке. Ячейки делятся на части (см.
+                    matrix::partitions), с options.threads != 1 части форматируются параллельно и пишутся
+                    по порядку. Порядок строк - порядок частей: для хеш-таблицы это порядок бакетов, он может
+                    отличаться от порядка обычной итерации, но от числа потоков не зависит, так что вывод
+                    побайтно совпадает с однопоточным. Матрица не должна меняться во время выгрузки.
+
+             \param  write -std::ostream или вызываемый объект write(const char* data, std::size_t size)
+      */
+      template <typename Matrix, typename Write>
+      void dump_coordinates(const Matrix& m, Write&& write, const dump_options& options = dump_options())
+      {
+            constexpr std::size_t Dimension = std::tuple_size<typename Matrix::coordinates_t>::value;
+
+            auto parts = m.partitions(internal::dump_part_count(m.size(), (Dimension + 1) * 8, options));
+            internal::ordered_dump(parts.size(), options, [&](std::size_t part, std::string& out) {
+                  // строка собирается в буфере на стеке и дописывается в вывод одним append
+                  char line[(Dimension + 1) * (internal::max_number_chars + 1)];
+                  for (auto&& node : parts[part])
+                  {
+                        auto c = internal::node_coordinates<Dimension>(node, std::make_index_sequence<Dimension>());
+                        if (options.reverse_coordinates)
+                              std::reverse(c.begin(), c.end());
+
+                        char* p = line;
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                        {
+                              p = internal::put_number(p, c[d]);
+                              *p++ = options.coordinate_separator;
+                        }
+                        p[-1] = options.value_separator;
+                        p = internal::put_number(p, std::get<Dimension>(node));
+                        *p++ = '\n';
+                        out.append(line, static_cast<std::size_t>(p - line));
+                  }
+            }, write);
+      }
+
+      /*!   \brief  Выгружает плотное окно [lo, hi] (границы включаются): строка на каждый набор ведущих координат,
+                    в строке значения всех ячеек вдоль последней координаты, включая значения по умолчанию.
+
+                    Для двумерной матрицы это таблица: строки матрицы с lo[0] по hi[0], столбцы с lo[1] по hi[1].
+                    Значения строки читаются одним get_batch. Буферы и потоки - как у dump_coordinates().
+
+             \param  write -std::ostream или вызываемый объект write(const char* data, std::size_t size)
+      */
+      template <typename Matrix, typename Write>
+      void dump_window(const Matrix& m, const typename Matrix::coordinates_t& lo, const typename Matrix::coordinates_t& hi,
+                       Write&& write, const dump_options& options = dump_options())
+      {
+            using T = typename Matrix::value_type;
+            using coordinates_t = typename Matrix::coordinates_t;
+            constexpr std::size_t Dimension = std::tuple_size<coordinates_t>::value;
+
+            std::size_t lines = 1;
+            for (std::size_t d = 0; d < Dimension; ++d)
+            {
+                  if (hi[d] < lo[d])
+                        return;
+                  if (d + 1 < Dimension)
+                        lines *= hi[d] - lo[d] + 1;
+            }
+            const std::size_t width = hi[Dimension - 1] - lo[Dimension - 1] + 1;
+
+            const std::size_t parts = internal::dump_part_count(lines, width * 4, options);
+            internal::ordered_dump(parts, options, [&](std::size_t part, std::string& out) {
+                  std::vector<coordinates_t> coords(width);
+                  std::vector<T> values(width);
+                  for (std::size_t line = part * lines / parts, last = (part + 1) * lines / parts; line < last; ++line)
+                  {
+                        // номер строки line раскладывается по ведущим координатам, последняя меняется быстрее всех
+                        coordinates_t c = lo;
+                        for (std::size_t d = Dimension - 1, rest = line; d-- > 0;)
+                        {
+                              const std::size_t extent = hi[d] - lo[d] + 1;
+                              c[d] = lo[d] + rest % extent;
+                              rest /= extent;
+                        }
+                        for (std::size_t k = 0; k < width; ++k)
+                        {
+                              coords[k] = c;
+                              coords[k][Dimension - 1] = lo[Dimension - 1] + k;
+                        }
+
+                        m.get_batch(coords, values);
+                        for (std::size_t k = 0; k < width; ++k)
+                        {
+                              char text[internal::max_number_chars + 1];
+                              char* p = internal::put_number(text, values[k]);
+                              if (k + 1 < width || options.trailing_separator)
+                                    *p++ = options.value_separator;
+                              out.append(text, static_cast<std::size_t>(p - text));
+                        }
+                        out.push_back('\n');
+                  }
+            }, write);
+      }
+}
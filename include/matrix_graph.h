@@ -0,0 +1,756 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <limits>
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#include "matrix.h"
+#include "matrix_parallel.h"
+
+namespace roro_lib
+{
+      /*!   \brief  Полукольца для алгебраических операций над графами в духе GraphBLAS.
+
+                    Полукольцо - это тип с методами zero() (нейтральный элемент сложения), add(a, b) и
+                    multiply(a, b). Необязательный метод terminal(v) сообщает, что дальнейшее сложение
+                    не изменит v (например, true для or_and): тогда свертка строки прерывается досрочно.
+                    Пользовательские полукольца задаются так же.
+      */
+      namespace semiring
+      {
+            //! Обычная алгебра: сумма произведений (PageRank, подсчет путей)
+            template <typename T>
+            struct plus_times
+            {
+                  T zero() const noexcept { return T(0); }
+                  T add(T a, T b) const noexcept { return a + b; }
+                  T multiply(T a, T b) const noexcept { return a * b; }
+            };
+
+            //! Тропическая алгебра: минимум сумм (кратчайшие пути), zero() - "бесконечность"
+            template <typename T>
+            struct min_plus
+            {
+                  T zero() const noexcept { return std::numeric_limits<T>::max(); }
+                  T add(T a, T b) const noexcept { return std::min(a, b); }
+                  T multiply(T a, T b) const noexcept { return (a == zero() || b == zero()) ? zero() : a + b; }
+            };
+
+            //! Булева алгебра: достижимость (BFS)
+            template <typename T = bool>
+            struct or_and
+            {
+                  T zero() const noexcept { return T(false); }
+                  T add(T a, T b) const noexcept { return T(a || b); }
+                  T multiply(T a, T b) const noexcept { return T(a && b); }
+                  bool terminal(T v) const noexcept { return static_cast<bool>(v); }
+            };
+      }
+
+      /*!   \brief  Разреженный вектор: упорядоченные по возрастанию индексы и значения, например фронт обхода графа
+      */
+      template <typename T>
+      class sparse_vector
+      {
+        public:
+            sparse_vector() = default;
+            explicit sparse_vector(std::size_t size) : length(size) {}
+
+            //! Размерность вектора
+            std::size_t size() const noexcept
+            {
+                  return length;
+            }
+
+            //! Число хранимых элементов
+            std::size_t nnz() const noexcept
+            {
+                  return positions.size();
+            }
+
+            bool empty() const noexcept
+            {
+                  return positions.empty();
+            }
+
+            //! Добавляет элемент с индексом больше всех имеющихся
+            void push_back(std::size_t index, T value)
+            {
+                  assert(index < length && (positions.empty() || positions.back() < index));
+                  positions.push_back(index);
+                  items.push_back(value);
+            }
+
+            void set(std::size_t index, T value)
+            {
+                  assert(index < length);
+                  auto it = std::lower_bound(positions.begin(), positions.end(), index);
+                  auto offset = it - positions.begin();
+                  if (it != positions.end() && *it == index)
+                  {
+                        items[offset] = value;
+                  }
+                  else
+                  {
+                        positions.insert(it, index);
+                        items.insert(items.begin() + offset, value);
+                  }
+            }
+
+            const T* find(std::size_t index) const noexcept
+            {
+                  auto it = std::lower_bound(positions.begin(), positions.end(), index);
+                  return (it != positions.end() && *it == index) ? &items[it - positions.begin()] : nullptr;
+            }
+
+            T get(std::size_t index, T otherwise) const noexcept
+            {
+                  const T* value = find(index);
+                  return value ? *value : otherwise;
+            }
+
+            const std::vector<std::size_t>& indices() const noexcept
+            {
+                  return positions;
+            }
+
+            const std::vector<T>& values() const noexcept
+            {
+                  return items;
+            }
+
+            void clear() noexcept
+            {
+                  positions.clear();
+                  items.clear();
+            }
+
+        private:
+            std::size_t length = 0;
+            std::vector<std::size_t> positions;
+            std::vector<T> items;
+      };
+
+      /*!   \brief  Структурная маска результата векторной операции.
+
+                    Результат вычисляется только в позициях, где у вектора маски есть элемент, а для
+                    дополнения маски - только там, где элемента нет. Маска ссылается на индексы вектора,
+                    поэтому вектор должен жить дольше маски.
+      */
+      class vector_mask
+      {
+        public:
+            //! Пустая маска: разрешены все позиции
+            vector_mask() = default;
+
+            template <typename T>
+            vector_mask(const sparse_vector<T>& v, bool inverted = false) : enabled(true),
+                                                                           complemented(inverted),
+                                                                           selected(&v.indices()),
+                                                                           bits((v.size() + 63) / 64, 0)
+            {
+                  for (std::size_t i : v.indices())
+                        bits[i >> 6] |= std::uint64_t(1) << (i & 63);
+            }
+
+            bool active() const noexcept
+            {
+                  return enabled;
+            }
+
+            bool complement() const noexcept
+            {
+                  return complemented;
+            }
+
+            bool allows(std::size_t i) const noexcept
+            {
+                  if (!enabled)
+                        return true;
+                  bool present = (i >> 6) < bits.size() && (bits[i >> 6] >> (i & 63) & 1);
+                  return present != complemented;
+            }
+
+            //! Позиции вектора маски; имеет смысл для активной маски без дополнения
+            const std::vector<std::size_t>& indices() const noexcept
+            {
+                  return *selected;
+            }
+
+        private:
+            bool enabled = false;
+            bool complemented = false;
+            const std::vector<std::size_t>* selected = nullptr;
+            std::vector<std::uint64_t> bits;
+      };
+
+      //! Дополнение маски: результат вычисляется там, где у v нет элемента (например, еще не посещенные вершины)
+      template <typename T>
+      vector_mask complement(const sparse_vector<T>& v)
+      {
+            return vector_mask(v, true);
+      }
+
+      //! Направление обхода при умножении на разреженный вектор
+      enum class direction
+      {
+            automatic, //!< выбирается по оценке работы для каждого вызова
+            push,      //!< от элементов вектора по их спискам смежности
+            pull       //!< от позиций результата по входящим спискам
+      };
+
+      //! Параметры алгебраических операций над графами
+      struct graph_options
+      {
+            std::size_t threads = 0; //!< число потоков, 0 - все потоки текущего исполнителя (см. current_executor())
+            direction mode = direction::automatic;
+      };
+
+      namespace internal
+      {
+            constexpr std::size_t no_list = std::numeric_limits<std::size_t>::max();
+
+            /*!   \brief  Списки смежности в сжатом виде (CSR для строк, CSC для столбцов).
+
+                          Списки заводятся только для встречающихся номеров: ids - их номера по возрастанию,
+                          список k - элементы с offsets[k] по offsets[k + 1]. indices хранят не номера другого
+                          измерения, а позиции в его ids, так что размеры массивов зависят от числа различных
+                          строк и столбцов, а не от наибольшего номера.
+            */
+            template <typename T>
+            struct compressed_lists
+            {
+                  std::vector<std::size_t> ids;
+                  std::vector<std::size_t> offsets;
+                  std::vector<std::size_t> indices;
+                  std::vector<T> values;
+
+                  std::size_t degree(std::size_t k) const noexcept
+                  {
+                        return offsets[k + 1] - offsets[k];
+                  }
+
+                  //! Позиция списка с номером id или no_list
+                  std::size_t find(std::size_t id) const noexcept
+                  {
+                        auto it = std::lower_bound(ids.begin(), ids.end(), id);
+                        return (it != ids.end() && *it == id) ? static_cast<std::size_t>(it - ids.begin()) : no_list;
+                  }
+
+                  /*!   \brief  Транспонирует списки; списки результата упорядочены по возрастанию индексов
+                         \param  minor_ids -номера другого измерения, на позиции в которых ссылаются indices
+                  */
+                  compressed_lists transpose(const std::vector<std::size_t>& minor_ids) const
+                  {
+                        const std::size_t count = minor_ids.size();
+                        compressed_lists result;
+                        result.ids = minor_ids;
+                        result.offsets.assign(count + 1, 0);
+                        for (std::size_t i : indices)
+                              ++result.offsets[i + 1];
+                        for (std::size_t i = 0; i < count; ++i)
+                              result.offsets[i + 1] += result.offsets[i];
+
+                        result.indices.resize(indices.size());
+                        result.values.resize(values.size());
+                        std::vector<std::size_t> fill(result.offsets.begin(), result.offsets.end() - 1);
+                        for (std::size_t major = 0; major + 1 < offsets.size(); ++major)
+                        {
+                              for (std::size_t k = offsets[major]; k < offsets[major + 1]; ++k)
+                              {
+                                    std::size_t& at = fill[indices[k]];
+                                    result.indices[at] = major;
+                                    result.values[at] = values[k];
+                                    ++at;
+                              }
+                        }
+                        return result;
+                  }
+            };
+
+            template <typename S, typename T, typename = void>
+            struct has_terminal : std::false_type
+            {
+            };
+
+            template <typename S, typename T>
+            struct has_terminal<S, T, std::void_t<decltype(std::declval<const S&>().terminal(std::declval<T>()))>> : std::true_type
+            {
+            };
+
+            template <typename S, typename T>
+            bool is_terminal(const S& s, T value) noexcept
+            {
+                  if constexpr (has_terminal<S, T>::value)
+                        return s.terminal(value);
+                  else
+                        return false;
+            }
+      }
+
+      /*!   \brief  Снимок двумерной матрицы в сжатом виде для алгебраических операций над графами.
+
+                    Хранит одновременно строки (CSR) и столбцы (CSC): строки нужны для обхода от вершин
+                    фронта, столбцы - для обхода "снизу вверх" от непосещенных вершин. Списки упорядочены
+                    по возрастанию индексов и заводятся только для строк и столбцов с ячейками (у результата
+                    mxm - для столбцов B), поэтому большие номера вершин не требуют массивов по наибольшему
+                    номеру. Построение из матрицы - сортировка ячеек, O(nnz log nnz).
+      */
+      template <typename T>
+      class compressed_matrix
+      {
+        public:
+            using lists_t = internal::compressed_lists<T>;
+
+            compressed_matrix() = default;
+
+            /*!   \param  rows, columns -размеры; если меньше, чем нужно для занятых ячеек матрицы, увеличиваются
+            */
+            template <T default_value, typename Policy>
+            explicit compressed_matrix(const matrix<T, default_value, 2, Policy>& m, std::size_t rows = 0, std::size_t columns = 0)
+                : row_total(rows), column_total(columns)
+            {
+                  // ячейки хранилища не упорядочены: сортируем их по строкам и столбцам
+                  std::vector<std::pair<std::pair<std::size_t, std::size_t>, T>> cells;
+                  cells.reserve(m.size());
+                  const auto& storage = m.storage();
+                  for (auto it = storage.cbegin(); it != storage.cend(); ++it)
+                  {
+                        cells.emplace_back(std::make_pair(it->first.coordinates[0], it->first.coordinates[1]), it->second);
+                        row_total = std::max(row_total, it->first.coordinates[0] + 1);
+                        column_total = std::max(column_total, it->first.coordinates[1] + 1);
+                  }
+                  std::sort(cells.begin(), cells.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+                  std::vector<std::size_t> column_ids(cells.size());
+                  for (std::size_t n = 0; n < cells.size(); ++n)
+                        column_ids[n] = cells[n].first.second;
+                  std::sort(column_ids.begin(), column_ids.end());
+                  column_ids.erase(std::unique(column_ids.begin(), column_ids.end()), column_ids.end());
+
+                  rows_lists.indices.reserve(cells.size());
+                  rows_lists.values.reserve(cells.size());
+                  for (std::size_t n = 0; n < cells.size(); ++n)
+                  {
+                        const auto& [row, column] = cells[n].first;
+                        if (n == 0 || row != cells[n - 1].first.first)
+                        {
+                              rows_lists.ids.push_back(row);
+                              rows_lists.offsets.push_back(n);
+                        }
+                        rows_lists.indices.push_back(static_cast<std::size_t>(
+                            std::lower_bound(column_ids.begin(), column_ids.end(), column) - column_ids.begin()));
+                        rows_lists.values.push_back(cells[n].second);
+                  }
+                  rows_lists.offsets.push_back(cells.size());
+
+                  columns_lists = rows_lists.transpose(column_ids);
+            }
+
+            /*!   \brief  Из упорядоченных строк, например результата mxm
+                   \param  column_ids -номера столбцов по возрастанию; rows.indices - позиции в column_ids
+            */
+            compressed_matrix(lists_t rows, const std::vector<std::size_t>& column_ids, std::size_t row_count, std::size_t column_count)
+                : row_total(row_count), column_total(column_count), rows_lists(std::move(rows))
+            {
+                  columns_lists = rows_lists.transpose(column_ids);
+            }
+
+            std::size_t row_count() const noexcept
+            {
+                  return row_total;
+            }
+
+            std::size_t column_count() const noexcept
+            {
+                  return column_total;
+            }
+
+            std::size_t nnz() const noexcept
+            {
+                  return rows_lists.indices.size();
+            }
+
+            //! Строки: ids - номера строк, indices - позиции в by_column().ids
+            const lists_t& by_row() const noexcept
+            {
+                  return rows_lists;
+            }
+
+            //! Столбцы: ids - номера столбцов, indices - позиции в by_row().ids
+            const lists_t& by_column() const noexcept
+            {
+                  return columns_lists;
+            }
+
+            //! Записывает ячейки в матрицу
+            template <typename Matrix>
+            void to_matrix(Matrix& m) const
+            {
+                  for (std::size_t r = 0; r < rows_lists.ids.size(); ++r)
+                  {
+                        for (std::size_t k = rows_lists.offsets[r]; k < rows_lists.offsets[r + 1]; ++k)
+                              m[rows_lists.ids[r]][columns_lists.ids[rows_lists.indices[k]]] = rows_lists.values[k];
+                  }
+            }
+
+        private:
+            std::size_t row_total = 0;
+            std::size_t column_total = 0;
+            lists_t rows_lists;
+            lists_t columns_lists;
+      };
+
+      /*!   \brief  Структурная маска результата mxm: по строкам матрицы маски (или по их дополнению)
+      */
+      class matrix_mask
+      {
+        public:
+            matrix_mask() = default;
+
+            template <typename T>
+            matrix_mask(const compressed_matrix<T>& m, bool inverted = false) : enabled(true),
+                                                                               complemented(inverted),
+                                                                               row_ids(&m.by_row().ids),
+                                                                               offsets(&m.by_row().offsets),
+                                                                               indices(&m.by_row().indices),
+                                                                               column_ids(&m.by_column().ids)
+            {
+            }
+
+            bool active() const noexcept
+            {
+                  return enabled;
+            }
+
+            bool complement() const noexcept
+            {
+                  return complemented;
+            }
+
+            //! Вызывает f(j) для каждого столбца j маски в строке i, по возрастанию j
+            template <typename F>
+            void for_each_in_row(std::size_t i, F&& f) const
+            {
+                  auto it = std::lower_bound(row_ids->begin(), row_ids->end(), i);
+                  if (it == row_ids->end() || *it != i)
+                        return;
+
+                  const std::size_t r = static_cast<std::size_t>(it - row_ids->begin());
+                  for (std::size_t k = (*offsets)[r]; k < (*offsets)[r + 1]; ++k)
+                        f((*column_ids)[(*indices)[k]]);
+            }
+
+        private:
+            bool enabled = false;
+            bool complemented = false;
+            const std::vector<std::size_t>* row_ids = nullptr;
+            const std::vector<std::size_t>* offsets = nullptr;
+            const std::vector<std::size_t>* indices = nullptr;
+            const std::vector<std::size_t>* column_ids = nullptr;
+      };
+
+      template <typename T>
+      matrix_mask complement(const compressed_matrix<T>& m)
+      {
+            return matrix_mask(m, true);
+      }
+
+      namespace internal
+      {
+            constexpr std::size_t graph_partition = 4096;
+
+            /*!   \brief  Произведение матрицы на разреженный вектор с выбором направления.
+
+                          push: для каждого элемента x_j проходим список push_adj[j] и копим вклады в позиции
+                          результата. Работа пропорциональна сумме степеней фронта, результат собирается
+                          сортировкой вкладов, без массивов размера n. Потоки делят позиции результата на
+                          диапазоны и находят свой участок каждого списка двоичным поиском.
+
+                          pull: для каждой разрешенной маской позиции результата i, у которой есть список pull_adj,
+                          сворачиваем этот список по элементам x; для полуколец с terminal() свертка прерывается досрочно.
+
+                          В автоматическом режиме pull выбирается, когда работа push больше работы pull,
+                          деленной на alpha (14 при досрочном прерывании, как у Beamer et al., иначе 1).
+
+                   \tparam  MatrixFirst -порядок множителей: multiply(a_ij, x_j) для mxv, multiply(x_i, a_ij) для vxm
+            */
+            template <bool MatrixFirst, typename T, typename S>
+            sparse_vector<T> vector_product(const compressed_lists<T>& push_adj, const compressed_lists<T>& pull_adj, std::size_t n_out,
+                                            const sparse_vector<T>& x, const S& s, const vector_mask& mask, const graph_options& options)
+            {
+                  auto product = [&](T a, T xv) { return MatrixFirst ? s.multiply(a, xv) : s.multiply(xv, a); };
+                  const auto& xi = x.indices();
+                  const auto& xv = x.values();
+                  const std::size_t outputs = pull_adj.ids.size();
+
+                  // позиции списков push_adj для элементов x; индексы x возрастают, поэтому поиск сужается
+                  std::vector<std::size_t> x_lists(xi.size(), no_list);
+                  std::size_t work = 0;
+                  for (std::size_t n = 0, from = 0; n < xi.size(); ++n)
+                  {
+                        auto it = std::lower_bound(push_adj.ids.begin() + from, push_adj.ids.end(), xi[n]);
+                        from = static_cast<std::size_t>(it - push_adj.ids.begin());
+                        if (it != push_adj.ids.end() && *it == xi[n])
+                        {
+                              x_lists[n] = from;
+                              work += push_adj.degree(from);
+                        }
+                  }
+
+                  bool pull = options.mode == direction::pull;
+                  if (options.mode == direction::automatic)
+                  {
+                        // оценки в плавающей точке: средняя степень edges / n_out обычно меньше единицы
+                        double pull_work = 0.0;
+                        if (mask.active() && !mask.complement())
+                        {
+                              for (std::size_t i : mask.indices())
+                              {
+                                    std::size_t c = pull_adj.find(i);
+                                    pull_work += c != no_list ? static_cast<double>(pull_adj.degree(c)) : 0.0;
+                              }
+                        }
+                        else if (n_out != 0)
+                        {
+                              std::size_t excluded = mask.active() ? std::min(mask.indices().size(), n_out) : 0;
+                              pull_work = static_cast<double>(pull_adj.indices.size()) / static_cast<double>(n_out) * static_cast<double>(n_out - excluded);
+                        }
+
+                        double alpha = has_terminal<S, T>::value ? 14.0 : 1.0;
+                        pull = static_cast<double>(work) * alpha > pull_work;
+                  }
+
+                  sparse_vector<T> result(n_out);
+                  std::vector<std::vector<std::pair<std::size_t, T>>> parts_out;
+
+                  if (!pull)
+                  {
+                        std::size_t parts = part_count(options.threads, work, graph_partition);
+                        parts_out.resize(parts);
+
+                        run_parts(parts, [&](std::size_t part) {
+                              // потоки делят позиции списков результата; они упорядочены так же, как номера
+                              std::size_t lo = part * outputs / parts;
+                              std::size_t hi = (part + 1) * outputs / parts;
+                              auto& out = parts_out[part];
+
+                              for (std::size_t n = 0; n < xi.size(); ++n)
+                              {
+                                    std::size_t j = x_lists[n];
+                                    if (j == no_list)
+                                          continue;
+
+                                    const std::size_t* first = push_adj.indices.data() + push_adj.offsets[j];
+                                    const std::size_t* last = push_adj.indices.data() + push_adj.offsets[j + 1];
+                                    if (parts != 1)
+                                          first = std::lower_bound(first, last, lo);
+
+                                    for (; first != last && *first < hi; ++first)
+                                    {
+                                          std::size_t i = pull_adj.ids[*first];
+                                          if (mask.allows(i))
+                                                out.emplace_back(i, product(push_adj.values[first - push_adj.indices.data()], xv[n]));
+                                    }
+                              }
+
+                              std::stable_sort(out.begin(), out.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+                              std::size_t kept = 0;
+                              for (std::size_t n = 0; n < out.size(); ++n)
+                              {
+                                    if (kept != 0 && out[kept - 1].first == out[n].first)
+                                          out[kept - 1].second = s.add(out[kept - 1].second, out[n].second);
+                                    else
+                                          out[kept++] = out[n];
+                              }
+                              out.resize(kept);
+                        });
+                  }
+                  else
+                  {
+                        // плотное представление x по спискам push_adj: позиция в массиве элементов или no_list
+                        std::vector<std::size_t> dense(push_adj.ids.size(), no_list);
+                        for (std::size_t n = 0; n < xi.size(); ++n)
+                        {
+                              if (x_lists[n] != no_list)
+                                    dense[x_lists[n]] = n;
+                        }
+
+                        bool by_mask = mask.active() && !mask.complement();
+                        std::size_t candidates = by_mask ? mask.indices().size() : outputs;
+                        std::size_t parts = part_count(options.threads, candidates, graph_partition);
+                        parts_out.resize(parts);
+
+                        run_parts(parts, [&](std::size_t part) {
+                              auto& out = parts_out[part];
+                              for (std::size_t c = part * candidates / parts; c < (part + 1) * candidates / parts; ++c)
+                              {
+                                    std::size_t i = by_mask ? mask.indices()[c] : pull_adj.ids[c];
+                                    std::size_t list = by_mask ? pull_adj.find(i) : c;
+                                    if (list == no_list || (!by_mask && !mask.allows(i)))
+                                          continue;
+
+                                    T acc = s.zero();
+                                    bool found = false;
+                                    for (std::size_t k = pull_adj.offsets[list]; k < pull_adj.offsets[list + 1]; ++k)
+                                    {
+                                          std::size_t j = dense[pull_adj.indices[k]];
+                                          if (j == no_list)
+                                                continue;
+
+                                          acc = s.add(acc, product(pull_adj.values[k], xv[j]));
+                                          found = true;
+                                          if (is_terminal(s, acc))
+                                                break;
+                                    }
+                                    if (found)
+                                          out.emplace_back(i, acc);
+                              }
+                        });
+                  }
+
+                  for (const auto& out : parts_out)
+                  {
+                        for (const auto& [i, v] : out)
+                              result.push_back(i, v);
+                  }
+                  return result;
+            }
+      }
+
+      /*!   \brief  y = A ⊕.⊗ x: y_i = ⊕_j multiply(A_ij, x_j)
+
+                    Позиции результата, в которые не попало ни одного произведения, не хранятся.
+      */
+      template <typename T, typename Semiring = semiring::plus_times<T>>
+      sparse_vector<T> mxv(const compressed_matrix<T>& a, const sparse_vector<T>& x, const Semiring& s = Semiring(),
+                           const vector_mask& mask = vector_mask(), const graph_options& options = graph_options())
+      {
+            return internal::vector_product<true>(a.by_column(), a.by_row(), a.row_count(), x, s, mask, options);
+      }
+
+      /*!   \brief  y = x ⊕.⊗ A: y_j = ⊕_i multiply(x_i, A_ij). Шаг обхода графа: x - фронт, A - матрица смежности
+      */
+      template <typename T, typename Semiring = semiring::plus_times<T>>
+      sparse_vector<T> vxm(const sparse_vector<T>& x, const compressed_matrix<T>& a, const Semiring& s = Semiring(),
+                           const vector_mask& mask = vector_mask(), const graph_options& options = graph_options())
+      {
+            return internal::vector_product<false>(a.by_row(), a.by_column(), a.column_count(), x, s, mask, options);
+      }
+
+      /*!   \brief  C = A ⊕.⊗ B по строкам (алгоритм Густавсона): C_ij = ⊕_k multiply(A_ik, B_kj).<br>
+                    Строки результата делятся между потоками; маска ограничивает вычисляемые ячейки.
+      */
+      template <typename T, typename Semiring = semiring::plus_times<T>>
+      compressed_matrix<T> mxm(const compressed_matrix<T>& a, const compressed_matrix<T>& b, const Semiring& s = Semiring(),
+                               const matrix_mask& mask = matrix_mask(), const graph_options& options = graph_options())
+      {
+            using lists_t = internal::compressed_lists<T>;
+            constexpr std::size_t no_list = internal::no_list;
+
+            const auto& ar = a.by_row();
+            const auto& br = b.by_row();
+            const auto& a_columns = a.by_column().ids;
+            const auto& b_columns = b.by_column().ids;
+            const std::size_t rows = ar.ids.size();
+            const std::size_t columns = b_columns.size();
+
+            // столбец A с номером k -> строка B с тем же номером (оба списка номеров упорядочены)
+            std::vector<std::size_t> inner(a_columns.size(), no_list);
+            for (std::size_t k = 0, r = 0; k < a_columns.size(); ++k)
+            {
+                  while (r < br.ids.size() && br.ids[r] < a_columns[k])
+                        ++r;
+                  if (r < br.ids.size() && br.ids[r] == a_columns[k])
+                        inner[k] = r;
+            }
+
+            std::size_t parts = internal::part_count(options.threads, a.nnz(), internal::graph_partition);
+            std::vector<lists_t> parts_out(parts);
+
+            internal::run_parts(parts, [&](std::size_t part) {
+                  // массивы по непустым столбцам B; метки "строка + 1" избавляют от очистки между строками
+                  std::vector<std::size_t> acc_mark(columns, 0);
+                  std::vector<std::size_t> mask_mark(mask.active() ? columns : 0, 0);
+                  std::vector<T> acc(columns);
+                  std::vector<std::size_t> touched;
+
+                  lists_t& out = parts_out[part];
+                  out.offsets.push_back(0);
+
+                  for (std::size_t i = part * rows / parts; i < (part + 1) * rows / parts; ++i)
+                  {
+                        const std::size_t stamp = i + 1;
+                        if (mask.active())
+                        {
+                              mask.for_each_in_row(ar.ids[i], [&](std::size_t column) {
+                                    auto it = std::lower_bound(b_columns.begin(), b_columns.end(), column);
+                                    if (it != b_columns.end() && *it == column)
+                                          mask_mark[it - b_columns.begin()] = stamp;
+                              });
+                        }
+
+                        touched.clear();
+                        for (std::size_t ka = ar.offsets[i]; ka < ar.offsets[i + 1]; ++ka)
+                        {
+                              std::size_t k = inner[ar.indices[ka]];
+                              if (k == no_list)
+                                    continue;
+
+                              for (std::size_t kb = br.offsets[k]; kb < br.offsets[k + 1]; ++kb)
+                              {
+                                    std::size_t j = br.indices[kb];
+                                    if (mask.active() && ((mask_mark[j] == stamp) == mask.complement()))
+                                          continue;
+
+                                    T p = s.multiply(ar.values[ka], br.values[kb]);
+                                    if (acc_mark[j] != stamp)
+                                    {
+                                          acc_mark[j] = stamp;
+                                          acc[j] = p;
+                                          touched.push_back(j);
+                                    }
+                                    else
+                                    {
+                                          acc[j] = s.add(acc[j], p);
+                                    }
+                              }
+                        }
+
+                        std::sort(touched.begin(), touched.end());
+                        for (std::size_t j : touched)
+                        {
+                              out.indices.push_back(j);
+                              out.values.push_back(acc[j]);
+                        }
+                        out.offsets.push_back(out.indices.size());
+                  }
+            });
+
+            // строки результата без ячеек не сохраняются
+            lists_t result;
+            for (std::size_t part = 0; part < parts; ++part)
+            {
+                  const lists_t& out = parts_out[part];
+                  const std::size_t first_row = part * rows / parts;
+                  for (std::size_t r = 0; r + 1 < out.offsets.size(); ++r)
+                  {
+                        if (out.offsets[r] == out.offsets[r + 1])
+                              continue;
+                        result.ids.push_back(ar.ids[first_row + r]);
+                        result.offsets.push_back(result.indices.size());
+                        result.indices.insert(result.indices.end(), out.indices.begin() + out.offsets[r], out.indices.begin() + out.offsets[r + 1]);
+                        result.values.insert(result.values.end(), out.values.begin() + out.offsets[r], out.values.begin() + out.offsets[r + 1]);
+                  }
+            }
+            result.offsets.push_back(result.indices.size());
+
+            return compressed_matrix<T>(std::move(result), b_columns, a.row_count(), b.column_count());
+      }
+}
@@ -0,0 +1,389 @@
+﻿#pragma once
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RORO_LIB_HAS_MMAP 1
+#endif
+
+#if defined(RORO_LIB_HAS_MMAP)
+
+#include <vector>
+#include <array>
+#include <string>
+#include <tuple>
+#include <iterator>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix.h"
+#include "matrix_posix.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            //! Отображение файла в память, снимаемое в деструкторе
+            class mapping
+            {
+              public:
+                  mapping() noexcept = default;
+
+                  mapping(int fd, std::size_t length, bool writable) : bytes(length)
+                  {
+                        void* p = ::mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+                        if (p == MAP_FAILED)
+                              throw_errno("mmap");
+                        address = p;
+                  }
+
+                  mapping(mapping&& other) noexcept : address(std::exchange(other.address, nullptr)), bytes(std::exchange(other.bytes, 0))
+                  {
+                  }
+
+                  mapping& operator=(mapping&& other) noexcept
+                  {
+                        if (this != &other)
+                        {
+                              release();
+                              address = std::exchange(other.address, nullptr);
+                              bytes = std::exchange(other.bytes, 0);
+                        }
+                        return *this;
+                  }
+
+                  ~mapping()
+                  {
+                        release();
+                  }
+
+                  char* data() const noexcept
+                  {
+                        return static_cast<char*>(address);
+                  }
+
+                  std::size_t size() const noexcept
+                  {
+                        return bytes;
+                  }
+
+              private:
+                  void* address = nullptr;
+                  std::size_t bytes = 0;
+
+                  void release() noexcept
+                  {
+                        if (address)
+                              ::munmap(address, bytes);
+                        address = nullptr;
+                  }
+            };
+
+            //! Заголовок образа матрицы в файле; все ссылки внутри образа - смещения от его начала
+            struct mapped_header
+            {
+                  char magic[8];
+                  std::uint32_t version;
+                  std::uint32_t dimension;
+                  std::uint32_t value_size;
+                  std::uint32_t coordinate_size;
+                  std::uint64_t count;
+                  std::uint64_t bucket_count;
+                  std::uint64_t buckets_offset;
+                  std::uint64_t cells_offset;
+                  std::uint64_t image_size;
+            };
+
+            constexpr char mapped_magic[8] = { 'R', 'O', 'R', 'O', 'M', 'T', 'X', '\0' };
+            constexpr std::uint32_t mapped_version = 1;
+
+            constexpr std::uint64_t align_up(std::uint64_t offset, std::uint64_t alignment) noexcept
+            {
+                  return (offset + alignment - 1) / alignment * alignment;
+            }
+
+            /*!   \brief  Проверяет, что массивы образа лежат внутри файла: bucket_count - степень двойки,
+                          начала бакетов и ячейки выровнены, не пересекаются и не выходят за image_size.
+                          Все проверки без переполнения, так что испорченный заголовок не приводит к чтению
+                          за пределами отображения.
+            */
+            inline bool mapped_layout_valid(const mapped_header& h, std::uint64_t cell_size, std::uint64_t cell_alignment) noexcept
+            {
+                  constexpr std::uint64_t limit = std::numeric_limits<std::uint64_t>::max();
+                  const std::uint64_t start_size = sizeof(std::uint64_t);
+
+                  if (h.bucket_count == 0 || (h.bucket_count & (h.bucket_count - 1)) != 0 || h.bucket_count > limit / start_size - 1)
+                        return false;
+                  if (h.buckets_offset < sizeof(mapped_header) || h.buckets_offset % alignof(std::uint64_t) != 0 || h.buckets_offset > h.image_size)
+                        return false;
+                  if ((h.bucket_count + 1) * start_size > h.image_size - h.buckets_offset)
+                        return false;
+                  if (h.cells_offset < h.buckets_offset + (h.bucket_count + 1) * start_size || h.cells_offset % cell_alignment != 0 || h.cells_offset > h.image_size)
+                        return false;
+                  return h.count <= (h.image_size - h.cells_offset) / cell_size;
+            }
+      }
+
+      /*!   \brief  Неизменяемая матрица в разделяемой памяти: файл, отображенный в память, или сегмент /dev/shm.
+
+                    Загрузчик один раз строит образ функцией build(), а любое число процессов подключается к
+                    нему конструктором только для чтения: подключение - это open и mmap, O(1) при любом размере,
+                    без копирования. Страницы образа общие для всех процессов через страничный кеш ОС, поэтому
+                    память хоста не растет с числом читателей.
+
+                    Внутри образа нет указателей, только смещения, так что он читается по любому адресу
+                    отображения. Образ - хеш-таблица в форме CSR: массив из bucket_count + 1 начал бакетов и
+                    массив ячеек, отсортированный по бакетам. Поиск читает два соседних начала бакета и
+                    просматривает в среднем одну ячейку.
+
+                    Образ привязан к архитектуре хоста (порядок байтов, размер std::size_t) и хранит T как есть,
+                    поэтому T должен быть тривиально копируемым. Для сегмента разделяемой памяти POSIX
+                    достаточно передать путь в /dev/shm.
+
+             \tparam  T             -тип данных ячейки матрицы
+             \tparam  default_value -значение по умолчанию для ячеек матрицы
+             \tparam  Dimension     -размерность матицы
+      */
+      template <typename T, T default_value = 0, std::size_t Dimension = 2>
+      class mapped_matrix
+      {
+            static_assert(std::is_trivially_copyable<T>::value, "Mapped matrix stores values as raw bytes");
+
+        public:
+            using value_type = T;
+            using size_type = std::size_t;
+            using coordinates_t = std::array<std::size_t, Dimension>;
+
+            //! Ячейка образа
+            struct cell
+            {
+                  coordinates_t coordinates;
+                  T value;
+            };
+
+            class const_iterator;
+            using iterator = const_iterator;
+
+            /*!   \brief  Строит образ матрицы m в файле path.
+
+                          Ячейки пишутся прямо в отображение файла: сначала подсчитываются размеры бакетов, затем
+                          каждая ячейка кладется на свое место. Образ собирается во временном файле path.XXXXXX
+                          (mkstemp) и переименовывается в path, так что читатели видят либо старый, либо полный
+                          новый образ. При ошибке временный файл удаляется.
+            */
+            template <typename Policy>
+            static void build(const matrix<T, default_value, Dimension, Policy>& m, const std::string& path)
+            {
+                  const std::uint64_t count = m.size();
+                  std::uint64_t bucket_count = 1;
+                  while (bucket_count < count)
+                        bucket_count *= 2;
+
+                  internal::mapped_header header {};
+                  std::memcpy(header.magic, internal::mapped_magic, sizeof(header.magic));
+                  header.version = internal::mapped_version;
+                  header.dimension = static_cast<std::uint32_t>(Dimension);
+                  header.value_size = static_cast<std::uint32_t>(sizeof(T));
+                  header.coordinate_size = static_cast<std::uint32_t>(sizeof(std::size_t));
+                  header.count = count;
+                  header.bucket_count = bucket_count;
+                  header.buckets_offset = internal::align_up(sizeof(header), alignof(std::uint64_t));
+                  header.cells_offset = internal::align_up(header.buckets_offset + (bucket_count + 1) * sizeof(std::uint64_t), 64);
+                  header.image_size = header.cells_offset + count * sizeof(cell);
+
+                  // временный файл со свободным именем рядом с path: rename не выходит за пределы файловой системы
+                  std::string temporary = path + ".XXXXXX";
+                  internal::unique_fd fd(::mkstemp(&temporary[0]));
+                  if (fd.get() < 0)
+                        internal::throw_errno("mkstemp " + temporary);
+
+                  try
+                  {
+                        // mkstemp создает файл только для владельца, а образ читают и другие процессы
+                        if (::fchmod(fd.get(), 0644) != 0)
+                              internal::throw_errno("fchmod " + temporary);
+                        if (::ftruncate(fd.get(), static_cast<off_t>(header.image_size)) != 0)
+                              internal::throw_errno("ftruncate " + temporary);
+
+                        {
+                              internal::mapping image(fd.get(), static_cast<std::size_t>(header.image_size), true);
+                              std::memcpy(image.data(), &header, sizeof(header));
+                              auto* starts = reinterpret_cast<std::uint64_t*>(image.data() + header.buckets_offset);
+                              auto* cells = reinterpret_cast<cell*>(image.data() + header.cells_offset);
+
+                              // подсчет: starts[b + 1] - число ячеек бакета b, затем префиксные суммы
+                              const std::uint64_t mask = bucket_count - 1;
+                              for (auto node : m.stream())
+                                    ++starts[(internal::mixed_hash(internal::node_coordinates<Dimension>(node, std::make_index_sequence<Dimension>())) & mask) + 1];
+                              for (std::uint64_t b = 0; b < bucket_count; ++b)
+                                    starts[b + 1] += starts[b];
+
+                              std::vector<std::uint64_t> cursor(starts, starts + bucket_count);
+                              for (auto node : m.stream())
+                              {
+                                    coordinates_t c = internal::node_coordinates<Dimension>(node, std::make_index_sequence<Dimension>());
+                                    cells[cursor[internal::mixed_hash(c) & mask]++] = cell { c, std::get<Dimension>(node) };
+                              }
+                        }
+
+                        fd.reset();
+                        if (::rename(temporary.c_str(), path.c_str()) != 0)
+                              internal::throw_errno("rename " + temporary);
+                  }
+                  catch (...)
+                  {
+                        ::unlink(temporary.c_str());
+                        throw;
+                  }
+            }
+
+            mapped_matrix() noexcept = default;
+            mapped_matrix(mapped_matrix&&) noexcept = default;
+            mapped_matrix& operator=(mapped_matrix&&) noexcept = default;
+
+            //! Подключается к образу path только для чтения
+            explicit mapped_matrix(const std::string& path)
+            {
+                  internal::unique_fd fd(::open(path.c_str(), O_RDONLY));
+                  if (fd.get() < 0)
+                        internal::throw_errno("open " + path);
+
+                  struct stat st;
+                  if (::fstat(fd.get(), &st) != 0)
+                        internal::throw_errno("fstat " + path);
+                  if (static_cast<std::uint64_t>(st.st_size) < sizeof(internal::mapped_header))
+                        throw std::runtime_error("not a matrix image: " + path);
+
+                  image = internal::mapping(fd.get(), static_cast<std::size_t>(st.st_size), false);
+
+                  const auto* header = reinterpret_cast<const internal::mapped_header*>(image.data());
+                  if (std::memcmp(header->magic, internal::mapped_magic, sizeof(header->magic)) != 0 ||
+                      header->version != internal::mapped_version || header->image_size != image.size())
+                        throw std::runtime_error("not a matrix image: " + path);
+                  if (header->dimension != Dimension || header->value_size != sizeof(T) ||
+                      header->coordinate_size != sizeof(std::size_t))
+                        throw std::runtime_error("matrix image has another dimension or value type: " + path);
+                  if (!internal::mapped_layout_valid(*header, sizeof(cell), alignof(cell)))
+                        throw std::runtime_error("corrupt matrix image: " + path);
+
+                  starts = reinterpret_cast<const std::uint64_t*>(image.data() + header->buckets_offset);
+                  if (starts[0] != 0 || starts[header->bucket_count] != header->count)
+                        throw std::runtime_error("corrupt matrix image: " + path);
+
+                  count = header->count;
+                  mask = header->bucket_count - 1;
+                  cells = reinterpret_cast<const cell*>(image.data() + header->cells_offset);
+            }
+
+            T get(const coordinates_t& c) const
+            {
+                  if (count == 0)
+                        return default_value;
+
+                  // начала бакетов проверяются при поиске, а не при подключении, чтобы оно оставалось O(1)
+                  const std::uint64_t b = internal::mixed_hash(c) & mask;
+                  const std::uint64_t first = starts[b];
+                  const std::uint64_t last = starts[b + 1];
+                  if (first > last || last > count)
+                        throw std::runtime_error("corrupt matrix image: bad bucket bounds");
+                  for (const cell* p = cells + first, *end = cells + last; p != end; ++p)
+                        if (p->coordinates == c)
+                              return p->value;
+                  return default_value;
+            }
+
+            size_type size() const noexcept
+            {
+                  return static_cast<size_type>(count);
+            }
+
+            //! Размер отображенного образа в байтах
+            std::size_t mapped_bytes() const noexcept
+            {
+                  return image.size();
+            }
+
+            const_iterator begin() const noexcept
+            {
+                  return const_iterator(cells);
+            }
+
+            const_iterator end() const noexcept
+            {
+                  return const_iterator(cells + count);
+            }
+
+            const_iterator cbegin() const noexcept
+            {
+                  return begin();
+            }
+
+            const_iterator cend() const noexcept
+            {
+                  return end();
+            }
+
+            /*!   \brief  Обход ячеек образа в порядке бакетов.<br>
+                          При разыменовании получаем std::tuple с координатами и значением ячейки, как у итератора matrix.
+            */
+            class const_iterator
+            {
+              public:
+                  using value_type = decltype(std::tuple_cat(std::declval<coordinates_t>(), std::make_tuple(std::declval<T>())));
+                  using iterator_category = std::forward_iterator_tag;
+                  using difference_type = ptrdiff_t;
+                  using pointer = const value_type*;
+                  using reference = value_type;
+
+                  const_iterator() noexcept = default;
+                  explicit const_iterator(const cell* position) noexcept : current(position) {}
+
+                  value_type operator*() const
+                  {
+                        return std::tuple_cat(current->coordinates, std::make_tuple(current->value));
+                  }
+
+                  const_iterator& operator++() noexcept
+                  {
+                        ++current;
+                        return *this;
+                  }
+
+                  const_iterator operator++(int) noexcept
+                  {
+                        const_iterator old_iter = *this;
+                        ++current;
+                        return old_iter;
+                  }
+
+                  bool operator==(const const_iterator& other) const noexcept
+                  {
+                        return current == other.current;
+                  }
+
+                  bool operator!=(const const_iterator& other) const noexcept
+                  {
+                        return current != other.current;
+                  }
+
+              private:
+                  const cell* current = nullptr;
+            };
+
+        private:
+            internal::mapping image;
+            std::uint64_t count = 0;
+            std::uint64_t mask = 0;
+            const std::uint64_t* starts = nullptr;
+            const cell* cells = nullptr;
+      };
+}
+
+#endif
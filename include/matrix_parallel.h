@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+#include "matrix_scheduler.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            //! Число потоков для параллельного алгоритма: 0 означает все потоки текущего исполнителя
+            inline std::size_t thread_count(std::size_t requested)
+            {
+                  return requested ? requested : current_executor()->concurrency();
+            }
+
+            //! Частей на поток: лишние части при неравномерной нагрузке забирают освободившиеся потоки
+            constexpr std::size_t parts_per_thread = 4;
+
+            /*!   \brief  На сколько частей делить работу объема work, если часть должна быть не меньше minimal.<br>
+                          При threads == 1 работа не делится и выполняется вызывающим потоком.
+            */
+            inline std::size_t part_count(std::size_t threads, std::size_t work, std::size_t minimal = 1)
+            {
+                  std::size_t n = thread_count(threads);
+                  if (n == 1)
+                        return 1;
+                  return std::max<std::size_t>(1, std::min(n * parts_per_thread, work / std::max<std::size_t>(1, minimal)));
+            }
+
+            /*!   \brief  Вызывает f(part) для part = 0 .. parts-1 на общем исполнителе (см. current_executor()).
+
+                          Части раздаются потокам пула с перехватом работы, вызывающий поток участвует
+                          в выполнении. Первое исключение, выброшенное какой-либо частью, пробрасывается
+                          после завершения цикла; оставшиеся части после ошибки не запускаются.
+            */
+            template <typename F>
+            void run_parts(std::size_t parts, F&& f)
+            {
+                  if (parts == 0)
+                        return;
+                  if (parts == 1)
+                  {
+                        f(std::size_t(0));
+                        return;
+                  }
+
+                  current_executor()->parallel_for(0, parts, 1, [&](std::size_t lo, std::size_t hi) {
+                        for (std::size_t part = lo; part < hi; ++part)
+                              f(part);
+                  });
+            }
+
+            //! Параметры шаблона матрицы (определяется в matrix.h)
+            template <typename Matrix>
+            struct matrix_traits;
+
+            //! Хранилище с копированием при записи: неконстантный find может клонировать страницы
+            template <typename Storage, typename = void>
+            struct is_copy_on_write : std::false_type
+            {
+            };
+
+            template <typename Storage>
+            struct is_copy_on_write<Storage, std::void_t<decltype(Storage::copy_on_write)>> : std::bool_constant<Storage::copy_on_write>
+            {
+            };
+
+            template <std::size_t Dimension, typename Node, std::size_t... I>
+            std::array<std::size_t, Dimension> node_coordinates(const Node& node, std::index_sequence<I...>)
+            {
+                  return { std::get<I>(node)... };
+            }
+      }
+
+      /*!   \brief  Вызывает f(node) для каждой занятой ячейки матрицы, разделив ячейки между потоками.
+
+                    node - тот же кортеж (координаты..., значение), что и при обычной итерации. f вызывается
+                    одновременно из нескольких потоков; матрица не должна меняться во время обхода.
+
+             \param  threads -число потоков, 0 - все потоки текущего исполнителя, 1 - обход без распараллеливания
+      */
+      template <typename Matrix, typename F>
+      void parallel_for_each(const Matrix& m, F f, std::size_t threads = 0)
+      {
+            auto parts = m.partitions(internal::part_count(threads, m.size()));
+            internal::run_parts(parts.size(), [&](std::size_t part) {
+                  for (auto&& node : parts[part])
+                        f(node);
+            });
+      }
+
+      /*!   \brief  Заменяет значение каждой занятой ячейки на f(node), разделив ячейки между потоками.
+
+                    Новые значения, отличные от значения по умолчанию, записываются на месте параллельно.
+                    Ячейки, которые становятся пустыми, удаляются после параллельной части одним потоком.
+                    При включенном журнале, счетчиках или Z-индексе, а также для хранилища с копированием
+                    при записи все изменения проходят через обычную запись.
+
+             \param  threads -число потоков, 0 - все потоки текущего исполнителя, 1 - без распараллеливания
+      */
+      template <typename Matrix, typename F>
+      void parallel_transform(Matrix& m, F f, std::size_t threads = 0)
+      {
+            using traits = internal::matrix_traits<Matrix>;
+            using T = typename traits::value_type;
+            using key_t = typename traits::key_type;
+            using storage_t = typename traits::policy::template storage<T, traits::default_value, traits::dimension>;
+            constexpr bool in_place = !traits::policy::track_changes && !traits::policy::instrument && !traits::policy::spatial_index &&
+                                     !internal::is_copy_on_write<storage_t>::value;
+
+            auto parts = m.partitions(internal::part_count(threads, m.size()));
+            std::vector<std::vector<std::pair<key_t, T>>> deferred(parts.size());
+
+            internal::run_parts(parts.size(), [&](std::size_t part) {
+                  for (auto&& node : parts[part])
+                  {
+                        T value = f(node);
+                        if (value == std::get<traits::dimension>(node))
+                              continue;
+
+                        key_t key(internal::node_coordinates<traits::dimension>(node, std::make_index_sequence<traits::dimension>()));
+                        if (in_place && value != traits::default_value)
+                        {
+                              *m.um.find(key) = value;
+                        }
+                        else
+                        {
+                              deferred[part].emplace_back(std::move(key), value);
+                        }
+                  }
+            });
+
+            for (auto& part : deferred)
+            {
+                  for (auto& [key, value] : part)
+                        m.set_value(key, value);
+            }
+      }
+}
@@ -0,0 +1,551 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <tuple>
+#include <iterator>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+
+#include "matrix.h"
+#include "matrix_bits.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            /*!   \brief  Узел префиксного дерева хешей (HAMT) в компактной форме CHAMP.
+
+                          Слот узла выбирается очередными 5 битами хеша координат. datamap отмечает слоты, в
+                          которых ячейка лежит прямо в узле, nodemap - слоты с дочерним узлом. Массивы entries и
+                          children плотные: позиция слота - число единичных битов карты левее его бита. Узел
+                          ниже последних битов хеша (коллизия всех 64 бит) хранит ячейки списком без карт.
+            */
+            template <typename T, std::size_t Dimension>
+            struct hamt_node
+            {
+                  using entry_t = std::pair<coordinates_holder<Dimension>, T>;
+
+                  std::uint32_t datamap = 0;
+                  std::uint32_t nodemap = 0;
+                  std::vector<entry_t> entries;
+                  std::vector<std::shared_ptr<const hamt_node>> children;
+            };
+      }
+
+      /*!   \brief  Неизменяемая (персистентная) разреженная матрица со структурным разделением версий.
+
+                    Ячейки лежат в префиксном дереве хешей (HAMT): каждый уровень разбирает 5 бит хорошо
+                    перемешанного хеша координат, так что глубина дерева из n ячеек - около log32(n), а поиск
+                    проходит 3-5 узлов. set() и erase() не меняют матрицу, а возвращают новую версию: копируются
+                    только узлы на пути от корня к ячейке (копирование пути), все остальные поддеревья общие
+                    со старой версией. Хранить тысячу версий, отличающихся несколькими ячейками, стоит
+                    примерно как одну матрицу плюс по пути узлов на каждое изменение.
+
+                    Узлы после построения не меняются, поэтому любые версии можно читать из любого числа
+                    потоков без блокировок. Сам объект версии - это указатель на корень и число ячеек: его
+                    копирование стоит одного атомарного инкремента, а замена версии, которую видят другие
+                    потоки, требует той же синхронизации, что и у std::shared_ptr.
+
+             \tparam  T             -тип данных ячейки матрицы
+             \tparam  default_value -значение по умолчанию для ячеек матрицы
+             \tparam  Dimension     -размерность матицы
+      */
+      template <typename T, T default_value = 0, std::size_t Dimension = 2>
+      class persistent_matrix
+      {
+            using node_t = internal::hamt_node<T, Dimension>;
+            using node_ptr = std::shared_ptr<const node_t>;
+            using entry_t = typename node_t::entry_t;
+
+            static constexpr unsigned bits = 5;
+            static constexpr unsigned hash_bits = 64;
+            //! Уровни с картами (сдвиги 0, 5, ..., 60) плюс уровень коллизий
+            static constexpr unsigned max_levels = (hash_bits + bits - 1) / bits + 1;
+
+        public:
+            using value_type = T;
+            using size_type = std::size_t;
+            using coordinates_t = std::array<std::size_t, Dimension>;
+
+            class const_iterator;
+            using iterator = const_iterator;
+
+            persistent_matrix() = default;
+
+            /*!   \brief  Строит первую версию из обычной матрицы.
+
+                          Ячейки сортируются в порядке обхода дерева, и каждый узел собирается один раз, без
+                          копирования путей, как при последовательных set().
+            */
+            template <typename Policy>
+            explicit persistent_matrix(const matrix<T, default_value, Dimension, Policy>& m)
+            {
+                  std::vector<staged_cell> cells;
+                  cells.reserve(m.size());
+                  for (const auto& node : m.stream())
+                  {
+                        coordinates_t c = internal::node_coordinates<Dimension>(node, std::make_index_sequence<Dimension>());
+                        std::uint64_t h = internal::mixed_hash(c);
+                        cells.push_back(staged_cell{ trie_order(h), h, entry_t{ { c }, std::get<Dimension>(node) } });
+                  }
+
+                  std::sort(cells.begin(), cells.end(),
+                            [](const staged_cell& a, const staged_cell& b) { return a.order < b.order; });
+
+                  if (!cells.empty())
+                        root = build(cells.data(), cells.data() + cells.size(), 0);
+                  count = cells.size();
+            }
+
+            T get(const coordinates_t& c) const
+            {
+                  const std::uint64_t h = internal::mixed_hash(c);
+                  const node_t* n = root.get();
+                  for (unsigned shift = 0; n; shift += bits)
+                  {
+                        if (shift >= hash_bits)
+                        {
+                              for (const auto& e : n->entries)
+                                    if (e.first.coordinates == c)
+                                          return e.second;
+                              return default_value;
+                        }
+
+                        const std::uint32_t bit = slot_bit(h, shift);
+                        if (n->datamap & bit)
+                        {
+                              const entry_t& e = n->entries[slot_index(n->datamap, bit)];
+                              return e.first.coordinates == c ? e.second : default_value;
+                        }
+                        if (!(n->nodemap & bit))
+                              return default_value;
+                        n = n->children[slot_index(n->nodemap, bit)].get();
+                  }
+                  return default_value;
+            }
+
+            /*!   \brief  Новая версия, в которой ячейка c равна value.
+
+                          Запись значения по умолчанию удаляет ячейку, как и в matrix. Если значение не
+                          меняется, возвращается та же версия без копирования узлов.
+            */
+            [[nodiscard]] persistent_matrix set(const coordinates_t& c, const T& value) const
+            {
+                  if (value == default_value)
+                        return erase(c);
+
+                  entry_t cell{ { c }, value };
+                  const std::uint64_t h = internal::mixed_hash(c);
+                  if (!root)
+                  {
+                        auto leaf = std::make_shared<node_t>();
+                        leaf->datamap = slot_bit(h, 0);
+                        leaf->entries.push_back(std::move(cell));
+                        return persistent_matrix(std::move(leaf), 1);
+                  }
+
+                  bool added = false;
+                  node_ptr updated = assoc(*root, 0, h, cell, added);
+                  if (!updated)
+                        return *this;
+                  return persistent_matrix(std::move(updated), count + (added ? 1 : 0));
+            }
+
+            //! Новая версия без ячейки c; если ячейки нет, возвращается та же версия
+            [[nodiscard]] persistent_matrix erase(const coordinates_t& c) const
+            {
+                  if (!root)
+                        return *this;
+
+                  bool removed = false;
+                  node_ptr updated = dissoc(*root, 0, internal::mixed_hash(c), c, removed);
+                  if (!removed)
+                        return *this;
+                  return persistent_matrix(std::move(updated), count - 1);
+            }
+
+            size_type size() const noexcept
+            {
+                  return count;
+            }
+
+            bool empty() const noexcept
+            {
+                  return count == 0;
+            }
+
+            //! Версии с общим корнем заведомо равны: так дешево проверить, что set() ничего не изменил
+            bool same_version(const persistent_matrix& other) const noexcept
+            {
+                  return root == other.root;
+            }
+
+            //! Обычная изменяемая матрица с теми же ячейками
+            template <typename Policy = default_policy>
+            matrix<T, default_value, Dimension, Policy> to_matrix() const
+            {
+                  std::vector<coordinates_t> coords;
+                  std::vector<T> values;
+                  coords.reserve(count);
+                  values.reserve(count);
+                  for (const_iterator it = begin(); it != end(); ++it)
+                  {
+                        coords.push_back(it.coordinates());
+                        values.push_back(it.value());
+                  }
+
+                  matrix<T, default_value, Dimension, Policy> result;
+                  result.set_batch(coords, values);
+                  return result;
+            }
+
+            const_iterator begin() const noexcept
+            {
+                  return const_iterator(root.get());
+            }
+
+            const_iterator end() const noexcept
+            {
+                  return const_iterator();
+            }
+
+            const_iterator cbegin() const noexcept
+            {
+                  return begin();
+            }
+
+            const_iterator cend() const noexcept
+            {
+                  return end();
+            }
+
+            /*!   \brief  Обход ячеек версии в порядке дерева.
+
+                          При разыменовании получаем std::tuple с координатами и значением ячейки, как у
+                          итератора matrix. Итератор держит стек из не более чем max_levels узлов и не выделяет
+                          памяти; версия должна жить, пока идет обход.
+            */
+            class const_iterator
+            {
+                  struct frame
+                  {
+                        const node_t* node;
+                        std::size_t position;
+                  };
+
+                  std::array<frame, max_levels> path{};
+                  unsigned depth = 0;
+                  const entry_t* current = nullptr;
+
+                  void advance() noexcept
+                  {
+                        while (depth != 0)
+                        {
+                              frame& f = path[depth - 1];
+                              if (f.position < f.node->entries.size())
+                              {
+                                    current = &f.node->entries[f.position++];
+                                    return;
+                              }
+
+                              const std::size_t child = f.position - f.node->entries.size();
+                              if (child < f.node->children.size())
+                              {
+                                    ++f.position;
+                                    path[depth++] = frame{ f.node->children[child].get(), 0 };
+                                    continue;
+                              }
+                              --depth;
+                        }
+                        current = nullptr;
+                  }
+
+              public:
+                  using value_type = decltype(std::tuple_cat(std::declval<coordinates_t>(), std::make_tuple(std::declval<T>())));
+                  using iterator_category = std::forward_iterator_tag;
+                  using difference_type = ptrdiff_t;
+                  using pointer = const value_type*;
+                  using reference = value_type;
+
+                  const_iterator() noexcept = default;
+
+                  explicit const_iterator(const node_t* root_node) noexcept
+                  {
+                        if (root_node)
+                        {
+                              path[depth++] = frame{ root_node, 0 };
+                              advance();
+                        }
+                  }
+
+                  const coordinates_t& coordinates() const noexcept
+                  {
+                        return current->first.coordinates;
+                  }
+
+                  const T& value() const noexcept
+                  {
+                        return current->second;
+                  }
+
+                  value_type operator*() const
+                  {
+                        return std::tuple_cat(current->first.coordinates, std::make_tuple(current->second));
+                  }
+
+                  const_iterator& operator++() noexcept
+                  {
+                        advance();
+                        return *this;
+                  }
+
+                  const_iterator operator++(int) noexcept
+                  {
+                        const_iterator old_iter = *this;
+                        advance();
+                        return old_iter;
+                  }
+
+                  bool operator==(const const_iterator& other) const noexcept
+                  {
+                        return current == other.current;
+                  }
+
+                  bool operator!=(const const_iterator& other) const noexcept
+                  {
+                        return current != other.current;
+                  }
+            };
+
+        private:
+            node_ptr root;
+            size_type count = 0;
+
+            persistent_matrix(node_ptr root_node, size_type cells) noexcept : root(std::move(root_node)), count(cells)
+            {
+            }
+
+            //! Ячейка, подготовленная к построению: order - цифры хеша по 5 бит в порядке уровней дерева
+            struct staged_cell
+            {
+                  std::uint64_t order;
+                  std::uint64_t hash;
+                  entry_t entry;
+            };
+
+            static std::uint32_t slot_bit(std::uint64_t h, unsigned shift) noexcept
+            {
+                  return std::uint32_t(1) << ((h >> shift) & ((1u << bits) - 1));
+            }
+
+            static std::size_t slot_index(std::uint32_t map, std::uint32_t bit) noexcept
+            {
+                  return internal::popcount64(map & (bit - 1));
+            }
+
+            //! Переставляет 5-битные цифры хеша так, что первой идет цифра корня: сортировка по ключу дает порядок обхода
+            static std::uint64_t trie_order(std::uint64_t h) noexcept
+            {
+                  std::uint64_t order = 0;
+                  for (unsigned shift = 0; shift + bits <= hash_bits; shift += bits)
+                        order = (order << bits) | ((h >> shift) & ((1u << bits) - 1));
+                  constexpr unsigned tail = hash_bits % bits;
+                  return (order << tail) | (h >> (hash_bits - tail));
+            }
+
+            //! Узел для отсортированного диапазона ячеек с общими младшими shift битами хеша
+            static node_ptr build(const staged_cell* first, const staged_cell* last, unsigned shift)
+            {
+                  auto n = std::make_shared<node_t>();
+                  if (shift >= hash_bits)
+                  {
+                        for (; first != last; ++first)
+                              n->entries.push_back(first->entry);
+                        return n;
+                  }
+
+                  while (first != last)
+                  {
+                        const std::uint32_t bit = slot_bit(first->hash, shift);
+                        const staged_cell* run_end = first + 1;
+                        while (run_end != last && slot_bit(run_end->hash, shift) == bit)
+                              ++run_end;
+
+                        if (run_end - first == 1)
+                        {
+                              n->datamap |= bit;
+                              n->entries.push_back(first->entry);
+                        }
+                        else
+                        {
+                              n->nodemap |= bit;
+                              n->children.push_back(build(first, run_end, shift + bits));
+                        }
+                        first = run_end;
+                  }
+                  return n;
+            }
+
+            //! Поддерево из двух ячеек, чьи хеши совпадают в младших shift битах
+            static node_ptr merge(const entry_t& a, std::uint64_t ha, const entry_t& b, std::uint64_t hb, unsigned shift)
+            {
+                  auto n = std::make_shared<node_t>();
+                  if (shift >= hash_bits)
+                  {
+                        n->entries = { a, b };
+                        return n;
+                  }
+
+                  const std::uint32_t bit_a = slot_bit(ha, shift);
+                  const std::uint32_t bit_b = slot_bit(hb, shift);
+                  if (bit_a == bit_b)
+                  {
+                        n->nodemap = bit_a;
+                        n->children.push_back(merge(a, ha, b, hb, shift + bits));
+                  }
+                  else
+                  {
+                        n->datamap = bit_a | bit_b;
+                        if (bit_a < bit_b)
+                              n->entries = { a, b };
+                        else
+                              n->entries = { b, a };
+                  }
+                  return n;
+            }
+
+            /*!   \brief  Копия пути с записанной ячейкой.
+
+                   \return  новый узел вместо n или nullptr, если ячейка уже хранит это значение
+            */
+            static node_ptr assoc(const node_t& n, unsigned shift, std::uint64_t h, const entry_t& cell, bool& added)
+            {
+                  const coordinates_t& c = cell.first.coordinates;
+                  if (shift >= hash_bits)
+                  {
+                        for (std::size_t i = 0; i < n.entries.size(); ++i)
+                              if (n.entries[i].first.coordinates == c)
+                                    return replace_value(n, i, cell.second);
+
+                        auto copy = std::make_shared<node_t>(n);
+                        copy->entries.push_back(cell);
+                        added = true;
+                        return copy;
+                  }
+
+                  const std::uint32_t bit = slot_bit(h, shift);
+                  if (n.datamap & bit)
+                  {
+                        const std::size_t i = slot_index(n.datamap, bit);
+                        const entry_t& present = n.entries[i];
+                        if (present.first.coordinates == c)
+                              return replace_value(n, i, cell.second);
+
+                        // слот занят другой ячейкой: обе уходят на уровень ниже
+                        node_ptr child = merge(present, internal::mixed_hash(present.first.coordinates), cell, h, shift + bits);
+                        auto copy = std::make_shared<node_t>(n);
+                        copy->datamap ^= bit;
+                        copy->entries.erase(copy->entries.begin() + i);
+                        copy->nodemap |= bit;
+                        copy->children.insert(copy->children.begin() + slot_index(copy->nodemap, bit), std::move(child));
+                        added = true;
+                        return copy;
+                  }
+
+                  if (n.nodemap & bit)
+                  {
+                        const std::size_t i = slot_index(n.nodemap, bit);
+                        node_ptr child = assoc(*n.children[i], shift + bits, h, cell, added);
+                        if (!child)
+                              return nullptr;
+                        auto copy = std::make_shared<node_t>(n);
+                        copy->children[i] = std::move(child);
+                        return copy;
+                  }
+
+                  auto copy = std::make_shared<node_t>(n);
+                  copy->datamap |= bit;
+                  copy->entries.insert(copy->entries.begin() + slot_index(copy->datamap, bit), cell);
+                  added = true;
+                  return copy;
+            }
+
+            static node_ptr replace_value(const node_t& n, std::size_t i, const T& value)
+            {
+                  if (n.entries[i].second == value)
+                        return nullptr;
+                  auto copy = std::make_shared<node_t>(n);
+                  copy->entries[i].second = value;
+                  return copy;
+            }
+
+            /*!   \brief  Копия пути без ячейки c.
+
+                          Дочерний узел, в котором осталась одна ячейка, заменяется этой ячейкой в родителе, так
+                          что дерево не зависит от порядка изменений и не копит пустых узлов.
+
+                   \return  новый узел вместо n (nullptr, если узел опустел); имеет смысл, только если removed
+            */
+            static node_ptr dissoc(const node_t& n, unsigned shift, std::uint64_t h, const coordinates_t& c, bool& removed)
+            {
+                  if (shift >= hash_bits)
+                  {
+                        for (std::size_t i = 0; i < n.entries.size(); ++i)
+                              if (n.entries[i].first.coordinates == c)
+                              {
+                                    removed = true;
+                                    if (n.entries.size() == 1)
+                                          return nullptr;
+                                    auto copy = std::make_shared<node_t>(n);
+                                    copy->entries.erase(copy->entries.begin() + i);
+                                    return copy;
+                              }
+                        return nullptr;
+                  }
+
+                  const std::uint32_t bit = slot_bit(h, shift);
+                  if (n.datamap & bit)
+                  {
+                        const std::size_t i = slot_index(n.datamap, bit);
+                        if (n.entries[i].first.coordinates != c)
+                              return nullptr;
+
+                        removed = true;
+                        if (n.entries.size() == 1 && n.nodemap == 0)
+                              return nullptr;
+                        auto copy = std::make_shared<node_t>(n);
+                        copy->datamap ^= bit;
+                        copy->entries.erase(copy->entries.begin() + i);
+                        return copy;
+                  }
+
+                  if (!(n.nodemap & bit))
+                        return nullptr;
+
+                  const std::size_t i = slot_index(n.nodemap, bit);
+                  node_ptr child = dissoc(*n.children[i], shift + bits, h, c, removed);
+                  if (!removed)
+                        return nullptr;
+
+                  auto copy = std::make_shared<node_t>(n);
+                  if (!child || (child->nodemap == 0 && child->entries.size() == 1))
+                  {
+                        copy->nodemap ^= bit;
+                        copy->children.erase(copy->children.begin() + i);
+                        if (child)
+                        {
+                              copy->datamap |= bit;
+                              copy->entries.insert(copy->entries.begin() + slot_index(copy->datamap, bit), child->entries.front());
+                        }
+                        else if (copy->nodemap == 0 && copy->entries.empty())
+                              return nullptr;
+                  }
+                  else
+                        copy->children[i] = std::move(child);
+                  return copy;
+            }
+      };
+}
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include <string>
+#include <cstdlib>
+#include <cerrno>
+#include <system_error>
+
+#include <unistd.h>
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            [[noreturn]] inline void throw_errno(const std::string& what)
+            {
+                  throw std::system_error(errno, std::generic_category(), what);
+            }
+
+            //! Дескриптор файла, закрываемый в деструкторе
+            class unique_fd
+            {
+              public:
+                  unique_fd() noexcept = default;
+                  explicit unique_fd(int descriptor) noexcept : fd(descriptor) {}
+                  unique_fd(const unique_fd&) = delete;
+                  unique_fd& operator=(const unique_fd&) = delete;
+
+                  unique_fd(unique_fd&& other) noexcept : fd(other.fd)
+                  {
+                        other.fd = -1;
+                  }
+
+                  unique_fd& operator=(unique_fd&& other) noexcept
+                  {
+                        if (this != &other)
+                        {
+                              reset();
+                              fd = other.fd;
+                              other.fd = -1;
+                        }
+                        return *this;
+                  }
+
+                  ~unique_fd()
+                  {
+                        reset();
+                  }
+
+                  int get() const noexcept
+                  {
+                        return fd;
+                  }
+
+                  void reset() noexcept
+                  {
+                        if (fd >= 0)
+                              ::close(fd);
+                        fd = -1;
+                  }
+
+              private:
+                  int fd = -1;
+            };
+
+            //! Создает пустой файл со свободным именем name.XXXXXX в $TMPDIR (или /tmp) через mkstemp и возвращает путь
+            inline std::string make_temporary_file(const std::string& name)
+            {
+                  const char* directory = std::getenv("TMPDIR");
+                  std::string path = std::string(directory && *directory ? directory : "/tmp") + "/" + name + ".XXXXXX";
+                  unique_fd fd(::mkstemp(&path[0]));
+                  if (fd.get() < 0)
+                        throw_errno("mkstemp " + path);
+                  return path;
+            }
+      }
+}
@@ -0,0 +1,564 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <exception>
+
+#include "matrix.h"
+#include "matrix_stream.h"
+
+namespace roro_lib
+{
+      /*!   \brief  Поток запросов к матрице: разбор, выполнение пакетами и ответы.
+
+                    Текстовый формат - по команде на строку, числа через пробелы:
+                    ~~~
+                    GET x y ...              ответ: значение
+                    SET x y ... value        ответ: OK
+                    ADD x y ... delta        ответ: новое значение
+                    RANGE x1 y1 ... x2 y2 ...  ответ: число ячеек n, затем n строк "x y ... value"
+                    ~~~
+                    Пустые строки пропускаются, на нераспознанную строку отвечается ERR.
+
+                    Двоичный формат - кадры без разделителей, числа в порядке байтов хоста: байт кода команды
+                    (1 GET, 2 SET, 3 ADD, 4 RANGE), затем Dimension координат uint64, для SET и ADD - значение
+                    int64, для RANGE - еще Dimension координат верхнего угла. Ответ начинается с байта статуса
+                    (0 - успех); GET, SET и ADD возвращают int64 (значение ячейки после команды), RANGE - uint64
+                    число ячеек и для каждой Dimension координат uint64 и значение int64. Неизвестный код
+                    команды дает ответ со статусом 1 и пропускает один байт.
+
+                    Ответы идут строго в порядке команд.
+      */
+      namespace query
+      {
+            enum class opcode : std::uint8_t
+            {
+                  invalid = 0,
+                  get = 1,
+                  set = 2,
+                  add = 3,
+                  range = 4
+            };
+
+            enum class wire_format
+            {
+                  text,
+                  binary
+            };
+
+            template <std::size_t Dimension>
+            struct command
+            {
+                  opcode op;
+                  std::array<std::size_t, Dimension> lo;
+                  std::array<std::size_t, Dimension> hi;
+                  std::int64_t value;
+            };
+
+            //! Пакет разобранных команд; вектор переиспользуется, так что память выделяется только при росте пакета
+            template <std::size_t Dimension>
+            struct batch
+            {
+                  std::vector<command<Dimension>> commands;
+            };
+
+            /*!   \brief  Разбор потока команд кусками произвольной длины.
+
+                          Команда, разрезанная границей куска, дособирается в буфере хвоста; полные команды
+                          разбираются прямо из куска без копирования.
+            */
+            template <std::size_t Dimension>
+            class parser
+            {
+              public:
+                  explicit parser(wire_format f) : format(f) {}
+
+                  //! Разбирает очередной кусок: полные команды добавляются в out, неполный хвост запоминается
+                  void feed(const char* data, std::size_t size, batch<Dimension>& out)
+                  {
+                        const char* first = data;
+                        const char* last = data + size;
+
+                        if (!tail.empty())
+                        {
+                              first = complete_tail(first, last, out);
+                              if (!tail.empty())
+                                    return;
+                        }
+
+                        const char* rest = format == wire_format::text ? parse_text(first, last, out) : parse_binary(first, last, out);
+                        tail.assign(rest, last);
+                  }
+
+                  //! Конец потока: текстовая строка без перевода строки - тоже команда, неполный кадр - ошибка
+                  void finish(batch<Dimension>& out)
+                  {
+                        if (tail.empty())
+                              return;
+
+                        if (format == wire_format::text)
+                              parse_line(tail.data(), tail.data() + tail.size(), out);
+                        else
+                              out.commands.push_back(command<Dimension> { opcode::invalid, {}, {}, 0 });
+                        tail.clear();
+                  }
+
+              private:
+                  wire_format format;
+                  std::vector<char> tail;
+
+                  //! Дописывает к хвосту начало куска, пока хвост не станет полной командой
+                  const char* complete_tail(const char* first, const char* last, batch<Dimension>& out)
+                  {
+                        if (format == wire_format::text)
+                        {
+                              const char* eol = static_cast<const char*>(std::memchr(first, '\n', static_cast<std::size_t>(last - first)));
+                              if (!eol)
+                              {
+                                    tail.insert(tail.end(), first, last);
+                                    return last;
+                              }
+                              tail.insert(tail.end(), first, eol);
+                              parse_line(tail.data(), tail.data() + tail.size(), out);
+                              tail.clear();
+                              return eol + 1;
+                        }
+
+                        const std::size_t need = frame_size(static_cast<opcode>(tail[0]));
+                        const std::size_t take = std::min<std::size_t>(need - tail.size(), static_cast<std::size_t>(last - first));
+                        tail.insert(tail.end(), first, first + take);
+                        if (tail.size() == need)
+                        {
+                              parse_binary(tail.data(), tail.data() + tail.size(), out);
+                              tail.clear();
+                        }
+                        return first + take;
+                  }
+
+                  const char* parse_text(const char* first, const char* last, batch<Dimension>& out)
+                  {
+                        while (first != last)
+                        {
+                              const char* eol = static_cast<const char*>(std::memchr(first, '\n', static_cast<std::size_t>(last - first)));
+                              if (!eol)
+                                    break;
+                              parse_line(first, eol, out);
+                              first = eol + 1;
+                        }
+                        return first;
+                  }
+
+                  static const char* skip_spaces(const char* p, const char* last) noexcept
+                  {
+                        while (p != last && (*p == ' ' || *p == '\t' || *p == '\r'))
+                              ++p;
+                        return p;
+                  }
+
+                  template <typename Number>
+                  static bool read_number(const char*& p, const char* last, Number& value) noexcept
+                  {
+                        p = skip_spaces(p, last);
+                        auto [end, ec] = std::from_chars(p, last, value);
+                        if (ec != std::errc() || end == p)
+                              return false;
+                        p = end;
+                        return true;
+                  }
+
+                  static bool read_coordinates(const char*& p, const char* last, std::array<std::size_t, Dimension>& c) noexcept
+                  {
+                        for (auto& x : c)
+                              if (!read_number(p, last, x))
+                                    return false;
+                        return true;
+                  }
+
+                  static opcode read_keyword(const char*& p, const char* last) noexcept
+                  {
+                        const char* word = p;
+                        while (p != last && *p != ' ' && *p != '\t' && *p != '\r')
+                              ++p;
+
+                        const std::size_t length = static_cast<std::size_t>(p - word);
+                        if (length == 3 && std::memcmp(word, "GET", 3) == 0)
+                              return opcode::get;
+                        if (length == 3 && std::memcmp(word, "SET", 3) == 0)
+                              return opcode::set;
+                        if (length == 3 && std::memcmp(word, "ADD", 3) == 0)
+                              return opcode::add;
+                        if (length == 5 && std::memcmp(word, "RANGE", 5) == 0)
+                              return opcode::range;
+                        return opcode::invalid;
+                  }
+
+                  static void parse_line(const char* p, const char* last, batch<Dimension>& out)
+                  {
+                        p = skip_spaces(p, last);
+                        if (p == last)
+                              return;
+
+                        command<Dimension> cmd { read_keyword(p, last), {}, {}, 0 };
+                        bool ok = cmd.op != opcode::invalid && read_coordinates(p, last, cmd.lo);
+                        if (ok && (cmd.op == opcode::set || cmd.op == opcode::add))
+                              ok = read_number(p, last, cmd.value);
+                        if (ok && cmd.op == opcode::range)
+                              ok = read_coordinates(p, last, cmd.hi);
+                        if (!ok || skip_spaces(p, last) != last)
+                              cmd.op = opcode::invalid;
+                        out.commands.push_back(cmd);
+                  }
+
+                  static std::size_t frame_size(opcode op) noexcept
+                  {
+                        switch (op)
+                        {
+                        case opcode::get:
+                              return 1 + Dimension * sizeof(std::uint64_t);
+                        case opcode::set:
+                        case opcode::add:
+                              return 1 + Dimension * sizeof(std::uint64_t) + sizeof(std::int64_t);
+                        case opcode::range:
+                              return 1 + 2 * Dimension * sizeof(std::uint64_t);
+                        default:
+                              return 1;
+                        }
+                  }
+
+                  static void read_frame_coordinates(const char*& p, std::array<std::size_t, Dimension>& c) noexcept
+                  {
+                        for (auto& x : c)
+                        {
+                              std::uint64_t v;
+                              std::memcpy(&v, p, sizeof(v));
+                              x = static_cast<std::size_t>(v);
+                              p += sizeof(v);
+                        }
+                  }
+
+                  static const char* parse_binary(const char* first, const char* last, batch<Dimension>& out)
+                  {
+                        while (first != last)
+                        {
+                              const opcode op = static_cast<opcode>(*first);
+                              const std::size_t size = frame_size(op);
+                              if (static_cast<std::size_t>(last - first) < size)
+                                    break;
+
+                              command<Dimension> cmd { op, {}, {}, 0 };
+                              const char* p = first + 1;
+                              if (size == 1)
+                                    cmd.op = opcode::invalid;
+                              else
+                              {
+                                    read_frame_coordinates(p, cmd.lo);
+                                    if (op == opcode::set || op == opcode::add)
+                                          std::memcpy(&cmd.value, p, sizeof(cmd.value));
+                                    if (op == opcode::range)
+                                          read_frame_coordinates(p, cmd.hi);
+                              }
+                              out.commands.push_back(cmd);
+                              first += size;
+                        }
+                        return first;
+                  }
+            };
+
+            /*!   \brief  Выполняет пакеты команд над матрицей и пишет ответы в буфер.
+
+                          Подряд идущие GET читаются одним get_batch, подряд идущие SET пишутся одним set_batch,
+                          так что промахи кеша соседних команд перекрываются. RANGE требует матрицу с политикой
+                          spatial_index; индекс обновляется при каждой записи, поэтому RANGE в смешанном потоке
+                          стоит пропорционально ответу, а не числу ячеек (см. matrix::range).
+            */
+            template <typename Matrix>
+            class executor
+            {
+                  using T = typename Matrix::value_type;
+                  using coordinates_t = typename Matrix::coordinates_t;
+                  static constexpr std::size_t Dimension = std::tuple_size<coordinates_t>::value;
+
+              public:
+                  executor(Matrix& target, wire_format f) : m(target), format(f) {}
+
+                  //! Ответы на команды пакета дописываются в out
+                  void run(const batch<Dimension>& in, std::string& out)
+                  {
+                        const auto& commands = in.commands;
+                        std::size_t n = 0;
+                        while (n < commands.size())
+                        {
+                              const opcode op = commands[n].op;
+                              std::size_t run_end = n + 1;
+                              if (op == opcode::get || op == opcode::set)
+                                    while (run_end < commands.size() && commands[run_end].op == op)
+                                          ++run_end;
+
+                              switch (op)
+                              {
+                              case opcode::get:
+                                    run_gets(commands, n, run_end, out);
+                                    break;
+                              case opcode::set:
+                                    run_sets(commands, n, run_end, out);
+                                    break;
+                              case opcode::add:
+                                    run_add(commands[n], out);
+                                    break;
+                              case opcode::range:
+                                    run_range(commands[n], out);
+                                    break;
+                              default:
+                                    if (format == wire_format::text)
+                                          out.append("ERR\n");
+                                    else
+                                          out.push_back(char(1));
+                                    break;
+                              }
+                              n = run_end;
+                        }
+                  }
+
+              private:
+                  Matrix& m;
+                  wire_format format;
+                  // рабочие векторы переиспользуются между пакетами
+                  std::vector<coordinates_t> coords;
+                  std::vector<T> values;
+                  std::vector<std::pair<coordinates_t, T>> cells;
+
+                  void put_int(std::string& out, std::int64_t value) const
+                  {
+                        char digits[24];
+                        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+                        out.append(digits, result.ptr);
+                  }
+
+                  template <typename Raw>
+                  static void put_raw(std::string& out, Raw value)
+                  {
+                        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+                  }
+
+                  //! Ответ со значением: строка с числом или статус 0 и int64
+                  void put_value(std::string& out, T value) const
+                  {
+                        if (format == wire_format::text)
+                        {
+                              put_int(out, static_cast<std::int64_t>(value));
+                              out.push_back('\n');
+                        }
+                        else
+                        {
+                              out.push_back(char(0));
+                              put_raw(out, static_cast<std::int64_t>(value));
+                        }
+                  }
+
+                  void run_gets(const std::vector<command<Dimension>>& commands, std::size_t first, std::size_t last, std::string& out)
+                  {
+                        coords.clear();
+                        for (std::size_t n = first; n < last; ++n)
+                              coords.push_back(commands[n].lo);
+                        values.resize(coords.size());
+                        m.get_batch(coords.data(), coords.size(), values.data());
+                        for (const T& value : values)
+                              put_value(out, value);
+                  }
+
+                  void run_sets(const std::vector<command<Dimension>>& commands, std::size_t first, std::size_t last, std::string& out)
+                  {
+                        coords.clear();
+                        values.clear();
+                        for (std::size_t n = first; n < last; ++n)
+                        {
+                              coords.push_back(commands[n].lo);
+                              values.push_back(static_cast<T>(commands[n].value));
+                        }
+                        m.set_batch(coords.data(), coords.size(), values.data());
+                        for (const T& value : values)
+                        {
+                              if (format == wire_format::text)
+                                    out.append("OK\n");
+                              else
+                                    put_value(out, value);
+                        }
+                  }
+
+                  void run_add(const command<Dimension>& cmd, std::string& out)
+                  {
+                        T value;
+                        m.get_batch(&cmd.lo, 1, &value);
+                        value = static_cast<T>(value + static_cast<T>(cmd.value));
+                        m.set_batch(&cmd.lo, 1, &value);
+                        put_value(out, value);
+                  }
+
+                  void run_range(const command<Dimension>& cmd, std::string& out)
+                  {
+                        cells.clear();
+                        for (auto&& node : m.range(cmd.lo, cmd.hi))
+                              cells.emplace_back(internal::node_coordinates<Dimension>(node, std::make_index_sequence<Dimension>()), std::get<Dimension>(node));
+
+                        if (format == wire_format::text)
+                        {
+                              put_int(out, static_cast<std::int64_t>(cells.size()));
+                              out.push_back('\n');
+                              for (const auto& [c, value] : cells)
+                              {
+                                    for (std::size_t x : c)
+                                    {
+                                          put_int(out, static_cast<std::int64_t>(x));
+                                          out.push_back(' ');
+                                    }
+                                    put_int(out, static_cast<std::int64_t>(value));
+                                    out.push_back('\n');
+                              }
+                        }
+                        else
+                        {
+                              out.push_back(char(0));
+                              put_raw(out, static_cast<std::uint64_t>(cells.size()));
+                              for (const auto& [c, value] : cells)
+                              {
+                                    for (std::size_t x : c)
+                                          put_raw(out, static_cast<std::uint64_t>(x));
+                                    put_raw(out, static_cast<std::int64_t>(value));
+                              }
+                        }
+                  }
+            };
+
+            /*!   \brief  Обслуживает поток команд конвейером из трех потоков: чтение и разбор, выполнение, запись.
+
+                          read(char* buffer, std::size_t capacity) возвращает число прочитанных байтов (0 - конец
+                          потока) и может вернуть меньше, чем есть места: тогда уже пришедшие команды выполняются,
+                          не дожидаясь полного куска. write(const char* data, std::size_t size) пишет все байты.
+                          Пакеты и буферы ответов ходят по кругу между стадиями и переиспользуются, так что на
+                          строку не приходится ни выделения памяти, ни сброса вывода: ответ пакета уходит одним
+                          вызовом write. Матрица изменяется только потоком выполнения (вызывающим).
+            */
+            template <typename Matrix, typename Read, typename Write>
+            void serve(Matrix& m, wire_format format, Read read, Write write, std::size_t chunk_size = 64 * 1024)
+            {
+                  constexpr std::size_t Dimension = std::tuple_size<typename Matrix::coordinates_t>::value;
+                  constexpr std::size_t in_flight = 4;
+
+                  using batch_ptr = std::unique_ptr<batch<Dimension>>;
+                  using output_ptr = std::unique_ptr<std::string>;
+
+                  internal::bounded_queue<batch_ptr> free_batches(in_flight);
+                  internal::bounded_queue<batch_ptr> parsed(in_flight);
+                  internal::bounded_queue<output_ptr> free_outputs(in_flight);
+                  internal::bounded_queue<output_ptr> written(in_flight);
+                  for (std::size_t k = 0; k < in_flight; ++k)
+                  {
+                        free_batches.push(std::make_unique<batch<Dimension>>());
+                        free_outputs.push(std::make_unique<std::string>());
+                  }
+
+                  std::thread reader([&] {
+                        try
+                        {
+                              parser<Dimension> p(format);
+                              std::vector<char> chunk(chunk_size);
+                              for (;;)
+                              {
+                                    std::size_t got = read(chunk.data(), chunk.size());
+                                    auto next = free_batches.pop();
+                                    if (!next)
+                                          break;
+
+                                    batch_ptr b = std::move(*next);
+                                    b->commands.clear();
+                                    if (got == 0)
+                                    {
+                                          p.finish(*b);
+                                          parsed.push(std::move(b));
+                                          break;
+                                    }
+                                    p.feed(chunk.data(), got, *b);
+                                    parsed.push(std::move(b));
+                              }
+                              parsed.close();
+                        }
+                        catch (...)
+                        {
+                              parsed.close(std::current_exception());
+                        }
+                  });
+
+                  std::exception_ptr write_error;
+                  std::atomic<bool> write_failed { false };
+                  std::thread writer([&] {
+                        while (auto out = written.pop())
+                        {
+                              if (!write_failed)
+                              {
+                                    try
+                                    {
+                                          if (!(*out)->empty())
+                                                write((*out)->data(), (*out)->size());
+                                    }
+                                    catch (...)
+                                    {
+                                          write_error = std::current_exception();
+                                          write_failed = true;
+                                    }
+                              }
+                              (*out)->clear();
+                              free_outputs.push(std::move(*out));
+                        }
+                  });
+
+                  std::exception_ptr error;
+                  try
+                  {
+                        executor<Matrix> exec(m, format);
+                        while (auto b = parsed.pop())
+                        {
+                              // после ошибки записи команды только вычитываются, чтобы читатель дошел до конца потока
+                              if (!write_failed)
+                              {
+                                    output_ptr out = std::move(*free_outputs.pop());
+                                    exec.run(**b, *out);
+                                    written.push(std::move(out));
+                              }
+                              free_batches.push(std::move(*b));
+                        }
+                  }
+                  catch (...)
+                  {
+                        // читатель останавливается на следующем пакете; его собственная ошибка уже не важна
+                        error = std::current_exception();
+                        free_batches.close();
+                        try
+                        {
+                              while (parsed.pop())
+                              {
+                              }
+                        }
+                        catch (...)
+                        {
+                        }
+                  }
+
+                  written.close();
+                  writer.join();
+                  reader.join();
+
+                  if (error)
+                        std::rethrow_exception(error);
+                  if (write_error)
+                        std::rethrow_exception(write_error);
+            }
+      }
+}
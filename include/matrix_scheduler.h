@@ -0,0 +1,525 @@
+﻿#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <algorithm>
+
+namespace roro_lib
+{
+      /*!   \brief  Исполнитель параллельных циклов, общий для всех параллельных алгоритмов матрицы.
+
+                    По умолчанию используется work_stealing_pool. Свой исполнитель (например, поверх
+                    пула потоков приложения) подключается через set_executor().
+      */
+      class executor
+      {
+        public:
+            using body_t = std::function<void(std::size_t, std::size_t)>;
+
+            virtual ~executor() = default;
+
+            //! Сколько потоков одновременно выполняют тело цикла
+            virtual std::size_t concurrency() const noexcept = 0;
+
+            /*!   \brief  Вызывает body(lo, hi) для непересекающихся диапазонов, покрывающих [first, last), и ждет завершения.<br>
+                          Диапазоны не короче grain (кроме последнего), 0 - выбор исполнителя.
+                          Первое исключение из body пробрасывается вызывающему.
+            */
+            virtual void parallel_for(std::size_t first, std::size_t last, std::size_t grain, const body_t& body) = 0;
+      };
+
+      //! Последовательный исполнитель: весь цикл выполняется вызывающим потоком
+      class inline_executor : public executor
+      {
+        public:
+            std::size_t concurrency() const noexcept override
+            {
+                  return 1;
+            }
+
+            void parallel_for(std::size_t first, std::size_t last, std::size_t, const body_t& body) override
+            {
+                  if (first < last)
+                        body(first, last);
+            }
+      };
+
+      namespace internal
+      {
+            //! Задача планировщика: функция и ее данные в одном объекте, run освобождает задачу
+            struct task
+            {
+                  void (*run)(task*);
+            };
+
+            /*!   \brief  Дек Чейза-Лева: владелец кладет и берет задачи с нижнего конца, воры крадут с верхнего.
+
+                          Реализация по Lê, Pop, Cohen, Zappa Nardelli, "Correct and Efficient Work-Stealing for
+                          Weak Memory Models" (PPoPP 2013). Кольцевой буфер растет вдвое при переполнении;
+                          старые буферы освобождаются вместе с деком, потому что вор мог успеть их прочитать.
+            */
+            class chase_lev_deque
+            {
+              public:
+                  explicit chase_lev_deque(std::size_t capacity = 256)
+                  {
+                        buffers.push_back(std::make_unique<ring>(capacity));
+                        array.store(buffers.back().get(), std::memory_order_relaxed);
+                  }
+
+                  chase_lev_deque(const chase_lev_deque&) = delete;
+                  chase_lev_deque& operator=(const chase_lev_deque&) = delete;
+
+                  //! Только владелец
+                  void push(task* t)
+                  {
+                        std::int64_t b = bottom.load(std::memory_order_relaxed);
+                        std::int64_t tp = top.load(std::memory_order_acquire);
+                        ring* a = array.load(std::memory_order_relaxed);
+                        if (b - tp > static_cast<std::int64_t>(a->mask))
+                              a = grow(a, tp, b);
+
+                        a->put(b, t);
+                        std::atomic_thread_fence(std::memory_order_release);
+                        bottom.store(b + 1, std::memory_order_relaxed);
+                  }
+
+                  //! Только владелец; nullptr, если дек пуст
+                  task* take()
+                  {
+                        std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+                        ring* a = array.load(std::memory_order_relaxed);
+                        bottom.store(b, std::memory_order_relaxed);
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                        std::int64_t tp = top.load(std::memory_order_relaxed);
+
+                        task* t = nullptr;
+                        if (tp <= b)
+                        {
+                              t = a->get(b);
+                              if (tp == b)
+                              {
+                                    // последний элемент: соревнуемся с ворами
+                                    if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                                          t = nullptr;
+                                    bottom.store(b + 1, std::memory_order_relaxed);
+                              }
+                        }
+                        else
+                        {
+                              bottom.store(b + 1, std::memory_order_relaxed);
+                        }
+                        return t;
+                  }
+
+                  //! Любой поток; nullptr, если дек пуст или кражу перехватил другой поток
+                  task* steal()
+                  {
+                        std::int64_t tp = top.load(std::memory_order_acquire);
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                        std::int64_t b = bottom.load(std::memory_order_acquire);
+
+                        if (tp >= b)
+                              return nullptr;
+
+                        ring* a = array.load(std::memory_order_acquire);
+                        task* t = a->get(tp);
+                        if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                              return nullptr;
+                        return t;
+                  }
+
+                  bool empty() const noexcept
+                  {
+                        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+                  }
+
+              private:
+                  struct ring
+                  {
+                        explicit ring(std::size_t capacity) : mask(capacity - 1), slots(new std::atomic<task*>[capacity])
+                        {
+                        }
+
+                        task* get(std::int64_t i) const noexcept
+                        {
+                              return slots[static_cast<std::size_t>(i) & mask].load(std::memory_order_relaxed);
+                        }
+
+                        void put(std::int64_t i, task* t) noexcept
+                        {
+                              slots[static_cast<std::size_t>(i) & mask].store(t, std::memory_order_relaxed);
+                        }
+
+                        std::size_t mask;
+                        std::unique_ptr<std::atomic<task*>[]> slots;
+                  };
+
+                  ring* grow(ring* a, std::int64_t tp, std::int64_t b)
+                  {
+                        buffers.push_back(std::make_unique<ring>((a->mask + 1) * 2));
+                        ring* bigger = buffers.back().get();
+                        for (std::int64_t i = tp; i < b; ++i)
+                              bigger->put(i, a->get(i));
+                        array.store(bigger, std::memory_order_release);
+                        return bigger;
+                  }
+
+                  alignas(64) std::atomic<std::int64_t> top { 0 };
+                  alignas(64) std::atomic<std::int64_t> bottom { 0 };
+                  std::atomic<ring*> array { nullptr };
+                  std::vector<std::unique_ptr<ring>> buffers;
+            };
+      }
+
+      /*!   \brief  Пул потоков с перехватом работы (work stealing).
+
+                    У каждого рабочего потока свой дек Чейза-Лева. Поток берет задачи из своего дека, а когда
+                    он пуст - крадет у случайно выбранного соседа. Задачи извне попадают в общую очередь.
+
+                    parallel_for делит диапазон лениво (lazy binary splitting): задача выполняет свой
+                    диапазон порциями по grain и перед каждой порцией, если ее собственный дек пуст, отдает
+                    вторую половину остатка в дек. Поэтому на неравномерной нагрузке (строки со степенным
+                    распределением длин) простаивающие потоки крадут крупные куски, а на равномерной
+                    накладные расходы - O(потоков * log n) задач. Вызывающий поток тоже выполняет задачи,
+                    поэтому вложенные parallel_for не блокируют пул.
+
+                    Пул создается один раз и переиспользуется между вызовами.
+      */
+      class work_stealing_pool : public executor
+      {
+        public:
+            /*!   \param  threads -число потоков, выполняющих задачи, включая вызывающий; 0 - std::thread::hardware_concurrency()
+            */
+            explicit work_stealing_pool(std::size_t threads = 0)
+            {
+                  std::size_t total = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+                  for (std::size_t i = 0; i + 1 < total; ++i)
+                        workers.push_back(std::make_unique<worker>());
+                  for (std::size_t i = 0; i < workers.size(); ++i)
+                        workers[i]->thread = std::thread([this, i] { work(i); });
+            }
+
+            ~work_stealing_pool() override
+            {
+                  {
+                        std::lock_guard<std::mutex> lock(sleep_mutex);
+                        stopping.store(true);
+                  }
+                  wake.notify_all();
+                  for (auto& w : workers)
+                        w->thread.join();
+            }
+
+            work_stealing_pool(const work_stealing_pool&) = delete;
+            work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+            std::size_t concurrency() const noexcept override
+            {
+                  return workers.size() + 1;
+            }
+
+            void parallel_for(std::size_t first, std::size_t last, std::size_t grain, const body_t& body) override
+            {
+                  if (first >= last)
+                        return;
+
+                  std::size_t n = last - first;
+                  if (grain == 0)
+                        grain = std::max<std::size_t>(1, n / (8 * concurrency()));
+                  if (workers.empty() || n <= grain)
+                  {
+                        body(first, last);
+                        return;
+                  }
+
+                  loop_state state(body, grain, n);
+                  spawn(new range_task(this, &state, first, last));
+
+                  // вызывающий поток помогает, пока цикл не закончится
+                  while (state.remaining.load(std::memory_order_acquire) != 0)
+                  {
+                        if (internal::task* t = find_task())
+                              t->run(t);
+                        else
+                              std::this_thread::yield();
+                  }
+
+                  if (state.error)
+                        std::rethrow_exception(state.error);
+            }
+
+        private:
+            struct worker
+            {
+                  internal::chase_lev_deque deque;
+                  std::thread thread;
+            };
+
+            struct loop_state
+            {
+                  loop_state(const body_t& body, std::size_t grain, std::size_t n) : body(body), grain(grain), remaining(n) {}
+
+                  const body_t& body;
+                  const std::size_t grain;
+                  std::atomic<std::size_t> remaining;
+                  std::atomic<bool> failed { false };
+                  std::exception_ptr error;
+            };
+
+            struct range_task : internal::task
+            {
+                  range_task(work_stealing_pool* pool, loop_state* state, std::size_t lo, std::size_t hi)
+                      : internal::task { &range_task::execute }, pool(pool), state(state), lo(lo), hi(hi)
+                  {
+                  }
+
+                  static void execute(internal::task* base)
+                  {
+                        std::unique_ptr<range_task> self(static_cast<range_task*>(base));
+                        loop_state& state = *self->state;
+                        std::size_t lo = self->lo;
+                        std::size_t hi = self->hi;
+
+                        while (lo < hi)
+                        {
+                              std::size_t end = std::min(hi, lo + state.grain);
+                              if (hi - end >= 2 * state.grain && self->pool->local_empty())
+                              {
+                                    // граница кратна grain от начала, поэтому короче grain бывает только диапазон у last
+                                    std::size_t mid = end + (hi - end) / 2 / state.grain * state.grain;
+                                    self->pool->spawn(new range_task(self->pool, self->state, mid, hi));
+                                    hi = mid;
+                              }
+
+                              if (!state.failed.load(std::memory_order_relaxed))
+                              {
+                                    try
+                                    {
+                                          state.body(lo, end);
+                                    }
+                                    catch (...)
+                                    {
+                                          if (!state.failed.exchange(true))
+                                                state.error = std::current_exception();
+                                    }
+                              }
+
+                              // последнее уменьшение освобождает вызывающий поток: после него state трогать нельзя
+                              std::size_t done = end - lo;
+                              lo = end;
+                              state.remaining.fetch_sub(done, std::memory_order_acq_rel);
+                        }
+                  }
+
+                  work_stealing_pool* pool;
+                  loop_state* state;
+                  std::size_t lo;
+                  std::size_t hi;
+            };
+
+            //! Номер рабочего потока этого пула для текущего потока, или npos
+            std::size_t self_index() const noexcept
+            {
+                  return current_pool() == this ? current_index() : npos;
+            }
+
+            bool local_empty() const noexcept
+            {
+                  std::size_t self = self_index();
+                  if (self != npos)
+                        return workers[self]->deque.empty();
+
+                  std::lock_guard<std::mutex> lock(inject_mutex);
+                  return injected.empty();
+            }
+
+            void spawn(internal::task* t)
+            {
+                  std::size_t self = self_index();
+                  if (self != npos)
+                  {
+                        workers[self]->deque.push(t);
+                  }
+                  else
+                  {
+                        std::lock_guard<std::mutex> lock(inject_mutex);
+                        injected.push_back(t);
+                  }
+
+                  epoch.fetch_add(1, std::memory_order_seq_cst);
+                  if (sleepers.load(std::memory_order_seq_cst) != 0)
+                  {
+                        std::lock_guard<std::mutex> lock(sleep_mutex);
+                        wake.notify_all();
+                  }
+            }
+
+            internal::task* find_task()
+            {
+                  std::size_t self = self_index();
+                  if (self != npos)
+                  {
+                        if (internal::task* t = workers[self]->deque.take())
+                              return t;
+                  }
+
+                  // случайный порядок обхода жертв, начиная с псевдослучайной
+                  std::size_t n = workers.size();
+                  std::size_t start = static_cast<std::size_t>(next_random() % n);
+                  for (std::size_t k = 0; k < n; ++k)
+                  {
+                        std::size_t victim = (start + k) % n;
+                        if (victim == self)
+                              continue;
+                        if (internal::task* t = workers[victim]->deque.steal())
+                              return t;
+                  }
+
+                  std::lock_guard<std::mutex> lock(inject_mutex);
+                  if (injected.empty())
+                        return nullptr;
+                  internal::task* t = injected.front();
+                  injected.pop_front();
+                  return t;
+            }
+
+            bool has_work() const
+            {
+                  for (const auto& w : workers)
+                  {
+                        if (!w->deque.empty())
+                              return true;
+                  }
+                  std::lock_guard<std::mutex> lock(inject_mutex);
+                  return !injected.empty();
+            }
+
+            void work(std::size_t index)
+            {
+                  current_pool() = this;
+                  current_index() = index;
+
+                  std::size_t idle = 0;
+                  while (!stopping.load(std::memory_order_acquire))
+                  {
+                        if (internal::task* t = find_task())
+                        {
+                              t->run(t);
+                              idle = 0;
+                              continue;
+                        }
+
+                        if (++idle < spin_rounds)
+                        {
+                              std::this_thread::yield();
+                              continue;
+                        }
+
+                        // засыпаем; проверка работы после регистрации в sleepers не дает потерять пробуждение
+                        std::unique_lock<std::mutex> lock(sleep_mutex);
+                        std::uint64_t seen = epoch.load(std::memory_order_seq_cst);
+                        sleepers.fetch_add(1, std::memory_order_seq_cst);
+                        if (!has_work())
+                        {
+                              wake.wait_for(lock, std::chrono::milliseconds(50), [&] {
+                                    return stopping.load() || epoch.load(std::memory_order_seq_cst) != seen;
+                              });
+                        }
+                        sleepers.fetch_sub(1, std::memory_order_seq_cst);
+                        idle = 0;
+                  }
+            }
+
+            static std::uint64_t next_random() noexcept
+            {
+                  thread_local std::uint64_t state = 0x9E3779B97F4A7C15ULL ^ reinterpret_cast<std::uintptr_t>(&state);
+                  state ^= state << 13;
+                  state ^= state >> 7;
+                  state ^= state << 17;
+                  return state;
+            }
+
+            static const work_stealing_pool*& current_pool() noexcept
+            {
+                  thread_local const work_stealing_pool* pool = nullptr;
+                  return pool;
+            }
+
+            static std::size_t& current_index() noexcept
+            {
+                  thread_local std::size_t index = npos;
+                  return index;
+            }
+
+            static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+            static constexpr std::size_t spin_rounds = 64;
+
+            std::vector<std::unique_ptr<worker>> workers;
+
+            mutable std::mutex inject_mutex;
+            std::deque<internal::task*> injected;
+
+            std::mutex sleep_mutex;
+            std::condition_variable wake;
+            std::atomic<std::uint64_t> epoch { 0 };
+            std::atomic<std::size_t> sleepers { 0 };
+            std::atomic<bool> stopping { false };
+      };
+
+      namespace internal
+      {
+            inline std::mutex& executor_mutex()
+            {
+                  static std::mutex m;
+                  return m;
+            }
+
+            inline std::shared_ptr<executor>& executor_slot()
+            {
+                  static std::shared_ptr<executor> slot;
+                  return slot;
+            }
+      }
+
+      /*!   \brief  Исполнитель параллельных алгоритмов матрицы.<br>
+                    При первом обращении создается work_stealing_pool на все ядра.
+      */
+      inline std::shared_ptr<executor> current_executor()
+      {
+            std::lock_guard<std::mutex> lock(internal::executor_mutex());
+            auto& slot = internal::executor_slot();
+            if (!slot)
+                  slot = std::make_shared<work_stealing_pool>();
+            return slot;
+      }
+
+      /*!   \brief  Заменяет исполнитель, например на пул с другим числом потоков:
+                    ~~~{.cpp}
+                    set_executor(std::make_shared<work_stealing_pool>(8));
+                    ~~~
+                    Уже идущие параллельные вызовы доработают на прежнем исполнителе.
+      */
+      inline void set_executor(std::shared_ptr<executor> e)
+      {
+            std::lock_guard<std::mutex> lock(internal::executor_mutex());
+            internal::executor_slot() = std::move(e);
+      }
+
+      /*!   \brief  Параллельный цикл на текущем исполнителе: body(lo, hi) для диапазонов, покрывающих [first, last)
+      */
+      template <typename Body>
+      void parallel_for(std::size_t first, std::size_t last, Body&& body, std::size_t grain = 0)
+      {
+            current_executor()->parallel_for(first, last, grain, executor::body_t(std::forward<Body>(body)));
+      }
+}
@@ -0,0 +1,458 @@
+﻿#pragma once
+
+#if defined(__linux__)
+#define RORO_LIB_HAS_EPOLL 1
+#endif
+
+#if defined(RORO_LIB_HAS_EPOLL)
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "matrix.h"
+#include "matrix_query.h"
+#include "matrix_posix.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            inline void set_nodelay(int fd) noexcept
+            {
+                  int on = 1;
+                  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+
+            inline sockaddr_un unix_address(const std::string& path) noexcept
+            {
+                  sockaddr_un address {};
+                  address.sun_family = AF_UNIX;
+                  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+                  return address;
+            }
+
+            /*!   \brief  Освобождает путь для Unix-сокета сервера.
+
+                          Удаляется только сокет, к которому никто не принимает соединения (остался от
+                          завершившегося сервера). Существующий файл другого типа и сокет работающего сервера
+                          не трогаются: конструктор сервера получит исключение.
+            */
+            inline void remove_stale_socket(const std::string& path)
+            {
+                  struct stat st;
+                  if (::lstat(path.c_str(), &st) != 0)
+                  {
+                        if (errno == ENOENT)
+                              return;
+                        throw_errno("stat " + path);
+                  }
+                  if (!S_ISSOCK(st.st_mode))
+                        throw std::system_error(std::make_error_code(std::errc::file_exists), "not a socket: " + path);
+
+                  unique_fd probe(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+                  if (probe.get() < 0)
+                        throw_errno("socket");
+                  sockaddr_un a = unix_address(path);
+                  if (::connect(probe.get(), reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0)
+                        throw std::system_error(std::make_error_code(std::errc::address_in_use), "server is already listening on " + path);
+                  if (errno != ECONNREFUSED)
+                        throw_errno("connect " + path);
+                  if (::unlink(path.c_str()) != 0 && errno != ENOENT)
+                        throw_errno("unlink " + path);
+            }
+
+            inline sockaddr_in loopback_address(std::uint16_t port) noexcept
+            {
+                  sockaddr_in address {};
+                  address.sin_family = AF_INET;
+                  address.sin_port = htons(port);
+                  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                  return address;
+            }
+      }
+
+      namespace query
+      {
+            /*!   \brief  Адрес сервера: "unix:/path/to/socket" или "tcp:port" (только 127.0.0.1).<br>
+                          tcp:0 - свободный порт, который выберет ОС.
+            */
+            struct endpoint
+            {
+                  bool unix_socket = false;
+                  std::string path;
+                  std::uint16_t port = 0;
+
+                  static endpoint parse(const std::string& address)
+                  {
+                        endpoint e;
+                        if (address.compare(0, 5, "unix:") == 0 && address.size() > 5)
+                        {
+                              e.unix_socket = true;
+                              e.path = address.substr(5);
+                              if (e.path.size() >= sizeof(sockaddr_un::sun_path))
+                                    throw std::invalid_argument("unix socket path is too long: " + e.path);
+                              return e;
+                        }
+                        if (address.compare(0, 4, "tcp:") == 0 && address.size() > 4)
+                        {
+                              unsigned long port = std::stoul(address.substr(4));
+                              if (port > 65535)
+                                    throw std::invalid_argument("bad tcp port: " + address);
+                              e.port = static_cast<std::uint16_t>(port);
+                              return e;
+                        }
+                        throw std::invalid_argument("address should be unix:/path or tcp:port: " + address);
+                  }
+            };
+
+            //! Блокирующее соединение клиента с сервером
+            class client
+            {
+              public:
+                  explicit client(const std::string& address)
+                  {
+                        endpoint e = endpoint::parse(address);
+                        fd = internal::unique_fd(::socket(e.unix_socket ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+                        if (fd.get() < 0)
+                              internal::throw_errno("socket");
+
+                        int rc;
+                        if (e.unix_socket)
+                        {
+                              sockaddr_un a = internal::unix_address(e.path);
+                              rc = ::connect(fd.get(), reinterpret_cast<sockaddr*>(&a), sizeof(a));
+                        }
+                        else
+                        {
+                              sockaddr_in a = internal::loopback_address(e.port);
+                              rc = ::connect(fd.get(), reinterpret_cast<sockaddr*>(&a), sizeof(a));
+                              internal::set_nodelay(fd.get());
+                        }
+                        if (rc != 0)
+                              internal::throw_errno("connect " + address);
+                  }
+
+                  void send_all(const char* data, std::size_t size)
+                  {
+                        while (size)
+                        {
+                              ssize_t put = ::send(fd.get(), data, size, MSG_NOSIGNAL);
+                              if (put < 0)
+                              {
+                                    if (errno == EINTR)
+                                          continue;
+                                    internal::throw_errno("send");
+                              }
+                              data += put;
+                              size -= static_cast<std::size_t>(put);
+                        }
+                  }
+
+                  void receive_exact(char* data, std::size_t size)
+                  {
+                        while (size)
+                        {
+                              ssize_t got = ::recv(fd.get(), data, size, 0);
+                              if (got == 0)
+                                    throw std::runtime_error("server closed the connection");
+                              if (got < 0)
+                              {
+                                    if (errno == EINTR)
+                                          continue;
+                                    internal::throw_errno("recv");
+                              }
+                              data += got;
+                              size -= static_cast<std::size_t>(got);
+                        }
+                  }
+
+                  //! Половинное закрытие: сервер дочитает команды, ответит и закроет соединение
+                  void finish_sending()
+                  {
+                        ::shutdown(fd.get(), SHUT_WR);
+                  }
+
+              private:
+                  internal::unique_fd fd;
+            };
+
+            /*!   \brief  Сервер матрицы на epoll: двоичный протокол из matrix_query.h по Unix-сокету или TCP на 127.0.0.1.
+
+                          Один поток обслуживает все соединения, поэтому матрица не требует блокировок. Все
+                          команды, пришедшие в соединение за одно чтение, разбираются прямо из буфера чтения
+                          в один пакет и выполняются одним вызовом executor::run: подряд идущие GET и SET
+                          идут через get_batch/set_batch. Клиент может слать команды, не дожидаясь ответов
+                          (конвейер): ответы копятся в буфере соединения и уходят, как только сокет готов. Если
+                          клиент не читает ответы и их набирается больше max_pending_output байтов, сервер
+                          перестает читать это соединение, пока буфер не уйдет. Отправленное начало буфера
+                          отрезается, как только его набирается read_chunk байтов, так что буфер не растет
+                          при непрерывном конвейере.
+
+                          run() работает до вызова stop(), который можно делать из любого потока.
+            */
+            template <typename Matrix>
+            class server
+            {
+                  static constexpr std::size_t Dimension = std::tuple_size<typename Matrix::coordinates_t>::value;
+
+              public:
+                  static constexpr std::size_t max_pending_output = 1 << 20;
+                  static constexpr std::size_t read_chunk = 64 * 1024;
+
+                  server(Matrix& target, const std::string& address) : exec(target, wire_format::binary), where(endpoint::parse(address))
+                  {
+                        listener = internal::unique_fd(::socket(where.unix_socket ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+                        if (listener.get() < 0)
+                              internal::throw_errno("socket");
+
+                        if (where.unix_socket)
+                        {
+                              internal::remove_stale_socket(where.path);
+                              sockaddr_un a = internal::unix_address(where.path);
+                              if (::bind(listener.get(), reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0)
+                                    internal::throw_errno("bind " + where.path);
+                              bound_path = where.path;
+                        }
+                        else
+                        {
+                              int on = 1;
+                              ::setsockopt(listener.get(), SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                              sockaddr_in a = internal::loopback_address(where.port);
+                              if (::bind(listener.get(), reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0)
+                                    internal::throw_errno("bind " + address);
+                              socklen_t length = sizeof(a);
+                              if (::getsockname(listener.get(), reinterpret_cast<sockaddr*>(&a), &length) != 0)
+                                    internal::throw_errno("getsockname");
+                              where.port = ntohs(a.sin_port);
+                        }
+                        if (::listen(listener.get(), SOMAXCONN) != 0)
+                              internal::throw_errno("listen");
+
+                        poller = internal::unique_fd(::epoll_create1(EPOLL_CLOEXEC));
+                        if (poller.get() < 0)
+                              internal::throw_errno("epoll_create1");
+                        wake = internal::unique_fd(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+                        if (wake.get() < 0)
+                              internal::throw_errno("eventfd");
+
+                        watch(listener.get(), EPOLLIN, EPOLL_CTL_ADD);
+                        watch(wake.get(), EPOLLIN, EPOLL_CTL_ADD);
+                  }
+
+                  server(const server&) = delete;
+                  server& operator=(const server&) = delete;
+
+                  ~server()
+                  {
+                        if (!bound_path.empty())
+                              ::unlink(bound_path.c_str());
+                  }
+
+                  //! Адрес, по которому сервер принимает соединения (для tcp:0 - с выбранным портом)
+                  std::string address() const
+                  {
+                        return where.unix_socket ? "unix:" + where.path : "tcp:" + std::to_string(where.port);
+                  }
+
+                  void stop() noexcept
+                  {
+                        std::uint64_t one = 1;
+                        ssize_t rc = ::write(wake.get(), &one, sizeof(one));
+                        (void)rc;
+                  }
+
+                  void run()
+                  {
+                        std::vector<char> chunk(read_chunk);
+                        epoll_event events[64];
+
+                        for (;;)
+                        {
+                              int ready = ::epoll_wait(poller.get(), events, 64, -1);
+                              if (ready < 0)
+                              {
+                                    if (errno == EINTR)
+                                          continue;
+                                    internal::throw_errno("epoll_wait");
+                              }
+
+                              for (int k = 0; k < ready; ++k)
+                              {
+                                    const int fd = events[k].data.fd;
+                                    if (fd == wake.get())
+                                          return;
+                                    if (fd == listener.get())
+                                          accept_all();
+                                    else
+                                          serve(fd, events[k].events, chunk);
+                              }
+                        }
+                  }
+
+              private:
+                  struct connection
+                  {
+                        explicit connection(int fd) : socket(fd), commands(wire_format::binary) {}
+
+                        internal::unique_fd socket;
+                        parser<Dimension> commands;
+                        batch<Dimension> pending;
+                        std::string output;
+                        std::size_t written = 0;
+                        bool peer_closed = false;
+                        std::uint32_t interest = 0;
+                  };
+
+                  executor<Matrix> exec;
+                  endpoint where;
+                  std::string bound_path;
+                  internal::unique_fd listener;
+                  internal::unique_fd poller;
+                  internal::unique_fd wake;
+                  std::unordered_map<int, std::unique_ptr<connection>> connections;
+
+                  void watch(int fd, std::uint32_t events, int op)
+                  {
+                        epoll_event ev {};
+                        ev.events = events;
+                        ev.data.fd = fd;
+                        if (::epoll_ctl(poller.get(), op, fd, &ev) != 0)
+                              internal::throw_errno("epoll_ctl");
+                  }
+
+                  void accept_all()
+                  {
+                        for (;;)
+                        {
+                              int fd = ::accept4(listener.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                              if (fd < 0)
+                              {
+                                    if (errno == EINTR)
+                                          continue;
+                                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+                                          return;
+                                    internal::throw_errno("accept4");
+                              }
+                              if (!where.unix_socket)
+                                    internal::set_nodelay(fd);
+
+                              auto c = std::make_unique<connection>(fd);
+                              c->interest = EPOLLIN;
+                              watch(fd, c->interest, EPOLL_CTL_ADD);
+                              connections.emplace(fd, std::move(c));
+                        }
+                  }
+
+                  void serve(int fd, std::uint32_t events, std::vector<char>& chunk)
+                  {
+                        auto it = connections.find(fd);
+                        if (it == connections.end())
+                              return;
+                        connection& c = *it->second;
+
+                        if (events & EPOLLIN)
+                              read_commands(c, chunk);
+                        if (!flush(c) || (c.peer_closed && c.written == c.output.size()) || ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)))
+                        {
+                              drop(c);
+                              return;
+                        }
+
+                        // читаем, пока ответы не скопились; ждем готовности к записи, пока они есть
+                        std::uint32_t interest = 0;
+                        if (!c.peer_closed && c.output.size() - c.written < max_pending_output)
+                              interest |= EPOLLIN;
+                        if (c.written != c.output.size())
+                              interest |= EPOLLOUT;
+                        if (interest != c.interest)
+                        {
+                              c.interest = interest;
+                              watch(c.socket.get(), interest, EPOLL_CTL_MOD);
+                        }
+                  }
+
+                  void read_commands(connection& c, std::vector<char>& chunk)
+                  {
+                        while (c.output.size() - c.written < max_pending_output)
+                        {
+                              ssize_t got = ::read(c.socket.get(), chunk.data(), chunk.size());
+                              if (got < 0)
+                              {
+                                    if (errno == EINTR)
+                                          continue;
+                                    if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                          c.peer_closed = true;
+                                    return;
+                              }
+
+                              c.pending.commands.clear();
+                              if (got == 0)
+                              {
+                                    c.commands.finish(c.pending);
+                                    c.peer_closed = true;
+                              }
+                              else
+                                    c.commands.feed(chunk.data(), static_cast<std::size_t>(got), c.pending);
+
+                              exec.run(c.pending, c.output);
+                              if (got == 0 || static_cast<std::size_t>(got) < chunk.size())
+                                    return;
+                        }
+                  }
+
+                  //! false - соединение сломано
+                  bool flush(connection& c)
+                  {
+                        while (c.written != c.output.size())
+                        {
+                              ssize_t put = ::send(c.socket.get(), c.output.data() + c.written, c.output.size() - c.written, MSG_NOSIGNAL);
+                              if (put < 0)
+                              {
+                                    if (errno == EINTR)
+                                          continue;
+                                    if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                          return false;
+
+                                    // сокет полон: отправленное начало буфера больше не нужно
+                                    if (c.written >= read_chunk)
+                                    {
+                                          c.output.erase(0, c.written);
+                                          c.written = 0;
+                                    }
+                                    return true;
+                              }
+                              c.written += static_cast<std::size_t>(put);
+                        }
+                        c.output.clear();
+                        c.written = 0;
+                        return true;
+                  }
+
+                  void drop(connection& c)
+                  {
+                        ::epoll_ctl(poller.get(), EPOLL_CTL_DEL, c.socket.get(), nullptr);
+                        connections.erase(c.socket.get());
+                  }
+            };
+      }
+}
+
+#endif
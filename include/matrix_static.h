@@ -0,0 +1,425 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cassert>
+#include <iterator>
+#include <utility>
+
+#include "matrix.h"
+#include "matrix_bits.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            /*!   \brief  Хранилище матрицы с размерами, известными на этапе компиляции.
+
+                          Ячейка адресуется линейным индексом (построчно), поэтому поиск - это арифметика над
+                          координатами без хеширования. В отладочной сборке координаты проверяются на выход за
+                          границы через assert.
+
+                          Пока доля занятых ячеек не больше DensePercent процентов, значения хранятся компактно:
+                          битовая карта занятости и по одному массиву значений на блок из block_bits ячеек.
+                          Позиция значения в блоке - это ранг бита (popcount не более block_words слов), вставка
+                          сдвигает значения только внутри своего блока. При превышении порога хранилище переходит на
+                          плотный массив из всех ячеек, а когда доля падает вдвое ниже порога - возвращается обратно.
+                          Битовая карта ведется в обоих представлениях и используется для итерации.
+
+                   \tparam  DensePercent -порог перехода на плотный массив, в процентах занятых ячеек
+                   \tparam  Extents      -размер матрицы по каждому измерению
+            */
+            template <typename T, T default_value, std::size_t Dimension, std::size_t DensePercent, std::size_t... Extents>
+            class static_storage
+            {
+                  static_assert(sizeof...(Extents) == Dimension, "Number of static extents should be equal to the matrix dimension");
+                  static_assert(((Extents != 0) && ...), "Static extents shoudn't be zero");
+                  static_assert(DensePercent <= 100, "DensePercent is a percentage");
+
+              public:
+                  using key_t = key<Dimension>;
+                  using size_type = std::size_t;
+                  using coordinates_t = std::array<std::size_t, Dimension>;
+
+                  static constexpr coordinates_t extents = { Extents... };
+                  static constexpr std::size_t volume = (Extents * ...);
+                  static constexpr std::size_t block_words = 8;
+                  static constexpr std::size_t block_bits = block_words * 64;
+                  static constexpr std::size_t word_count = (volume + 63) / 64;
+                  static constexpr std::size_t block_count = (volume + block_bits - 1) / block_bits;
+
+                  class const_iterator;
+                  using iterator = const_iterator;
+
+                  static std::size_t linear_index(const coordinates_t& c) noexcept
+                  {
+                        std::size_t index = 0;
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                        {
+                              assert(c[d] < extents[d] && "matrix coordinate is out of static extents");
+                              index = index * extents[d] + c[d];
+                        }
+                        return index;
+                  }
+
+                  static coordinates_t coordinates_of(std::size_t index) noexcept
+                  {
+                        coordinates_t c;
+                        for (std::size_t d = Dimension; d-- > 0;)
+                        {
+                              c[d] = index % extents[d];
+                              index /= extents[d];
+                        }
+                        return c;
+                  }
+
+                  bool is_dense() const noexcept
+                  {
+                        return !dense.empty();
+                  }
+
+                  T get(const key_t& key) const
+                  {
+                        const T* slot = find_index(linear_index(key.coordinates));
+                        return slot ? *slot : default_value;
+                  }
+
+                  T* find(const key_t& key)
+                  {
+                        return const_cast<T*>(find_index(linear_index(key.coordinates)));
+                  }
+
+                  const T* find(const key_t& key) const
+                  {
+                        return find_index(linear_index(key.coordinates));
+                  }
+
+                  void set(const key_t& key, T value)
+                  {
+                        std::size_t index = linear_index(key.coordinates);
+                        if (T* slot = const_cast<T*>(find_index(index)))
+                        {
+                              if (value != default_value)
+                                    *slot = value;
+                              else
+                                    erase_index(index);
+                        }
+                        else if (value != default_value)
+                        {
+                              insert_index(index, value);
+                        }
+                  }
+
+                  void insert(const key_t& key, T value)
+                  {
+                        insert_index(linear_index(key.coordinates), value);
+                  }
+
+                  void erase(const key_t& key)
+                  {
+                        std::size_t index = linear_index(key.coordinates);
+                        if (find_index(index))
+                              erase_index(index);
+                  }
+
+                  //! Удаляет за один проход по битовой карте ячейки, для которых pred(coordinates, value) == true
+                  template <typename Pred>
+                  size_type erase_if(Pred pred)
+                  {
+                        size_type removed = 0;
+                        for (std::size_t index = next_present(0); index < volume; index = next_present(index + 1))
+                        {
+                              if (pred(coordinates_of(index), *find_index(index)))
+                              {
+                                    erase_index(index);
+                                    ++removed;
+                              }
+                        }
+                        return removed;
+                  }
+
+                  //! Отдает память блоков; пустое хранилище освобождает и битовую карту
+                  void shrink_to_fit()
+                  {
+                        if (count == 0)
+                        {
+                              clear();
+                              return;
+                        }
+                        for (auto& block : blocks)
+                              block.shrink_to_fit();
+                  }
+
+                  size_type size() const noexcept
+                  {
+                        return count;
+                  }
+
+                  void clear() noexcept
+                  {
+                        bits = std::vector<std::uint64_t>();
+                        blocks = std::vector<std::vector<T>>();
+                        dense = std::vector<T>();
+                        count = 0;
+                  }
+
+                  const_iterator begin() const noexcept
+                  {
+                        return const_iterator(this, next_present(0));
+                  }
+
+                  const_iterator end() const noexcept
+                  {
+                        return const_iterator(this, volume);
+                  }
+
+                  const_iterator cbegin() const noexcept
+                  {
+                        return begin();
+                  }
+
+                  const_iterator cend() const noexcept
+                  {
+                        return end();
+                  }
+
+                  size_type capacity() const noexcept
+                  {
+                        return volume;
+                  }
+
+                  size_type probe_length(const key_t&) const noexcept
+                  {
+                        return 1;
+                  }
+
+                  storage_stats stats() const
+                  {
+                        storage_stats st;
+                        st.size = count;
+                        st.bucket_count = volume;
+                        st.load_factor = static_cast<double>(count) / volume;
+                        st.max_load_factor = 1.0;
+                        st.longest_chain = count ? 1 : 0;
+                        st.occupancy_histogram.assign(histogram_bins, 0);
+                        st.occupancy_histogram[0] = volume - count;
+                        st.occupancy_histogram[1] = count;
+
+                        st.bucket_bytes = bits.capacity() * sizeof(std::uint64_t);
+                        if (is_dense())
+                        {
+                              st.value_bytes = dense.capacity() * sizeof(T);
+                              st.fixed_bytes = st.bucket_bytes + st.value_bytes;
+                        }
+                        else
+                        {
+                              st.value_bytes = count * sizeof(T);
+                              st.overhead_bytes = blocks.capacity() * sizeof(std::vector<T>);
+                              for (const auto& block : blocks)
+                              {
+                                    if (block.capacity() != 0)
+                                          st.overhead_bytes += allocated_block_size(block.capacity() * sizeof(T)) - block.size() * sizeof(T);
+                              }
+                              st.bytes_per_entry = sizeof(T);
+                              st.fixed_bytes = word_count * sizeof(std::uint64_t) + block_count * sizeof(std::vector<T>);
+                        }
+
+                        return st;
+                  }
+
+                  //! Часть part из parts: равный диапазон линейных индексов
+                  std::pair<const_iterator, const_iterator> partition(std::size_t part, std::size_t parts) const noexcept
+                  {
+                        return { const_iterator(this, next_present(part * volume / parts)),
+                                 const_iterator(this, next_present((part + 1) * volume / parts)) };
+                  }
+
+                  /*!   \brief  Итератор по занятым ячейкам в порядке возрастания линейного индекса
+                  */
+                  class const_iterator
+                  {
+                    public:
+                        using value_type = std::pair<coordinates_holder<Dimension>, T>;
+                        using iterator_category = std::forward_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const value_type*;
+                        using reference = const value_type&;
+
+                        const_iterator() noexcept = default;
+                        const_iterator(const static_storage* owner, std::size_t index) noexcept : owner(owner),
+                                                                                               index(index)
+                        {
+                        }
+
+                        const value_type* operator->()
+                        {
+                              current.first.coordinates = coordinates_of(index);
+                              current.second = *owner->find_index(index);
+                              return &current;
+                        }
+
+                        const value_type& operator*()
+                        {
+                              return *operator->();
+                        }
+
+                        const_iterator& operator++() noexcept
+                        {
+                              index = owner->next_present(index + 1);
+                              return *this;
+                        }
+
+                        const_iterator operator++(int) noexcept
+                        {
+                              const_iterator old_iter = *this;
+                              ++*this;
+                              return old_iter;
+                        }
+
+                        bool operator==(const const_iterator& arg) const noexcept
+                        {
+                              return index == arg.index;
+                        }
+
+                        bool operator!=(const const_iterator& arg) const noexcept
+                        {
+                              return index != arg.index;
+                        }
+
+                    private:
+                        const static_storage* owner = nullptr;
+                        std::size_t index = volume;
+                        value_type current;
+                  };
+
+              private:
+                  bool test(std::size_t index) const noexcept
+                  {
+                        return !bits.empty() && (bits[index >> 6] >> (index & 63) & 1);
+                  }
+
+                  //! Ранг бита index внутри его блока: число занятых ячеек блока перед ним
+                  std::size_t rank_in_block(std::size_t index) const noexcept
+                  {
+                        std::size_t word = index >> 6;
+                        std::size_t first = word - word % block_words;
+                        std::size_t rank = 0;
+                        for (std::size_t w = first; w < word; ++w)
+                              rank += popcount64(bits[w]);
+                        return rank + popcount64(bits[word] & ((std::uint64_t(1) << (index & 63)) - 1));
+                  }
+
+                  const T* find_index(std::size_t index) const noexcept
+                  {
+                        if (is_dense())
+                              return test(index) ? &dense[index] : nullptr;
+                        if (!test(index))
+                              return nullptr;
+                        return &blocks[index / block_bits][rank_in_block(index)];
+                  }
+
+                  std::size_t next_present(std::size_t index) const noexcept
+                  {
+                        if (bits.empty())
+                              return volume;
+
+                        std::size_t word = index >> 6;
+                        if (word >= word_count)
+                              return volume;
+
+                        std::uint64_t current = bits[word] & (~std::uint64_t(0) << (index & 63));
+                        while (current == 0)
+                        {
+                              if (++word == word_count)
+                                    return volume;
+                              current = bits[word];
+                        }
+                        return word * 64 + countr_zero64(current);
+                  }
+
+                  void insert_index(std::size_t index, T value)
+                  {
+                        if (bits.empty())
+                        {
+                              bits.assign(word_count, 0);
+                              blocks.resize(block_count);
+                        }
+
+                        if (is_dense())
+                        {
+                              dense[index] = value;
+                        }
+                        else
+                        {
+                              auto& block = blocks[index / block_bits];
+                              block.insert(block.begin() + rank_in_block(index), value);
+                        }
+
+                        bits[index >> 6] |= std::uint64_t(1) << (index & 63);
+                        ++count;
+
+                        if (!is_dense() && count * 100 > volume * DensePercent)
+                              to_dense();
+                  }
+
+                  void erase_index(std::size_t index)
+                  {
+                        if (is_dense())
+                        {
+                              dense[index] = default_value;
+                        }
+                        else
+                        {
+                              auto& block = blocks[index / block_bits];
+                              block.erase(block.begin() + rank_in_block(index));
+                        }
+
+                        bits[index >> 6] &= ~(std::uint64_t(1) << (index & 63));
+                        --count;
+
+                        if (is_dense() && count * 200 < volume * DensePercent)
+                              to_compact();
+                  }
+
+                  void to_dense()
+                  {
+                        std::vector<T> values(volume, default_value);
+                        for (std::size_t index = next_present(0); index < volume; index = next_present(index + 1))
+                              values[index] = *find_index(index);
+                        dense.swap(values);
+                        blocks = std::vector<std::vector<T>>();
+                  }
+
+                  void to_compact()
+                  {
+                        blocks.assign(block_count, std::vector<T>());
+                        for (std::size_t index = next_present(0); index < volume; index = next_present(index + 1))
+                              blocks[index / block_bits].push_back(dense[index]);
+                        dense = std::vector<T>();
+                  }
+
+                  std::vector<std::uint64_t> bits;
+                  std::vector<std::vector<T>> blocks;
+                  std::vector<T> dense;
+                  std::size_t count = 0;
+            };
+      }
+
+      /*!   \brief  Политика матрицы с размерами, известными на этапе компиляции.
+
+                    Пример: матрица 4096x4096, которая переходит на плотный массив при 25% занятых ячеек
+                    ~~~{.cpp}
+                    matrix<int, 0, 2, static_extents<4096, 4096>> m;
+                    ~~~
+      */
+      template <std::size_t DensePercent, std::size_t... Extents>
+      struct static_extents_with_threshold : default_policy
+      {
+            template <typename T, T default_value, std::size_t Dimension>
+            using storage = internal::static_storage<T, default_value, Dimension, DensePercent, Extents...>;
+      };
+
+      template <std::size_t... Extents>
+      using static_extents = static_extents_with_threshold<25, Extents...>;
+}
@@ -0,0 +1,360 @@
+﻿#pragma once
+
+#include <array>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "matrix.h"
+#include "matrix_workload.h"
+#include "matrix_parallel.h"
+
+namespace roro_lib
+{
+      namespace stencil
+      {
+            /*!   \brief  Окрестность фон Неймана: 2N соседей, отличающихся на единицу по одной координате
+            */
+            template <std::size_t Dimension>
+            struct von_neumann
+            {
+                  static constexpr std::size_t dimension = Dimension;
+                  static constexpr std::size_t radius = 1;
+                  static constexpr std::size_t size = 2 * Dimension;
+
+                  static constexpr std::array<std::array<std::ptrdiff_t, Dimension>, size> offsets()
+                  {
+                        std::array<std::array<std::ptrdiff_t, Dimension>, size> result {};
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                        {
+                              result[2 * d][d] = -1;
+                              result[2 * d + 1][d] = 1;
+                        }
+                        return result;
+                  }
+            };
+
+            /*!   \brief  Окрестность Мура: 3^N - 1 соседей, отличающихся не больше чем на единицу по каждой координате
+            */
+            template <std::size_t Dimension>
+            struct moore
+            {
+                  static constexpr std::size_t dimension = Dimension;
+                  static constexpr std::size_t radius = 1;
+
+                  static constexpr std::size_t cube() noexcept
+                  {
+                        std::size_t n = 1;
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                              n *= 3;
+                        return n;
+                  }
+
+                  static constexpr std::size_t size = cube() - 1;
+
+                  static constexpr std::array<std::array<std::ptrdiff_t, Dimension>, size> offsets()
+                  {
+                        std::array<std::array<std::ptrdiff_t, Dimension>, size> result {};
+                        std::size_t n = 0;
+                        for (std::size_t code = 0; code < cube(); ++code)
+                        {
+                              std::array<std::ptrdiff_t, Dimension> o {};
+                              bool center = true;
+                              for (std::size_t d = Dimension, rest = code; d-- > 0; rest /= 3)
+                              {
+                                    o[d] = static_cast<std::ptrdiff_t>(rest % 3) - 1;
+                                    center = center && o[d] == 0;
+                              }
+                              if (!center)
+                                    result[n++] = o;
+                        }
+                        return result;
+                  }
+            };
+      }
+
+      //! Параметры шага трафаретного вычисления
+      struct stencil_options
+      {
+            std::size_t threads = 0; //!< число потоков, 0 - все потоки текущего исполнителя (см. current_executor())
+            bool expand = true;      //!< вычислять и пустые ячейки, соседние с занятыми (рождение клеток, диффузия)
+      };
+
+      namespace internal
+      {
+            /*!   \brief  Ядро трафаретного вычисления над занятыми ячейками, отсортированными лексикографически.
+
+                          Сдвиг на постоянный вектор сохраняет лексикографический порядок, поэтому для каждого
+                          смещения окрестности достаточно одного курсора, который только движется вперед по
+                          отсортированному массиву: поиск всех соседей всех ячеек - это слияние N+1 потоков без
+                          хеширования, с последовательным доступом к памяти.
+
+                          Координаты в ядре смещены на radius, чтобы сдвиг на отрицательное смещение не уходил
+                          ниже нуля. Ячейки, у которых после сдвига координата отрицательна, лежат вне матрицы и не
+                          вычисляются. Координаты должны быть меньше SIZE_MAX - radius.
+            */
+            template <typename T, T default_value, typename Neighborhood>
+            class stencil_kernel
+            {
+              public:
+                  static constexpr std::size_t Dimension = Neighborhood::dimension;
+                  static constexpr std::size_t radius = Neighborhood::radius;
+                  static constexpr std::size_t minimal_partition = 1024;
+
+                  using coordinates_t = std::array<std::size_t, Dimension>;
+                  using cell_t = std::pair<coordinates_t, T>;
+                  using cells_t = std::vector<cell_t>;
+                  using neighbors_t = std::array<T, Neighborhood::size>;
+
+                  //! Занятые ячейки хранилища матрицы со смещенными координатами, в лексикографическом порядке
+                  template <typename Storage>
+                  static cells_t gather(const Storage& storage)
+                  {
+                        cells_t cells;
+                        cells.reserve(storage.size());
+                        for (auto it = storage.cbegin(); it != storage.cend(); ++it)
+                        {
+                              coordinates_t c = it->first.coordinates;
+                              for (auto& x : c)
+                                    x += radius;
+                              cells.emplace_back(c, it->second);
+                        }
+                        std::sort(cells.begin(), cells.end(), [](const cell_t& a, const cell_t& b) { return a.first < b.first; });
+                        return cells;
+                  }
+
+                  //! Записывает ячейки в матрицу, возвращая координатам исходное смещение
+                  template <typename Matrix>
+                  static void materialize(const cells_t& cells, Matrix& m)
+                  {
+                        m.clear();
+                        for (const auto& cell : cells)
+                        {
+                              coordinates_t c = cell.first;
+                              for (auto& x : c)
+                                    x -= radius;
+                              workload::at(m, c) = cell.second;
+                        }
+                  }
+
+                  /*!   \brief  Вычисляет следующее поколение: в next попадают непустые результаты f в лексикографическом порядке.<br>
+                                Ячейки делятся на диапазоны координат, каждый диапазон обрабатывается своим потоком.
+                  */
+                  template <typename F>
+                  static void step(const cells_t& cells, cells_t& next, F& f, const stencil_options& options)
+                  {
+                        next.clear();
+                        if (cells.empty())
+                              return;
+
+                        std::size_t parts = part_count(options.threads, cells.size(), minimal_partition);
+                        std::vector<cells_t> results(parts);
+
+                        run_parts(parts, [&](std::size_t part) {
+                              coordinates_t lo {};
+                              if (part != 0)
+                                    lo = cells[part * cells.size() / parts].first;
+                              const coordinates_t* hi = part + 1 < parts ? &cells[(part + 1) * cells.size() / parts].first : nullptr;
+
+                              evaluate(cells, lo, hi, f, options.expand, results[part]);
+                        });
+
+                        std::size_t total = 0;
+                        for (const auto& r : results)
+                              total += r.size();
+                        next.reserve(total);
+                        for (auto& r : results)
+                              next.insert(next.end(), r.begin(), r.end());
+                  }
+
+              private:
+                  static constexpr auto offsets = Neighborhood::offsets();
+
+                  static coordinates_t shift(coordinates_t c, const std::array<std::ptrdiff_t, Dimension>& o, bool back = false) noexcept
+                  {
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                              c[d] += back ? -o[d] : o[d];
+                        return c;
+                  }
+
+                  static std::size_t lower_bound(const cells_t& cells, const coordinates_t& c)
+                  {
+                        auto it = std::lower_bound(cells.begin(), cells.end(), c, [](const cell_t& a, const coordinates_t& v) { return a.first < v; });
+                        return static_cast<std::size_t>(it - cells.begin());
+                  }
+
+                  //! Курсор по ячейкам, сдвинутым на смещение: значение соседа для неубывающей последовательности центров
+                  struct neighbor_cursor
+                  {
+                        std::size_t position;
+
+                        T value(const cells_t& cells, const coordinates_t& target) noexcept
+                        {
+                              while (position < cells.size() && cells[position].first < target)
+                                    ++position;
+                              return position < cells.size() && cells[position].first == target ? cells[position].second : default_value;
+                        }
+                  };
+
+                  template <typename F>
+                  static void evaluate(const cells_t& cells, const coordinates_t& lo, const coordinates_t* hi, F& f, bool expand, cells_t& out)
+                  {
+                        // у первого диапазона нижней границы нет; границы остальных - занятые ячейки, их сдвиг не уходит ниже нуля
+                        bool from_start = lo == coordinates_t {};
+
+                        std::array<neighbor_cursor, Neighborhood::size> cursors;
+                        for (std::size_t k = 0; k < Neighborhood::size; ++k)
+                              cursors[k].position = from_start ? 0 : lower_bound(cells, shift(lo, offsets[k]));
+                        neighbor_cursor self { from_start ? 0 : lower_bound(cells, lo) };
+
+                        neighbors_t neighbors;
+                        auto visit = [&](const coordinates_t& x) {
+                              for (std::size_t d = 0; d < Dimension; ++d)
+                              {
+                                    if (x[d] < radius)
+                                          return;
+                              }
+
+                              for (std::size_t k = 0; k < Neighborhood::size; ++k)
+                                    neighbors[k] = cursors[k].value(cells, shift(x, offsets[k]));
+
+                              T result = f(self.value(cells, x), static_cast<const neighbors_t&>(neighbors));
+                              if (result != default_value)
+                                    out.emplace_back(x, result);
+                        };
+
+                        auto below_hi = [&](const coordinates_t& x) { return !hi || x < *hi; };
+
+                        if (!expand)
+                        {
+                              for (std::size_t i = self.position; i < cells.size() && below_hi(cells[i].first); ++i)
+                                    visit(cells[i].first);
+                              return;
+                        }
+
+                        // кандидаты - ячейки c - o для всех занятых c и смещений o, включая нулевое; поток k дает их по возрастанию
+                        struct head
+                        {
+                              coordinates_t candidate;
+                              std::size_t stream;
+                              std::size_t position;
+
+                              bool operator>(const head& arg) const noexcept
+                              {
+                                    return arg.candidate < candidate;
+                              }
+                        };
+
+                        std::priority_queue<head, std::vector<head>, std::greater<head>> heads;
+                        auto push = [&](std::size_t stream, std::size_t position) {
+                              if (position >= cells.size())
+                                    return;
+                              coordinates_t candidate = stream < Neighborhood::size ? shift(cells[position].first, offsets[stream], true) : cells[position].first;
+                              if (below_hi(candidate))
+                                    heads.push(head { candidate, stream, position });
+                        };
+
+                        for (std::size_t k = 0; k < Neighborhood::size; ++k)
+                              push(k, cursors[k].position);
+                        push(Neighborhood::size, self.position);
+
+                        while (!heads.empty())
+                        {
+                              coordinates_t x = heads.top().candidate;
+                              while (!heads.empty() && heads.top().candidate == x)
+                              {
+                                    head h = heads.top();
+                                    heads.pop();
+                                    push(h.stream, h.position + 1);
+                              }
+                              visit(x);
+                        }
+                  }
+            };
+      }
+
+      /*!   \brief  Двойной буфер для пошаговых трафаретных вычислений (клеточные автоматы, диффузия).
+
+                    Поколения хранятся как отсортированные массивы занятых ячеек: шаг читает текущий и
+                    пишет следующий, затем буферы меняются местами. Матрица собирается из массива только
+                    при обращении к current(), поэтому серия шагов не платит за вставки в хеш-таблицу.
+
+                    Функция шага вызывается для каждой вычисляемой ячейки:
+                    ~~~{.cpp}
+                    T f(T self, const std::array<T, Neighborhood::size>& neighbors);
+                    ~~~
+                    соседи перечислены в порядке Neighborhood::offsets(). Функция вызывается из нескольких
+                    потоков одновременно. Для пустой ячейки без занятых соседей она должна возвращать
+                    значение по умолчанию: такие ячейки не вычисляются.
+
+                    Пример: игра "Жизнь"
+                    ~~~{.cpp}
+                    stencil_grid<matrix<int, 0, 2>, stencil::moore<2>> life(initial);
+                    life.step([](int self, const auto& nb) {
+                          int alive = std::count(nb.begin(), nb.end(), 1);
+                          return alive == 3 || (self && alive == 2);
+                    });
+                    ~~~
+      */
+      template <typename Matrix, typename Neighborhood>
+      class stencil_grid
+      {
+            using traits = internal::matrix_traits<Matrix>;
+            using kernel_t = internal::stencil_kernel<typename traits::value_type, traits::default_value, Neighborhood>;
+
+            static_assert(traits::dimension == Neighborhood::dimension, "Neighborhood dimension should be equal to the matrix dimension");
+
+        public:
+            explicit stencil_grid(const Matrix& initial) : cells(kernel_t::gather(initial.storage()))
+            {
+            }
+
+            template <typename F>
+            void step(F f, const stencil_options& options = stencil_options())
+            {
+                  kernel_t::step(cells, next, f, options);
+                  cells.swap(next);
+                  materialized = false;
+            }
+
+            //! Текущее поколение в виде матрицы
+            const Matrix& current()
+            {
+                  if (!materialized)
+                  {
+                        kernel_t::materialize(cells, front);
+                        materialized = true;
+                  }
+                  return front;
+            }
+
+            //! Число занятых ячеек текущего поколения
+            std::size_t size() const noexcept
+            {
+                  return cells.size();
+            }
+
+        private:
+            typename kernel_t::cells_t cells;
+            typename kernel_t::cells_t next;
+            Matrix front;
+            bool materialized = false;
+      };
+
+      /*!   \brief  Один шаг трафаретного вычисления: dst получает результат f для ячеек src (см. stencil_grid).
+      */
+      template <typename Neighborhood, typename Matrix, typename F>
+      void apply_stencil(const Matrix& src, Matrix& dst, F f, const stencil_options& options = stencil_options())
+      {
+            using traits = internal::matrix_traits<Matrix>;
+            using kernel_t = internal::stencil_kernel<typename traits::value_type, traits::default_value, Neighborhood>;
+
+            static_assert(traits::dimension == Neighborhood::dimension, "Neighborhood dimension should be equal to the matrix dimension");
+
+            typename kernel_t::cells_t next;
+            kernel_t::step(kernel_t::gather(src.storage()), next, f, options);
+            kernel_t::materialize(next, dst);
+      }
+}
@@ -0,0 +1,690 @@
+﻿#pragma once
+
+#include <array>
+#include <vector>
+#include <deque>
+#include <optional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define RORO_LIB_HAS_COROUTINES 1
+#endif
+
+#include "matrix.h"
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            template <typename Range>
+            using range_iterator_t = decltype(std::begin(std::declval<std::remove_reference_t<Range>&>()));
+
+            template <typename Range>
+            using range_value_t = std::decay_t<decltype(*std::declval<range_iterator_t<Range>&>())>;
+
+            //! Диапазон, у которого итератор пропускает элементы, не удовлетворяющие pred
+            template <typename Source, typename Pred>
+            class filter_range
+            {
+              public:
+                  filter_range(Source source, Pred pred) : source(std::forward<Source>(source)), pred(std::move(pred)) {}
+
+                  class iterator
+                  {
+                    public:
+                        using value_type = range_value_t<Source>;
+                        using iterator_category = std::input_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = void;
+                        using reference = decltype(*std::declval<range_iterator_t<Source>&>());
+
+                        iterator(filter_range* owner, range_iterator_t<Source> it, range_iterator_t<Source> last)
+                            : owner(owner), it(std::move(it)), last(std::move(last))
+                        {
+                              settle();
+                        }
+
+                        reference operator*()
+                        {
+                              return *it;
+                        }
+
+                        iterator& operator++()
+                        {
+                              ++it;
+                              settle();
+                              return *this;
+                        }
+
+                        bool operator==(const iterator& arg) const
+                        {
+                              return it == arg.it;
+                        }
+
+                        bool operator!=(const iterator& arg) const
+                        {
+                              return !(it == arg.it);
+                        }
+
+                    private:
+                        void settle()
+                        {
+                              while (it != last && !owner->pred(*it))
+                                    ++it;
+                        }
+
+                        filter_range* owner;
+                        range_iterator_t<Source> it;
+                        range_iterator_t<Source> last;
+                  };
+
+                  iterator begin()
+                  {
+                        return iterator(this, std::begin(source), std::end(source));
+                  }
+
+                  iterator end()
+                  {
+                        return iterator(this, std::end(source), std::end(source));
+                  }
+
+              private:
+                  Source source;
+                  Pred pred;
+            };
+
+            //! Диапазон значений f(x) для элементов x исходного диапазона, f вызывается при разыменовании
+            template <typename Source, typename F>
+            class map_range
+            {
+              public:
+                  map_range(Source source, F f) : source(std::forward<Source>(source)), f(std::move(f)) {}
+
+                  class iterator
+                  {
+                    public:
+                        using reference = decltype(std::declval<F&>()(*std::declval<range_iterator_t<Source>&>()));
+                        using value_type = std::decay_t<reference>;
+                        using iterator_category = std::input_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = void;
+
+                        iterator(map_range* owner, range_iterator_t<Source> it) : owner(owner), it(std::move(it)) {}
+
+                        reference operator*()
+                        {
+                              return owner->f(*it);
+                        }
+
+                        iterator& operator++()
+                        {
+                              ++it;
+                              return *this;
+                        }
+
+                        bool operator==(const iterator& arg) const
+                        {
+                              return it == arg.it;
+                        }
+
+                        bool operator!=(const iterator& arg) const
+                        {
+                              return !(it == arg.it);
+                        }
+
+                    private:
+                        map_range* owner;
+                        range_iterator_t<Source> it;
+                  };
+
+                  iterator begin()
+                  {
+                        return iterator(this, std::begin(source));
+                  }
+
+                  iterator end()
+                  {
+                        return iterator(this, std::end(source));
+                  }
+
+              private:
+                  Source source;
+                  F f;
+            };
+
+            //! Диапазон пачек: std::vector не больше чем из size элементов исходного диапазона
+            template <typename Source>
+            class batch_range
+            {
+              public:
+                  using batch_t = std::vector<range_value_t<Source>>;
+
+                  batch_range(Source source, std::size_t size) : source(std::forward<Source>(source)), size(std::max<std::size_t>(size, 1)) {}
+
+                  class iterator
+                  {
+                    public:
+                        using value_type = batch_t;
+                        using iterator_category = std::input_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const batch_t*;
+                        using reference = const batch_t&;
+
+                        iterator() = default;
+                        iterator(batch_range* owner) : owner(owner), it(std::begin(owner->source))
+                        {
+                              fill();
+                        }
+
+                        const batch_t& operator*() const noexcept
+                        {
+                              return chunk;
+                        }
+
+                        const batch_t* operator->() const noexcept
+                        {
+                              return &chunk;
+                        }
+
+                        iterator& operator++()
+                        {
+                              fill();
+                              return *this;
+                        }
+
+                        //! Однопроходный итератор: равны только исчерпанные итераторы
+                        bool operator==(const iterator& arg) const noexcept
+                        {
+                              return chunk.empty() && arg.chunk.empty();
+                        }
+
+                        bool operator!=(const iterator& arg) const noexcept
+                        {
+                              return !(*this == arg);
+                        }
+
+                    private:
+                        void fill()
+                        {
+                              chunk.clear();
+                              auto last = std::end(owner->source);
+                              for (; chunk.size() < owner->size && *it != last; ++*it)
+                                    chunk.push_back(**it);
+                        }
+
+                        batch_range* owner = nullptr;
+                        std::optional<range_iterator_t<Source>> it;
+                        batch_t chunk;
+                  };
+
+                  iterator begin()
+                  {
+                        return iterator(this);
+                  }
+
+                  iterator end()
+                  {
+                        return iterator();
+                  }
+
+              private:
+                  Source source;
+                  std::size_t size;
+            };
+
+            /*!   \brief  Ограниченная очередь между одним производителем и одним потребителем.<br>
+                          Производитель ждет, пока очередь полна; потребитель - пока она пуста и не закрыта.
+            */
+            template <typename T>
+            class bounded_queue
+            {
+              public:
+                  explicit bounded_queue(std::size_t capacity) : capacity(std::max<std::size_t>(capacity, 1)) {}
+
+                  //! false, если потребитель отказался от остатка потока
+                  bool push(T value)
+                  {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        not_full.wait(lock, [&] { return items.size() < capacity || cancelled; });
+                        if (cancelled)
+                              return false;
+
+                        items.push_back(std::move(value));
+                        if (items.size() == 1)
+                              not_empty.notify_one();
+                        return true;
+                  }
+
+                  //! Пустое значение - поток закончился; исключение производителя пробрасывается здесь
+                  std::optional<T> pop()
+                  {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        not_empty.wait(lock, [&] { return !items.empty() || closed; });
+                        if (items.empty())
+                        {
+                              if (error)
+                                    std::rethrow_exception(std::exchange(error, nullptr));
+                              return std::nullopt;
+                        }
+
+                        std::optional<T> value(std::move(items.front()));
+                        items.pop_front();
+                        if (items.size() + 1 == capacity)
+                              not_full.notify_one();
+                        return value;
+                  }
+
+                  void close(std::exception_ptr e = nullptr)
+                  {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        closed = true;
+                        error = e;
+                        not_empty.notify_one();
+                  }
+
+                  void cancel()
+                  {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        cancelled = true;
+                        not_full.notify_one();
+                  }
+
+              private:
+                  const std::size_t capacity;
+                  std::mutex mutex;
+                  std::condition_variable not_full;
+                  std::condition_variable not_empty;
+                  std::deque<T> items;
+                  bool closed = false;
+                  bool cancelled = false;
+                  std::exception_ptr error;
+            };
+
+            /*!   \brief  Диапазон, исходный диапазон которого обходится в отдельном потоке.
+
+                          Поток запускается вызовом begin() и кладет элементы в ограниченную очередь, так что
+                          верхние стадии конвейера (чтение, разбор) работают одновременно с нижними. Диапазон
+                          однопроходный: повторный begin() бросает std::logic_error. Объект не перемещается
+                          после begin(); при разрушении поток останавливается и присоединяется.
+            */
+            template <typename Source>
+            class async_range
+            {
+              public:
+                  using value_type = range_value_t<Source>;
+
+                  async_range(Source source, std::size_t capacity) : source(std::forward<Source>(source)), capacity(capacity), queue(capacity) {}
+
+                  //! Перемещать можно только до begin(), например при передаче в следующий адаптер
+                  async_range(async_range&& arg) : source(std::forward<Source>(arg.source)), capacity(arg.capacity), queue(arg.capacity) {}
+
+                  ~async_range()
+                  {
+                        if (producer.joinable())
+                        {
+                              queue.cancel();
+                              producer.join();
+                        }
+                  }
+
+                  class iterator
+                  {
+                    public:
+                        using value_type = typename async_range::value_type;
+                        using iterator_category = std::input_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const value_type*;
+                        using reference = const value_type&;
+
+                        iterator() = default;
+                        explicit iterator(async_range* owner) : owner(owner)
+                        {
+                              ++*this;
+                        }
+
+                        const value_type& operator*() const noexcept
+                        {
+                              return *current;
+                        }
+
+                        const value_type* operator->() const noexcept
+                        {
+                              return &*current;
+                        }
+
+                        iterator& operator++()
+                        {
+                              current = owner->queue.pop();
+                              return *this;
+                        }
+
+                        bool operator==(const iterator& arg) const noexcept
+                        {
+                              return !current && !arg.current;
+                        }
+
+                        bool operator!=(const iterator& arg) const noexcept
+                        {
+                              return !(*this == arg);
+                        }
+
+                    private:
+                        async_range* owner = nullptr;
+                        std::optional<value_type> current;
+                  };
+
+                  iterator begin()
+                  {
+                        if (producer.joinable())
+                              throw std::logic_error("async_range is single-pass: begin() was already called");
+
+                        producer = std::thread([this] {
+                              try
+                              {
+                                    for (auto&& value : source)
+                                    {
+                                          if (!queue.push(value))
+                                                break;
+                                    }
+                                    queue.close();
+                              }
+                              catch (...)
+                              {
+                                    queue.close(std::current_exception());
+                              }
+                        });
+                        return iterator(this);
+                  }
+
+                  iterator end()
+                  {
+                        return iterator();
+                  }
+
+              private:
+                  Source source;
+                  const std::size_t capacity;
+                  bounded_queue<value_type> queue;
+                  std::thread producer;
+            };
+
+            template <typename Pred>
+            struct filter_adaptor
+            {
+                  Pred pred;
+            };
+
+            template <typename F>
+            struct map_adaptor
+            {
+                  F f;
+            };
+
+            struct batch_adaptor
+            {
+                  std::size_t size;
+            };
+
+            struct async_adaptor
+            {
+                  std::size_t capacity;
+            };
+
+            // операторы находятся поиском по аргументам (ADL) по типу адаптера
+            template <typename Source, typename Pred>
+            filter_range<Source, Pred> operator|(Source&& source, filter_adaptor<Pred> a)
+            {
+                  return { std::forward<Source>(source), std::move(a.pred) };
+            }
+
+            template <typename Source, typename F>
+            map_range<Source, F> operator|(Source&& source, map_adaptor<F> a)
+            {
+                  return { std::forward<Source>(source), std::move(a.f) };
+            }
+
+            template <typename Source>
+            batch_range<Source> operator|(Source&& source, batch_adaptor a)
+            {
+                  return { std::forward<Source>(source), a.size };
+            }
+
+            template <typename Source>
+            async_range<Source> operator|(Source&& source, async_adaptor a)
+            {
+                  return { std::forward<Source>(source), a.capacity };
+            }
+      }
+
+      /*!   \brief  Адаптеры ленивых конвейеров: source | pipeline::filter(p) | pipeline::map(f) | pipeline::batch(n).
+
+                    Источник - любой диапазон с begin() и end(): m.stream(), stream_range(), stream_row(),
+                    результат другого адаптера или генератор. Элементы проходят стадии по одному, поэтому
+                    память конвейера не зависит от числа ячеек. Источник-lvalue хранится по ссылке,
+                    временный источник перемещается внутрь адаптера. Итераторы однопроходные.
+      */
+      namespace pipeline
+      {
+            //! Пропускает только элементы, для которых pred(x) == true
+            template <typename Pred>
+            internal::filter_adaptor<Pred> filter(Pred pred)
+            {
+                  return { std::move(pred) };
+            }
+
+            //! Заменяет элемент x на f(x)
+            template <typename F>
+            internal::map_adaptor<F> map(F f)
+            {
+                  return { std::move(f) };
+            }
+
+            //! Собирает элементы в std::vector по size штук (последняя пачка может быть короче)
+            inline internal::batch_adaptor batch(std::size_t size)
+            {
+                  return { size };
+            }
+
+            /*!   \brief  Обходит верхнюю часть конвейера в отдельном потоке, передавая элементы через очередь
+                          не длиннее capacity. Исключения верхних стадий пробрасываются при чтении.
+            */
+            inline internal::async_adaptor async(std::size_t capacity = 1024)
+            {
+                  return { capacity };
+            }
+      }
+
+      /*!   \brief  Ленивый поток ячеек матрицы внутри бокса [lo, hi] (границы включаются).<br>
+                    При включенном spatial_index ячейки берутся из Z-индекса, иначе фильтруется m.stream().
+      */
+      template <typename Matrix>
+      auto stream_range(const Matrix& m, const typename Matrix::coordinates_t& lo, const typename Matrix::coordinates_t& hi)
+      {
+            using traits = internal::matrix_traits<Matrix>;
+            if constexpr (traits::policy::spatial_index)
+            {
+                  return m.range(lo, hi);
+            }
+            else
+            {
+                  return m.stream() | pipeline::filter([lo, hi](const auto& node) {
+                               return internal::in_box(internal::node_coordinates<traits::dimension>(node, std::make_index_sequence<traits::dimension>()), lo, hi);
+                         });
+            }
+      }
+
+      //! Ленивый поток ячеек матрицы с первой координатой row
+      template <typename Matrix>
+      auto stream_row(const Matrix& m, std::size_t row)
+      {
+            typename Matrix::coordinates_t lo {};
+            typename Matrix::coordinates_t hi {};
+            hi.fill(std::numeric_limits<std::size_t>::max());
+            lo[0] = hi[0] = row;
+            return stream_range(m, lo, hi);
+      }
+
+#ifdef RORO_LIB_HAS_COROUTINES
+      /*!   \brief  Генератор на сопрограммах C++20: значения co_yield выдаются по одному при обходе.<br>
+                    Годится как источник и как стадия конвейера pipeline.
+      */
+      template <typename T>
+      class generator
+      {
+        public:
+            struct promise_type
+            {
+                  std::optional<T> current;
+                  std::exception_ptr error;
+
+                  generator get_return_object()
+                  {
+                        return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+                  }
+
+                  std::suspend_always initial_suspend() noexcept
+                  {
+                        return {};
+                  }
+
+                  std::suspend_always final_suspend() noexcept
+                  {
+                        return {};
+                  }
+
+                  template <typename U>
+                  std::suspend_always yield_value(U&& value)
+                  {
+                        current.emplace(std::forward<U>(value));
+                        return {};
+                  }
+
+                  void return_void() noexcept {}
+
+                  void unhandled_exception() noexcept
+                  {
+                        error = std::current_exception();
+                  }
+            };
+
+            class iterator
+            {
+              public:
+                  using value_type = T;
+                  using iterator_category = std::input_iterator_tag;
+                  using difference_type = std::ptrdiff_t;
+                  using pointer = const T*;
+                  using reference = const T&;
+
+                  iterator() = default;
+                  explicit iterator(std::coroutine_handle<promise_type> handle) : handle(handle)
+                  {
+                        advance();
+                  }
+
+                  const T& operator*() const noexcept
+                  {
+                        return *handle.promise().current;
+                  }
+
+                  const T* operator->() const noexcept
+                  {
+                        return &*handle.promise().current;
+                  }
+
+                  iterator& operator++()
+                  {
+                        advance();
+                        return *this;
+                  }
+
+                  bool operator==(const iterator& arg) const noexcept
+                  {
+                        return !handle && !arg.handle;
+                  }
+
+                  bool operator!=(const iterator& arg) const noexcept
+                  {
+                        return !(*this == arg);
+                  }
+
+              private:
+                  void advance()
+                  {
+                        handle.promise().current.reset();
+                        handle.resume();
+                        if (handle.done())
+                        {
+                              auto error = std::exchange(handle.promise().error, nullptr);
+                              handle = nullptr;
+                              if (error)
+                                    std::rethrow_exception(error);
+                        }
+                  }
+
+                  std::coroutine_handle<promise_type> handle;
+            };
+
+            generator(generator&& arg) noexcept : handle(std::exchange(arg.handle, nullptr)), started(std::exchange(arg.started, false)) {}
+
+            generator& operator=(generator&& arg) noexcept
+            {
+                  if (this != &arg)
+                  {
+                        if (handle)
+                              handle.destroy();
+                        handle = std::exchange(arg.handle, nullptr);
+                        started = std::exchange(arg.started, false);
+                  }
+                  return *this;
+            }
+
+            ~generator()
+            {
+                  if (handle)
+                        handle.destroy();
+            }
+
+            //! Запускает сопрограмму; обойти генератор можно только один раз, повторный begin() бросает std::logic_error
+            iterator begin()
+            {
+                  if (!handle)
+                        throw std::logic_error("generator has no coroutine: it was moved from");
+                  if (started)
+                        throw std::logic_error("generator is single-pass: begin() was already called");
+
+                  started = true;
+                  return iterator(handle);
+            }
+
+            iterator end()
+            {
+                  return iterator();
+            }
+
+        private:
+            explicit generator(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+            std::coroutine_handle<promise_type> handle;
+            bool started = false;
+      };
+
+      //! Генератор, выдающий элементы диапазона (например, конвейера над m.stream())
+      template <typename Range>
+      generator<internal::range_value_t<Range>> to_generator(Range range)
+      {
+            for (auto&& value : range)
+                  co_yield value;
+      }
+#endif
+}
@@ -0,0 +1,178 @@
+﻿#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+namespace roro_lib
+{
+      /*!   \brief  Генераторы координат для бенчмарков и нагрузочных тестов матрицы.
+      */
+      namespace workload
+      {
+            //! Схема расположения занятых ячеек
+            enum class pattern
+            {
+                  random,    //!< равномерно по ограничивающему кубу
+                  diagonal,  //!< главная и побочная диагонали, как в демо src/main.cpp
+                  banded,    //!< ленточная матрица: координаты отстоят от первой не больше, чем на ширину ленты
+                  clustered  //!< плотные сгустки вокруг случайных центров
+            };
+
+            inline const char* to_string(pattern p) noexcept
+            {
+                  switch (p)
+                  {
+                  case pattern::random:
+                        return "random";
+                  case pattern::diagonal:
+                        return "diagonal";
+                  case pattern::banded:
+                        return "banded";
+                  case pattern::clustered:
+                        return "clustered";
+                  }
+                  return "unknown";
+            }
+
+            inline pattern parse_pattern(std::string_view name)
+            {
+                  for (pattern p : { pattern::random, pattern::diagonal, pattern::banded, pattern::clustered })
+                  {
+                        if (name == to_string(p))
+                              return p;
+                  }
+                  throw std::invalid_argument("unknown access pattern: " + std::string(name));
+            }
+
+            /*!   \brief  Длина ребра ограничивающего куба, в котором count ячеек дают заданную плотность
+            */
+            template <std::size_t Dimension>
+            std::size_t extent_for(std::size_t count, double density)
+            {
+                  double volume = static_cast<double>(count) / (density > 0.0 ? density : 1.0);
+                  double edge = std::ceil(std::pow(volume, 1.0 / Dimension));
+                  return std::max<std::size_t>(1, static_cast<std::size_t>(edge));
+            }
+
+            /*!   \brief  Генерирует count координат по схеме p.
+
+                          density - доля занятых ячеек в ограничивающем кубе, определяет его размер для
+                          random и clustered и ширину ленты для banded. Координаты могут повторяться.
+            */
+            template <std::size_t Dimension>
+            std::vector<std::array<std::size_t, Dimension>> make_coordinates(pattern p, std::size_t count, double density, std::uint64_t seed = 42)
+            {
+                  using coordinates_t = std::array<std::size_t, Dimension>;
+
+                  std::mt19937_64 rng(seed);
+                  std::vector<coordinates_t> result;
+                  result.reserve(count);
+
+                  std::size_t extent = extent_for<Dimension>(count, density);
+                  std::uniform_int_distribution<std::size_t> any(0, extent - 1);
+
+                  switch (p)
+                  {
+                  case pattern::random:
+                        for (std::size_t n = 0; n < count; ++n)
+                        {
+                              coordinates_t c;
+                              for (auto& x : c)
+                                    x = any(rng);
+                              result.push_back(c);
+                        }
+                        break;
+
+                  case pattern::diagonal:
+                  {
+                        std::size_t side = std::max<std::size_t>(1, (count + 1) / 2);
+                        for (std::size_t n = 0; n < count; ++n)
+                        {
+                              std::size_t i = n / 2;
+                              coordinates_t c;
+                              for (std::size_t d = 0; d < Dimension; ++d)
+                                    c[d] = (n % 2 && d % 2) ? side - 1 - i : i;
+                              result.push_back(c);
+                        }
+                        break;
+                  }
+
+                  case pattern::banded:
+                  {
+                        std::size_t width = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(1.0 / density)));
+                        std::size_t rows = std::max<std::size_t>(1, count / width);
+                        std::uniform_int_distribution<std::size_t> offset(0, 2 * width);
+                        for (std::size_t n = 0; n < count; ++n)
+                        {
+                              coordinates_t c;
+                              c[0] = n % rows;
+                              for (std::size_t d = 1; d < Dimension; ++d)
+                                    c[d] = c[0] + width - std::min(c[0] + width, offset(rng));
+                              result.push_back(c);
+                        }
+                        break;
+                  }
+
+                  case pattern::clustered:
+                  {
+                        std::size_t clusters = std::max<std::size_t>(1, count / 1024);
+                        std::size_t radius = std::max<std::size_t>(1, extent / (2 * clusters + 1));
+                        std::vector<coordinates_t> centers(clusters);
+                        for (auto& center : centers)
+                        {
+                              for (auto& x : center)
+                                    x = any(rng) + radius;
+                        }
+
+                        std::uniform_int_distribution<std::size_t> which(0, clusters - 1);
+                        std::uniform_int_distribution<std::size_t> offset(0, 2 * radius);
+                        for (std::size_t n = 0; n < count; ++n)
+                        {
+                              const coordinates_t& center = centers[which(rng)];
+                              coordinates_t c;
+                              for (std::size_t d = 0; d < Dimension; ++d)
+                                    c[d] = center[d] + offset(rng) - radius;
+                              result.push_back(c);
+                        }
+                        break;
+                  }
+                  }
+
+                  return result;
+            }
+
+            /*!   \brief  Координаты, гарантированно не совпадающие ни с одной из present.
+
+                          Первая координата сдвигается за максимум первых координат present.
+            */
+            template <std::size_t Dimension>
+            std::vector<std::array<std::size_t, Dimension>> make_missing(const std::vector<std::array<std::size_t, Dimension>>& present)
+            {
+                  std::size_t shift = 1;
+                  for (const auto& c : present)
+                        shift = std::max(shift, c[0] + 1);
+
+                  std::vector<std::array<std::size_t, Dimension>> result(present);
+                  for (auto& c : result)
+                        c[0] += shift;
+                  return result;
+            }
+
+            //! Доступ к ячейке матрицы через цепочку operator[] по массиву координат
+            template <std::size_t I = 0, typename Indexable, std::size_t Dimension>
+            auto at(Indexable&& m, const std::array<std::size_t, Dimension>& c)
+            {
+                  if constexpr (I + 1 == Dimension)
+                        return m[c[I]];
+                  else
+                        return at<I + 1>(m[c[I]], c);
+            }
+      }
+}
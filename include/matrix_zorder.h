@@ -0,0 +1,402 @@
+﻿#pragma once
+
+#include <array>
+#include <vector>
+#include <map>
+#include <utility>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <algorithm>
+
+namespace roro_lib
+{
+      namespace internal
+      {
+            /*!   \brief  Порядок Z-кривой (Мортона) над координатами ячеек.
+
+                          Код Мортона - это биты координат, перемежающиеся от старших к младшим; на одном уровне
+                          битов старшей считается координата с меньшим номером. Сами коды не строятся: для
+                          сравнения достаточно найти координату с самым старшим отличающимся битом.
+            */
+            template <std::size_t Dimension>
+            struct zorder_less
+            {
+                  using coordinates_t = std::array<std::size_t, Dimension>;
+
+                  //! Старший бит x меньше старшего бита y
+                  static bool less_msb(std::size_t x, std::size_t y) noexcept
+                  {
+                        return x < y && x < (x ^ y);
+                  }
+
+                  bool operator()(const coordinates_t& a, const coordinates_t& b) const noexcept
+                  {
+                        std::size_t major = 0;
+                        std::size_t major_bits = 0;
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                        {
+                              std::size_t bits = a[d] ^ b[d];
+                              if (less_msb(major_bits, bits))
+                              {
+                                    major = d;
+                                    major_bits = bits;
+                              }
+                        }
+                        return a[major] < b[major];
+                  }
+            };
+
+            template <std::size_t Dimension>
+            bool in_box(const std::array<std::size_t, Dimension>& c,
+                        const std::array<std::size_t, Dimension>& lo,
+                        const std::array<std::size_t, Dimension>& hi) noexcept
+            {
+                  for (std::size_t d = 0; d < Dimension; ++d)
+                  {
+                        if (c[d] < lo[d] || c[d] > hi[d])
+                              return false;
+                  }
+                  return true;
+            }
+
+            /*!   \brief  BIGMIN (Tropf, Herzog): наименьшая в порядке Z-кривой точка бокса [lo, hi], большая point.
+
+                          Биты кода перебираются от старших к младшим, бокс сужается по одной координате за шаг.
+                          Точка point должна лежать вне бокса, но не дальше его верхнего угла.
+
+                   \return  false, если такой точки нет
+            */
+            template <std::size_t Dimension>
+            bool zorder_bigmin(const std::array<std::size_t, Dimension>& point,
+                               std::array<std::size_t, Dimension> lo,
+                               std::array<std::size_t, Dimension> hi,
+                               std::array<std::size_t, Dimension>& result) noexcept
+            {
+                  std::size_t used = 0;
+                  for (std::size_t d = 0; d < Dimension; ++d)
+                        used |= point[d] | lo[d] | hi[d];
+
+                  // уровни выше старшего занятого бита у всех координат нулевые
+                  std::size_t top = std::size_t(1) << (sizeof(std::size_t) * 8 - 1);
+                  while (top != 0 && !(used & top))
+                        top >>= 1;
+
+                  bool found = false;
+                  for (std::size_t mask = top; mask != 0; mask >>= 1)
+                  {
+                        for (std::size_t d = 0; d < Dimension; ++d)
+                        {
+                              bool p = point[d] & mask;
+                              bool l = lo[d] & mask;
+                              bool h = hi[d] & mask;
+                              std::size_t lower = mask - 1;
+
+                              if (!p && !l && h)
+                              {
+                                    result = lo;
+                                    result[d] = (lo[d] & ~lower) | mask;
+                                    hi[d] = (hi[d] & ~mask) | lower;
+                                    found = true;
+                              }
+                              else if (!p && l && h)
+                              {
+                                    result = lo;
+                                    return true;
+                              }
+                              else if (p && !l && !h)
+                              {
+                                    return found;
+                              }
+                              else if (p && !l && h)
+                              {
+                                    lo[d] = (lo[d] & ~lower) | mask;
+                              }
+                        }
+                  }
+                  return found;
+            }
+
+            /*!   \brief  Продвигает it по Z-упорядоченной последовательности [it, end) к первому элементу внутри бокса [lo, hi].
+
+                          Встретив элемент вне бокса, перепрыгивает к BIGMIN: seek(next, it) возвращает первый
+                          элемент после it, не меньший next. coordinates(it) - координаты элемента.
+            */
+            template <typename Iter, typename Seek, typename Coordinates, std::size_t Dimension>
+            Iter zorder_settle(Iter it, Iter end,
+                               const std::array<std::size_t, Dimension>& lo,
+                               const std::array<std::size_t, Dimension>& hi,
+                               Seek seek, Coordinates coordinates)
+            {
+                  zorder_less<Dimension> less;
+                  while (it != end)
+                  {
+                        const std::array<std::size_t, Dimension>& c = coordinates(it);
+                        if (less(hi, c))
+                              return end;
+                        if (in_box(c, lo, hi))
+                              return it;
+
+                        std::array<std::size_t, Dimension> next;
+                        if (!zorder_bigmin(c, lo, hi, next))
+                              return end;
+                        it = seek(next, it);
+                  }
+                  return end;
+            }
+
+            /*!   \brief  Индекс ячеек, упорядоченных по Z-кривой, для запросов по гиперпрямоугольнику.
+
+                          Ячейки бокса образуют на Z-кривой несколько непрерывных отрезков. Запрос идет по
+                          отсортированному массиву от Z-минимума бокса до Z-максимума и, встретив ячейку вне бокса,
+                          перепрыгивает двоичным поиском к BIGMIN - следующей точке кривой внутри бокса. Поэтому
+                          стоимость запроса зависит от числа найденных ячеек и отрезков, а не от nnz или объема бокса.
+
+                          Индекс обновляется при каждом изменении ячейки за O(log d): изменение попадает в
+                          упорядоченный по той же кривой буфер из d изменений. Когда буфер дорастает до 1/8 массива,
+                          они сливаются за O(nnz) без сортировки, так что на одну запись приходится O(1) перемещений.
+                          Запрос объединяет массив с изменениями буфера внутри бокса и ничего не меняет в индексе,
+                          поэтому запросы из нескольких потоков к неизменяемому индексу безопасны. Массив
+                          неизменяем и разделяется результатами запросов: результат остается снимком на момент запроса.
+
+                   \tparam  Entry -пара (координаты, значение), координаты берутся из entry.first.coordinates
+            */
+            template <typename Entry, std::size_t Dimension>
+            class zorder_index
+            {
+              public:
+                  using coordinates_t = std::array<std::size_t, Dimension>;
+                  using value_type = typename Entry::second_type;
+
+              private:
+                  //! Снимок для запроса: массив индекса и изменения буфера внутри бокса (флаг - ячейка занята)
+                  struct snapshot
+                  {
+                        std::shared_ptr<const std::vector<Entry>> base;
+                        std::vector<std::pair<Entry, bool>> changes;
+                  };
+
+                  static bool entry_less(const Entry& e, const coordinates_t& c) noexcept
+                  {
+                        return zorder_less<Dimension>()(e.first.coordinates, c);
+                  }
+
+              public:
+                  /*!   \brief  Курсор по ячейкам индекса внутри бокса
+                  */
+                  class cursor
+                  {
+                    public:
+                        using value_type = Entry;
+                        using iterator_category = std::forward_iterator_tag;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const Entry*;
+                        using reference = const Entry&;
+
+                        cursor() = default;
+
+                        //! Курсор на первую ячейку бокса
+                        cursor(std::shared_ptr<const snapshot> view, const coordinates_t& lo, const coordinates_t& hi)
+                            : view(std::move(view)), lo(lo), hi(hi)
+                        {
+                              const auto& base = *this->view->base;
+                              position = settle_base(static_cast<std::size_t>(std::lower_bound(base.begin(), base.end(), lo, entry_less) - base.begin()));
+                              settle();
+                        }
+
+                        //! Курсор за последней ячейкой бокса
+                        explicit cursor(std::shared_ptr<const snapshot> view)
+                            : view(std::move(view)), position(this->view->base->size()), change(this->view->changes.size())
+                        {
+                        }
+
+                        const Entry* operator->() const
+                        {
+                              return &**this;
+                        }
+
+                        const Entry& operator*() const
+                        {
+                              return from_change ? view->changes[change].first : (*view->base)[position];
+                        }
+
+                        cursor& operator++()
+                        {
+                              if (from_change)
+                                    ++change;
+                              else
+                                    position = settle_base(position + 1);
+                              settle();
+                              return *this;
+                        }
+
+                        cursor operator++(int)
+                        {
+                              cursor old_iter = *this;
+                              ++*this;
+                              return old_iter;
+                        }
+
+                        bool operator==(const cursor& arg) const noexcept
+                        {
+                              return position == arg.position && change == arg.change;
+                        }
+
+                        bool operator!=(const cursor& arg) const noexcept
+                        {
+                              return !(*this == arg);
+                        }
+
+                    private:
+                        //! Первая ячейка массива внутри бокса, начиная с позиции from
+                        std::size_t settle_base(std::size_t from) const
+                        {
+                              const auto& base = *view->base;
+                              auto it = zorder_settle(
+                                  base.begin() + static_cast<std::ptrdiff_t>(from), base.end(), lo, hi,
+                                  [&](const coordinates_t& next, auto at) { return std::lower_bound(at + 1, base.end(), next, entry_less); },
+                                  [](auto at) -> const coordinates_t& { return at->first.coordinates; });
+                              return static_cast<std::size_t>(it - base.begin());
+                        }
+
+                        //! Выбирает, откуда взять текущую ячейку: изменение заменяет ячейку массива с теми же координатами
+                        void settle()
+                        {
+                              const auto& base = *view->base;
+                              const auto& changes = view->changes;
+                              zorder_less<Dimension> less;
+
+                              for (; change < changes.size(); ++change)
+                              {
+                                    const coordinates_t& c = changes[change].first.first.coordinates;
+                                    if (position < base.size())
+                                    {
+                                          const coordinates_t& b = base[position].first.coordinates;
+                                          if (less(b, c))
+                                          {
+                                                from_change = false;
+                                                return;
+                                          }
+                                          if (!less(c, b))
+                                                position = settle_base(position + 1);
+                                    }
+                                    if (changes[change].second)
+                                    {
+                                          from_change = true;
+                                          return;
+                                    }
+                              }
+                              from_change = false;
+                        }
+
+                        std::shared_ptr<const snapshot> view;
+                        coordinates_t lo {};
+                        coordinates_t hi {};
+                        std::size_t position = 0;
+                        std::size_t change = 0;
+                        bool from_change = false;
+                  };
+
+                  //! Ячейка c получила значение value (present == true) или стала пустой (present == false)
+                  void assign(const coordinates_t& c, bool present, const value_type& value)
+                  {
+                        delta.insert_or_assign(c, std::make_pair(present, value));
+                        if (delta.size() > std::max(min_delta, base_size() / 8))
+                              merge();
+                  }
+
+                  void clear() noexcept
+                  {
+                        base.reset();
+                        delta.clear();
+                  }
+
+                  //! Курсоры на первую ячейку бокса [lo, hi] и за последнюю
+                  std::pair<cursor, cursor> query(const coordinates_t& lo, const coordinates_t& hi) const
+                  {
+                        auto view = std::make_shared<snapshot>();
+                        view->base = base ? base : std::make_shared<const std::vector<Entry>>();
+
+                        auto seek = [&](const coordinates_t& next, auto) { return delta.lower_bound(next); };
+                        auto coordinates = [](auto at) -> const coordinates_t& { return at->first; };
+                        for (auto it = zorder_settle(delta.lower_bound(lo), delta.end(), lo, hi, seek, coordinates);
+                             it != delta.end();
+                             it = zorder_settle(std::next(it), delta.end(), lo, hi, seek, coordinates))
+                        {
+                              view->changes.emplace_back(Entry{ { it->first }, it->second.second }, it->second.first);
+                        }
+
+                        std::shared_ptr<const snapshot> shared = std::move(view);
+                        return { cursor(shared, lo, hi), cursor(shared) };
+                  }
+
+              private:
+                  //! Наименьший размер буфера изменений, при котором он сливается с массивом
+                  static constexpr std::size_t min_delta = 256;
+
+                  std::size_t base_size() const noexcept
+                  {
+                        return base ? base->size() : 0;
+                  }
+
+                  //! Слияние буфера с массивом за один проход; массив копируется, ранее выданные снимки не меняются
+                  void merge()
+                  {
+                        auto merged = std::make_shared<std::vector<Entry>>();
+                        merged->reserve(base_size() + delta.size());
+
+                        auto change = delta.begin();
+                        auto take_change = [&] {
+                              if (change->second.first)
+                                    merged->push_back(Entry{ { change->first }, change->second.second });
+                              ++change;
+                        };
+
+                        if (base)
+                        {
+                              for (const Entry& e : *base)
+                              {
+                                    while (change != delta.end() && zorder_less<Dimension>()(change->first, e.first.coordinates))
+                                          take_change();
+                                    if (change != delta.end() && change->first == e.first.coordinates)
+                                          take_change();
+                                    else
+                                          merged->push_back(e);
+                              }
+                        }
+                        while (change != delta.end())
+                              take_change();
+
+                        base = std::move(merged);
+                        delta.clear();
+                  }
+
+                  std::shared_ptr<const std::vector<Entry>> base;
+                  std::map<coordinates_t, std::pair<bool, value_type>, zorder_less<Dimension>> delta;
+            };
+
+            /*!   \brief  Результат запроса по боксу: пара итераторов с методами begin() и end()
+            */
+            template <typename Iter>
+            class range_view
+            {
+              public:
+                  range_view(Iter first, Iter last) : first(first), last(last) {}
+
+                  Iter begin() const
+                  {
+                        return first;
+                  }
+
+                  Iter end() const
+                  {
+                        return last;
+                  }
+
+              private:
+                  Iter first;
+                  Iter last;
+            };
+      }
+}
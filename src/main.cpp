@@ -1,9 +1,43 @@
 ﻿#include <iostream>
+#include <fstream>
+#include <sstream>
 #include <exception>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <csignal>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cerrno>
+#include <system_error>
+#endif
 
 #include "lib_version.h"
 #include "CLParser.h"
 #include "matrix.h"
+#include "matrix_workload.h"
+#include "matrix_adaptive.h"
+#include "matrix_cow.h"
+#include "matrix_persistent.h"
+#include "matrix_buffered.h"
+#include "matrix_mapped.h"
+#include "matrix_query.h"
+#include "matrix_server.h"
+#include "matrix_dump.h"
 
 using namespace std;
 using namespace roro_lib;
@@ -11,13 +45,58 @@ using namespace roro_lib;
 void help()
 {
       cout << R"(
- This demo is my matrix.
+ Workload driver for roro_lib::matrix: fills a matrix, runs an operation mix and reports
+ throughput, latency percentiles and peak RSS.
+
+    matrix  [-dimension D] [-value_type V] [-nnz N] [-pattern P] [-density F] [-threads T]
+            [-repetitions R] [-ops K] [-mix M] [-backend B] [-seed S]
+            [-load=file] [-save=file] [-json=file]
+    matrix  -query=text|binary [-dimension D] [-value_type V] [-nnz N] [-pattern P] [-load=file] ...
+    matrix  -serve=address [-dimension D] [-value_type V] [-nnz N] [-pattern P] [-load=file] ...
+    matrix  -client=address [-dimension D] [-threads T] [-repetitions R] [-ops K] [-mix M]
+            [-batch B] [-in_flight F] [-pattern P] [-density F] [-seed S]
+    matrix  -dump=file [-dimension D] [-value_type V] [-nnz N] [-pattern P] [-load=file] [-threads T] ...
+    matrix  -demo [-math_oder_dimensions]
+    matrix  -version | -?
 
-    matrix  [-version | -? | -math_oder_dimensions]
-       Options:  
-       -version                -get version of program
-       -?                      -about program (this info)
-       -math_oder_dimensions   -output dimensions at math order (like x, y). Example: column, row   
+       Options:
+       -dimension      -matrix dimension 1..4 (default 2)
+       -value_type     -int, short or long_long (default int)
+       -nnz            -number of cells written before the run (default 100000)
+       -pattern        -random, diagonal, banded or clustered (default random)
+       -density        -fraction of occupied cells in the bounding box (default 0.001)
+       -threads        -threads running the mix, 0 - all cores (default 1)
+       -repetitions    -runs of the mix, each on a freshly filled matrix (default 5)
+       -ops            -operations per thread in one run (default nnz)
+       -mix            -operation weights, e.g. get:90,set:5,add:4,erase:1 (default get:90,set:10)
+       -backend        -hash, adaptive, cow, persistent or mapped (default hash)
+                        hash, adaptive and cow are sharded when several threads write;
+                        persistent gives every thread its own chain of versions;
+                        mapped is read-only (default mix get:100) and attaches to an image
+                        in the -save file or in a temporary file in $TMPDIR (default /tmp)
+       -seed           -seed of the coordinate and operation generators (default 42)
+       -load           -take the cells from a matrix image instead of generating them
+       -save           -write the generated cells as a matrix image
+                        (paths starting with / need the -load=/path form)
+       -json           -write the report as JSON to the file
+       -query          -fill or load the matrix once, then answer GET/SET/ADD/RANGE commands from
+                        stdin on stdout, in text or binary framing (see include/matrix_query.h):
+                          GET x y      SET x y value      ADD x y delta      RANGE x1 y1 x2 y2
+       -serve          -fill or load the matrix once, then serve the binary framing of -query to many
+                        clients over a socket until SIGINT or SIGTERM; address is unix:/path or tcp:port
+                        (tcp listens on 127.0.0.1 only, tcp:0 picks a free port)
+       -client         -load generator for -serve: every thread opens a connection and sends -ops
+                        commands of the mix (erase is sent as SET 0) in frames of -batch commands,
+                        keeping up to -in_flight frames unanswered; reports commands/s and the
+                        round-trip latency of a frame
+       -batch          -commands per frame of -client (default 64)
+       -in_flight      -frames sent ahead of replies by -client (default 4)
+       -dump           -fill or load the matrix once and write its cells to the file as lines
+                        "x y value"; -threads formats in parallel, the output does not depend on it
+       -demo           -print the 10x10 demo matrix
+       -version        -get version of program
+       -?              -about program (this info)
+       -math_oder_dimensions   -output dimensions at math order (like x, y) in -demo. Example: column, row
                                 By Default: row, column
 )" << endl;
 }
@@ -27,6 +106,960 @@ void version_matrix()
       cout << "Version matrix: " << version() << endl;
 }
 
+void demo(bool math_order)
+{
+      matrix<int, 0> diagonal_matrix;
+
+      for (int i = 0; i < 10; ++i)
+      {
+            diagonal_matrix[i][i] = i;
+      }
+
+      for (int i = 0; i < 10; ++i)
+      {
+            diagonal_matrix[i][9 - i] = 9 - i;
+      }
+
+      dump_options grid;
+      grid.trailing_separator = true;
+      dump_window(diagonal_matrix, { 1, 1 }, { 8, 8 }, cout, grid);
+
+      cout << diagonal_matrix.size() << "\n";
+
+      dump_options list;
+      list.coordinate_separator = 'x';
+      list.reverse_coordinates = math_order;
+      dump_coordinates(diagonal_matrix, cout, list);
+      cout.flush();
+}
+
+enum class op_kind : std::uint8_t
+{
+      get,
+      set,
+      add,
+      erase
+};
+
+//! Веса операций в смеси
+struct op_mix
+{
+      std::array<unsigned, 4> weights { { 90, 10, 0, 0 } };
+
+      bool has_writes() const noexcept
+      {
+            return weights[1] + weights[2] + weights[3] != 0;
+      }
+
+      string to_string() const
+      {
+            static const char* names[] = { "get", "set", "add", "erase" };
+            string text;
+            for (size_t k = 0; k < weights.size(); ++k)
+            {
+                  if (!weights[k])
+                        continue;
+                  if (!text.empty())
+                        text += ',';
+                  text += names[k] + (":" + std::to_string(weights[k]));
+            }
+            return text;
+      }
+
+      //! Разбирает строку вида get:90,set:10
+      static op_mix parse(const string& text)
+      {
+            static const char* names[] = { "get", "set", "add", "erase" };
+            op_mix mix;
+            mix.weights = { { 0, 0, 0, 0 } };
+
+            istringstream in(text);
+            string item;
+            while (getline(in, item, ','))
+            {
+                  size_t colon = item.find(':');
+                  string name = item.substr(0, colon);
+                  auto known = find_if(begin(names), end(names), [&](const char* n) { return name == n; });
+                  if (colon == string::npos || known == end(names))
+                        throw invalid_argument("bad operation mix item: " + item);
+                  mix.weights[known - begin(names)] = static_cast<unsigned>(stoul(item.substr(colon + 1)));
+            }
+
+            if (mix.weights[0] + mix.weights[1] + mix.weights[2] + mix.weights[3] == 0)
+                  throw invalid_argument("operation mix is empty: " + text);
+            return mix;
+      }
+};
+
+struct driver_config
+{
+      size_t dimension = 2;
+      string value_type = "int";
+      size_t nnz = 100000;
+      workload::pattern pattern = workload::pattern::random;
+      double density = 0.001;
+      size_t threads = 1;
+      size_t repetitions = 5;
+      size_t ops = 0;
+      op_mix mix;
+      string backend = "hash";
+      std::uint64_t seed = 42;
+      string load;
+      string save;
+      string json;
+      string query;
+      string serve;
+      string client;
+      string dump;
+      size_t batch = 64;
+      size_t in_flight = 4;
+
+      string to_string() const
+      {
+            ostringstream out;
+            out << "backend=" << backend << " dimension=" << dimension << " value_type=" << value_type << " nnz=" << nnz
+                << " pattern=" << workload::to_string(pattern) << " density=" << density << " threads=" << threads
+                << " repetitions=" << repetitions << " ops=" << ops << " mix=" << mix.to_string() << " seed=" << seed;
+            if (!load.empty())
+                  out << " load=" << load;
+            return out.str();
+      }
+};
+
+/*!   \brief  Гистограмма задержек с логарифмическими корзинами: 16 корзин на каждую степень двойки.
+
+              Относительная ошибка перцентиля не больше 1/16, запись - несколько инструкций без выделения памяти.
+*/
+class latency_histogram
+{
+  public:
+      void record(std::uint64_t ns) noexcept
+      {
+            ++counts[bucket_of(ns)];
+            ++total;
+            slowest = max(slowest, ns);
+      }
+
+      void merge(const latency_histogram& other) noexcept
+      {
+            for (size_t b = 0; b < bucket_count; ++b)
+                  counts[b] += other.counts[b];
+            total += other.total;
+            slowest = max(slowest, other.slowest);
+      }
+
+      //! Верхняя граница корзины, в которую попадает перцентиль q (0..1)
+      std::uint64_t percentile(double q) const noexcept
+      {
+            if (total == 0)
+                  return 0;
+
+            std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(total - 1)) + 1;
+            std::uint64_t seen = 0;
+            for (size_t b = 0; b < bucket_count; ++b)
+            {
+                  seen += counts[b];
+                  if (seen >= rank)
+                        return min(upper_bound_of(b), slowest);
+            }
+            return slowest;
+      }
+
+      std::uint64_t max_ns() const noexcept
+      {
+            return slowest;
+      }
+
+  private:
+      static constexpr unsigned sub_bits = 4;
+      static constexpr size_t bucket_count = (64 - sub_bits + 1) << sub_bits;
+
+      std::array<std::uint64_t, bucket_count> counts {};
+      std::uint64_t total = 0;
+      std::uint64_t slowest = 0;
+
+      static size_t bucket_of(std::uint64_t ns) noexcept
+      {
+            if (ns < (1u << sub_bits))
+                  return static_cast<size_t>(ns);
+#if defined(__GNUC__) || defined(__clang__)
+            unsigned exponent = 63 - static_cast<unsigned>(__builtin_clzll(ns));
+#else
+            unsigned exponent = 0;
+            for (std::uint64_t rest = ns; rest >>= 1;)
+                  ++exponent;
+#endif
+            size_t sub = static_cast<size_t>(ns >> (exponent - sub_bits)) & ((1u << sub_bits) - 1);
+            return ((exponent - sub_bits + 1) << sub_bits) + sub;
+      }
+
+      static std::uint64_t upper_bound_of(size_t bucket) noexcept
+      {
+            if (bucket < (1u << sub_bits))
+                  return bucket;
+            unsigned exponent = static_cast<unsigned>(bucket >> sub_bits) + sub_bits - 1;
+            std::uint64_t sub = bucket & ((1u << sub_bits) - 1);
+            return ((std::uint64_t(1) << sub_bits) + sub + 1) << (exponent - sub_bits);
+      }
+};
+
+//! Пиковый размер резидентной памяти процесса в килобайтах, 0 - неизвестен
+std::uint64_t peak_rss_kb()
+{
+#if defined(__unix__) || defined(__APPLE__)
+      rusage usage {};
+      if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+#if defined(__APPLE__)
+      return static_cast<std::uint64_t>(usage.ru_maxrss) / 1024;
+#else
+      return static_cast<std::uint64_t>(usage.ru_maxrss);
+#endif
+#else
+      return 0;
+#endif
+}
+
+template <typename T, size_t Dimension>
+using source_t = matrix<T, 0, Dimension>;
+
+//! Хранилище на одном потоке или с одними чтениями: операции идут прямо в матрицу
+template <typename T, size_t Dimension, typename Policy>
+class local_backend
+{
+  public:
+      using coordinates_t = array<size_t, Dimension>;
+
+      explicit local_backend(const source_t<T, Dimension>& source, const driver_config&)
+      {
+            for (auto node : source.stream())
+                  workload::at(m, internal::node_coordinates<Dimension>(node, make_index_sequence<Dimension>())) = get<Dimension>(node);
+      }
+
+      size_t size() const
+      {
+            return m.size();
+      }
+
+      //! Операции идут через operator[] матрицы - тот путь, которым пользуется обычный код
+      struct worker
+      {
+            local_backend& owner;
+
+            T get(const coordinates_t& c) const
+            {
+                  return workload::at(owner.m, c);
+            }
+
+            void set(const coordinates_t& c, T value)
+            {
+                  workload::at(owner.m, c) = value;
+            }
+
+            void add(const coordinates_t& c, T delta)
+            {
+                  set(c, get(c) + delta);
+            }
+
+            void erase(const coordinates_t& c)
+            {
+                  set(c, T());
+            }
+      };
+
+      worker make_worker()
+      {
+            return worker { *this };
+      }
+
+  private:
+      matrix<T, 0, Dimension, Policy> m;
+};
+
+//! Несколько потоков пишут: матрица разбита на шарды со своими мьютексами
+template <typename T, size_t Dimension, typename Policy>
+class sharded_backend
+{
+  public:
+      using coordinates_t = array<size_t, Dimension>;
+      using shared_t = sharded_matrix<T, 0, Dimension, Policy>;
+
+      explicit sharded_backend(const source_t<T, Dimension>& source, const driver_config&)
+      {
+            for (auto node : source.stream())
+                  m.set(internal::node_coordinates<Dimension>(node, make_index_sequence<Dimension>()), get<Dimension>(node));
+      }
+
+      size_t size() const
+      {
+            return m.size();
+      }
+
+      struct worker
+      {
+            shared_t& m;
+
+            T get(const coordinates_t& c) const
+            {
+                  return m.get(c);
+            }
+
+            void set(const coordinates_t& c, T value)
+            {
+                  m.set(c, value);
+            }
+
+            void add(const coordinates_t& c, T delta)
+            {
+                  m.with_shard(shared_t::shard_of(c), [&](auto& cells) {
+                        T value;
+                        cells.get_batch(&c, 1, &value);
+                        value += delta;
+                        cells.set_batch(&c, 1, &value);
+                  });
+            }
+
+            void erase(const coordinates_t& c)
+            {
+                  m.set(c, T());
+            }
+      };
+
+      worker make_worker()
+      {
+            return worker { m };
+      }
+
+  private:
+      shared_t m;
+};
+
+//! Персистентная матрица: все потоки начинают с общей версии и пишут каждый в свою цепочку версий
+template <typename T, size_t Dimension>
+class persistent_backend
+{
+  public:
+      using coordinates_t = array<size_t, Dimension>;
+      using versioned_t = persistent_matrix<T, 0, Dimension>;
+
+      explicit persistent_backend(const source_t<T, Dimension>& source, const driver_config&) : base(source)
+      {
+      }
+
+      size_t size() const
+      {
+            return base.size();
+      }
+
+      struct worker
+      {
+            versioned_t version;
+
+            T get(const coordinates_t& c) const
+            {
+                  return version.get(c);
+            }
+
+            void set(const coordinates_t& c, T value)
+            {
+                  version = version.set(c, value);
+            }
+
+            void add(const coordinates_t& c, T delta)
+            {
+                  version = version.set(c, version.get(c) + delta);
+            }
+
+            void erase(const coordinates_t& c)
+            {
+                  version = version.erase(c);
+            }
+      };
+
+      worker make_worker()
+      {
+            return worker { base };
+      }
+
+  private:
+      versioned_t base;
+};
+
+#if defined(RORO_LIB_HAS_MMAP)
+//! Образ в разделяемой памяти: только чтение
+template <typename T, size_t Dimension>
+class mapped_backend
+{
+  public:
+      using coordinates_t = array<size_t, Dimension>;
+      using image_t = mapped_matrix<T, 0, Dimension>;
+
+      mapped_backend(const source_t<T, Dimension>& source, const driver_config& cfg)
+      {
+            if (cfg.mix.has_writes())
+                  throw invalid_argument("mapped backend is read-only, use a mix of get only");
+
+            string path = cfg.save.empty() ? internal::make_temporary_file("roro_matrix_driver") : cfg.save;
+            image_t::build(source, path);
+            image = image_t(path);
+            if (cfg.save.empty())
+                  remove(path.c_str());
+      }
+
+      size_t size() const
+      {
+            return image.size();
+      }
+
+      struct worker
+      {
+            const image_t& image;
+
+            T get(const coordinates_t& c) const
+            {
+                  return image.get(c);
+            }
+
+            void set(const coordinates_t&, T) {}
+            void add(const coordinates_t&, T) {}
+            void erase(const coordinates_t&) {}
+      };
+
+      worker make_worker()
+      {
+            return worker { image };
+      }
+
+  private:
+      image_t image;
+};
+#endif
+
+struct run_report
+{
+      size_t cells = 0;
+      size_t ops_per_run = 0;
+      //! Время заполнения каждого повторения
+      vector<double> fill_ms;
+      vector<double> ops_per_second;
+      latency_histogram latency;
+};
+
+//! Операции одного потока, сгенерированные до замера
+template <size_t Dimension>
+struct op_stream
+{
+      vector<array<size_t, Dimension>> coordinates;
+      vector<op_kind> kinds;
+};
+
+template <size_t Dimension>
+op_stream<Dimension> make_ops(const driver_config& cfg, size_t thread)
+{
+      op_stream<Dimension> ops;
+      ops.coordinates = workload::make_coordinates<Dimension>(cfg.pattern, cfg.ops, cfg.density, cfg.seed + 1 + thread);
+
+      mt19937_64 rng(cfg.seed + 1000 + thread);
+      discrete_distribution<int> kind(cfg.mix.weights.begin(), cfg.mix.weights.end());
+      ops.kinds.resize(cfg.ops);
+      for (auto& k : ops.kinds)
+            k = static_cast<op_kind>(kind(rng));
+      return ops;
+}
+
+template <typename Backend, typename T, size_t Dimension>
+run_report run(const source_t<T, Dimension>& source, const driver_config& cfg)
+{
+      vector<op_stream<Dimension>> streams;
+      for (size_t t = 0; t < cfg.threads; ++t)
+            streams.push_back(make_ops<Dimension>(cfg, t));
+
+      run_report report;
+      report.ops_per_run = cfg.ops * cfg.threads;
+
+      for (size_t rep = 0; rep < cfg.repetitions; ++rep)
+      {
+            auto fill_start = chrono::steady_clock::now();
+            Backend backend(source, cfg);
+            report.fill_ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - fill_start).count());
+            report.cells = backend.size();
+
+            vector<latency_histogram> histograms(cfg.threads);
+            // сумма прочитанных значений не дает компилятору выбросить чтения
+            vector<T> checksums(cfg.threads);
+            atomic<size_t> ready { 0 };
+            atomic<bool> go { false };
+            vector<thread> threads;
+            for (size_t t = 0; t < cfg.threads; ++t)
+            {
+                  threads.emplace_back([&, t] {
+                        auto worker = backend.make_worker();
+                        const op_stream<Dimension>& ops = streams[t];
+                        latency_histogram& latency = histograms[t];
+                        const T delta = T(1);
+                        T checksum = T();
+
+                        ++ready;
+                        while (!go.load(memory_order_acquire))
+                              this_thread::yield();
+
+                        // одно чтение часов на операцию: задержка - интервал между соседними отметками
+                        auto previous = chrono::steady_clock::now();
+                        for (size_t n = 0; n < ops.kinds.size(); ++n)
+                        {
+                              const auto& c = ops.coordinates[n];
+                              switch (ops.kinds[n])
+                              {
+                              case op_kind::get:
+                                    checksum += worker.get(c);
+                                    break;
+                              case op_kind::set:
+                                    worker.set(c, static_cast<T>(n % 1000 + 1));
+                                    break;
+                              case op_kind::add:
+                                    worker.add(c, delta);
+                                    break;
+                              case op_kind::erase:
+                                    worker.erase(c);
+                                    break;
+                              }
+
+                              auto now = chrono::steady_clock::now();
+                              latency.record(static_cast<std::uint64_t>(chrono::duration_cast<chrono::nanoseconds>(now - previous).count()));
+                              previous = now;
+                        }
+
+                        checksums[t] = checksum;
+                  });
+            }
+
+            while (ready.load() != cfg.threads)
+                  this_thread::yield();
+            auto start = chrono::steady_clock::now();
+            go.store(true, memory_order_release);
+            for (auto& t : threads)
+                  t.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            report.ops_per_second.push_back(seconds > 0.0 ? report.ops_per_run / seconds : 0.0);
+            for (const auto& h : histograms)
+                  report.latency.merge(h);
+      }
+
+      return report;
+}
+
+void print_report(const driver_config& cfg, const run_report& r)
+{
+      vector<double> sorted(r.ops_per_second);
+      sort(sorted.begin(), sorted.end());
+      double median = sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+      double fill_min = r.fill_ms.empty() ? 0.0 : *min_element(r.fill_ms.begin(), r.fill_ms.end());
+      double fill_mean = r.fill_ms.empty() ? 0.0 : accumulate(r.fill_ms.begin(), r.fill_ms.end(), 0.0) / static_cast<double>(r.fill_ms.size());
+      std::uint64_t rss = peak_rss_kb();
+
+      cout << "config: " << cfg.to_string() << "\n"
+           << "cells: " << r.cells << "  fill: " << fill_mean << " ms (mean of " << r.fill_ms.size() << ", min " << fill_min << ")\n"
+           << "throughput: " << median << " ops/s (median of " << sorted.size() << ", min "
+           << (sorted.empty() ? 0.0 : sorted.front()) << ", max " << (sorted.empty() ? 0.0 : sorted.back()) << ")\n"
+           << "latency ns: p50 " << r.latency.percentile(0.5) << "  p90 " << r.latency.percentile(0.9)
+           << "  p99 " << r.latency.percentile(0.99) << "  p99.9 " << r.latency.percentile(0.999)
+           << "  max " << r.latency.max_ns() << "\n"
+           << "peak RSS: " << rss << " KB" << endl;
+
+      if (!cfg.json.empty())
+      {
+            ofstream json(cfg.json);
+            json << "{\n  \"config\": \"" << cfg.to_string() << "\",\n"
+                 << "  \"cells\": " << r.cells << ",\n"
+                 << "  \"fill_ms\": " << fill_mean << ",\n"
+                 << "  \"fill_ms_min\": " << fill_min << ",\n"
+                 << "  \"ops_per_run\": " << r.ops_per_run << ",\n"
+                 << "  \"ops_per_second\": " << median << ",\n"
+                 << "  \"ops_per_second_samples\": [";
+            for (size_t i = 0; i < r.ops_per_second.size(); ++i)
+                  json << (i ? ", " : "") << r.ops_per_second[i];
+            json << "],\n"
+                 << "  \"latency_ns\": {\"p50\": " << r.latency.percentile(0.5) << ", \"p90\": " << r.latency.percentile(0.9)
+                 << ", \"p99\": " << r.latency.percentile(0.99) << ", \"p999\": " << r.latency.percentile(0.999)
+                 << ", \"max\": " << r.latency.max_ns() << "},\n"
+                 << "  \"peak_rss_kb\": " << rss << "\n}\n";
+      }
+}
+
+//! Ячейки для заполнения: сгенерированные по схеме или взятые из образа -load
+template <typename T, size_t Dimension>
+source_t<T, Dimension> make_source(const driver_config& cfg)
+{
+      source_t<T, Dimension> source;
+#if defined(RORO_LIB_HAS_MMAP)
+      if (!cfg.load.empty())
+      {
+            mapped_matrix<T, 0, Dimension> image(cfg.load);
+            for (auto node : image)
+            {
+                  auto c = internal::node_coordinates<Dimension>(node, make_index_sequence<Dimension>());
+                  T value = get<Dimension>(node);
+                  source.set_batch(&c, 1, &value);
+            }
+            return source;
+      }
+#else
+      if (!cfg.load.empty() || !cfg.save.empty())
+            throw invalid_argument("matrix images need mmap, which this platform lacks");
+#endif
+
+      auto coords = workload::make_coordinates<Dimension>(cfg.pattern, cfg.nnz, cfg.density, cfg.seed);
+      vector<T> values(coords.size());
+      for (size_t n = 0; n < values.size(); ++n)
+            values[n] = static_cast<T>(n % 1000 + 1);
+      source.set_batch(coords, values);
+
+#if defined(RORO_LIB_HAS_MMAP)
+      if (!cfg.save.empty() && cfg.backend != "mapped")
+            mapped_matrix<T, 0, Dimension>::build(source, cfg.save);
+#endif
+      return source;
+}
+
+template <typename T, size_t Dimension, typename Policy>
+run_report run_mutable(const source_t<T, Dimension>& source, const driver_config& cfg)
+{
+      if (cfg.threads > 1 && cfg.mix.has_writes())
+            return run<sharded_backend<T, Dimension, Policy>, T, Dimension>(source, cfg);
+      return run<local_backend<T, Dimension, Policy>, T, Dimension>(source, cfg);
+}
+
+//! Чтение stdin кусками: read() возвращает то, что уже пришло, и не ждет заполнения буфера
+size_t read_stdin(char* buffer, size_t capacity)
+{
+#if defined(__unix__) || defined(__APPLE__)
+      for (;;)
+      {
+            ssize_t got = ::read(STDIN_FILENO, buffer, capacity);
+            if (got >= 0)
+                  return static_cast<size_t>(got);
+            if (errno != EINTR)
+                  throw system_error(errno, generic_category(), "read stdin");
+      }
+#else
+      return fread(buffer, 1, capacity, stdin);
+#endif
+}
+
+void write_stdout(const char* data, size_t size)
+{
+#if defined(__unix__) || defined(__APPLE__)
+      while (size)
+      {
+            ssize_t put = ::write(STDOUT_FILENO, data, size);
+            if (put < 0)
+            {
+                  if (errno == EINTR)
+                        continue;
+                  throw system_error(errno, generic_category(), "write stdout");
+            }
+            data += put;
+            size -= static_cast<size_t>(put);
+      }
+#else
+      if (fwrite(data, 1, size, stdout) != size)
+            throw runtime_error("write stdout");
+      fflush(stdout);
+#endif
+}
+
+template <typename T, size_t Dimension>
+using query_matrix_t = matrix<T, 0, Dimension, spatial_policy>;
+
+//! Матрица для режимов запросов: с индексом для RANGE, заполняется один раз
+template <typename T, size_t Dimension>
+void fill_query_matrix(const source_t<T, Dimension>& source, query_matrix_t<T, Dimension>& m)
+{
+      vector<array<size_t, Dimension>> coords;
+      vector<T> values;
+      for (auto node : source.stream())
+      {
+            coords.push_back(internal::node_coordinates<Dimension>(node, make_index_sequence<Dimension>()));
+            values.push_back(get<Dimension>(node));
+      }
+      m.set_batch(coords, values);
+}
+
+//! Режим запросов: матрица обслуживает поток команд со stdin
+template <typename T, size_t Dimension>
+void serve_queries(const source_t<T, Dimension>& source, const driver_config& cfg)
+{
+      query::wire_format format;
+      if (cfg.query == "text")
+            format = query::wire_format::text;
+      else if (cfg.query == "binary")
+            format = query::wire_format::binary;
+      else
+            throw invalid_argument("unknown query format: " + cfg.query);
+
+      query_matrix_t<T, Dimension> m;
+      fill_query_matrix<T, Dimension>(source, m);
+      query::serve(m, format, read_stdin, write_stdout);
+}
+
+#if defined(RORO_LIB_HAS_EPOLL)
+//! Режим сервера: матрица обслуживает клиентов по сокету, пока процесс не остановят
+template <typename T, size_t Dimension>
+void serve_socket(const source_t<T, Dimension>& source, const driver_config& cfg)
+{
+      query_matrix_t<T, Dimension> m;
+      fill_query_matrix<T, Dimension>(source, m);
+
+      using server_t = query::server<query_matrix_t<T, Dimension>>;
+      server_t server(m, cfg.serve);
+
+      // SIGINT и SIGTERM останавливают цикл: stop() только пишет в eventfd, это безопасно в обработчике
+      static server_t* running = nullptr;
+      running = &server;
+      signal(SIGINT, [](int) { running->stop(); });
+      signal(SIGTERM, [](int) { running->stop(); });
+
+      cerr << "cells: " << m.size() << "  listening on " << server.address() << endl;
+      server.run();
+
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+}
+
+//! Кадр клиента: двоичные команды подряд и размер ответа на них
+struct client_frame
+{
+      string commands;
+      size_t reply_size = 0;
+};
+
+template <size_t Dimension>
+vector<client_frame> make_frames(const driver_config& cfg, size_t thread)
+{
+      op_stream<Dimension> ops = make_ops<Dimension>(cfg, thread);
+      vector<client_frame> frames;
+      for (size_t first = 0; first < ops.kinds.size(); first += cfg.batch)
+      {
+            client_frame frame;
+            const size_t last = min(ops.kinds.size(), first + cfg.batch);
+            for (size_t n = first; n < last; ++n)
+            {
+                  std::int64_t value = 0;
+                  query::opcode op = query::opcode::set;
+                  switch (ops.kinds[n])
+                  {
+                  case op_kind::get:
+                        op = query::opcode::get;
+                        break;
+                  case op_kind::set:
+                        value = static_cast<std::int64_t>(n % 1000 + 1);
+                        break;
+                  case op_kind::add:
+                        op = query::opcode::add;
+                        value = 1;
+                        break;
+                  case op_kind::erase:
+                        break;
+                  }
+
+                  frame.commands.push_back(static_cast<char>(op));
+                  for (size_t c : ops.coordinates[n])
+                  {
+                        std::uint64_t coordinate = c;
+                        frame.commands.append(reinterpret_cast<const char*>(&coordinate), sizeof(coordinate));
+                  }
+                  if (op != query::opcode::get)
+                        frame.commands.append(reinterpret_cast<const char*>(&value), sizeof(value));
+                  // статус и значение ячейки
+                  frame.reply_size += 1 + sizeof(std::int64_t);
+            }
+            frames.push_back(std::move(frame));
+      }
+      return frames;
+}
+
+//! Генератор нагрузки для -serve: поток на соединение, до in_flight кадров без ответа
+template <size_t Dimension>
+void run_client(const driver_config& cfg)
+{
+      if (cfg.batch == 0 || cfg.in_flight == 0)
+            throw invalid_argument("batch and in_flight should be positive");
+
+      vector<vector<client_frame>> frames;
+      for (size_t t = 0; t < cfg.threads; ++t)
+            frames.push_back(make_frames<Dimension>(cfg, t));
+
+      vector<double> commands_per_second;
+      latency_histogram latency;
+      for (size_t rep = 0; rep < cfg.repetitions; ++rep)
+      {
+            vector<latency_histogram> histograms(cfg.threads);
+            vector<exception_ptr> errors(cfg.threads);
+            atomic<size_t> ready { 0 };
+            atomic<bool> go { false };
+            vector<thread> threads;
+            for (size_t t = 0; t < cfg.threads; ++t)
+            {
+                  threads.emplace_back([&, t] {
+                        bool counted = false;
+                        try
+                        {
+                              query::client connection(cfg.client);
+                              const vector<client_frame>& own = frames[t];
+                              vector<chrono::steady_clock::time_point> sent(own.size());
+                              string reply;
+
+                              ++ready;
+                              counted = true;
+                              while (!go.load(memory_order_acquire))
+                                    this_thread::yield();
+
+                              size_t next = 0;
+                              for (size_t answered = 0; answered < own.size(); ++answered)
+                              {
+                                    for (; next < own.size() && next < answered + cfg.in_flight; ++next)
+                                    {
+                                          sent[next] = chrono::steady_clock::now();
+                                          connection.send_all(own[next].commands.data(), own[next].commands.size());
+                                    }
+
+                                    reply.resize(own[answered].reply_size);
+                                    connection.receive_exact(&reply[0], reply.size());
+                                    histograms[t].record(static_cast<std::uint64_t>(
+                                        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - sent[answered]).count()));
+                              }
+                        }
+                        catch (...)
+                        {
+                              errors[t] = current_exception();
+                              if (!counted)
+                                    ++ready;
+                        }
+                  });
+            }
+
+            while (ready.load() != cfg.threads)
+                  this_thread::yield();
+            auto start = chrono::steady_clock::now();
+            go.store(true, memory_order_release);
+            for (auto& t : threads)
+                  t.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            for (auto& error : errors)
+                  if (error)
+                        rethrow_exception(error);
+            commands_per_second.push_back(seconds > 0.0 ? cfg.ops * cfg.threads / seconds : 0.0);
+            for (const auto& h : histograms)
+                  latency.merge(h);
+      }
+
+      sort(commands_per_second.begin(), commands_per_second.end());
+      cout << "config: client=" << cfg.client << " dimension=" << Dimension << " threads=" << cfg.threads
+           << " repetitions=" << cfg.repetitions << " ops=" << cfg.ops << " mix=" << cfg.mix.to_string()
+           << " batch=" << cfg.batch << " in_flight=" << cfg.in_flight << "\n"
+           << "throughput: " << commands_per_second[commands_per_second.size() / 2] << " commands/s (median of "
+           << commands_per_second.size() << ")\n"
+           << "frame round trip ns: p50 " << latency.percentile(0.5) << "  p90 " << latency.percentile(0.9)
+           << "  p99 " << latency.percentile(0.99) << "  max " << latency.max_ns() << endl;
+}
+#endif
+
+//! Режим выгрузки: ячейки пишутся в файл списком "x y value"
+template <typename T, size_t Dimension>
+void dump_source(const source_t<T, Dimension>& source, const driver_config& cfg)
+{
+      ofstream file(cfg.dump, ios::binary);
+      if (!file)
+            throw runtime_error("can't open " + cfg.dump);
+
+      size_t bytes = 0;
+      dump_options options;
+      options.threads = cfg.threads;
+
+      auto start = chrono::steady_clock::now();
+      dump_coordinates(source, [&](const char* data, size_t size) {
+            file.write(data, static_cast<streamsize>(size));
+            bytes += size;
+      }, options);
+      file.close();
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+      if (!file)
+            throw runtime_error("can't write " + cfg.dump);
+      cerr << "cells: " << source.size() << "  bytes: " << bytes << "  time: " << seconds << " s  threads: " << cfg.threads << endl;
+}
+
+template <typename T, size_t Dimension>
+void drive(const driver_config& cfg)
+{
+#if defined(RORO_LIB_HAS_EPOLL)
+      if (!cfg.client.empty())
+            return run_client<Dimension>(cfg);
+#else
+      if (!cfg.client.empty() || !cfg.serve.empty())
+            throw invalid_argument("server mode needs epoll, which this platform lacks");
+#endif
+
+      source_t<T, Dimension> source = make_source<T, Dimension>(cfg);
+
+      if (!cfg.query.empty())
+            return serve_queries<T, Dimension>(source, cfg);
+      if (!cfg.dump.empty())
+            return dump_source<T, Dimension>(source, cfg);
+#if defined(RORO_LIB_HAS_EPOLL)
+      if (!cfg.serve.empty())
+            return serve_socket<T, Dimension>(source, cfg);
+#endif
+
+      run_report report;
+      if (cfg.backend == "hash")
+            report = run_mutable<T, Dimension, default_policy>(source, cfg);
+      else if (cfg.backend == "adaptive")
+            report = run_mutable<T, Dimension, adaptive_policy>(source, cfg);
+      else if (cfg.backend == "cow")
+            report = run_mutable<T, Dimension, copy_on_write_policy>(source, cfg);
+      else if (cfg.backend == "persistent")
+            report = run<persistent_backend<T, Dimension>, T, Dimension>(source, cfg);
+#if defined(RORO_LIB_HAS_MMAP)
+      else if (cfg.backend == "mapped")
+            report = run<mapped_backend<T, Dimension>, T, Dimension>(source, cfg);
+#endif
+      else
+            throw invalid_argument("unknown backend: " + cfg.backend);
+
+      print_report(cfg, report);
+}
+
+template <typename T>
+void drive_dimension(const driver_config& cfg)
+{
+      switch (cfg.dimension)
+      {
+      case 1:
+            return drive<T, 1>(cfg);
+      case 2:
+            return drive<T, 2>(cfg);
+      case 3:
+            return drive<T, 3>(cfg);
+      case 4:
+            return drive<T, 4>(cfg);
+      }
+      throw invalid_argument("dimension should be 1..4: " + to_string(cfg.dimension));
+}
+
+void drive(const driver_config& cfg)
+{
+      if (cfg.value_type == "int")
+            drive_dimension<int>(cfg);
+      else if (cfg.value_type == "long_long")
+            drive_dimension<long long>(cfg);
+      else if (cfg.value_type == "short")
+            drive_dimension<short>(cfg);
+      else
+            throw invalid_argument("unknown value type: " + cfg.value_type);
+}
 
 
 #ifndef _TEST
@@ -40,6 +1073,27 @@ int main(int argc, char* argv[])
             PCL.AddFormatOfArg("help", no_argument, '?');
             PCL.AddFormatOfArg("version", no_argument, 'v');
             PCL.AddFormatOfArg("math_oder_dimensions", no_argument, 'm');
+            PCL.AddFormatOfArg("demo", no_argument, 'g');
+            PCL.AddFormatOfArg("dimension", required_argument, 'd');
+            PCL.AddFormatOfArg("value_type", required_argument, 'y');
+            PCL.AddFormatOfArg("nnz", required_argument, 'n');
+            PCL.AddFormatOfArg("pattern", required_argument, 'p');
+            PCL.AddFormatOfArg("density", required_argument, 'e');
+            PCL.AddFormatOfArg("threads", required_argument, 't');
+            PCL.AddFormatOfArg("repetitions", required_argument, 'r');
+            PCL.AddFormatOfArg("ops", required_argument, 'o');
+            PCL.AddFormatOfArg("mix", required_argument, 'x');
+            PCL.AddFormatOfArg("backend", required_argument, 'b');
+            PCL.AddFormatOfArg("seed", required_argument, 's');
+            PCL.AddFormatOfArg("load", required_argument, 'l');
+            PCL.AddFormatOfArg("save", required_argument, 'w');
+            PCL.AddFormatOfArg("json", required_argument, 'j');
+            PCL.AddFormatOfArg("query", required_argument, 'q');
+            PCL.AddFormatOfArg("serve", required_argument, 'a');
+            PCL.AddFormatOfArg("client", required_argument, 'c');
+            PCL.AddFormatOfArg("batch", required_argument, 'k');
+            PCL.AddFormatOfArg("in_flight", required_argument, 'i');
+            PCL.AddFormatOfArg("dump", required_argument, 'u');
 
             PCL.SetShowError(false);
             PCL.Parser(argc, argv);
@@ -54,41 +1108,64 @@ int main(int argc, char* argv[])
                   version_matrix();
                   return 0;
             }
-
-            matrix<int, 0> diagonal_matrix;
-
-            for (int i = 0; i < 10; ++i)
+            if (PCL.Option['g'])
             {
-                  diagonal_matrix[i][i] = i;
+                  demo(static_cast<bool>(PCL.Option['m']));
+                  return 0;
             }
 
-            for (int i = 0; i < 10; ++i)
-            {
-                  diagonal_matrix[i][9 - i] = 9 - i;
-            }
+            driver_config cfg;
+            if (PCL.Option['d'])
+                  cfg.dimension = stoul(PCL.Option['d'].ParamOption[0]);
+            if (PCL.Option['y'])
+                  cfg.value_type = PCL.Option['y'].ParamOption[0];
+            if (PCL.Option['n'])
+                  cfg.nnz = stoul(PCL.Option['n'].ParamOption[0]);
+            if (PCL.Option['p'])
+                  cfg.pattern = workload::parse_pattern(PCL.Option['p'].ParamOption[0]);
+            if (PCL.Option['e'])
+                  cfg.density = stod(PCL.Option['e'].ParamOption[0]);
+            if (PCL.Option['t'])
+                  cfg.threads = stoul(PCL.Option['t'].ParamOption[0]);
+            if (PCL.Option['r'])
+                  cfg.repetitions = stoul(PCL.Option['r'].ParamOption[0]);
+            if (PCL.Option['o'])
+                  cfg.ops = stoul(PCL.Option['o'].ParamOption[0]);
+            if (PCL.Option['b'])
+                  cfg.backend = PCL.Option['b'].ParamOption[0];
+            if (PCL.Option['x'])
+                  cfg.mix = op_mix::parse(PCL.Option['x'].ParamOption[0]);
+            else if (cfg.backend == "mapped")
+                  cfg.mix = op_mix::parse("get:100");
+            if (PCL.Option['s'])
+                  cfg.seed = stoull(PCL.Option['s'].ParamOption[0]);
+            if (PCL.Option['l'])
+                  cfg.load = PCL.Option['l'].ParamOption[0];
+            if (PCL.Option['w'])
+                  cfg.save = PCL.Option['w'].ParamOption[0];
+            if (PCL.Option['j'])
+                  cfg.json = PCL.Option['j'].ParamOption[0];
+            if (PCL.Option['q'])
+                  cfg.query = PCL.Option['q'].ParamOption[0];
+            if (PCL.Option['a'])
+                  cfg.serve = PCL.Option['a'].ParamOption[0];
+            if (PCL.Option['c'])
+                  cfg.client = PCL.Option['c'].ParamOption[0];
+            if (PCL.Option['k'])
+                  cfg.batch = stoul(PCL.Option['k'].ParamOption[0]);
+            if (PCL.Option['i'])
+                  cfg.in_flight = stoul(PCL.Option['i'].ParamOption[0]);
+            if (PCL.Option['u'])
+                  cfg.dump = PCL.Option['u'].ParamOption[0];
 
-            for (int i = 1; i < 9; ++i)
-            {
-                  for (int j = 1; j < 9; ++j)
-                  {
-                        cout << diagonal_matrix[i][j] << " ";
-                  }
-                  cout << "\n";
-            }
+            if (cfg.threads == 0)
+                  cfg.threads = max(1u, thread::hardware_concurrency());
+            if (cfg.ops == 0)
+                  cfg.ops = cfg.nnz;
+            if (cfg.repetitions == 0)
+                  cfg.repetitions = 1;
 
-            cout << diagonal_matrix.size() << "\n";
-
-            for (auto const& [row, column, v] : diagonal_matrix)
-            {
-                  if (PCL.Option['m'])
-                  {
-                        std::cout << column << "x" << row << " " << v << std::endl;
-                  }
-                  else
-                  {
-                        std::cout << row << "x" << column << " " << v << std::endl;
-                  }                  
-            }
+            drive(cfg);
       }
       catch (const exception& ex)
       {
@@ -0,0 +1,186 @@
+﻿#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <ostream>
+#include <utility>
+
+namespace bench
+{
+      /*!   \brief  Не дает компилятору выбросить вычисление, результат которого не используется
+      */
+      template <typename T>
+      inline void do_not_optimize(const T& value)
+      {
+#if defined(__GNUC__) || defined(__clang__)
+            asm volatile("" : : "r,m"(value) : "memory");
+#else
+            static volatile const T* sink;
+            sink = &value;
+#endif
+      }
+
+      //! Метки результата: пары имя - значение, в отчете идут в порядке добавления
+      using labels = std::vector<std::pair<std::string, std::string>>;
+
+      //! Результат одного бенчмарка: время каждого повтора в наносекундах и число операций в повторе
+      struct result
+      {
+            std::string name;
+            bench::labels labels;
+            std::size_t items = 0;
+            std::vector<double> samples_ns;
+
+            double median_ns() const
+            {
+                  std::vector<double> sorted(samples_ns);
+                  std::sort(sorted.begin(), sorted.end());
+                  std::size_t n = sorted.size();
+                  if (n == 0)
+                        return 0.0;
+                  return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+            }
+
+            double min_ns() const
+            {
+                  return samples_ns.empty() ? 0.0 : *std::min_element(samples_ns.begin(), samples_ns.end());
+            }
+
+            double mean_ns() const
+            {
+                  return samples_ns.empty() ? 0.0 : std::accumulate(samples_ns.begin(), samples_ns.end(), 0.0) / samples_ns.size();
+            }
+
+            //! Медианное абсолютное отклонение - устойчивая к выбросам оценка шума
+            double mad_ns() const
+            {
+                  double m = median_ns();
+                  result deviations;
+                  for (double s : samples_ns)
+                        deviations.samples_ns.push_back(s > m ? s - m : m - s);
+                  return deviations.median_ns();
+            }
+
+            double ns_per_item() const
+            {
+                  return items ? median_ns() / items : median_ns();
+            }
+
+            double items_per_second() const
+            {
+                  double m = median_ns();
+                  return m > 0.0 ? items * 1e9 / m : 0.0;
+            }
+      };
+
+      /*!   \brief  Измеряет операцию op заданное число раз.
+
+                    Перед каждым повтором вызывается setup(), его время не учитывается. Результат setup()
+                    передается в op() по ссылке, так что op() может изменять подготовленные данные.
+      */
+      template <typename Setup, typename Op>
+      result measure(std::string name, std::size_t items, std::size_t repetitions, Setup&& setup, Op&& op)
+      {
+            result r;
+            r.name = std::move(name);
+            r.items = items;
+
+            for (std::size_t rep = 0; rep < repetitions; ++rep)
+            {
+                  auto context = setup();
+
+                  auto start = std::chrono::steady_clock::now();
+                  op(context);
+                  auto stop = std::chrono::steady_clock::now();
+
+                  do_not_optimize(context);
+                  r.samples_ns.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+            }
+
+            return r;
+      }
+
+      inline std::string json_escape(const std::string& str)
+      {
+            std::string out;
+            for (char ch : str)
+            {
+                  if (ch == '"' || ch == '\\')
+                        out += '\\';
+                  out += ch;
+            }
+            return out;
+      }
+
+      //! Отчет в формате JSON, близком к формату Google Benchmark
+      inline void write_json(std::ostream& os, const std::vector<result>& results)
+      {
+            os << "{\n  \"benchmarks\": [\n";
+            for (std::size_t i = 0; i < results.size(); ++i)
+            {
+                  const result& r = results[i];
+                  os << "    {\"name\": \"" << json_escape(r.name) << "\"";
+                  for (const auto& [label, value] : r.labels)
+                        os << ", \"" << json_escape(label) << "\": \"" << json_escape(value) << "\"";
+                  os << ", \"items\": " << r.items
+                     << ", \"repetitions\": " << r.samples_ns.size()
+                     << ", \"real_time\": " << r.median_ns()
+                     << ", \"min_time\": " << r.min_ns()
+                     << ", \"mean_time\": " << r.mean_ns()
+                     << ", \"ns_per_item\": " << r.ns_per_item()
+                     << ", \"items_per_second\": " << r.items_per_second()
+                     << ", \"time_unit\": \"ns\"}"
+                     << (i + 1 < results.size() ? ",\n" : "\n");
+            }
+            os << "  ]\n}\n";
+      }
+
+      //! Короткий отчет для консоли
+      inline void write_text(std::ostream& os, const result& r)
+      {
+            os << r.name << "  " << r.ns_per_item() << " ns/item  " << r.items_per_second() << " items/s\n";
+      }
+
+      /*!   \brief  Группа замеров с общим суффиксом имени и общими метками.
+
+                    add() дает замеру имя op + suffix и пропускает его, если имя не содержит filter. Иначе
+                    измеряет его (см. measure), ставит метки "op", общие и extra, печатает строку отчета в log
+                    и добавляет результат в results.
+      */
+      class group
+      {
+        public:
+            group(std::vector<result>& results, std::ostream& log, std::string filter, std::size_t repetitions, std::string suffix,
+                  bench::labels common = {})
+                : results(results), log(log), filter(std::move(filter)), repetitions(repetitions), suffix(std::move(suffix)),
+                  common(std::move(common))
+            {
+            }
+
+            template <typename Setup, typename Op>
+            void add(const std::string& op, std::size_t items, Setup&& setup, Op&& body, const bench::labels& extra = {})
+            {
+                  std::string name = op + suffix;
+                  if (!filter.empty() && name.find(filter) == std::string::npos)
+                        return;
+
+                  result r = measure(std::move(name), items, repetitions, setup, body);
+                  r.labels.emplace_back("op", op);
+                  r.labels.insert(r.labels.end(), common.begin(), common.end());
+                  r.labels.insert(r.labels.end(), extra.begin(), extra.end());
+                  write_text(log, r);
+                  results.push_back(std::move(r));
+            }
+
+        private:
+            std::vector<result>& results;
+            std::ostream& log;
+            const std::string filter;
+            const std::size_t repetitions;
+            const std::string suffix;
+            const bench::labels common;
+      };
+}
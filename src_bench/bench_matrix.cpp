@@ -0,0 +1,632 @@
+﻿#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <initializer_list>
+#include <thread>
+#include <cstdio>
+
+#include "CLParser.h"
+#include "matrix.h"
+#include "matrix_workload.h"
+#include "matrix_stencil.h"
+#include "matrix_cow.h"
+#include "matrix_persistent.h"
+#include "matrix_buffered.h"
+#include "matrix_mapped.h"
+#include "matrix_dump.h"
+#include "bench_harness.h"
+
+using namespace std;
+using namespace roro_lib;
+
+struct bench_config
+{
+      size_t nnz = 50000;
+      size_t repetitions = 5;
+      size_t threads = 0;
+      string filter;
+      vector<double> densities = { 0.001, 0.1 };
+};
+
+template <typename T>
+const char* type_name();
+template <>
+const char* type_name<short>() { return "short"; }
+template <>
+const char* type_name<int>() { return "int"; }
+template <>
+const char* type_name<long long>() { return "long_long"; }
+
+template <typename T>
+T value_for(size_t n)
+{
+      return static_cast<T>(n % 100 + 1);
+}
+
+//! Проходит ли фильтр хотя бы одна операция, чтобы не готовить данные для пропускаемых замеров
+bool selected(const bench_config& cfg, initializer_list<const char*> ops, const string& suffix)
+{
+      if (cfg.filter.empty())
+            return true;
+      return any_of(ops.begin(), ops.end(), [&](const char* op) { return (op + suffix).find(cfg.filter) != string::npos; });
+}
+
+//! Группа замеров с фильтром и числом повторов из конфигурации, отчет печатается в cout
+bench::group make_group(const bench_config& cfg, vector<bench::result>& results, const string& suffix, bench::labels common)
+{
+      return bench::group(results, cout, cfg.filter, cfg.repetitions, suffix, std::move(common));
+}
+
+//! Общие метки замеров над случайной двумерной матрицей int
+bench::labels random_d2_labels(double density, size_t nnz)
+{
+      return { { "dimension", "2" }, { "value_type", "int" }, { "pattern", "random" }, { "density", to_string(density) }, { "nnz", to_string(nnz) } };
+}
+
+/*!   \brief  Прогоняет все операции над матрицей для одной комбинации размерности, типа, схемы и плотности
+*/
+template <typename T, size_t Dimension>
+void bench_case(const bench_config& cfg, workload::pattern p, double density, vector<bench::result>& results)
+{
+      using matrix_t = matrix<T, 0, Dimension>;
+
+      string suffix = "/d" + to_string(Dimension) + "/" + type_name<T>() + "/" + workload::to_string(p) + "/" + to_string(density);
+      if (!selected(cfg, { "insert", "lookup_hit", "lookup_miss", "erase", "iterate", "parallel_iterate", "copy", "clear" }, suffix))
+            return;
+
+      auto coords = workload::make_coordinates<Dimension>(p, cfg.nnz, density);
+      auto missing = workload::make_missing(coords);
+
+      auto filled = make_shared<matrix_t>();
+      for (size_t n = 0; n < coords.size(); ++n)
+            workload::at(*filled, coords[n]) = value_for<T>(n);
+
+      auto group = make_group(cfg, results, suffix,
+          { { "dimension", to_string(Dimension) },
+              { "value_type", type_name<T>() },
+              { "pattern", workload::to_string(p) },
+              { "density", to_string(density) },
+              { "nnz", to_string(filled->size()) } });
+
+      auto shared = [&] { return filled; };
+      auto copied = [&] { return make_unique<matrix_t>(*filled); };
+
+      group.add("insert", coords.size(), [] { return make_unique<matrix_t>(); },
+          [&](auto& m) {
+                for (size_t n = 0; n < coords.size(); ++n)
+                      workload::at(*m, coords[n]) = value_for<T>(n);
+          });
+
+      group.add("lookup_hit", coords.size(), shared,
+          [&](auto& m) {
+                T sum = 0;
+                for (const auto& c : coords)
+                      sum += workload::at(*m, c);
+                bench::do_not_optimize(sum);
+          });
+
+      group.add("lookup_miss", missing.size(), shared,
+          [&](auto& m) {
+                T sum = 0;
+                for (const auto& c : missing)
+                      sum += workload::at(*m, c);
+                bench::do_not_optimize(sum);
+          });
+
+      group.add("erase", coords.size(), copied,
+          [&](auto& m) {
+                for (const auto& c : coords)
+                      workload::at(*m, c) = 0;
+          });
+
+      group.add("iterate", filled->size(), shared,
+          [&](auto& m) {
+                T sum = 0;
+                for (const auto& node : *m)
+                      sum += std::get<Dimension>(node);
+                bench::do_not_optimize(sum);
+          });
+
+      group.add("parallel_iterate", filled->size(), shared,
+          [&](auto& m) {
+                auto parts = m->partitions(internal::thread_count(cfg.threads));
+                vector<T> sums(parts.size());
+                internal::run_parts(parts.size(), [&](size_t part) {
+                      T sum = 0;
+                      for (auto&& node : parts[part])
+                            sum += std::get<Dimension>(node);
+                      sums[part] = sum;
+                });
+                bench::do_not_optimize(sums);
+          });
+
+      group.add("copy", filled->size(), [&] { return make_pair(filled, matrix_t()); },
+          [&](auto& ctx) {
+                ctx.second = *ctx.first;
+          });
+
+      group.add("clear", filled->size(), copied,
+          [&](auto& m) {
+                m->clear();
+          });
+}
+
+template <typename T, size_t Dimension>
+void bench_all_patterns(const bench_config& cfg, vector<bench::result>& results)
+{
+      for (auto p : { workload::pattern::random, workload::pattern::diagonal, workload::pattern::banded, workload::pattern::clustered })
+      {
+            for (double density : cfg.densities)
+                  bench_case<T, Dimension>(cfg, p, density, results);
+      }
+}
+
+/*!   \brief  Один шаг игры "Жизнь" на случайном поле: цикл через operator[] против stencil_grid
+*/
+void bench_stencil(const bench_config& cfg, vector<bench::result>& results)
+{
+      using matrix_t = matrix<int, 0, 2>;
+      const double density = 0.3;
+
+      auto life = [](int self, const array<int, 8>& nb) {
+            int alive = static_cast<int>(count(nb.begin(), nb.end(), 1));
+            return (alive == 3 || (self && alive == 2)) ? 1 : 0;
+      };
+
+      const string suffix = "/d2/int/random/" + to_string(density);
+      if (!selected(cfg, { "stencil_naive", "stencil_apply", "stencil_grid" }, suffix))
+            return;
+
+      auto initial = make_shared<matrix_t>();
+      for (const auto& c : workload::make_coordinates<2>(workload::pattern::random, cfg.nnz, density))
+            workload::at(*initial, c) = 1;
+
+      auto group = make_group(cfg, results, suffix, random_d2_labels(density, initial->size()));
+
+      group.add("stencil_naive", initial->size(), [&] { return make_pair(initial, matrix_t()); },
+          [&](auto& ctx) {
+                matrix_t& src = *ctx.first;
+                for (const auto& [r, c, v] : src)
+                {
+                      for (size_t x = (r ? r - 1 : 0); x <= r + 1; ++x)
+                            for (size_t y = (c ? c - 1 : 0); y <= c + 1; ++y)
+                            {
+                                  array<int, 8> nb {};
+                                  size_t k = 0;
+                                  for (size_t i = x - 1; i != x + 2; ++i)
+                                        for (size_t j = y - 1; j != y + 2; ++j)
+                                              if (i != x || j != y)
+                                                    nb[k++] = (i == size_t(-1) || j == size_t(-1)) ? 0 : static_cast<int>(src[i][j]);
+                                  if (int next = life(src[x][y], nb))
+                                        ctx.second[x][y] = next;
+                            }
+                }
+          });
+
+      group.add("stencil_apply", initial->size(), [&] { return make_pair(initial, matrix_t()); },
+          [&](auto& ctx) {
+                apply_stencil<stencil::moore<2>>(*ctx.first, ctx.second, life);
+          });
+
+      group.add("stencil_grid", initial->size(), [&] { return make_unique<stencil_grid<matrix_t, stencil::moore<2>>>(*initial); },
+          [&](auto& grid) {
+                grid->step(life);
+          });
+}
+
+/*!   \brief  Случайные чтения и записи занятых ячеек: по одной через operator[] против get_batch/set_batch
+                  с разным размером пакета
+*/
+void bench_batch(const bench_config& cfg, vector<bench::result>& results)
+{
+      using matrix_t = matrix<int, 0, 2>;
+      using coordinates_t = matrix_t::coordinates_t;
+      const double density = 0.001;
+      const size_t batch_sizes[] = { 16, 256, 4096, 65536 };
+
+      vector<string> ops = { "gather_scalar", "scatter_scalar" };
+      for (size_t b : batch_sizes)
+      {
+            ops.push_back("gather_batch" + to_string(b));
+            ops.push_back("scatter_batch" + to_string(b));
+      }
+
+      const string suffix = "/d2/int/random/" + to_string(density);
+      if (!cfg.filter.empty() && none_of(ops.begin(), ops.end(), [&](const string& op) { return (op + suffix).find(cfg.filter) != string::npos; }))
+            return;
+
+      // координаты случайны, поэтому соседние запросы попадают в разные строки кеша
+      auto filled = make_shared<matrix_t>();
+      vector<coordinates_t> queries = workload::make_coordinates<2>(workload::pattern::random, cfg.nnz, density);
+      for (const auto& c : queries)
+            workload::at(*filled, c) = 1;
+      vector<int> values(queries.size(), 2);
+
+      auto group = make_group(cfg, results, suffix, random_d2_labels(density, filled->size()));
+      auto add = [&](const string& op, auto&& body) { group.add(op, queries.size(), [&] { return filled; }, body); };
+
+      add("gather_scalar", [&](auto& m) {
+            long long sum = 0;
+            for (const auto& c : queries)
+                  sum += (*m)[c[0]][c[1]];
+            bench::do_not_optimize(sum);
+      });
+
+      add("scatter_scalar", [&](auto& m) {
+            for (size_t i = 0; i < queries.size(); ++i)
+                  (*m)[queries[i][0]][queries[i][1]] = values[i];
+      });
+
+      for (size_t b : batch_sizes)
+      {
+            add("gather_batch" + to_string(b), [&, b](auto& m) {
+                  vector<int> out(b);
+                  long long sum = 0;
+                  for (size_t first = 0; first < queries.size(); first += b)
+                  {
+                        size_t n = min(b, queries.size() - first);
+                        m->get_batch(queries.data() + first, n, out.data());
+                        for (size_t i = 0; i < n; ++i)
+                              sum += out[i];
+                  }
+                  bench::do_not_optimize(sum);
+            });
+
+            add("scatter_batch" + to_string(b), [&, b](auto& m) {
+                  for (size_t first = 0; first < queries.size(); first += b)
+                        m->set_batch(queries.data() + first, min(b, queries.size() - first), values.data() + first);
+            });
+      }
+}
+
+/*!   \brief  Копия матрицы с изменением нескольких ячеек: полное копирование хеш-таблицы против
+                  хранилища с копированием при записи
+*/
+void bench_fork(const bench_config& cfg, vector<bench::result>& results)
+{
+      using plain_t = matrix<int, 0, 2>;
+      using cow_t = matrix<int, 0, 2, copy_on_write_policy>;
+      const double density = 0.001;
+      const size_t changed = 16;
+
+      const string suffix = "/d2/int/random/" + to_string(density);
+      if (!selected(cfg, { "fork_copy", "fork_cow" }, suffix))
+            return;
+
+      auto coords = workload::make_coordinates<2>(workload::pattern::random, cfg.nnz, density);
+      auto plain = make_shared<plain_t>();
+      auto cow = make_shared<cow_t>();
+      for (size_t n = 0; n < coords.size(); ++n)
+      {
+            workload::at(*plain, coords[n]) = value_for<int>(n);
+            workload::at(*cow, coords[n]) = value_for<int>(n);
+      }
+
+      auto group = make_group(cfg, results, suffix, random_d2_labels(density, plain->size()));
+
+      auto fork = [&](auto& m) {
+            auto copy = *m;
+            for (size_t n = 0; n < changed && n < coords.size(); ++n)
+                  workload::at(copy, coords[n * coords.size() / changed]) = -1;
+            bench::do_not_optimize(copy.size());
+      };
+
+      group.add("fork_copy", 1, [&] { return plain; }, fork);
+      group.add("fork_cow", 1, [&] { return cow; }, fork);
+}
+
+/*!   \brief  Чтение из персистентной матрицы против хеш-таблицы и цена новой версии на каждую запись
+*/
+void bench_versions(const bench_config& cfg, vector<bench::result>& results)
+{
+      using plain_t = matrix<int, 0, 2>;
+      using versioned_t = persistent_matrix<int, 0, 2>;
+      const double density = 0.001;
+
+      const string suffix = "/d2/int/random/" + to_string(density);
+      if (!selected(cfg, { "lookup_hash", "lookup_persistent", "set_persistent" }, suffix))
+            return;
+
+      auto coords = workload::make_coordinates<2>(workload::pattern::random, cfg.nnz, density);
+      auto plain = make_shared<plain_t>();
+      for (size_t n = 0; n < coords.size(); ++n)
+            workload::at(*plain, coords[n]) = value_for<int>(n);
+      auto versioned = make_shared<versioned_t>(*plain);
+
+      auto group = make_group(cfg, results, suffix, random_d2_labels(density, plain->size()));
+
+      group.add("lookup_hash", coords.size(), [&] { return plain; }, [&](auto& m) {
+            long long sum = 0;
+            for (const auto& c : coords)
+                  sum += workload::at(*m, c);
+            bench::do_not_optimize(sum);
+      });
+
+      group.add("lookup_persistent", coords.size(), [&] { return versioned; }, [&](auto& m) {
+            long long sum = 0;
+            for (const auto& c : coords)
+                  sum += m->get(c);
+            bench::do_not_optimize(sum);
+      });
+
+      // каждая запись выпускает новую версию, предыдущая освобождается
+      group.add("set_persistent", coords.size(), [&] { return versioned; }, [&](auto& m) {
+            versioned_t version = *m;
+            for (size_t n = 0; n < coords.size(); ++n)
+                  version = version.set(coords[n], -1);
+            bench::do_not_optimize(version.size());
+      });
+}
+
+/*!   \brief  Приращения в горячие ячейки из нескольких потоков: мьютекс шарда на каждую запись против
+                  буферов потоков со сбросом пакетами
+*/
+void bench_hot_writes(const bench_config& cfg, vector<bench::result>& results)
+{
+      using shared_t = sharded_matrix<long long, 0, 2>;
+      const size_t hot_cells = 64;
+
+      const string suffix = "/d2/long long/hot" + to_string(hot_cells);
+      if (!selected(cfg, { "hot_locked", "hot_buffered" }, suffix))
+            return;
+
+      const size_t threads = max<size_t>(2, internal::thread_count(cfg.threads));
+      const size_t per_thread = max<size_t>(1, cfg.nnz / threads);
+      vector<shared_t::coordinates_t> coords(per_thread);
+      for (size_t i = 0; i < per_thread; ++i)
+            coords[i] = { i % 8, i % hot_cells };
+
+      auto group = make_group(cfg, results, suffix,
+          { { "dimension", "2" }, { "value_type", "long long" }, { "pattern", "hot" }, { "threads", to_string(threads) }, { "nnz", to_string(hot_cells) } });
+      auto add = [&](const string& op, auto&& writer_body) {
+            group.add(op, per_thread * threads, [] { return make_shared<shared_t>(); }, [&](auto& m) {
+                  vector<thread> workers;
+                  for (size_t t = 0; t < threads; ++t)
+                        workers.emplace_back([&] { writer_body(*m); });
+                  for (auto& w : workers)
+                        w.join();
+            });
+      };
+
+      add("hot_locked", [&](shared_t& m) {
+            for (const auto& c : coords)
+                  m.with_shard(shared_t::shard_of(c), [&](auto& cells) {
+                        long long value = 0;
+                        cells.get_batch(&c, 1, &value);
+                        ++value;
+                        cells.set_batch(&c, 1, &value);
+                  });
+      });
+
+      add("hot_buffered", [&](shared_t& m) {
+            buffered_writer<shared_t> writer(m);
+            for (const auto& c : coords)
+                  writer.add(c, 1);
+      });
+}
+
+#if defined(RORO_LIB_HAS_MMAP)
+/*!   \brief  Подключение к образу матрицы в разделяемой памяти и чтение из него против хеш-таблицы процесса
+*/
+void bench_mapped(const bench_config& cfg, vector<bench::result>& results)
+{
+      using plain_t = matrix<int, 0, 2>;
+      using image_t = mapped_matrix<int, 0, 2>;
+      const double density = 0.001;
+
+      const string suffix = "/d2/int/random/" + to_string(density);
+      if (!selected(cfg, { "attach_mapped", "lookup_mapped" }, suffix))
+            return;
+
+      auto coords = workload::make_coordinates<2>(workload::pattern::random, cfg.nnz, density);
+      plain_t plain;
+      for (size_t n = 0; n < coords.size(); ++n)
+            workload::at(plain, coords[n]) = value_for<int>(n);
+
+      const string path = internal::make_temporary_file("bench_matrix_mapped");
+      image_t::build(plain, path);
+      auto image = make_shared<image_t>(path);
+
+      auto group = make_group(cfg, results, suffix, random_d2_labels(density, image->size()));
+
+      group.add("attach_mapped", 1, [&] { return image; }, [&](auto&) {
+            image_t reader(path);
+            bench::do_not_optimize(reader.size());
+      });
+
+      group.add("lookup_mapped", coords.size(), [&] { return image; }, [&](auto& m) {
+            long long sum = 0;
+            for (const auto& c : coords)
+                  sum += m->get(c);
+            bench::do_not_optimize(sum);
+      });
+
+      remove(path.c_str());
+}
+#endif
+
+/*!   \brief  Выгрузка ячеек списком в /dev/null: iostream со сбросом на каждой строке против dump_coordinates
+*/
+void bench_dump(const bench_config& cfg, vector<bench::result>& results)
+{
+      using plain_t = matrix<int, 0, 2>;
+      const double density = 0.001;
+
+      const string suffix = "/d2/int/random/" + to_string(density);
+      if (!selected(cfg, { "dump_iostream", "dump_coordinates", "parallel_dump_coordinates" }, suffix))
+            return;
+
+      auto plain = make_shared<plain_t>();
+      for (const auto& c : workload::make_coordinates<2>(workload::pattern::random, cfg.nnz, density))
+            workload::at(*plain, c) = 1;
+      const size_t threads = internal::thread_count(cfg.threads);
+
+      auto group = make_group(cfg, results, suffix, random_d2_labels(density, plain->size()));
+      auto add = [&](const string& op, size_t op_threads, auto&& body) {
+            group.add(op, plain->size(), [&] { return plain; }, [&](auto& m) {
+                  ofstream null_device("/dev/null", ios::binary);
+                  body(*m, null_device);
+            }, { { "threads", to_string(op_threads) } });
+      };
+
+      add("dump_iostream", 1, [](const plain_t& m, ofstream& out) {
+            for (auto node : m.stream())
+                  out << get<0>(node) << " " << get<1>(node) << " " << get<2>(node) << endl;
+      });
+
+      add("dump_coordinates", 1, [](const plain_t& m, ofstream& out) {
+            dump_coordinates(m, out);
+      });
+
+      add("parallel_dump_coordinates", threads, [&](const plain_t& m, ofstream& out) {
+            dump_options options;
+            options.threads = threads;
+            dump_coordinates(m, out, options);
+      });
+}
+
+/*!   \brief  Разбор миллиона командных строк: один ParserCommandLine на поток, переиспользуемый между строками
+*/
+void bench_command_line(const bench_config& cfg, vector<bench::result>& results)
+{
+      const size_t lines = 1000000;
+      const string suffix = "/" + to_string(lines) + " lines";
+      if (!selected(cfg, { "parse_command_line", "parallel_parse_command_line" }, suffix))
+            return;
+
+      const vector<string> samples = {
+            "matrix -dimension 3 -value_type=int -nnz 100000 -pattern banded -mix get:90,set:10 extra.txt",
+            "matrix -backend=persistent -threads 4 -repetitions 5 -seed=42 -json=report.json",
+            "matrix -serve=unix:/tmp/matrix.sock -nnz 1000 \"quoted argument\" 'single quoted'",
+            "matrix -client=tcp:7000 -ops 1000000 -batch 64 -in_flight 4 -- -not-an-option"
+      };
+
+      auto make_parser = [] {
+            auto parser = make_unique<ParserCommandLine>();
+            parser->SetShowError(false);
+            const pair<const char*, char> options[] = { { "dimension", 'd' }, { "value_type", 'y' }, { "nnz", 'n' }, { "pattern", 'p' },
+                  { "mix", 'x' }, { "backend", 'b' }, { "threads", 't' }, { "repetitions", 'r' }, { "seed", 's' }, { "json", 'j' },
+                  { "serve", 'a' }, { "client", 'c' }, { "ops", 'o' }, { "batch", 'k' }, { "in_flight", 'i' } };
+            for (const auto& [name, alias] : options)
+                  parser->AddFormatOfArg(name, required_argument, alias);
+            return parser;
+      };
+
+      // разбирает строки first, first + step, ...; сумма числа опций не дает выбросить разбор
+      auto parse = [&](ParserCommandLine& parser, size_t first, size_t step) {
+            size_t found = 0;
+            for (size_t n = first; n < lines; n += step)
+            {
+                  parser.Parser(samples[n % samples.size()]);
+                  found += parser.Option.size() + parser.NonOption.size();
+            }
+            bench::do_not_optimize(found);
+      };
+
+      auto group = make_group(cfg, results, suffix, {});
+      auto add = [&](const string& op, size_t threads, auto&& body) { group.add(op, lines, [] { return 0; }, body, { { "threads", to_string(threads) } }); };
+
+      add("parse_command_line", 1, [&](auto&) {
+            auto parser = make_parser();
+            parse(*parser, 0, 1);
+      });
+
+      const size_t threads = internal::thread_count(cfg.threads);
+      add("parallel_parse_command_line", threads, [&](auto&) {
+            vector<thread> workers;
+            for (size_t t = 0; t < threads; ++t)
+                  workers.emplace_back([&, t] {
+                        auto parser = make_parser();
+                        parse(*parser, t, threads);
+                  });
+            for (auto& w : workers)
+                  w.join();
+      });
+}
+
+void help()
+{
+      cout << R"(
+ Microbenchmarks of roro_lib::matrix.
+
+    bench_matrix  [-nnz N] [-repetitions R] [-threads T] [-filter substr] [-json=file]
+       Options:
+       -nnz            -number of cells written per benchmark (default 50000)
+       -repetitions    -repetitions per benchmark, median is reported (default 5)
+       -threads        -threads for parallel benchmarks, 0 - all cores (default 0)
+       -filter         -run only benchmarks whose name contains substr, e.g. insert/d2/int
+       -json           -write results as JSON to the file
+       -?              -about program (this info)
+)" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+      try
+      {
+            ParserCommandLine PCL;
+            PCL.AddFormatOfArg("?", no_argument, '?');
+            PCL.AddFormatOfArg("help", no_argument, '?');
+            PCL.AddFormatOfArg("nnz", required_argument, 'n');
+            PCL.AddFormatOfArg("repetitions", required_argument, 'r');
+            PCL.AddFormatOfArg("threads", required_argument, 't');
+            PCL.AddFormatOfArg("filter", required_argument, 'f');
+            PCL.AddFormatOfArg("json", required_argument, 'j');
+
+            PCL.SetShowError(false);
+            PCL.Parser(argc, argv);
+
+            if (PCL.Option['?'])
+            {
+                  help();
+                  return EXIT_SUCCESS;
+            }
+
+            bench_config cfg;
+            if (PCL.Option['n'])
+                  cfg.nnz = stoul(PCL.Option['n'].ParamOption[0]);
+            if (PCL.Option['r'])
+                  cfg.repetitions = stoul(PCL.Option['r'].ParamOption[0]);
+            if (PCL.Option['t'])
+                  cfg.threads = stoul(PCL.Option['t'].ParamOption[0]);
+            if (PCL.Option['f'])
+                  cfg.filter = PCL.Option['f'].ParamOption[0];
+
+            vector<bench::result> results;
+
+            bench_all_patterns<int, 1>(cfg, results);
+            bench_all_patterns<int, 2>(cfg, results);
+            bench_all_patterns<int, 3>(cfg, results);
+            bench_all_patterns<int, 4>(cfg, results);
+            bench_all_patterns<int, 5>(cfg, results);
+            bench_all_patterns<short, 2>(cfg, results);
+            bench_all_patterns<long long, 2>(cfg, results);
+            bench_stencil(cfg, results);
+            bench_batch(cfg, results);
+            bench_fork(cfg, results);
+            bench_versions(cfg, results);
+            bench_hot_writes(cfg, results);
+#if defined(RORO_LIB_HAS_MMAP)
+            bench_mapped(cfg, results);
+#endif
+            bench_dump(cfg, results);
+            bench_command_line(cfg, results);
+
+            if (PCL.Option['j'])
+            {
+                  ofstream json(PCL.Option['j'].ParamOption[0]);
+                  bench::write_json(json, results);
+            }
+      }
+      catch (const exception& ex)
+      {
+            cerr << "Error: " << ex.what() << endl;
+            return EXIT_FAILURE;
+      }
+
+      return EXIT_SUCCESS;
+}
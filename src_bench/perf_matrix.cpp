@@ -0,0 +1,325 @@
+﻿#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <random>
+
+#include <sys/resource.h>
+
+#include "CLParser.h"
+#include "matrix.h"
+#include "matrix_workload.h"
+#include "bench_harness.h"
+
+using namespace std;
+using namespace roro_lib;
+
+/*
+      perf_matrix - проверка производительности матрицы относительно сохраненного базового замера.
+
+      Прогоняет фиксированный набор макро-нагрузок, сравнивает медианы с базовым JSON-файлом и
+      завершается с ошибкой, если пропускная способность упала или пиковый RSS вырос больше допуска.
+      Если базового файла нет, текущий замер записывается как базовый. Базовый замер имеет смысл
+      только для той машины, на которой он получен.
+*/
+
+struct perf_config
+{
+      size_t nnz = 200000;
+      size_t repetitions = 7;
+      double time_tolerance = 0.25; // допустимое падение пропускной способности
+      double rss_tolerance = 0.10;  // допустимый рост пикового RSS
+      double noise_factor = 3.0;    // сколько MAD базового замера добавляется к допуску
+      string baseline;
+      bool update = false;
+};
+
+struct workload_result
+{
+      bench::result timing;
+      long peak_rss_kb = 0;
+};
+
+struct baseline_entry
+{
+      string name;
+      double median_ns = 0.0;
+      double mad_ns = 0.0;
+      double peak_rss_kb = 0.0;
+};
+
+//! Сбрасывает пиковый RSS процесса (Linux >= 4.0), чтобы измерить пик отдельной нагрузки
+void reset_peak_rss()
+{
+      ofstream clear_refs("/proc/self/clear_refs");
+      if (clear_refs)
+            clear_refs << "5";
+}
+
+long peak_rss_kb()
+{
+      ifstream status("/proc/self/status");
+      string line;
+      while (getline(status, line))
+      {
+            if (line.compare(0, 6, "VmHWM:") == 0)
+                  return stol(line.substr(6));
+      }
+
+      rusage usage {};
+      getrusage(RUSAGE_SELF, &usage);
+      return usage.ru_maxrss;
+}
+
+template <typename Setup, typename Op>
+workload_result run_workload(const perf_config& cfg, const string& name, size_t items, Setup&& setup, Op&& op)
+{
+      reset_peak_rss();
+
+      workload_result r;
+      r.timing = bench::measure(name, items, cfg.repetitions, setup, op);
+      r.peak_rss_kb = peak_rss_kb();
+      return r;
+}
+
+vector<workload_result> run_all(const perf_config& cfg)
+{
+      using matrix_t = matrix<int, 0, 2>;
+
+      auto coords = workload::make_coordinates<2>(workload::pattern::random, cfg.nnz, 0.001);
+
+      auto filled = make_shared<matrix_t>();
+      for (size_t n = 0; n < coords.size(); ++n)
+            workload::at(*filled, coords[n]) = static_cast<int>(n % 100 + 1);
+
+      vector<workload_result> results;
+
+      results.push_back(run_workload(cfg, "bulk_build", coords.size(),
+          [] { return make_unique<matrix_t>(); },
+          [&](auto& m) {
+                for (size_t n = 0; n < coords.size(); ++n)
+                      workload::at(*m, coords[n]) = static_cast<int>(n % 100 + 1);
+          }));
+
+      // 80% чтений, 15% записей, 5% записей значения по умолчанию
+      results.push_back(run_workload(cfg, "mixed_read_write", coords.size(),
+          [&] { return make_unique<matrix_t>(*filled); },
+          [&](auto& m) {
+                int sum = 0;
+                for (size_t n = 0; n < coords.size(); ++n)
+                {
+                      size_t kind = n % 20;
+                      const auto& c = coords[(n * 7919) % coords.size()];
+                      if (kind < 16)
+                            sum += workload::at(*m, c);
+                      else if (kind < 19)
+                            workload::at(*m, c) = static_cast<int>(kind);
+                      else
+                            workload::at(*m, c) = 0;
+                }
+                bench::do_not_optimize(sum);
+          }));
+
+      results.push_back(run_workload(cfg, "full_scan", filled->size(),
+          [&] { return filled; },
+          [&](auto& m) {
+                long long sum = 0;
+                for (const auto& [row, column, v] : *m)
+                      sum += static_cast<long long>(row ^ column) + v;
+                bench::do_not_optimize(sum);
+          }));
+
+      size_t extent = workload::extent_for<2>(cfg.nnz, 0.001);
+      vector<double> x(extent, 1.5);
+
+      results.push_back(run_workload(cfg, "spmv", filled->size(),
+          [&] { return vector<double>(extent, 0.0); },
+          [&](auto& y) {
+                for (const auto& [row, column, v] : *filled)
+                      y[row] += v * x[column];
+          }));
+
+      return results;
+}
+
+void write_baseline(ostream& os, const vector<workload_result>& results)
+{
+      os << "{\n  \"workloads\": [\n";
+      for (size_t i = 0; i < results.size(); ++i)
+      {
+            const auto& r = results[i];
+            os << "    {\"name\": \"" << bench::json_escape(r.timing.name) << "\""
+               << ", \"items\": " << r.timing.items
+               << ", \"median_ns\": " << r.timing.median_ns()
+               << ", \"mad_ns\": " << r.timing.mad_ns()
+               << ", \"peak_rss_kb\": " << r.peak_rss_kb << "}"
+               << (i + 1 < results.size() ? ",\n" : "\n");
+      }
+      os << "  ]\n}\n";
+}
+
+//! Читает базовый файл, записанный write_baseline(): плоские объекты с полями name и числами
+vector<baseline_entry> read_baseline(istream& is)
+{
+      string text((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+      vector<baseline_entry> entries;
+
+      auto number = [](const string& obj, const string& field) {
+            auto pos = obj.find("\"" + field + "\":");
+            return pos == string::npos ? 0.0 : stod(obj.substr(pos + field.size() + 3));
+      };
+
+      size_t pos = 0;
+      while ((pos = text.find('{', pos + 1)) != string::npos)
+      {
+            size_t end = text.find('}', pos);
+            if (end == string::npos)
+                  break;
+
+            string obj = text.substr(pos, end - pos);
+            auto name_pos = obj.find("\"name\":");
+            if (name_pos != string::npos)
+            {
+                  size_t open = obj.find('"', name_pos + 7);
+                  size_t close = obj.find('"', open + 1);
+
+                  baseline_entry e;
+                  e.name = obj.substr(open + 1, close - open - 1);
+                  e.median_ns = number(obj, "median_ns");
+                  e.mad_ns = number(obj, "mad_ns");
+                  e.peak_rss_kb = number(obj, "peak_rss_kb");
+                  entries.push_back(e);
+            }
+            pos = end;
+      }
+
+      return entries;
+}
+
+//! Сравнивает замер с базовым, возвращает число регрессий; нагрузка без базового замера считается провалом
+size_t compare(const perf_config& cfg, const vector<workload_result>& results, const vector<baseline_entry>& baseline)
+{
+      size_t regressions = 0;
+
+      for (const auto& r : results)
+      {
+            auto it = find_if(baseline.begin(), baseline.end(), [&](const baseline_entry& e) { return e.name == r.timing.name; });
+            if (it == baseline.end() || it->median_ns <= 0.0)
+            {
+                  cout << r.timing.name << ": MISSING BASELINE (regenerate " << cfg.baseline << " with -update)\n";
+                  ++regressions;
+                  continue;
+            }
+
+            double noise = cfg.noise_factor * max(it->mad_ns, r.timing.mad_ns()) / it->median_ns;
+            double allowed_time = it->median_ns * (1.0 + cfg.time_tolerance + noise);
+            double allowed_rss = it->peak_rss_kb * (1.0 + cfg.rss_tolerance);
+
+            bool slow = r.timing.median_ns() > allowed_time;
+            bool fat = it->peak_rss_kb > 0.0 && r.peak_rss_kb > allowed_rss;
+
+            cout << r.timing.name
+                 << ": median " << r.timing.median_ns() << " ns (baseline " << it->median_ns << ", limit " << allowed_time << ")"
+                 << ", peak rss " << r.peak_rss_kb << " kb (baseline " << it->peak_rss_kb << ", limit " << allowed_rss << ")"
+                 << (slow ? "  THROUGHPUT REGRESSION" : "")
+                 << (fat ? "  MEMORY REGRESSION" : "") << "\n";
+
+            regressions += slow + fat;
+      }
+
+      return regressions;
+}
+
+//! Код выхода "проверка пропущена" (SKIP_RETURN_CODE теста perf_matrix в CMake)
+constexpr int exit_skipped = 77;
+
+void help()
+{
+      cout << R"(
+ Performance regression check of roro_lib::matrix against a stored baseline.
+
+    perf_matrix  -baseline=file [-update] [-nnz N] [-repetitions R] [-time_tolerance X] [-rss_tolerance X]
+       Options:
+       -baseline         -JSON file with the baseline; if it doesn't exist, it is created from the current run
+                          and the program exits with code 77 (check skipped)
+       -update           -overwrite the baseline with the current run; needed when a workload
+                          is missing from the baseline, otherwise the check fails
+       -nnz              -cells per workload (default 200000)
+       -repetitions      -repetitions per workload, medians are compared (default 7)
+       -time_tolerance   -allowed throughput drop, fraction (default 0.25)
+       -rss_tolerance    -allowed peak RSS growth, fraction (default 0.10)
+       -?                -about program (this info)
+)" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+      try
+      {
+            ParserCommandLine PCL;
+            PCL.AddFormatOfArg("?", no_argument, '?');
+            PCL.AddFormatOfArg("help", no_argument, '?');
+            PCL.AddFormatOfArg("baseline", required_argument, 'b');
+            PCL.AddFormatOfArg("update", no_argument, 'u');
+            PCL.AddFormatOfArg("nnz", required_argument, 'n');
+            PCL.AddFormatOfArg("repetitions", required_argument, 'r');
+            PCL.AddFormatOfArg("time_tolerance", required_argument, 't');
+            PCL.AddFormatOfArg("rss_tolerance", required_argument, 'm');
+
+            PCL.SetShowError(false);
+            PCL.Parser(argc, argv);
+
+            if (PCL.Option['?'] || !PCL.Option['b'])
+            {
+                  help();
+                  return PCL.Option['?'] ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+
+            perf_config cfg;
+            cfg.baseline = PCL.Option['b'].ParamOption[0];
+            cfg.update = PCL.Option['u'];
+            if (PCL.Option['n'])
+                  cfg.nnz = stoul(PCL.Option['n'].ParamOption[0]);
+            if (PCL.Option['r'])
+                  cfg.repetitions = stoul(PCL.Option['r'].ParamOption[0]);
+            if (PCL.Option['t'])
+                  cfg.time_tolerance = stod(PCL.Option['t'].ParamOption[0]);
+            if (PCL.Option['m'])
+                  cfg.rss_tolerance = stod(PCL.Option['m'].ParamOption[0]);
+
+            auto results = run_all(cfg);
+
+            ifstream baseline_file(cfg.baseline);
+            if (!baseline_file || cfg.update)
+            {
+                  const bool created = !baseline_file;
+                  baseline_file.close();
+                  ofstream out(cfg.baseline);
+                  write_baseline(out, results);
+                  cout << "baseline written to " << cfg.baseline << "\n";
+                  if (created)
+                  {
+                        // сравнивать не с чем: проверка пропущена, а не пройдена
+                        cout << "no baseline to compare with, check skipped\n";
+                        return exit_skipped;
+                  }
+                  return EXIT_SUCCESS;
+            }
+
+            size_t regressions = compare(cfg, results, read_baseline(baseline_file));
+            if (regressions != 0)
+            {
+                  cerr << regressions << " performance regression(s)" << endl;
+                  return EXIT_FAILURE;
+            }
+      }
+      catch (const exception& ex)
+      {
+            cerr << "Error: " << ex.what() << endl;
+            return EXIT_FAILURE;
+      }
+
+      return EXIT_SUCCESS;
+}
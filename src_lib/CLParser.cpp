@@ -6,7 +6,7 @@
 //                        вокруг GNU ф-ии _getopt_internal(), которая и выполняет всю черновую работу по
 //                        разбору командной строки.
 //
-//    Версия файла 1.01  - внесены незначительные изменения
+//    Версия файла 1.02  - разбор реентерабелен и работает с представлениями строк (string_view)
 //
 //
 
@@ -32,6 +32,13 @@ class GetOpt
 
       bool StatusScanShortOption;
 
+      /////////////////////////////////////////////////////////////////////////////////////////
+      // Позиция следующего символа в группе коротких опций argv[optindex], например "-otion".
+      // Раньше это были статические переменные AnalizShortOption(), из-за чего разбор
+      // не был реентерабельным; теперь состояние сканирования целиком лежит в объекте.
+
+      size_t NextChar;
+
       /////////////////////////////////////////////////////////////////////////////////////////
       // struct Option    - задает формат длинной опции
 
@@ -55,24 +62,24 @@ class GetOpt
       /////////////////////////////////////////////////////////////////////////////////////////
       // Функция, которая меняет местами опции и не опции
 
-      void exchange(vector<tstring>& argv);
+      void exchange(vector<tstring_view>& argv);
 
       /////////////////////////////////////////////////////////////////////////////////////////
       // Введем функцию, которая определяет переданная строка содержит опцию или нет
       // Возвращает, true если строка - это не опция
 
-      bool IsNoneOption(tstring& ArgStr)
+      bool IsNoneOption(tstring_view ArgStr)
       {
-            return (!IsSeparatorTChar(ArgStr[0]) || ArgStr[1] == _T('\0'));
+            return ArgStr.size() < 2 || !IsSeparatorTChar(ArgStr[0]) || ArgStr[1] == _T('\0');
       }
 
       /////////////////////////////////////////////////////////////////////////////////////////
       // Введем функцию, которая определяет начинается ли опция с "--" или  другого двойного разделителя
       // Возвращает true если опция имеет длинный разделитель
 
-      bool IsLoongSeparator(tstring& ArgStr)
+      bool IsLoongSeparator(tstring_view ArgStr)
       {
-            return IsSeparatorTChar(ArgStr[0]) && IsSeparatorTChar(ArgStr[1]);
+            return ArgStr.size() > 1 && IsSeparatorTChar(ArgStr[0]) && IsSeparatorTChar(ArgStr[1]);
       }
 
       /////////////////////////////////////////////////////////////////////////////////////////
@@ -90,9 +97,19 @@ class GetOpt
       // AnalizLongOption()     - распознавание длинных опций
       // AnalizShortOption()    - распознавание коротких опций
 
-      int AnalizInitialisation(vector<tstring>& argv);
-      int AnalizLongOption(tstring& OptionStr, tstring_view ParamStr, vector<Option>::iterator* ptrLongOptInd);
-      int AnalizShortOption(tstring& OptionStr, tstring_view ParamStr);
+      int AnalizInitialisation(vector<tstring_view>& argv);
+
+      /////////////////////////////////////////////////////////////////////////////////////////
+      // Вероятный параметр текущей опции: следующий ARGV-элемент, если он есть и не является опцией
+
+      tstring_view NextArgument(const vector<tstring_view>& argv)
+      {
+            return (optindex + 1 < argv.size() && !argv[optindex + 1].empty() && !IsSeparatorTChar(argv[optindex + 1][0]))
+                       ? argv[optindex + 1]
+                       : tstring_view();
+      }
+      int AnalizLongOption(tstring_view OptionStr, tstring_view ParamStr, vector<Option>::iterator* ptrLongOptInd);
+      int AnalizShortOption(tstring_view OptionStr, tstring_view ParamStr);
 
 
   public:
@@ -115,9 +132,16 @@ class GetOpt
       tstring short_opts_str;
 
       /////////////////////////////////////////////////////////////////////////////////////////
-      // В эту переменную помещается распознанный параметр опции, если _getopt_internal() его находит
+      // В эту переменную помещается распознанный параметр опции, если _getopt_internal() его находит.
+      // Это представление части одного из ARGV-элементов, оно действительно, пока жив ARGV
+
+      tstring_view optarg;
+
+      /////////////////////////////////////////////////////////////////////////////////////////
+      // ARGV-элементы текущего разбора: представления строк вызывающей программы или строки,
+      // разбитой Parser(). Вектор переиспользуется между разборами, чтобы не выделять память заново
 
-      tstring optarg;
+      vector<tstring_view> Args;
 
       /////////////////////////////////////////////////////////////////////////////////////////
       // Если мы не можем распознать опцию, или у опции нет обязательного параметра
@@ -141,18 +165,28 @@ class GetOpt
 
       GetOpt()
       {
-            first_nonopt = last_nonopt = optindex = 1;
-            StatusScanShortOption = false;
+            Reset();
             ShowErrorFlag = true;
             SeparatorChar = _T('/');
             short_opts_str = _T("");
       }
 
+      /////////////////////////////////////////////////////////////////////////////////////////
+      //    Подготовка к разбору нового ARGV: форматы опций сохраняются, состояние сканирования сбрасывается
+
+      void Reset()
+      {
+            first_nonopt = last_nonopt = optindex = 1;
+            StatusScanShortOption = false;
+            NextChar = 1;
+            optarg = tstring_view();
+      }
+
       /////////////////////////////////////////////////////////////////////////////////////////
       //    Основная функция анализирующая ARGV элементы. При каждом вызове возвращает либо символьный
       //    Псевдоним короткой опции, либо 0 в случае ошибки распознавания, либо EOF в случае если все распознано
 
-      int _getopt_internal(vector<tstring>& argv, vector<Option>::iterator* ptrLongOptInd);
+      int _getopt_internal(vector<tstring_view>& argv, vector<Option>::iterator* ptrLongOptInd);
 
       /////////////////////////////////////////////////////////////////////////////////////////
       //    Функия, которая инициализирует список содержащий формат длинных опций.
@@ -171,7 +205,7 @@ class GetOpt
 /*                               Реализация класса-       class GetOpt
 */
 
-void GetOpt::exchange(vector<tstring>& argv)
+void GetOpt::exchange(vector<tstring_view>& argv)
 {
       /* Поменять две смежных под последовательности ARGV.
         Одна под последовательность - множество элементов [first_nonopt,last_nonopt),
@@ -181,27 +215,10 @@ void GetOpt::exchange(vector<tstring>& argv)
 
         Перемещение осуществляется так, что после перемещения 'first_nonopt' и 'last_nonopt'
         содержат новые значения индексов не опций в последовательности ARGV, полученных после
-        перемещения. */
-      size_t nonopts_size = last_nonopt - first_nonopt;
-
-      /*Interchange the two blocks of data in ARGV.  */
-      tstring* temp = new tstring[nonopts_size];
-
-      for (size_t i = 0; i < nonopts_size; i++)
-      {
-            temp[i] = argv[first_nonopt + i];
-      }
-
-      for (size_t i = 0; i < (optindex - last_nonopt); i++)
-      {
-            argv[first_nonopt + i] = argv[last_nonopt + i];
-      }
-
-      for (size_t i = 0; i < nonopts_size; i++)
-      {
-            argv[first_nonopt + optindex - last_nonopt + i] = temp[i];
-      }
+        перемещения. Элементы ARGV - представления строк, поэтому перестановка на месте
+        не копирует символы и не выделяет память. */
 
+      rotate(argv.begin() + first_nonopt, argv.begin() + last_nonopt, argv.begin() + optindex);
 
       /* Update records for the slots the non-options now occupy.  */
 
@@ -211,7 +228,7 @@ void GetOpt::exchange(vector<tstring>& argv)
 
 //----------------------------------------------------------------------------------------------------
 
-int GetOpt::AnalizInitialisation(vector<tstring>& argv)
+int GetOpt::AnalizInitialisation(vector<tstring_view>& argv)
 {
 
       // Если  у нас есть не опции в начале argv, то их нужно переставить после всех опций в argv
@@ -270,19 +287,19 @@ int GetOpt::AnalizInitialisation(vector<tstring>& argv)
 
 //----------------------------------------------------------------------------------------------------
 
-int GetOpt::AnalizLongOption(tstring& OptionStr, tstring_view ParamStr, vector<Option>::iterator* ptrLongOptInd)
+int GetOpt::AnalizLongOption(tstring_view OptionStr, tstring_view ParamStr, vector<Option>::iterator* ptrLongOptInd)
 {
       // Очистим строку опции от лидирующих разделителей "-" или "--" или "/"
-      tstring OptionStrWithoutSeparator = OptionStr.substr(IsSeparatorTChar(OptionStr[0]) + IsSeparatorTChar(OptionStr[1]));
+      tstring_view OptionStrWithoutSeparator = OptionStr.substr(IsSeparatorTChar(OptionStr[0]) + IsSeparatorTChar(OptionStr[1]));
 
       // Найдем позицию символа "=", отделяющего Имя опции от Параметра опции
       size_t PosSeparator = OptionStrWithoutSeparator.find_first_of(_T('='));
 
       // Получим имя текущей опции
-      tstring NameOptionStr = OptionStrWithoutSeparator.substr(0, PosSeparator);
+      tstring_view NameOptionStr = OptionStrWithoutSeparator.substr(0, PosSeparator);
 
       // Получим параметр текущей опции
-      tstring ParamOptionStr = (PosSeparator != npos) ? OptionStrWithoutSeparator.substr(PosSeparator + 1) : tstring();
+      tstring_view ParamOptionStr = (PosSeparator != npos) ? OptionStrWithoutSeparator.substr(PosSeparator + 1) : tstring_view();
 
 
       bool ambig = false; // Флаг устанавливается в true если найденная опция двусмысленна
@@ -296,7 +313,7 @@ int GetOpt::AnalizLongOption(tstring& OptionStr, tstring_view ParamStr, vector<O
       for (auto ptrOption = this->long_opts_array.begin(); ptrOption != this->long_opts_array.end(); ptrOption++)
       {
             // Если текущая опция NameOptionStr является началом шаблона длинной опции ptrOption
-            if (ptrOption->name.find(NameOptionStr) == 0)
+            if (tstring_view(ptrOption->name).substr(0, NameOptionStr.length()) == NameOptionStr)
             {
                   if (ptrOption->name.length() == NameOptionStr.length()) // и если их длинна совпадает
                   {
@@ -320,7 +337,7 @@ int GetOpt::AnalizLongOption(tstring& OptionStr, tstring_view ParamStr, vector<O
 
             ErrorOpt Error;
             Error.ErrorID = ErrorOpt::ambiguous_opt;
-            Error.optopt = OptionStr;
+            Error.optopt = tstring(OptionStr);
             throw Error;
       }
 
@@ -340,7 +357,7 @@ int GetOpt::AnalizLongOption(tstring& OptionStr, tstring_view ParamStr, vector<O
                         //Если параметр есть, но он не нужен
                         ErrorOpt Error;
                         Error.ErrorID = ErrorOpt::not_need_arg;
-                        Error.optopt = OptionStr.substr(0, OptionStr.find_first_of(_T('=')));
+                        Error.optopt = tstring(OptionStr.substr(0, OptionStr.find_first_of(_T('='))));
                         throw Error;
                   }
             }
@@ -360,7 +377,7 @@ int GetOpt::AnalizLongOption(tstring& OptionStr, tstring_view ParamStr, vector<O
                         { // Его нет, ошибка
                               ErrorOpt Error;
                               Error.ErrorID = ErrorOpt::requires_arg;
-                              Error.optopt = OptionStr;
+                              Error.optopt = tstring(OptionStr);
                               throw Error;
                         }
                         break;
@@ -391,41 +408,29 @@ int GetOpt::AnalizLongOption(tstring& OptionStr, tstring_view ParamStr, vector<O
 
 //----------------------------------------------------------------------------------------------------
 
-int GetOpt::AnalizShortOption(tstring& ArgStr, tstring_view ParamStr)
+int GetOpt::AnalizShortOption(tstring_view OptionStr, tstring_view ParamStr)
 {
       // Короткие символы могут быть заданы или так “-o –t –i –o –n” или так “-otion”
       // Мы должны пробежаться по строке OptionStr, и проанализировать все
-      // входящие в нее символы, не увеличивая optindex пока не дойдем до конца OptionStr
-      // Что бы сохранить состояние ф-ии при повторном входе в нее, и
-      // возобновить сканирование строки с места, где мы его прервали,
-      // зададим указатель nextchar и прочее, как статическии переменные ф-ии.
-      // Сканирование продолжаем пока nextchar не укажет на конец OptionStr.
-
-      // Инициализация статических переменных будет выполнена один раз
-      // при первом вызове AnalizShortOption()
-
-      static tstring OptionStr = ArgStr;                        // Скопируем в статическую переменную, строку с опцией
-      static tstring::iterator BeginArgStr = OptionStr.begin(); // Зададим начало опциональной строки
-      static tstring::iterator EndArgStr = OptionStr.end();     // Зададим конец опциональной строки
-      static tstring::iterator nextchar = BeginArgStr + 1;      // опции начинающиеся на '--' этой ф-ией мы не обрабатываем.
-
-      // Если нам передали новую группу коротких опций
-      if (OptionStr != ArgStr)
-      {
-            OptionStr = ArgStr;
-            BeginArgStr = OptionStr.begin();
-            EndArgStr = OptionStr.end();
-            nextchar = BeginArgStr + 1;
-      }
+      // входящие в нее символы, не увеличивая optindex пока не дойдем до конца OptionStr.
+      // Позиция следующего символа хранится в NextChar между вызовами, сканирование продолжаем,
+      // пока NextChar не дойдет до конца OptionStr.
+
+      // Если нам передали новую группу коротких опций, опции начинающиеся на '--' этой ф-ией мы не обрабатываем
+      if (!StatusScanShortOption)
+            NextChar = 1;
 
       StatusScanShortOption = true;
 
       //Прочитаем новый символ опции из строки опций, и найдем его в short_opts_str
-      TCHAR c = *nextchar++;
+      TCHAR c = OptionStr[NextChar++];
       size_t IndexShOtion = short_opts_str.find(c);
 
+      const bool AtEnd = NextChar == OptionStr.size();               // символ опции последний в OptionStr
+      const bool HasEqual = !AtEnd && OptionStr[NextChar] == _T('='); // за символом опции следует '='
+
       // Увеличим значение 'optindex', когда мы дошли до последнего символа OptionStr.
-      if (nextchar == EndArgStr)
+      if (AtEnd)
       {
             ++optindex;
             StatusScanShortOption = false;
@@ -447,25 +452,20 @@ int GetOpt::AnalizShortOption(tstring& ArgStr, tstring_view ParamStr)
             {
                   /* Эта опция требует не обязательные параметры.  */
 
-                  // Если параметров нет у опции
-                  if (!(nextchar != EndArgStr && nextchar[0] == _T('=')) &&
-                      !(nextchar == EndArgStr && ParamStr != _T("") && !IsSeparatorTChar(ParamStr[0])))
-                        optarg.clear();
-
                   // Если параметры опции записаны через пробел, то это последний символ опции и следовательно
                   // мы уже увеличивали `optindex'; увеличим его еще раз после получения параметра
-                  if (nextchar == EndArgStr && ParamStr != _T("") && !IsSeparatorTChar(ParamStr[0]))
+                  if (AtEnd && ParamStr != _T("") && !IsSeparatorTChar(ParamStr[0]))
                   {
                         optarg = ParamStr;
                         optindex++;
                   }
 
                   // Если параметры опции записаны через равно
-                  if (nextchar != EndArgStr && nextchar[0] == _T('='))
+                  if (HasEqual)
                   {
-                        optarg = OptionStr.substr(nextchar - BeginArgStr + 1);
+                        optarg = OptionStr.substr(NextChar + 1);
                         optindex++;
-                        nextchar = EndArgStr;
+                        NextChar = OptionStr.size();
                         StatusScanShortOption = false;
                   }
             }
@@ -474,30 +474,29 @@ int GetOpt::AnalizShortOption(tstring& ArgStr, tstring_view ParamStr)
                   /* Эта опция требует обязательные параметры */
 
                   //Если параметр задан через символ равно
-                  if (nextchar != EndArgStr && nextchar[0] == _T('='))
+                  if (HasEqual)
                   {
-                        optarg = OptionStr.substr(nextchar - BeginArgStr + 1);
+                        optarg = OptionStr.substr(NextChar + 1);
                         optindex++;
                   }
 
                   // Если параметры опции записаны через пробел, то это последний символ опции и следовательно
                   // мы уже увеличивали `optindex'; увеличим его еще раз после получения параметра
-                  if (nextchar == EndArgStr && ParamStr != _T(""))
+                  if (AtEnd && ParamStr != _T(""))
                   {
                         optarg = ParamStr;
                         optindex++;
                   }
 
                   //В случае если у опции нет параметра
-                  if (!(nextchar != EndArgStr && nextchar[0] == _T('=')) &&
-                      !(nextchar == EndArgStr && ParamStr != _T("")))
+                  if (!HasEqual && !(AtEnd && ParamStr != _T("")))
                   {
                         ErrorOpt Error;
                         Error.ErrorID = ErrorOpt::requires_arg;
                         Error.optopt = tstring(_T("-")) + c;
                         throw Error;
                   }
-                  nextchar = EndArgStr;
+                  NextChar = OptionStr.size();
                   StatusScanShortOption = false;
             }
       }
@@ -542,10 +541,10 @@ int GetOpt::AnalizShortOption(tstring& ArgStr, tstring_view ParamStr)
 
 */
 
-int GetOpt::_getopt_internal(vector<tstring>& argv, vector<Option>::iterator* ptrLongOptInd)
+int GetOpt::_getopt_internal(vector<tstring_view>& argv, vector<Option>::iterator* ptrLongOptInd)
 
 {
-      this->optarg.clear();
+      this->optarg = tstring_view();
 
       //----------------1-й IF----------------------
       //  AnalizInitialisation() анализирует ordering, и выполняет соответствующие действия
@@ -574,13 +573,9 @@ int GetOpt::_getopt_internal(vector<tstring>& argv, vector<Option>::iterator* pt
                     argv[optindex].size() > 2 ||
                     short_opts_str.find(argv[optindex][1]) == npos))
             {
-                  tstring empty_param(_T(""));
                   // Проверим существует ли вероятный параметр опции,
                   // или у нас последняя опция в списке или параметр пропущен и далее идет другая опция
-                  tstring_view ParamStr = ((optindex + 1) < argv.size() &&
-                                              !IsSeparatorTChar(argv[this->optindex + 1][0]))
-                                              ? argv[this->optindex + 1]
-                                              : empty_param;
+                  tstring_view ParamStr = NextArgument(argv);
 
                   int Ret = AnalizLongOption(argv[this->optindex], ParamStr, ptrLongOptInd);
                   // AnalizLongOption() возвращает 0, если опция не была найдена среди длинных опций
@@ -599,13 +594,9 @@ int GetOpt::_getopt_internal(vector<tstring>& argv, vector<Option>::iterator* pt
                 !IsSeparatorTChar(argv[this->optindex][1]) &&
                 short_opts_str.find(argv[this->optindex][1]) != npos)
             {
-                  tstring empty_param(_T(""));
                   // Если short_opts_str не пустая строка и текущая опция не начинается с '--'
                   // продолжим сканировать argv[this->optindex], на предмет поиска коротких символов
-                  tstring_view ParamStr = ((optindex + 1) < argv.size() &&
-                                              !IsSeparatorTChar(argv[this->optindex + 1][0]))
-                                              ? argv[this->optindex + 1]
-                                              : empty_param;
+                  tstring_view ParamStr = NextArgument(argv);
                   // Cмотрим и обработаем следующую символ опции
                   return AnalizShortOption(argv[this->optindex], ParamStr);
             }
@@ -614,12 +605,12 @@ int GetOpt::_getopt_internal(vector<tstring>& argv, vector<Option>::iterator* pt
                   // Не возможно найти текущую опцию, как длинную опцию и как короткую опцию
                   ErrorOpt Error;
                   Error.ErrorID = ErrorOpt::unrecognized_opt;
-                  Error.optopt = argv[this->optindex];
+                  Error.optopt = tstring(argv[this->optindex]);
                   optindex++;
                   throw Error;
             }
       }
-      catch (ErrorOpt Error)
+      catch (ErrorOpt& Error)
       {
             // При необходимости выведим сообщение об ошибке
             if (ShowErrorFlag)
@@ -647,7 +638,7 @@ int GetOpt::_getopt_internal(vector<tstring>& argv, vector<Option>::iterator* pt
                   tcerr << argv[0] << _T(": ") << ErrorMsg << _T("\n");
             }
 
-            OptOpt = Error;
+            OptOpt = std::move(Error);
 
             return 0; //Вернем ноль в случае ошибки
       }
@@ -690,21 +681,66 @@ void ParserCommandLine::AddFormatOfArg(Tstring::tstring name, _argtype has_arg,
       GetOptObject->AddFormatOfArg(name, has_arg, val);
 }
 
-// Две функции Parser() с разными входными параметрами
-template <class _Elem>
-void ParserCommandLine::Parser(int argc, _Elem* argv[])
+//----------------------------------------------------------------------------------------------------
+// Разбивает строку параметров на ARGV-элементы, как регулярное выражение
+// ("[^"]+"|'[^']+'|\S+) с последующим снятием обрамляющих кавычек:
+//    либо подстрока в двойных кавычках, либо подстрока в одинарных кавычках,
+//    либо подстрока без пробельных символов.
+// Элементы - представления частей ArgV_str, символы не копируются.
+
+static bool IsSpaceTChar(TCHAR Ch)
 {
-      // сконвертируем стандартный вид списка аргументов ф-ии main()
-      // в аналогичный список строк tstring
-      vector<tstring> ArgV_p;
-      ArgV_p.resize(argc, _T(""));
+      return Ch == _T(' ') || Ch == _T('\t') || Ch == _T('\n') || Ch == _T('\v') || Ch == _T('\f') || Ch == _T('\r');
+}
 
-      for (int i = 0; i < argc; i++)
+static void SplitCommandLine(tstring_view ArgV_str, vector<tstring_view>& ArgV_p)
+{
+      size_t Pos = 0;
+      while (Pos < ArgV_str.size())
       {
-            ArgV_p[i] = argv[i];
+            if (IsSpaceTChar(ArgV_str[Pos]))
+            {
+                  ++Pos;
+                  continue;
+            }
+
+            // Подстрока в кавычках: хотя бы один символ до парной кавычки, пробелы внутри допустимы
+            TCHAR Quote = ArgV_str[Pos];
+            if (Quote == _T('\"') || Quote == _T('\''))
+            {
+                  size_t Close = ArgV_str.find(Quote, Pos + 1);
+                  if (Close != npos && Close > Pos + 1)
+                  {
+                        ArgV_p.push_back(ArgV_str.substr(Pos + 1, Close - Pos - 1));
+                        Pos = Close + 1;
+                        continue;
+                  }
+            }
+
+            // Подстрока без пробельных символов; если она сама обрамлена кавычками, снимем их
+            size_t End = Pos;
+            while (End < ArgV_str.size() && !IsSpaceTChar(ArgV_str[End]))
+                  ++End;
+
+            tstring_view Token = ArgV_str.substr(Pos, End - Pos);
+            if ((Token.front() == _T('\"') && Token.back() == _T('\"')) ||
+                (Token.front() == _T('\'') && Token.back() == _T('\'')))
+                  Token = Token.size() > 1 ? Token.substr(1, Token.size() - 2) : tstring_view();
+            ArgV_p.push_back(Token);
+            Pos = End;
       }
+}
+
+// Функции Parser() с разными входными параметрами; все они сводят ARGV к представлениям строк
+// в GetOptObject->Args и вызывают ParseArgs()
+template <class _Elem>
+void ParserCommandLine::Parser(int argc, _Elem* argv[])
+{
+      GetOptObject->Args.clear();
+      for (int i = 0; i < argc; i++)
+            GetOptObject->Args.push_back(argv[i]);
 
-      Parser(ArgV_p);
+      ParseArgs();
 }
 
 template void ParserCommandLine::Parser(int argc, char* argv[]);
@@ -712,43 +748,40 @@ template void ParserCommandLine::Parser(int argc, char* argv[]);
 template <class _Elem>
 void ParserCommandLine::Parser(const std::basic_string<_Elem>& ArgV_str, bool bProgramName)
 {
-      // 1) Конвертируем строку параметров ArgV_str из произвольного типа в TempStr типа tstring
-      // 2) Пробежимся по строке TempStr и разобьем ее на подстроки с помощью tregex
-      //    либо подстрока в двойных кавычках \"[^\"]+\"
-      //    либо подстрока в одинарных кавычках \'[^\']+\'
-      //    либо подстрока без пробельных символов \\S+
-      // 3) Из полученной подстроки уберем обрамляющие кавычки с помощью лямбды
-      // 4) И вставим результирующую строку в конец вектора ArgV_p
-
-      tstring TempStr = ArgV_str;
+      Parser(tstring_view(ArgV_str), bProgramName);
+}
 
-      vector<tstring> ArgV_p;
+template void ParserCommandLine::Parser(const std::string& ArgV_str, bool bProgramName);
 
+void ParserCommandLine::Parser(tstring_view ArgV_str, bool bProgramName)
+{
+      GetOptObject->Args.clear();
       if (bProgramName == false)
-            ArgV_p.push_back(_T(""));
-
-      tregex treg_exp(_T("(\"[^\"]+\"|\'[^\']+\'|[^\\s]+)"));
-
-      transform(tsregex_token_iterator(TempStr.begin(), TempStr.end(), treg_exp, 1),
-          tsregex_token_iterator(),
-          back_inserter(ArgV_p),
-          [](const tstring& str) {
-                if ((str[0] == _T('\"') && str[str.size() - 1] == _T('\"')) ||
-                    (str[0] == _T('\'') && str[str.size() - 1] == _T('\'')))
-                      return str.substr(1, str.size() - 2);
-                else
-                      return str;
-          });
-
-      Parser(ArgV_p);
+            GetOptObject->Args.push_back(tstring_view());
+
+      SplitCommandLine(ArgV_str, GetOptObject->Args);
+
+      ParseArgs();
 }
 
-template void ParserCommandLine::Parser(const std::string& ArgV_str, bool bProgramName);
+void ParserCommandLine::Parser(const vector<tstring>& ArgV_p)
+{
+      GetOptObject->Args.assign(ArgV_p.begin(), ArgV_p.end());
 
-void ParserCommandLine::Parser(vector<tstring>& ArgV_p)
+      ParseArgs();
+}
+
+void ParserCommandLine::ParseArgs()
 {
+      vector<tstring_view>& ArgV_p = GetOptObject->Args;
       TCHAR EnableOption = 0; //После вызова _getopt_internal() содержит символ псевдоним найденной опции
 
+      // Результаты прошлого разбора не нужны: объект можно использовать для разбора многих строк подряд
+      GetOptObject->Reset();
+      Option.ListArg.clear();
+      NonOption.TOptionArg.clear();
+      ErrorOption.TOptionArg.clear();
+
       //Разбор коммандной строки
       while ((EnableOption = GetOptObject->_getopt_internal(ArgV_p, 0)) != (TCHAR)EOF)
       {
@@ -764,7 +797,7 @@ void ParserCommandLine::Parser(vector<tstring>& ArgV_p)
                   {
                         //Если опция встретилась повторно, добавим новый параметр опции если он есть
                         if (GetOptObject->optarg != _T(""))
-                              ItrListItemArg->ParamOption.push_back(GetOptObject->optarg);
+                              ItrListItemArg->ParamOption.emplace_back(GetOptObject->optarg);
                   }
                   else
                   {
@@ -773,8 +806,8 @@ void ParserCommandLine::Parser(vector<tstring>& ArgV_p)
                         TempItem.NameOption = EnableOption;
                         TempItem.IsSet = true;
                         if (GetOptObject->optarg != _T(""))
-                              TempItem.ParamOption.push_back(GetOptObject->optarg);
-                        Option.ListArg.push_back(TempItem);
+                              TempItem.ParamOption.emplace_back(GetOptObject->optarg);
+                        Option.ListArg.push_back(std::move(TempItem));
                   }
             }
             else
@@ -786,12 +819,5 @@ void ParserCommandLine::Parser(vector<tstring>& ArgV_p)
 
       //Сохраним не опции в списке неопций
       if (GetOptObject->optindex < ArgV_p.size())
-      {
-            NonOption.TOptionArg.clear();
-            NonOption.TOptionArg.resize(ArgV_p.size() - GetOptObject->optindex, tstring());
-            for (size_t i = 0; (GetOptObject->optindex + i) < ArgV_p.size(); i++)
-            {
-                  NonOption.TOptionArg[i] = ArgV_p[GetOptObject->optindex + i];
-            }
-      }
+            NonOption.TOptionArg.assign(ArgV_p.begin() + GetOptObject->optindex, ArgV_p.end());
 }
@@ -0,0 +1,60 @@
+﻿#include "gtest/gtest.h"
+
+#include <stdexcept>
+
+#include "matrix.h"
+#include "matrix_stream.h"
+
+// генераторы на сопрограммах требуют C++20, поэтому проверяются отдельной целью test_generator
+
+#ifdef RORO_LIB_HAS_COROUTINES
+TEST(matrix, stream_generator)
+{
+      using namespace roro_lib::pipeline;
+
+      roro_lib::matrix<int, 0, 2> matrix;
+      for (std::size_t i = 0; i < 50; ++i)
+            matrix[i][2 * i] = static_cast<int>(i) + 1;
+
+      // стадия на сопрограмме: каждая ячейка дает два значения
+      auto twice = [](auto source) -> roro_lib::generator<int> {
+            for (auto node : source)
+            {
+                  co_yield std::get<2>(node);
+                  co_yield -std::get<2>(node);
+            }
+      };
+
+      long long positive = 0;
+      std::size_t count = 0;
+      for (int v : twice(roro_lib::stream_range(matrix, { 0, 0 }, { 9, 100 })) | filter([](int v) { return v > 0; }))
+      {
+            positive += v;
+            ++count;
+      }
+      ASSERT_TRUE(count == 10 && positive == 55);
+
+      std::size_t total = 0;
+      for (const auto& node : roro_lib::to_generator(matrix.stream()))
+            total += std::get<0>(node) * 2 == std::get<1>(node);
+      ASSERT_TRUE(total == 50);
+
+      // генератор однопроходный: повторный begin() не возобновляет завершенную сопрограмму
+      auto single = roro_lib::to_generator(matrix.stream());
+      std::size_t first_pass = 0;
+      for (const auto& node : single)
+            first_pass += std::get<2>(node) > 0;
+      ASSERT_TRUE(first_pass == 50);
+      ASSERT_THROW(single.begin(), std::logic_error);
+
+      // у генератора, из которого переместили, сопрограммы нет
+      auto source = roro_lib::to_generator(matrix.stream());
+      auto target = std::move(source);
+      ASSERT_THROW(source.begin(), std::logic_error);
+
+      auto assigned = roro_lib::to_generator(matrix.stream());
+      assigned = std::move(target);
+      ASSERT_THROW(target.begin(), std::logic_error);
+      ASSERT_TRUE(assigned.begin() != assigned.end());
+}
+#endif
@@ -1,8 +1,31 @@
 ﻿#include "gtest/gtest.h"
 #include "gtest/gtest_prod.h"
 
+#include <random>
+#include <set>
+#include <map>
+#include <sstream>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+#include <cstdio>
+
 #include "lib_version.h"
+#include "CLParser.h"
 #include "matrix.h"
+#include "matrix_static.h"
+#include "matrix_adaptive.h"
+#include "matrix_stencil.h"
+#include "matrix_graph.h"
+#include "matrix_stream.h"
+#include "matrix_cow.h"
+#include "matrix_persistent.h"
+#include "matrix_buffered.h"
+#include "matrix_mapped.h"
+#include "matrix_query.h"
+#include "matrix_server.h"
+#include "matrix_dump.h"
 
 #define _TEST 1
 
@@ -237,3 +260,1747 @@ TEST(matrix, assignment_default_dimension3)
       ASSERT_TRUE(matrix[100][100][100] == -1 && matrix[12345][12345][12345] == -1);
       ASSERT_TRUE(matrix.size() == 0);
 }
+
+TEST(matrix, journal_disabled_has_no_overhead)
+{
+      ASSERT_TRUE(sizeof(roro_lib::matrix<int, -1>) == sizeof(roro_lib::matrix<int, -1>::iternal_data_t));
+}
+
+TEST(matrix, journal_records_changes)
+{
+      roro_lib::matrix<int, -1, 2, roro_lib::tracking_policy> matrix;
+      using record_t = decltype(matrix)::journal_t::record_t;
+
+      matrix[1][1] = 10;
+      matrix[2][2] = 20;
+      matrix.journal().checkpoint();
+
+      matrix[1][1] = 11;
+      matrix[1][1] = 12;
+      matrix[2][2] = -1;
+      matrix[3][3] = 30;
+      matrix[4][4] = 40;
+      matrix[4][4] = -1;
+      ASSERT_TRUE(matrix.journal().size() == 3);
+
+      auto changes = matrix.journal().drain();
+      ASSERT_TRUE(changes.size() == 3);
+      ASSERT_TRUE(matrix.journal().empty());
+
+      for (const auto& c : changes)
+      {
+            if (c.coordinates[0] == 1)
+            {
+                  ASSERT_TRUE(c.kind == record_t::updated && c.old_value == 10 && c.new_value == 12);
+            }
+            else if (c.coordinates[0] == 2)
+            {
+                  ASSERT_TRUE(c.kind == record_t::erased && c.old_value == 20 && c.new_value == -1);
+            }
+            else
+            {
+                  ASSERT_TRUE(c.kind == record_t::inserted && c.coordinates[1] == 3 && c.new_value == 30);
+            }
+      }
+
+      // запись того же значения и возврат к значению контрольной точки не оставляют записей
+      matrix[1][1] = 12;
+      matrix[3][3] = 31;
+      matrix[3][3] = 30;
+      ASSERT_TRUE(matrix.journal().empty());
+
+      matrix[3][3] = -1;
+      matrix[3][3] = 30;
+      matrix[5][5] = -1;
+      ASSERT_TRUE(matrix.journal().empty());
+}
+
+TEST(matrix, stats)
+{
+      roro_lib::matrix<int, -1> matrix;
+      auto empty = matrix.stats();
+      ASSERT_TRUE(empty.size == 0 && empty.key_bytes == 0 && empty.value_bytes == 0);
+
+      for (std::size_t i = 0; i < 1000; ++i)
+            matrix[i][i] = 1;
+
+      auto st = matrix.stats();
+      ASSERT_TRUE(st.size == 1000);
+      ASSERT_TRUE(st.value_bytes == 1000 * sizeof(int));
+      ASSERT_TRUE(st.bucket_count >= 1000 / st.max_load_factor);
+      ASSERT_TRUE(st.longest_chain >= 1);
+      ASSERT_TRUE(st.total_bytes() > st.key_bytes + st.value_bytes);
+
+      std::size_t buckets = 0;
+      for (auto n : st.occupancy_histogram)
+            buckets += n;
+      ASSERT_TRUE(buckets == st.bucket_count);
+
+      ASSERT_TRUE(st.projected_bytes(2000) > st.total_bytes());
+}
+
+TEST(matrix, counters)
+{
+      roro_lib::counters_reset();
+
+      roro_lib::matrix<int, -1> plain;
+      plain[1][1] = 1;
+      ASSERT_TRUE(plain[1][1] == 1);
+      ASSERT_TRUE(roro_lib::counters_snapshot().lookups == 0);
+
+      roro_lib::matrix<int, -1, 2, roro_lib::instrumented_policy> matrix;
+      matrix[1][1] = 1;
+      matrix[1][1] = 2;
+      matrix[2][2] = -1;
+      matrix[1][1] = -1;
+      ASSERT_TRUE(matrix[1][1] == -1);
+
+      auto c = roro_lib::counters_snapshot();
+      ASSERT_TRUE(c.lookups == 5);
+      ASSERT_TRUE(c.hits == 2 && c.misses == 3);
+      ASSERT_TRUE(c.inserts == 1 && c.updates == 1);
+      ASSERT_TRUE(c.default_writes == 2 && c.default_erases == 1);
+      ASSERT_TRUE(c.rehashes >= 1);
+
+      std::ostringstream json;
+      roro_lib::write_counters_json(json, c);
+      ASSERT_TRUE(json.str().find("\"default_erases\": 1") != std::string::npos);
+}
+
+TEST(matrix, static_extents)
+{
+      roro_lib::matrix<int, -1, 2, roro_lib::static_extents<100, 200>> matrix;
+      ASSERT_TRUE(matrix[99][199] == -1);
+      ASSERT_TRUE(matrix.size() == 0);
+
+      ((matrix[10][20] = 314) = 0) = 100;
+      matrix[99][199] = 5;
+      matrix[0][0] = 7;
+      ASSERT_TRUE(matrix[10][20] == 100 && matrix[99][199] == 5 && matrix[0][0] == 7);
+      ASSERT_TRUE(matrix.size() == 3);
+
+      matrix[0][0] = -1;
+      ASSERT_TRUE(matrix[0][0] == -1);
+      ASSERT_TRUE(matrix.size() == 2);
+
+      std::size_t n = 0;
+      for (auto [row, column, v] : matrix)
+      {
+            ASSERT_TRUE(v == matrix[row][column]);
+            ++n;
+      }
+      ASSERT_TRUE(n == 2);
+}
+
+TEST(matrix, static_extents_dense_switch)
+{
+      using policy_t = roro_lib::static_extents_with_threshold<50, 4, 8, 8>;
+      roro_lib::matrix<int, 0, 3, policy_t> matrix;
+
+      for (std::size_t i = 0; i < 4; ++i)
+            for (std::size_t j = 0; j < 8; ++j)
+                  for (std::size_t k = 0; k < 8; ++k)
+                        matrix[i][j][k] = static_cast<int>(i * 64 + j * 8 + k + 1);
+
+      ASSERT_TRUE(matrix.size() == 256);
+      ASSERT_TRUE(matrix.stats().bytes_per_entry == 0);
+      ASSERT_TRUE(matrix[3][7][7] == 256);
+
+      for (std::size_t i = 0; i < 4; ++i)
+            for (std::size_t j = 0; j < 8; ++j)
+                  for (std::size_t k = 1; k < 8; ++k)
+                        matrix[i][j][k] = 0;
+
+      ASSERT_TRUE(matrix.size() == 32);
+      ASSERT_TRUE(matrix.stats().bytes_per_entry == sizeof(int));
+
+      for (auto [i, j, k, v] : matrix)
+      {
+            ASSERT_TRUE(k == 0);
+            ASSERT_TRUE(v == static_cast<int>(i * 64 + j * 8 + 1));
+      }
+}
+
+TEST(matrix, bool_bit_storage)
+{
+      roro_lib::matrix<bool, false, 2, roro_lib::bit_rows_policy> matrix;
+      static_assert(std::is_same_v<decltype(matrix)::iternal_data_t, roro_lib::internal::bit_storage<false, 2>>);
+      static_assert(std::is_same_v<roro_lib::matrix<bool, false>::iternal_data_t, roro_lib::internal::hash_storage<bool, false, 2>>);
+
+      ASSERT_TRUE(matrix[5][7] == false);
+      matrix[5][7] = true;
+      matrix[5][1 << 20] = true;
+      (matrix[6][7] = true) = false;
+      ASSERT_TRUE(matrix[5][7] == true && matrix[5][1 << 20] == true && matrix[6][7] == false);
+      ASSERT_TRUE(matrix.size() == 2);
+
+      std::size_t n = 0;
+      for (auto [row, column, v] : matrix)
+      {
+            ASSERT_TRUE(row == 5 && (column == 7 || column == (1 << 20)) && v);
+            ++n;
+      }
+      ASSERT_TRUE(n == 2);
+
+      matrix[5][7] = false;
+      matrix[5][1 << 20] = false;
+      ASSERT_TRUE(matrix.size() == 0);
+      ASSERT_TRUE(matrix.begin() == matrix.end());
+}
+
+TEST(matrix, bit_kernels)
+{
+      // векторные ядра (сборка с MATRIX_AVX2) и скалярные должны давать один и тот же результат,
+      // включая хвост из words % 4 слов
+      std::mt19937_64 random(7);
+      std::vector<std::uint64_t> a(67), b(67);
+      for (std::size_t w = 0; w < a.size(); ++w)
+      {
+            a[w] = random();
+            b[w] = w % 5 == 0 ? ~std::uint64_t(0) : random();
+      }
+
+      for (std::size_t words = 0; words <= a.size(); ++words)
+      {
+            std::size_t both = 0, either = 0, ones = 0;
+            for (std::size_t w = 0; w < words; ++w)
+                  for (unsigned bit = 0; bit < 64; ++bit)
+                  {
+                        bool x = (a[w] >> bit) & 1, y = (b[w] >> bit) & 1;
+                        both += x && y;
+                        either += x || y;
+                        ones += x;
+                  }
+
+            ASSERT_TRUE(roro_lib::internal::popcount_and(a.data(), b.data(), words) == both);
+            ASSERT_TRUE(roro_lib::internal::popcount_or(a.data(), b.data(), words) == either);
+            ASSERT_TRUE(roro_lib::internal::popcount_words(a.data(), words) == ones);
+      }
+}
+
+TEST(matrix, bool_row_set_operations)
+{
+      roro_lib::matrix<bool, false, 2, roro_lib::bit_rows_policy> adjacency;
+
+      // строка 0 - битовая карта (каждый второй столбец), строка 1 - массив (каждый третий)
+      for (std::size_t c = 0; c < 20000; c += 2)
+            adjacency[0][c] = true;
+      for (std::size_t c = 0; c < 20000; c += 3)
+            adjacency[1][c] = true;
+
+      ASSERT_TRUE(roro_lib::row_size(adjacency, 0) == 10000);
+      ASSERT_TRUE(roro_lib::row_size(adjacency, 1) == 6667);
+      ASSERT_TRUE(roro_lib::row_intersection_count(adjacency, 0, 1) == 3334);
+      ASSERT_TRUE(roro_lib::row_union_count(adjacency, 0, 1) == 10000 + 6667 - 3334);
+
+      auto common = roro_lib::row_intersection(adjacency, 0, 1);
+      ASSERT_TRUE(common.size() == 3334 && common[1] == 6);
+      ASSERT_TRUE(roro_lib::row_union(adjacency, 0, 1).size() == 13333);
+      ASSERT_TRUE(roro_lib::row_intersection_count(adjacency, 0, 0) == 10000);
+
+      std::size_t n = 0;
+      for (auto node : adjacency)
+            n += std::get<2>(node);
+      ASSERT_TRUE(n == adjacency.size());
+
+      // треугольник 2-3-4
+      roro_lib::matrix<bool, false, 2, roro_lib::bit_rows_policy> graph;
+      for (auto [u, v] : { std::pair<int, int>(2, 3), { 3, 4 }, { 2, 4 }, { 4, 5 } })
+      {
+            graph[u][v] = true;
+            graph[v][u] = true;
+      }
+      ASSERT_TRUE(roro_lib::row_intersection_count(graph, 2, 3) == 1);
+      ASSERT_TRUE(roro_lib::row_intersection_count(graph, 4, 5) == 0);
+}
+
+TEST(matrix, adaptive_storage)
+{
+      using storage_t = roro_lib::internal::adaptive_storage<int, 0, 2, 30, 10>;
+      roro_lib::matrix<int, 0, 2, roro_lib::adaptive_policy> matrix;
+      static_assert(std::is_same_v<decltype(matrix)::iternal_data_t, storage_t>);
+      static_assert(storage_t::tile_edge == 64);
+
+      // разреженные ячейки далеко друг от друга остаются в хеш-таблице
+      matrix[100000][5] = 1;
+      matrix[5][100000] = 2;
+      ASSERT_TRUE(matrix.storage().tile_count() == 0);
+
+      // заполненный квадрат 64x64 переводится в плотный блок
+      for (std::size_t i = 0; i < 64; ++i)
+            for (std::size_t j = 0; j < 64; ++j)
+                  matrix[i][j] = static_cast<int>(i * 64 + j + 1);
+
+      ASSERT_TRUE(matrix.storage().tile_count() == 1);
+      ASSERT_TRUE(matrix.size() == 64 * 64 + 2);
+      ASSERT_TRUE(matrix[10][20] == 10 * 64 + 20 + 1 && matrix[100000][5] == 1 && matrix[64][0] == 0);
+
+      long long sum = 0;
+      std::size_t n = 0;
+      for (auto [row, column, v] : matrix)
+      {
+            ASSERT_TRUE(matrix[row][column] == v);
+            sum += v;
+            ++n;
+      }
+      ASSERT_TRUE(n == matrix.size());
+      ASSERT_TRUE(sum == 64LL * 64 * (64 * 64 + 1) / 2 + 3);
+
+      // после очистки почти всего блока он расформировывается, значения сохраняются
+      for (std::size_t i = 0; i < 64; ++i)
+            for (std::size_t j = 0; j < 64; ++j)
+                  if (i != 7)
+                        matrix[i][j] = 0;
+
+      while (matrix.storage().migrating_count() != 0)
+            matrix[200000][0] = (matrix[200000][0] == 0);
+
+      ASSERT_TRUE(matrix.storage().tile_count() == 0);
+      ASSERT_TRUE(matrix.size() == 64 + 2 + (matrix[200000][0] != 0));
+      ASSERT_TRUE(matrix[7][63] == 7 * 64 + 63 + 1 && matrix[8][0] == 0);
+
+      n = 0;
+      for (auto [row, column, v] : matrix)
+      {
+            ASSERT_TRUE(v != 0 && matrix[row][column] == v);
+            ++n;
+      }
+      ASSERT_TRUE(n == matrix.size());
+}
+
+TEST(matrix, zorder_bigmin)
+{
+      // пример Tropf и Herzog: бокс [3..5]x[3..5] в сетке 8x8, точка (1, 6) вне бокса
+      std::array<std::size_t, 2> next;
+      ASSERT_TRUE(roro_lib::internal::zorder_bigmin<2>({ 1, 6 }, { 3, 3 }, { 5, 5 }, next));
+      ASSERT_TRUE(!roro_lib::internal::zorder_less<2>()(next, std::array<std::size_t, 2> { 1, 6 }));
+      ASSERT_TRUE(roro_lib::internal::in_box<2>(next, { 3, 3 }, { 5, 5 }));
+
+      // между точкой и next на Z-кривой нет ячеек бокса
+      for (std::size_t i = 3; i <= 5; ++i)
+            for (std::size_t j = 3; j <= 5; ++j)
+            {
+                  std::array<std::size_t, 2> c { i, j };
+                  roro_lib::internal::zorder_less<2> less;
+                  ASSERT_TRUE(!(less({ 1, 6 }, c) && less(c, next)));
+            }
+}
+
+TEST(matrix, range_query)
+{
+      roro_lib::matrix<int, 0, 3, roro_lib::spatial_policy> voxels;
+
+      std::mt19937_64 rng(7);
+      std::uniform_int_distribution<std::size_t> coord(0, 200);
+      for (int n = 1; n <= 20000; ++n)
+            voxels[coord(rng)][coord(rng)][coord(rng)] = n;
+
+      auto check = [&](std::array<std::size_t, 3> lo, std::array<std::size_t, 3> hi) {
+            std::size_t expected = 0;
+            for (auto [x, y, z, v] : voxels)
+                  expected += roro_lib::internal::in_box<3>({ x, y, z }, lo, hi) && v != 0;
+
+            std::size_t found = 0;
+            for (auto [x, y, z, v] : voxels.range(lo, hi))
+            {
+                  if (!roro_lib::internal::in_box<3>({ x, y, z }, lo, hi) || voxels[x][y][z] != v)
+                        return false;
+                  ++found;
+            }
+            return found == expected;
+      };
+
+      ASSERT_TRUE(check({ 10, 20, 30 }, { 60, 50, 90 }));
+      ASSERT_TRUE(check({ 0, 0, 0 }, { 200, 200, 200 }));
+      ASSERT_TRUE(check({ 100, 100, 100 }, { 100, 100, 100 }));
+      ASSERT_TRUE(check({ 150, 0, 7 }, { 155, 200, 9 }));
+
+      // запись после запроса перестраивает индекс, ранее полученный результат остается снимком
+      auto before = voxels.range({ 0, 0, 0 }, { 5, 5, 5 });
+      voxels[1][2][3] = -1;
+      voxels[4][4][4] = -2;
+      ASSERT_TRUE(check({ 0, 0, 0 }, { 5, 5, 5 }));
+
+      std::size_t old_count = 0;
+      for (auto node : before)
+            old_count += std::get<3>(node) < 0;
+      ASSERT_TRUE(old_count == 0);
+}
+
+TEST(matrix, range_query_incremental)
+{
+      roro_lib::matrix<int, 0, 2, roro_lib::spatial_policy> m;
+      std::map<std::pair<std::size_t, std::size_t>, int> model;
+
+      auto check = [&](std::array<std::size_t, 2> lo, std::array<std::size_t, 2> hi) {
+            std::map<std::pair<std::size_t, std::size_t>, int> expected, found;
+            for (const auto& [c, v] : model)
+                  if (roro_lib::internal::in_box<2>({ c.first, c.second }, lo, hi))
+                        expected.emplace(c, v);
+            for (auto [r, c, v] : m.range(lo, hi))
+                  if (!found.emplace(std::make_pair(r, c), v).second)
+                        return false;
+            return found == expected;
+      };
+
+      // записи, удаления и запросы вперемешку: буфер изменений много раз сливается с массивом индекса
+      std::mt19937_64 rng(11);
+      std::uniform_int_distribution<std::size_t> coord(0, 300);
+      std::uniform_int_distribution<int> value(-2, 5);
+      for (int step = 1; step <= 20000; ++step)
+      {
+            std::size_t r = coord(rng), c = coord(rng);
+            int v = value(rng) > 0 ? step : 0;
+            m[r][c] = v;
+            if (v != 0)
+                  model[{ r, c }] = v;
+            else
+                  model.erase({ r, c });
+
+            if (step % 997 == 0)
+            {
+                  std::size_t x = coord(rng), y = coord(rng);
+                  ASSERT_TRUE(check({ x / 2, y / 2 }, { x, y }));
+            }
+      }
+      ASSERT_TRUE(check({ 0, 0 }, { 300, 300 }));
+
+      std::size_t erased = m.erase_range({ 100, 100 }, { 199, 199 });
+      std::size_t expected_erased = 0;
+      for (auto it = model.begin(); it != model.end();)
+      {
+            bool inside = roro_lib::internal::in_box<2>({ it->first.first, it->first.second }, { 100, 100 }, { 199, 199 });
+            expected_erased += inside;
+            it = inside ? model.erase(it) : std::next(it);
+      }
+      ASSERT_TRUE(erased == expected_erased && check({ 0, 0 }, { 300, 300 }));
+
+      // запросы к неизменяемой матрице из нескольких потоков
+      const auto& shared = m;
+      std::atomic<std::size_t> total { 0 };
+      std::vector<std::thread> readers;
+      for (int t = 0; t < 4; ++t)
+            readers.emplace_back([&] {
+                  for (int i = 0; i < 50; ++i)
+                        for (auto node : shared.range({ 0, 0 }, { 300, 300 }))
+                              total += std::get<2>(node) != 0;
+            });
+      for (auto& reader : readers)
+            reader.join();
+      ASSERT_TRUE(total == 4 * 50 * model.size());
+
+      m.clear();
+      model.clear();
+      ASSERT_TRUE(check({ 0, 0 }, { 300, 300 }));
+}
+
+TEST(matrix, stencil_neighborhoods)
+{
+      constexpr auto moore = roro_lib::stencil::moore<3>::offsets();
+      static_assert(moore.size() == 26 && roro_lib::stencil::von_neumann<3>::size == 6);
+      ASSERT_TRUE(std::find(moore.begin(), moore.end(), std::array<std::ptrdiff_t, 3> { 0, 0, 0 }) == moore.end());
+      ASSERT_TRUE(std::find(moore.begin(), moore.end(), std::array<std::ptrdiff_t, 3> { -1, 1, 0 }) != moore.end());
+}
+
+TEST(matrix, stencil_game_of_life)
+{
+      using matrix_t = roro_lib::matrix<int, 0, 2>;
+      auto life = [](int self, const std::array<int, 8>& nb) {
+            int alive = static_cast<int>(std::count(nb.begin(), nb.end(), 1));
+            return (alive == 3 || (self && alive == 2)) ? 1 : 0;
+      };
+
+      // обычный цикл через operator[], с которым сравнивается результат
+      auto naive_step = [&](matrix_t& m) {
+            matrix_t next;
+            std::vector<std::array<std::size_t, 2>> cells;
+            for (auto [r, c, v] : m)
+                  cells.push_back({ r, c });
+            for (auto [r, c] : cells)
+                  for (std::size_t x = (r ? r - 1 : 0); x <= r + 1; ++x)
+                        for (std::size_t y = (c ? c - 1 : 0); y <= c + 1; ++y)
+                        {
+                              std::array<int, 8> nb {};
+                              std::size_t k = 0;
+                              for (int dx = -1; dx <= 1; ++dx)
+                                    for (int dy = -1; dy <= 1; ++dy)
+                                          if (dx || dy)
+                                                nb[k++] = (x + dx == std::size_t(-1) || y + dy == std::size_t(-1)) ? 0 : static_cast<int>(m[x + dx][y + dy]);
+                              if (int v = life(m[x][y], nb))
+                                    next[x][y] = v;
+                        }
+            m = next;
+      };
+
+      matrix_t soup;
+      std::mt19937_64 rng(3);
+      std::uniform_int_distribution<std::size_t> coord(0, 90);
+      for (int n = 0; n < 5000; ++n)
+            soup[coord(rng)][coord(rng)] = 1;
+
+      roro_lib::stencil_options options;
+      options.threads = 4;
+
+      roro_lib::stencil_grid<matrix_t, roro_lib::stencil::moore<2>> grid(soup);
+      matrix_t expected = soup;
+      for (int generation = 0; generation < 3; ++generation)
+      {
+            grid.step(life, options);
+            naive_step(expected);
+      }
+
+      matrix_t actual = grid.current();
+      ASSERT_TRUE(actual.size() == expected.size() && grid.size() == expected.size());
+      for (auto [r, c, v] : expected)
+            ASSERT_TRUE(actual[r][c] == v);
+
+      // мигалка у края матрицы: ячейки с отрицательными координатами не появляются
+      matrix_t blinker;
+      for (std::size_t c = 0; c < 3; ++c)
+            blinker[0][c] = 1;
+      matrix_t next;
+      roro_lib::apply_stencil<roro_lib::stencil::moore<2>>(blinker, next, life);
+      ASSERT_TRUE(next.size() == 2 && next[0][1] == 1 && next[1][1] == 1);
+}
+
+TEST(matrix, graph_bfs_push_pull)
+{
+      // случайный ориентированный граф; уровни BFS через vxm с полукольцом or_and и дополнением маски посещенных
+      const std::size_t n = 20000;
+      roro_lib::matrix<int, 0, 2> adjacency;
+      std::mt19937_64 rng(11);
+      std::uniform_int_distribution<std::size_t> vertex(0, n - 1);
+      for (std::size_t e = 0; e < 5 * n; ++e)
+            adjacency[vertex(rng)][vertex(rng)] = 1;
+
+      roro_lib::compressed_matrix<int> a(adjacency, n, n);
+      ASSERT_TRUE(a.nnz() == adjacency.size() && a.by_column().indices.size() == a.nnz());
+
+      auto bfs = [&](roro_lib::direction mode) {
+            roro_lib::graph_options options;
+            options.mode = mode;
+            options.threads = 3;
+
+            std::vector<int> level(n, -1);
+            roro_lib::sparse_vector<int> visited(n), frontier(n);
+            frontier.push_back(0, 1);
+            for (int depth = 0; !frontier.empty(); ++depth)
+            {
+                  roro_lib::sparse_vector<int> seen(n);
+                  for (std::size_t v : frontier.indices())
+                        level[v] = depth;
+                  for (std::size_t v = 0; v < n; ++v)
+                        if (level[v] != -1)
+                              seen.push_back(v, 1);
+                  visited = seen;
+                  frontier = roro_lib::vxm(frontier, a, roro_lib::semiring::or_and<int>(), roro_lib::complement(visited), options);
+            }
+            return level;
+      };
+
+      // эталон: обычный BFS по спискам
+      std::vector<std::vector<std::size_t>> out(n);
+      for (auto [u, v, w] : adjacency)
+            out[u].push_back(v);
+      std::vector<int> expected(n, -1);
+      std::vector<std::size_t> queue { 0 };
+      expected[0] = 0;
+      for (std::size_t q = 0; q < queue.size(); ++q)
+            for (std::size_t v : out[queue[q]])
+                  if (expected[v] == -1)
+                  {
+                        expected[v] = expected[queue[q]] + 1;
+                        queue.push_back(v);
+                  }
+
+      ASSERT_TRUE(bfs(roro_lib::direction::push) == expected);
+      ASSERT_TRUE(bfs(roro_lib::direction::pull) == expected);
+      ASSERT_TRUE(bfs(roro_lib::direction::automatic) == expected);
+}
+
+TEST(matrix, graph_semirings)
+{
+      // кратчайшие пути (Беллман-Форд через min_plus)
+      roro_lib::matrix<int, 0, 2> weights;
+      weights[0][1] = 4;
+      weights[0][2] = 1;
+      weights[2][1] = 2;
+      weights[1][3] = 1;
+      weights[2][3] = 7;
+      roro_lib::compressed_matrix<int> w(weights);
+
+      roro_lib::semiring::min_plus<int> tropical;
+      roro_lib::sparse_vector<int> distance(4);
+      distance.push_back(0, 0);
+      for (int round = 0; round < 3; ++round)
+      {
+            auto relaxed = roro_lib::vxm(distance, w, tropical);
+            for (std::size_t k = 0; k < relaxed.nnz(); ++k)
+            {
+                  std::size_t v = relaxed.indices()[k];
+                  distance.set(v, std::min(distance.get(v, tropical.zero()), relaxed.values()[k]));
+            }
+      }
+      ASSERT_TRUE(distance.get(1, -1) == 3 && distance.get(2, -1) == 1 && distance.get(3, -1) == 4);
+
+      // y = A x для plus_times совпадает с обходом по итератору матрицы
+      roro_lib::sparse_vector<int> ones(4);
+      for (std::size_t v = 0; v < 4; ++v)
+            ones.push_back(v, 1);
+      auto row_sums = roro_lib::mxv(w, ones);
+      ASSERT_TRUE(row_sums.get(0, 0) == 5 && row_sums.get(1, 0) == 1 && row_sums.get(2, 0) == 9 && row_sums.find(3) == nullptr);
+
+      // треугольники неориентированного графа: C<A> = A * A, сумма C / 6
+      roro_lib::matrix<int, 0, 2> undirected;
+      for (auto [u, v] : { std::pair<int, int>(0, 1), { 1, 2 }, { 0, 2 }, { 2, 3 }, { 3, 4 }, { 2, 4 }, { 4, 5 } })
+      {
+            undirected[u][v] = 1;
+            undirected[v][u] = 1;
+      }
+      roro_lib::compressed_matrix<int> g(undirected);
+      auto paths = roro_lib::mxm(g, g, roro_lib::semiring::plus_times<int>(), roro_lib::matrix_mask(g));
+      int total = 0;
+      for (int v : paths.by_row().values)
+            total += v;
+      ASSERT_TRUE(total / 6 == 2);
+
+      roro_lib::matrix<int, 0, 2> square;
+      roro_lib::mxm(g, g).to_matrix(square);
+      ASSERT_TRUE(square[0][0] == 2 && square[0][3] == 1 && square[5][5] == 1 && square[0][5] == 0);
+}
+
+TEST(matrix, graph_sparse_ids)
+{
+      // номера вершин порядка 10^12: массивы снимка зависят от числа различных строк и столбцов
+      const std::size_t base = std::size_t(1) << 40;
+      roro_lib::matrix<int, 0, 2> edges;
+      edges[base][base + 7] = 2;
+      edges[base][5] = 3;
+      edges[base + 7][5] = 4;
+      edges[5][base] = 1;
+
+      roro_lib::compressed_matrix<int> g(edges);
+      ASSERT_TRUE(g.row_count() == base + 8 && g.column_count() == base + 8 && g.nnz() == 4);
+      ASSERT_TRUE(g.by_row().offsets.size() == 4 && g.by_column().offsets.size() == 4);
+
+      roro_lib::sparse_vector<int> x(g.row_count());
+      x.push_back(5, 10);
+      x.push_back(base, 1);
+      for (auto mode : { roro_lib::direction::push, roro_lib::direction::pull, roro_lib::direction::automatic })
+      {
+            roro_lib::graph_options options;
+            options.mode = mode;
+            auto y = roro_lib::vxm(x, g, roro_lib::semiring::plus_times<int>(), roro_lib::vector_mask(), options);
+            ASSERT_TRUE(y.nnz() == 3 && y.get(base, 0) == 10 && y.get(base + 7, 0) == 2 && y.get(5, 0) == 3);
+
+            auto z = roro_lib::mxv(g, x, roro_lib::semiring::plus_times<int>(), roro_lib::vector_mask(), options);
+            ASSERT_TRUE(z.nnz() == 3 && z.get(base, 0) == 30 && z.get(base + 7, 0) == 40 && z.get(5, 0) == 1);
+      }
+
+      // пути длины 2, например base -> base+7 -> 5 и 5 -> base -> {base+7, 5}
+      roro_lib::matrix<int, 0, 2> square;
+      auto paths = roro_lib::mxm(g, g);
+      paths.to_matrix(square);
+      ASSERT_TRUE(paths.nnz() == 5 && square[base][5] == 8 && square[base][base] == 3 && square[base + 7][base] == 4);
+      ASSERT_TRUE(square[5][base + 7] == 2 && square[5][5] == 3);
+
+      // маска оставляет только пути, совпадающие с ребрами
+      auto masked = roro_lib::mxm(g, g, roro_lib::semiring::plus_times<int>(), roro_lib::matrix_mask(g));
+      ASSERT_TRUE(masked.nnz() == 1 && masked.by_row().ids[0] == base && masked.by_row().values[0] == 8);
+}
+
+TEST(matrix, parallel_partitions)
+{
+      roro_lib::matrix<int, 0, 2> matrix;
+      for (std::size_t i = 0; i < 30000; ++i)
+            matrix[i % 397][i / 397] = static_cast<int>(i % 50) + 1;
+
+      // части не пересекаются и вместе покрывают все ячейки
+      auto parts = matrix.partitions(7);
+      ASSERT_TRUE(parts.size() == 7);
+      std::size_t total = 0;
+      std::set<std::pair<std::size_t, std::size_t>> seen;
+      for (const auto& part : parts)
+            for (auto [r, c, v] : part)
+            {
+                  ASSERT_TRUE(seen.emplace(r, c).second && matrix[r][c] == v);
+                  ++total;
+            }
+      ASSERT_TRUE(total == matrix.size());
+
+      std::atomic<long long> sum { 0 };
+      roro_lib::parallel_for_each(matrix, [&](const auto& node) { sum += std::get<2>(node); }, 4);
+      long long expected = 0;
+      for (auto [r, c, v] : matrix)
+            expected += v;
+      ASSERT_TRUE(sum == expected);
+
+      // значения 1..50: удвоение на месте, ячейки со значением 50 становятся пустыми
+      roro_lib::parallel_transform(matrix, [](const auto& node) { return std::get<2>(node) == 50 ? 0 : std::get<2>(node) * 2; }, 4);
+      ASSERT_TRUE(matrix.size() == 30000 - 600);
+      ASSERT_TRUE(matrix[0][0] == 2 && matrix[49 % 397][0] == 0 && matrix[48][0] == 98);
+
+      // журнал видит изменения, сделанные параллельно
+      roro_lib::matrix<int, 0, 2, roro_lib::tracking_policy> tracked;
+      tracked[1][1] = 1;
+      tracked[2][2] = 2;
+      tracked.journal().checkpoint();
+      roro_lib::parallel_transform(tracked, [](const auto& node) { return std::get<2>(node) - 1; }, 2);
+      ASSERT_TRUE(tracked.size() == 1 && tracked[2][2] == 1 && tracked.journal().drain().size() == 2);
+
+      // хранилище с размерами на этапе компиляции делится по диапазонам ячеек
+      roro_lib::matrix<int, 0, 2, roro_lib::static_extents<64, 64>> fixed;
+      for (std::size_t i = 0; i < 64; ++i)
+            fixed[i][i] = 1;
+      std::size_t in_parts = 0;
+      for (const auto& part : fixed.partitions(3))
+            for (auto node : part)
+                  in_parts += std::get<2>(node);
+      ASSERT_TRUE(in_parts == 64);
+}
+
+TEST(matrix, chase_lev_deque)
+{
+      // владелец кладет и забирает задачи, воры одновременно крадут: каждая задача достается ровно одному потоку
+      constexpr std::size_t count = 200000;
+      std::vector<roro_lib::internal::task> tasks(count);
+      std::vector<std::atomic<int>> taken(count);
+      roro_lib::internal::chase_lev_deque deque(4);
+      std::atomic<bool> done { false };
+
+      auto mark = [&](roro_lib::internal::task* t) { taken[static_cast<std::size_t>(t - tasks.data())]++; };
+
+      std::vector<std::thread> thieves;
+      for (int k = 0; k < 3; ++k)
+            thieves.emplace_back([&] {
+                  while (!done.load())
+                  {
+                        if (auto t = deque.steal())
+                              mark(t);
+                  }
+            });
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+            deque.push(&tasks[i]);
+            if (i % 3 == 0)
+            {
+                  if (auto t = deque.take())
+                        mark(t);
+            }
+      }
+      while (auto t = deque.take())
+            mark(t);
+      done = true;
+      for (auto& t : thieves)
+            t.join();
+
+      ASSERT_TRUE(std::all_of(taken.begin(), taken.end(), [](const auto& n) { return n.load() == 1; }));
+}
+
+TEST(matrix, work_stealing_pool)
+{
+      roro_lib::work_stealing_pool pool(4);
+      ASSERT_TRUE(pool.concurrency() == 4);
+
+      // неравномерная нагрузка: каждый индекс обрабатывается ровно один раз, диапазоны не короче grain
+      constexpr std::size_t n = 100000;
+      std::vector<std::atomic<int>> visited(n);
+      std::atomic<std::size_t> short_chunks { 0 };
+      pool.parallel_for(0, n, 64, [&](std::size_t lo, std::size_t hi) {
+            if (hi - lo < 64 && hi != n)
+                  ++short_chunks;
+            for (std::size_t i = lo; i < hi; ++i)
+            {
+                  volatile std::size_t spin = i % 1000 == 0 ? 20000 : 0;
+                  while (spin)
+                        spin = spin - 1;
+                  visited[i]++;
+            }
+      });
+      ASSERT_TRUE(short_chunks == 0);
+      ASSERT_TRUE(std::all_of(visited.begin(), visited.end(), [](const auto& v) { return v.load() == 1; }));
+
+      // пул переиспользуется, вложенные циклы выполняются теми же потоками
+      std::atomic<long long> sum { 0 };
+      for (int rep = 0; rep < 200; ++rep)
+      {
+            pool.parallel_for(0, 16, 1, [&](std::size_t lo, std::size_t hi) {
+                  for (std::size_t i = lo; i < hi; ++i)
+                        pool.parallel_for(0, 100, 10, [&](std::size_t a, std::size_t b) { sum += static_cast<long long>(b - a); });
+            });
+      }
+      ASSERT_TRUE(sum == 200 * 16 * 100);
+
+      // исключение доходит до вызывающего, пул после него работает
+      bool thrown = false;
+      try
+      {
+            pool.parallel_for(0, 1000, 1, [](std::size_t lo, std::size_t) {
+                  if (lo == 500)
+                        throw std::runtime_error("part");
+            });
+      }
+      catch (const std::runtime_error&)
+      {
+            thrown = true;
+      }
+      ASSERT_TRUE(thrown);
+
+      std::atomic<std::size_t> after { 0 };
+      pool.parallel_for(0, 1000, 0, [&](std::size_t lo, std::size_t hi) { after += hi - lo; });
+      ASSERT_TRUE(after == 1000);
+}
+
+TEST(matrix, custom_executor)
+{
+      // свой исполнитель подключается через set_executor и используется алгоритмами матрицы
+      struct counting_executor : roro_lib::inline_executor
+      {
+            std::size_t concurrency() const noexcept override
+            {
+                  return 3;
+            }
+
+            void parallel_for(std::size_t first, std::size_t last, std::size_t grain, const body_t& body) override
+            {
+                  ++calls;
+                  inline_executor::parallel_for(first, last, grain, body);
+            }
+
+            std::size_t calls = 0;
+      };
+
+      auto previous = roro_lib::current_executor();
+      auto custom = std::make_shared<counting_executor>();
+      roro_lib::set_executor(custom);
+
+      roro_lib::matrix<int, 0, 2> matrix;
+      for (std::size_t i = 0; i < 1000; ++i)
+            matrix[i][i] = 1;
+
+      std::atomic<int> sum { 0 };
+      roro_lib::parallel_for_each(matrix, [&](const auto& node) { sum += std::get<2>(node); });
+      roro_lib::set_executor(previous);
+
+      ASSERT_TRUE(sum == 1000 && custom->calls == 1);
+      ASSERT_TRUE(roro_lib::current_executor() == previous);
+}
+
+TEST(matrix, stream_pipeline)
+{
+      using namespace roro_lib::pipeline;
+
+      roro_lib::matrix<int, 0, 2> matrix;
+      for (std::size_t i = 0; i < 100; ++i)
+            matrix[i % 10][i / 10] = static_cast<int>(i) + 1;
+
+      std::size_t cells = 0;
+      for (auto [r, c, v] : matrix.stream())
+            cells += matrix[r][c] == v;
+      ASSERT_TRUE(cells == 100);
+
+      // фильтр, преобразование и пачки без промежуточных контейнеров
+      auto chain = matrix.stream()
+                   | filter([](const auto& node) { return std::get<2>(node) % 2 == 0; })
+                   | map([](const auto& node) { return std::get<2>(node); })
+                   | batch(8);
+      std::size_t batches = 0;
+      long long sum = 0;
+      for (const auto& b : chain)
+      {
+            ASSERT_TRUE(!b.empty() && b.size() <= 8);
+            ++batches;
+            for (int v : b)
+                  sum += v;
+      }
+      ASSERT_TRUE(batches == 7 && sum == 2550);
+
+      // бокс и строка: с Z-индексом и без него результат одинаков
+      roro_lib::matrix<int, 0, 2, roro_lib::spatial_policy> spatial;
+      for (auto [r, c, v] : matrix)
+            spatial[r][c] = v;
+
+      std::set<std::tuple<std::size_t, std::size_t, int>> plain_box, spatial_box;
+      for (auto node : roro_lib::stream_range(matrix, { 2, 3 }, { 5, 7 }))
+            plain_box.insert(node);
+      for (auto node : roro_lib::stream_range(spatial, { 2, 3 }, { 5, 7 }))
+            spatial_box.insert(node);
+      ASSERT_TRUE(plain_box.size() == 20 && plain_box == spatial_box);
+
+      std::size_t in_row = 0;
+      for (auto [r, c, v] : roro_lib::stream_row(spatial, 4))
+            in_row += r == 4 && static_cast<std::size_t>(v) == c * 10 + 5;
+      ASSERT_TRUE(in_row == 10);
+}
+
+TEST(matrix, stream_async)
+{
+      using namespace roro_lib::pipeline;
+
+      roro_lib::matrix<int, 0, 2> matrix;
+      for (std::size_t i = 0; i < 5000; ++i)
+            matrix[i][i] = 1;
+
+      // верхние стадии в отдельном потоке, очередь короче потока
+      long long sum = 0;
+      for (int v : matrix.stream() | map([](const auto& node) { return std::get<2>(node); }) | async(16))
+            sum += v;
+      ASSERT_TRUE(sum == 5000);
+
+      // потребитель прерывает обход: производитель останавливается при разрушении
+      std::size_t taken = 0;
+      {
+            auto early = matrix.stream() | async(4);
+            for (const auto& node : early)
+            {
+                  (void)node;
+                  if (++taken == 10)
+                        break;
+            }
+
+            // диапазон однопроходный
+            bool rejected = false;
+            try
+            {
+                  early.begin();
+            }
+            catch (const std::logic_error&)
+            {
+                  rejected = true;
+            }
+            ASSERT_TRUE(rejected);
+      }
+      ASSERT_TRUE(taken == 10);
+
+      // исключение производителя доходит до потребителя
+      bool thrown = false;
+      try
+      {
+            auto failing = matrix.stream() | map([](const auto& node) {
+                                 if (std::get<0>(node) == 100)
+                                       throw std::runtime_error("stage");
+                                 return std::get<2>(node);
+                           })
+                           | async(8);
+            for (int v : failing)
+                  (void)v;
+      }
+      catch (const std::runtime_error&)
+      {
+            thrown = true;
+      }
+      ASSERT_TRUE(thrown);
+}
+
+TEST(matrix, batch_gather_scatter)
+{
+      using coordinates_t = roro_lib::matrix<int, 0, 2>::coordinates_t;
+
+      std::mt19937_64 rng(40);
+      std::vector<coordinates_t> coords(10007);
+      std::vector<int> values(coords.size());
+      for (std::size_t i = 0; i < coords.size(); ++i)
+      {
+            coords[i] = { rng() % 500, rng() % 500 };
+            values[i] = static_cast<int>(rng() % 7); // часть значений равна значению по умолчанию
+      }
+
+      // пакетная запись в пустую матрицу (с перехешированием по ходу) совпадает с поэлементной
+      roro_lib::matrix<int, 0, 2> batched, scalar;
+      batched.set_batch(coords, values);
+      for (std::size_t i = 0; i < coords.size(); ++i)
+            scalar[coords[i][0]][coords[i][1]] = values[i];
+      ASSERT_TRUE(batched.size() == scalar.size());
+
+      std::vector<int> out(coords.size(), -1);
+      batched.get_batch(coords, out);
+      for (std::size_t i = 0; i < coords.size(); ++i)
+            ASSERT_TRUE(out[i] == scalar[coords[i][0]][coords[i][1]]);
+
+      // повтор координат в одной группе: остается последнее значение, значение по умолчанию удаляет ячейку
+      std::vector<coordinates_t> repeated = { { 1000, 1 }, { 1000, 1 }, { 1000, 2 }, { 1000, 2 } };
+      std::vector<int> repeated_values = { 5, 6, 7, 0 };
+      batched.set_batch(repeated, repeated_values);
+      ASSERT_TRUE(batched[1000][1] == 6 && batched[1000][2] == 0);
+
+      // пакеты копии не задевают исходную матрицу
+      auto copy = batched;
+      std::vector<coordinates_t> fresh(5000);
+      for (std::size_t i = 0; i < fresh.size(); ++i)
+            fresh[i] = { 2000 + i, i };
+      copy.set_batch(fresh, std::vector<int>(fresh.size(), 9));
+      auto moved = std::move(copy);
+      std::vector<int> fresh_out(fresh.size());
+      moved.get_batch(fresh, fresh_out);
+      ASSERT_TRUE(std::all_of(fresh_out.begin(), fresh_out.end(), [](int v) { return v == 9; }));
+      batched.get_batch(fresh, fresh_out);
+      ASSERT_TRUE(std::all_of(fresh_out.begin(), fresh_out.end(), [](int v) { return v == 0; }));
+      ASSERT_TRUE(moved.size() == batched.size() + fresh.size());
+
+      // матрица, из которой переместили (конструктором и присваиванием), остается пригодной для записи
+      roro_lib::matrix<int, 0, 2> source;
+      source[1][1] = 5;
+      roro_lib::matrix<int, 0, 2> target(std::move(source));
+      source.clear();
+      for (std::size_t i = 0; i < 100; ++i)
+            source[i][i] = 1;
+      source.set_batch(fresh, std::vector<int>(fresh.size(), 3));
+      ASSERT_TRUE(source.size() == 100 + fresh.size() && source[7][7] == 1 && target[1][1] == 5 && target.size() == 1);
+
+      roro_lib::matrix<int, 0, 2> assigned;
+      assigned = std::move(target);
+      target.clear();
+      for (std::size_t i = 0; i < 100; ++i)
+            target[i][i + 1] = 2;
+      target.get_batch(fresh, fresh_out);
+      ASSERT_TRUE(target.size() == 100 && target[7][8] == 2 && assigned[1][1] == 5 && fresh_out[0] == 0);
+
+      // хранилища без пакетных операций и журнал используют обычный путь
+      roro_lib::matrix<int, 0, 2, roro_lib::tracking_policy> tracked;
+      tracked.set_batch(repeated, repeated_values);
+      ASSERT_TRUE(tracked.size() == 1 && tracked.journal().drain().size() == 1);
+
+      roro_lib::matrix<int, 0, 2, roro_lib::static_extents<16, 16>> fixed;
+      std::vector<coordinates_t> small = { { 1, 2 }, { 3, 4 }, { 15, 15 } };
+      std::array<int, 3> small_values = { 1, 2, 3 };
+      std::array<int, 3> small_out {};
+      fixed.set_batch(small, small_values);
+      fixed.get_batch(small, small_out);
+      ASSERT_TRUE(small_out == small_values && fixed.size() == 3);
+}
+
+TEST(matrix, bulk_erase)
+{
+      roro_lib::matrix<int, 0, 2> matrix;
+      for (std::size_t i = 0; i < 100; ++i)
+            for (std::size_t j = 0; j < 100; ++j)
+                  matrix[i][j] = static_cast<int>((i + j) % 10) + 1;
+
+      // значения 1..10 по 1000 ячеек: условие удаляет значения меньше 4
+      ASSERT_TRUE(matrix.erase_if([](const auto& node) { return std::get<2>(node) < 4; }) == 3000);
+      ASSERT_TRUE(matrix.size() == 7000 && matrix[0][0] == 0 && matrix[0][3] == 4);
+
+      std::size_t in_box = 0;
+      for (auto [r, c, v] : matrix)
+            in_box += r >= 10 && r <= 19 && c >= 50 && c <= 59;
+      ASSERT_TRUE(matrix.erase_range({ 10, 50 }, { 19, 59 }) == in_box && matrix[15][55] == 0);
+
+      std::size_t in_column = 0;
+      for (auto [r, c, v] : matrix)
+            in_column += c == 7;
+      ASSERT_TRUE(matrix.clear_slice<1>(7) == in_column && matrix[5][7] == 0 && matrix[5][8] != 0);
+
+      // после массового удаления массив бакетов уменьшается
+      std::size_t buckets = matrix.stats().bucket_count;
+      matrix.erase_if([](const auto& node) { return std::get<0>(node) >= 5; });
+      matrix.shrink_to_fit();
+      ASSERT_TRUE(matrix.stats().bucket_count < buckets && matrix[4][3] == 8);
+
+      // Z-индекс и журнал видят удаления
+      roro_lib::matrix<int, 0, 2, roro_lib::spatial_policy> spatial;
+      for (std::size_t i = 0; i < 50; ++i)
+            spatial[i][i] = 1;
+      ASSERT_TRUE(spatial.erase_range({ 10, 10 }, { 19, 30 }) == 10 && spatial.size() == 40);
+      std::size_t found = 0;
+      for (auto node : spatial.range({ 0, 0 }, { 49, 49 }))
+            found += std::get<2>(node);
+      ASSERT_TRUE(found == 40);
+
+      roro_lib::matrix<int, 0, 2, roro_lib::tracking_policy> tracked;
+      tracked[1][1] = 1;
+      tracked[2][2] = 2;
+      tracked.journal().checkpoint();
+      tracked.clear_slice<0>(2);
+      auto changes = tracked.journal().drain();
+      ASSERT_TRUE(changes.size() == 1 && changes[0].kind == decltype(changes)::value_type::erased && changes[0].old_value == 2);
+
+      // хранилища без своего erase_if/shrink_to_fit
+      roro_lib::matrix<int, 0, 2, roro_lib::adaptive_policy> adaptive;
+      roro_lib::matrix<bool, false, 2, roro_lib::bit_rows_policy> bits;
+      roro_lib::matrix<int, 0, 2, roro_lib::static_extents<32, 32>> fixed;
+      for (std::size_t i = 0; i < 32; ++i)
+            for (std::size_t j = 0; j < 32; ++j)
+            {
+                  adaptive[i][j] = 1;
+                  bits[i][j] = true;
+                  fixed[i][j] = static_cast<int>(j) + 1;
+            }
+      ASSERT_TRUE(adaptive.clear_slice<0>(3) == 32 && bits.clear_slice<1>(3) == 32 && fixed.erase_if([](const auto& node) { return std::get<2>(node) > 16; }) == 512);
+      adaptive.shrink_to_fit();
+      bits.shrink_to_fit();
+      fixed.shrink_to_fit();
+      ASSERT_TRUE(adaptive.size() == 992 && adaptive[4][4] == 1 && adaptive[3][4] == 0);
+      ASSERT_TRUE(bits.size() == 992 && bits[4][4] && !bits[4][3]);
+      ASSERT_TRUE(fixed.size() == 512 && fixed[0][15] == 16 && fixed[0][16] == 0);
+}
+
+TEST(matrix, copy_on_write)
+{
+      using cow_matrix = roro_lib::matrix<int, 0, 2, roro_lib::copy_on_write_pages<64>>;
+
+      cow_matrix base;
+      for (std::size_t i = 0; i < 20000; ++i)
+            base[i % 211][i / 211] = static_cast<int>(i % 9) + 1;
+      ASSERT_TRUE(base.size() == 20000 && base.storage().page_count() > 200);
+      ASSERT_TRUE(base.storage().shared_page_count() == 0);
+
+      // копия делит все страницы, запись клонирует только страницы измененных ячеек
+      cow_matrix fork = base;
+      ASSERT_TRUE(fork.storage().shared_page_count() == base.storage().page_count());
+      fork[0][0] = 100;
+      fork[5][5] = 0;
+      fork[1000][1000] = 7;
+      ASSERT_TRUE(fork[0][0] == 100 && fork[5][5] == 0 && fork[1000][1000] == 7 && fork.size() == 20000);
+      ASSERT_TRUE(base[0][0] == 1 && base[5][5] != 0 && base[1000][1000] == 0 && base.size() == 20000);
+      ASSERT_TRUE(base.storage().page_count() - base.storage().shared_page_count() <= 3);
+
+      // вторая копия, очистка одной копии не трогает остальные
+      cow_matrix second = fork;
+      second.clear();
+      ASSERT_TRUE(second.size() == 0 && fork.size() == 20000 && fork[0][0] == 100);
+
+      long long base_sum = 0;
+      std::size_t visited = 0;
+      for (auto [r, c, v] : base)
+      {
+            base_sum += v;
+            ++visited;
+      }
+      ASSERT_TRUE(visited == base.size());
+
+      // параллельные алгоритмы видят каждую ячейку один раз и не пишут в общие страницы
+      std::atomic<long long> parallel_sum { 0 };
+      roro_lib::parallel_for_each(fork, [&](const auto& node) { parallel_sum += std::get<2>(node); }, 4);
+      ASSERT_TRUE(parallel_sum == base_sum + 99 - base[5][5] + 7);
+
+      roro_lib::parallel_transform(fork, [](const auto& node) { return std::get<2>(node) * 2; }, 4);
+      ASSERT_TRUE(fork[0][0] == 200 && base[0][0] == 1);
+      long long after = 0;
+      for (auto [r, c, v] : base)
+            after += v;
+      ASSERT_TRUE(after == base_sum);
+}
+
+TEST(matrix, copy_on_write_threads)
+{
+      using cow_matrix = roro_lib::matrix<int, 0, 2, roro_lib::copy_on_write_pages<64>>;
+
+      cow_matrix base;
+      for (std::size_t i = 0; i < 5000; ++i)
+            base[i % 97][i / 97] = 1;
+
+      // каждый поток меняет и отпускает свои копии, решая по счетчикам ссылок, какие страницы общие
+      std::vector<std::thread> writers;
+      std::atomic<int> failures { 0 };
+      for (int t = 0; t < 4; ++t)
+            writers.emplace_back([&, t] {
+                  for (int round = 0; round < 50; ++round)
+                  {
+                        cow_matrix fork = base;
+                        for (std::size_t i = 0; i < 5000; i += 7)
+                              fork[i % 97][i / 97] = t + 2;
+                        auto copy = fork;
+                        fork.clear();
+                        if (copy[0][0] != t + 2 || copy[1][0] != 1 || copy.size() != 5000)
+                              ++failures;
+                  }
+            });
+      for (auto& writer : writers)
+            writer.join();
+
+      ASSERT_TRUE(failures == 0 && base.storage().shared_page_count() == 0);
+      std::size_t ones = 0;
+      for (auto [r, c, v] : base)
+            ones += v == 1;
+      ASSERT_TRUE(ones == 5000);
+}
+
+TEST(matrix, persistent_versions)
+{
+      using versioned = roro_lib::persistent_matrix<int, 0, 2>;
+      using coords = versioned::coordinates_t;
+
+      // каждая версия сверяется с эталоном, старые версии после новых записей не меняются
+      std::mt19937 gen(7);
+      std::uniform_int_distribution<std::size_t> pos(0, 63);
+      std::uniform_int_distribution<int> val(0, 5);
+
+      std::vector<versioned> versions(1);
+      std::vector<std::map<coords, int>> models(1);
+      for (int step = 0; step < 3000; ++step)
+      {
+            coords c { pos(gen), pos(gen) };
+            int v = val(gen);
+            versions.push_back(versions.back().set(c, v));
+            models.push_back(models.back());
+            if (v == 0)
+                  models.back().erase(c);
+            else
+                  models.back()[c] = v;
+      }
+
+      for (std::size_t k = 0; k < versions.size(); k += 250)
+      {
+            ASSERT_TRUE(versions[k].size() == models[k].size());
+            for (const auto& [c, v] : models[k])
+                  ASSERT_TRUE(versions[k].get(c) == v);
+
+            std::size_t visited = 0;
+            for (auto [r, col, v] : versions[k])
+            {
+                  ASSERT_TRUE(models[k].at(coords { r, col }) == v);
+                  ++visited;
+            }
+            ASSERT_TRUE(visited == models[k].size());
+      }
+
+      // запись того же значения и удаление пустой ячейки не создают новую версию
+      versioned last = versions.back();
+      ASSERT_TRUE(last.set(coords { 1000, 1000 }, 0).same_version(last));
+      if (!models.back().empty())
+      {
+            auto [c, v] = *models.back().begin();
+            ASSERT_TRUE(last.set(c, v).same_version(last));
+      }
+
+      // удаление всех ячеек приводит к пустой версии
+      versioned drained = last;
+      for (const auto& cell : models.back())
+            drained = drained.erase(cell.first);
+      ASSERT_TRUE(drained.empty() && drained.begin() == drained.end() && last.size() == models.back().size());
+}
+
+TEST(matrix, persistent_from_matrix)
+{
+      roro_lib::matrix<int, -1, 3> source;
+      for (std::size_t i = 0; i < 5000; ++i)
+            source[i % 17][i % 29][i] = static_cast<int>(i);
+
+      roro_lib::persistent_matrix<int, -1, 3> snapshot(source);
+      ASSERT_TRUE(snapshot.size() == source.size());
+      ASSERT_TRUE(snapshot.get({ 3, 3, 3 }) == 3 && snapshot.get({ 0, 0, 1 }) == -1);
+
+      auto edited = snapshot.set({ 3, 3, 3 }, 42).erase({ 4, 4, 4 });
+      ASSERT_TRUE(edited.size() == source.size() - 1 && edited.get({ 3, 3, 3 }) == 42 && edited.get({ 4, 4, 4 }) == -1);
+      ASSERT_TRUE(snapshot.get({ 3, 3, 3 }) == 3 && snapshot.get({ 4, 4, 4 }) == 4);
+
+      auto back = edited.to_matrix();
+      ASSERT_TRUE(back.size() == edited.size() && back[3][3][3] == 42 && back[4][4][4] == -1 && back[9][9][9] == 9);
+
+      // версии читаются из нескольких потоков без блокировок, пока главный поток выпускает новые
+      std::atomic<bool> mismatch { false };
+      std::vector<std::thread> readers;
+      for (int t = 0; t < 4; ++t)
+            readers.emplace_back([&snapshot, &mismatch] {
+                  for (std::size_t i = 0; i < 5000; ++i)
+                        if (snapshot.get({ i % 17, i % 29, i }) != static_cast<int>(i))
+                              mismatch = true;
+            });
+
+      auto writer = snapshot;
+      for (std::size_t i = 0; i < 5000; ++i)
+            writer = writer.set({ i % 17, i % 29, i }, -1);
+
+      for (auto& r : readers)
+            r.join();
+      ASSERT_TRUE(!mismatch && writer.size() == 0 && snapshot.size() == 5000);
+}
+
+TEST(matrix, buffered_writer)
+{
+      using shared_t = roro_lib::sharded_matrix<int, 0, 2, roro_lib::default_policy, 8>;
+      using coords = shared_t::coordinates_t;
+
+      shared_t target;
+      {
+            roro_lib::buffered_writer<shared_t> writer(target, roro_lib::buffer_options { 0, std::chrono::milliseconds(0) });
+
+            // до сброса записи не видны; повторы одной ячейки схлопываются сразу, в порядке записи
+            writer.set({ 1, 1 }, 5);
+            writer.add({ 1, 1 }, 2);
+            writer.add({ 2, 2 }, 3);
+            writer.add({ 2, 2 }, 4);
+            writer.set({ 3, 3 }, 9);
+            writer.set({ 3, 3 }, 1);
+            ASSERT_TRUE(writer.pending() == 3 && target.size() == 0);
+
+            writer.flush();
+            ASSERT_TRUE(writer.pending() == 0 && target.size() == 3);
+            ASSERT_TRUE(target.get({ 1, 1 }) == 7 && target.get({ 2, 2 }) == 7 && target.get({ 3, 3 }) == 1);
+
+            // приращение до значения по умолчанию удаляет ячейку
+            writer.add({ 2, 2 }, -7);
+            writer.set({ 4, 4 }, 3);
+            writer.set({ 4, 4 }, 0);
+            writer.add({ 5, 5 }, 0);
+      }
+      ASSERT_TRUE(target.size() == 2 && target.get({ 2, 2 }) == 0 && target.get({ 1, 1 }) == 7);
+
+      // сброс по размеру и по времени
+      {
+            roro_lib::buffered_writer<shared_t> writer(target, roro_lib::buffer_options { 4, std::chrono::milliseconds(0) });
+            for (std::size_t i = 0; i < 4; ++i)
+                  writer.set({ 10, i }, 1);
+            ASSERT_TRUE(writer.pending() == 0 && target.get({ 10, 3 }) == 1);
+      }
+      {
+            roro_lib::buffered_writer<shared_t> writer(target, roro_lib::buffer_options { 0, std::chrono::milliseconds(1) });
+            writer.set({ 11, 0 }, 1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            for (std::size_t i = 1; i < writer.time_check_period; ++i)
+                  writer.add({ 11, 1 }, 1);
+            ASSERT_TRUE(writer.pending() == 0 && target.get({ 11, 0 }) == 1);
+      }
+
+      // потоки бьют в одни и те же горячие ячейки, приращения не теряются
+      shared_t hot;
+      std::vector<std::thread> threads;
+      for (int t = 0; t < 4; ++t)
+            threads.emplace_back([&hot] {
+                  roro_lib::buffered_writer<shared_t> writer(hot, roro_lib::buffer_options { 256, std::chrono::milliseconds(0) });
+                  for (std::size_t i = 0; i < 10000; ++i)
+                        writer.add(coords { i % 4, i % 16 }, 1);
+            });
+      for (auto& t : threads)
+            t.join();
+
+      long long total = 0;
+      hot.for_each_shard([&](const auto& cells) {
+            for (auto node : cells.stream())
+                  total += std::get<2>(node);
+      });
+      ASSERT_TRUE(hot.size() == 16 && total == 40000 && hot.get({ 0, 0 }) == 2500);
+}
+
+#if defined(RORO_LIB_HAS_MMAP)
+TEST(matrix, mapped_matrix)
+{
+      using image_t = roro_lib::mapped_matrix<long long, -1, 3>;
+      const std::string path = ::testing::TempDir() + "roro_mapped_matrix.img";
+
+      roro_lib::matrix<long long, -1, 3> source;
+      for (std::size_t i = 0; i < 10000; ++i)
+            source[i % 13][i % 101][i] = static_cast<long long>(i) * 3;
+      image_t::build(source, path);
+
+      // два подключения видят один и тот же образ
+      image_t reader(path);
+      image_t second(path);
+      ASSERT_TRUE(reader.size() == source.size() && second.size() == source.size());
+      for (std::size_t i = 0; i < 10000; i += 7)
+            ASSERT_TRUE(reader.get({ i % 13, i % 101, i }) == static_cast<long long>(i) * 3 && second.get({ i % 13, i % 101, i }) == static_cast<long long>(i) * 3);
+      ASSERT_TRUE(reader.get({ 0, 0, 1 }) == -1);
+
+      long long sum = 0;
+      std::size_t visited = 0;
+      for (auto [x, y, z, v] : reader)
+      {
+            ASSERT_TRUE(source[x][y][z] == v);
+            sum += v;
+            ++visited;
+      }
+      ASSERT_TRUE(visited == source.size() && sum == 3LL * 9999 * 10000 / 2);
+
+      // новый образ подменяет файл атомарно, уже подключенные читатели видят старый
+      source.clear();
+      source[1][2][3] = 7;
+      image_t::build(source, path);
+      image_t fresh(path);
+      ASSERT_TRUE(fresh.size() == 1 && fresh.get({ 1, 2, 3 }) == 7);
+      ASSERT_TRUE(reader.size() == 10000 && reader.get({ 1, 2, 3 }) == -1 && reader.get({ 3, 3, 3 }) == 9);
+
+      // образ другой размерности или другого типа не подключается
+      bool rejected = false;
+      try
+      {
+            roro_lib::mapped_matrix<long long, -1, 2> wrong(path);
+      }
+      catch (const std::runtime_error&)
+      {
+            rejected = true;
+      }
+      ASSERT_TRUE(rejected);
+
+      roro_lib::matrix<int, 0, 2> empty;
+      roro_lib::mapped_matrix<int, 0, 2>::build(empty, path);
+      roro_lib::mapped_matrix<int, 0, 2> nothing(path);
+      ASSERT_TRUE(nothing.size() == 0 && nothing.get({ 1, 1 }) == 0 && nothing.begin() == nothing.end());
+      std::remove(path.c_str());
+
+      // сборка не удалась (на месте образа каталог): временный файл не остается рядом с path
+      const std::string folder = ::testing::TempDir() + "roro_mapped_failed";
+      const std::string occupied = folder + "/image";
+      ASSERT_TRUE(::mkdir(folder.c_str(), 0755) == 0 && ::mkdir(occupied.c_str(), 0755) == 0);
+      using empty_image_t = roro_lib::mapped_matrix<int, 0, 2>;
+      ASSERT_THROW(empty_image_t::build(empty, occupied), std::system_error);
+      ASSERT_TRUE(::rmdir(occupied.c_str()) == 0 && ::rmdir(folder.c_str()) == 0);
+}
+
+TEST(matrix, mapped_matrix_corrupt)
+{
+      using image_t = roro_lib::mapped_matrix<int, 0, 2>;
+      using header_t = roro_lib::internal::mapped_header;
+      const std::string path = ::testing::TempDir() + "roro_mapped_corrupt.img";
+      const std::string broken = path + ".broken";
+
+      roro_lib::matrix<int, 0, 2> source;
+      for (std::size_t i = 0; i < 1000; ++i)
+            source[i][i + 1] = static_cast<int>(i) + 1;
+      image_t::build(source, path);
+
+      std::string bytes;
+      {
+            std::ifstream in(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      }
+      header_t good;
+      std::memcpy(&good, bytes.data(), sizeof(good));
+
+      // каждый испорченный образ отвергается конструктором, а не читается за пределами файла
+      auto rejected = [&](const header_t& h, std::size_t keep) {
+            std::string copy = bytes.substr(0, keep);
+            std::memcpy(&copy[0], &h, sizeof(h));
+            {
+                  std::ofstream out(broken, std::ios::binary | std::ios::trunc);
+                  out.write(copy.data(), static_cast<std::streamsize>(copy.size()));
+            }
+            try
+            {
+                  image_t image(broken);
+            }
+            catch (const std::runtime_error&)
+            {
+                  return true;
+            }
+            return false;
+      };
+
+      header_t h = good;
+      h.bucket_count = 1000;
+      ASSERT_TRUE(rejected(h, bytes.size()));
+      h = good;
+      h.bucket_count = std::uint64_t(1) << 40;
+      ASSERT_TRUE(rejected(h, bytes.size()));
+      h = good;
+      h.buckets_offset = good.buckets_offset + 4;
+      ASSERT_TRUE(rejected(h, bytes.size()));
+      h = good;
+      h.cells_offset = good.image_size - 64;
+      ASSERT_TRUE(rejected(h, bytes.size()));
+      h = good;
+      h.count = good.count * 2;
+      ASSERT_TRUE(rejected(h, bytes.size()));
+      h = good;
+      h.image_size = good.cells_offset + 100;
+      ASSERT_TRUE(rejected(h, static_cast<std::size_t>(h.image_size)));
+      ASSERT_TRUE(!rejected(good, bytes.size()));
+
+      std::remove(broken.c_str());
+      std::remove(path.c_str());
+}
+#endif
+
+TEST(matrix, query_text)
+{
+      namespace q = roro_lib::query;
+      roro_lib::matrix<int, 0, 2, roro_lib::spatial_policy> m;
+      m[3][4] = 10;
+
+      const std::string input = "GET 3 4\nSET 1 1 5\nADD 1 1 3\n\nRANGE 0 0 5 5\nBAD 1\nSET 2 2\nADD 3 4 -10\nGET 3 4";
+
+      // команды, разрезанные границами кусков, разбираются так же, как целые
+      for (std::size_t chunk : { std::size_t(1), std::size_t(3), std::size_t(64) })
+      {
+            auto copy = m;
+            std::size_t position = 0;
+            std::string output;
+            q::serve(copy, q::wire_format::text,
+                     [&](char* buffer, std::size_t capacity) {
+                           std::size_t n = std::min({ capacity, chunk, input.size() - position });
+                           std::copy_n(input.data() + position, n, buffer);
+                           position += n;
+                           return n;
+                     },
+                     [&](const char* data, std::size_t size) { output.append(data, size); });
+
+            ASSERT_TRUE(output == "10\nOK\n8\n2\n1 1 8\n3 4 10\nERR\nERR\n0\n0\n");
+            ASSERT_TRUE(copy.size() == 1 && copy[1][1] == 8);
+      }
+}
+
+TEST(matrix, query_binary)
+{
+      namespace q = roro_lib::query;
+      roro_lib::matrix<long long, 0, 2, roro_lib::spatial_policy> m;
+
+      std::string input;
+      auto frame = [&](q::opcode op, std::initializer_list<std::uint64_t> coords, const std::int64_t* value) {
+            input.push_back(static_cast<char>(op));
+            for (std::uint64_t c : coords)
+                  input.append(reinterpret_cast<const char*>(&c), sizeof(c));
+            if (value)
+                  input.append(reinterpret_cast<const char*>(value), sizeof(*value));
+      };
+      const std::int64_t seven = 7, minus = -2;
+      frame(q::opcode::set, { 5, 6 }, &seven);
+      frame(q::opcode::add, { 5, 6 }, &minus);
+      frame(q::opcode::get, { 5, 6 }, nullptr);
+      frame(q::opcode::range, { 0, 0, 9, 9 }, nullptr);
+      input.push_back(char(9));
+
+      q::parser<2> parser(q::wire_format::binary);
+      q::batch<2> parsed;
+      for (std::size_t first = 0; first < input.size(); first += 5)
+            parser.feed(input.data() + first, std::min<std::size_t>(5, input.size() - first), parsed);
+      parser.finish(parsed);
+      ASSERT_TRUE(parsed.commands.size() == 5 && parsed.commands[3].op == q::opcode::range && parsed.commands[3].hi[1] == 9);
+      ASSERT_TRUE(parsed.commands[4].op == q::opcode::invalid);
+
+      std::string output;
+      q::executor<decltype(m)> exec(m, q::wire_format::binary);
+      exec.run(parsed, output);
+
+      auto read_i64 = [&](std::size_t offset) {
+            std::int64_t v;
+            std::memcpy(&v, output.data() + offset, sizeof(v));
+            return v;
+      };
+      // три ответа по 9 байт, RANGE: статус, число, одна ячейка, затем статус ошибки
+      ASSERT_TRUE(output.size() == 3 * 9 + 1 + 8 + 3 * 8 + 1);
+      ASSERT_TRUE(output[0] == 0 && read_i64(1) == 7 && read_i64(10) == 5 && read_i64(19) == 5);
+      ASSERT_TRUE(read_i64(28) == 1 && read_i64(36) == 5 && read_i64(44) == 6 && read_i64(52) == 5);
+      ASSERT_TRUE(output.back() == 1);
+}
+
+#if defined(RORO_LIB_HAS_EPOLL)
+TEST(matrix, socket_server)
+{
+      namespace q = roro_lib::query;
+      using matrix_t = roro_lib::matrix<long long, 0, 2, roro_lib::spatial_policy>;
+      matrix_t m;
+
+      auto frame = [](std::string& out, q::opcode op, std::uint64_t x, std::uint64_t y, std::int64_t value) {
+            out.push_back(static_cast<char>(op));
+            out.append(reinterpret_cast<const char*>(&x), sizeof(x));
+            out.append(reinterpret_cast<const char*>(&y), sizeof(y));
+            if (op != q::opcode::get)
+                  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+      };
+      auto value_at = [](const std::string& reply, std::size_t n) {
+            std::int64_t v;
+            std::memcpy(&v, reply.data() + n * 9 + 1, sizeof(v));
+            return v;
+      };
+
+      // поток сервера останавливается и при выходе из теста по неудачной проверке
+      struct running_server
+      {
+            q::server<matrix_t>& server;
+            std::thread loop;
+
+            ~running_server()
+            {
+                  server.stop();
+                  loop.join();
+            }
+      };
+
+      const std::string socket_path = ::testing::TempDir() + "roro_matrix_test.sock";
+      for (const std::string& address : { "unix:" + socket_path, std::string("tcp:0") })
+      {
+            q::server<matrix_t> server(m, address);
+            {
+                  running_server running { server, std::thread([&] { server.run(); }) };
+
+
+                  // два клиента; первый шлет кадры, не дожидаясь ответов, и рвет последнюю команду посередине
+                  q::client first(server.address());
+                  q::client second(server.address());
+
+                  std::string commands;
+                  for (std::uint64_t i = 0; i < 100; ++i)
+                        frame(commands, q::opcode::set, i, i, static_cast<std::int64_t>(i + 1));
+                  frame(commands, q::opcode::add, 3, 3, 10);
+                  frame(commands, q::opcode::get, 3, 3, 0);
+                  first.send_all(commands.data(), 700);
+                  first.send_all(commands.data() + 700, commands.size() - 700);
+
+                  std::string reply(102 * 9, '\0');
+                  first.receive_exact(&reply[0], reply.size());
+                  ASSERT_TRUE(reply[0] == 0 && value_at(reply, 0) == 1 && value_at(reply, 99) == 100);
+                  ASSERT_TRUE(value_at(reply, 100) == 14 && value_at(reply, 101) == 14);
+
+                  std::string read_back;
+                  frame(read_back, q::opcode::get, 50, 50, 0);
+                  frame(read_back, q::opcode::set, 50, 50, 0);
+                  second.send_all(read_back.data(), read_back.size());
+                  std::string answer(2 * 9, '\0');
+                  second.receive_exact(&answer[0], answer.size());
+                  ASSERT_TRUE(value_at(answer, 0) == 51 && value_at(answer, 1) == 0);
+                  ASSERT_TRUE(m.size() == 99);
+
+                  // после половинного закрытия сервер отвечает на оставшееся и закрывает соединение
+                  char unknown = 9;
+                  second.send_all(&unknown, 1);
+                  second.finish_sending();
+                  char status = 0;
+                  second.receive_exact(&status, 1);
+                  ASSERT_TRUE(status == 1);
+
+                  // длинный конвейер без ожидания ответов: ответов больше max_pending_output
+                  q::client third(server.address());
+                  const std::size_t gets = 300000;
+                  std::thread sender([&] {
+                        std::string many;
+                        for (std::size_t i = 0; i < gets; ++i)
+                              frame(many, q::opcode::get, i % 100, i % 100, 0);
+                        third.send_all(many.data(), many.size());
+                  });
+                  std::string replies(gets * 9, '\0');
+                  third.receive_exact(&replies[0], replies.size());
+                  sender.join();
+                  ASSERT_TRUE(value_at(replies, 0) == 1 && value_at(replies, 50) == 0 && value_at(replies, gets - 1) == 100);
+            }
+            m = matrix_t();
+      }
+
+      // чужой файл на месте сокета не удаляется, сокет работающего сервера не перехватывается
+      const std::string plain_path = ::testing::TempDir() + "roro_matrix_test.file";
+      std::FILE* plain = std::fopen(plain_path.c_str(), "w");
+      ASSERT_TRUE(plain != nullptr);
+      std::fclose(plain);
+      ASSERT_THROW(q::server<matrix_t>(m, "unix:" + plain_path), std::system_error);
+      ASSERT_TRUE(std::remove(plain_path.c_str()) == 0);
+
+      q::server<matrix_t> live(m, "unix:" + socket_path);
+      running_server running { live, std::thread([&] { live.run(); }) };
+      ASSERT_THROW(q::server<matrix_t>(m, "unix:" + socket_path), std::system_error);
+      q::client still_served(live.address());
+}
+#endif
+
+TEST(matrix, command_line_reuse)
+{
+      ParserCommandLine parser;
+      parser.SetShowError(false);
+      parser.SetShortFormatOfArg("ab:");
+      parser.AddFormatOfArg("nnz", required_argument, 'n');
+
+      // одна группа коротких опций дважды подряд и повторный разбор тем же объектом
+      for (int pass = 0; pass < 2; ++pass)
+      {
+            parser.Parser(std::string("prog file -ab=7 -ab 8 -nnz=5 \"two words\" 'x' -q"));
+            ASSERT_TRUE(parser.Option['a'] && parser.Option['b'].ParamOption.size() == 2);
+            ASSERT_TRUE(parser.Option['b'].ParamOption[0] == "7" && parser.Option['b'].ParamOption[1] == "8");
+            ASSERT_TRUE(parser.Option['n'].ParamOption[0] == "5");
+            ASSERT_TRUE(parser.NonOption.size() == 3 && parser.NonOption[0] == "file" && parser.NonOption[1] == "two words" &&
+                        parser.NonOption[2] == "x");
+            ASSERT_TRUE(parser.ErrorOption.size() == 1 && parser.ErrorOption[0].optopt == "-q");
+      }
+
+      parser.Parser(std::string("-nnz 9"), false);
+      ASSERT_TRUE(parser.Option.size() == 1 && parser.Option['n'].ParamOption[0] == "9" && parser.NonOption.empty());
+}
+
+TEST(matrix, command_line_threads)
+{
+      // разбор без общего состояния: отдельные объекты разбирают одновременно в нескольких потоках
+      const std::size_t threads = 8;
+      std::atomic<bool> mismatch { false };
+      std::vector<std::thread> workers;
+      for (std::size_t t = 0; t < threads; ++t)
+            workers.emplace_back([t, &mismatch] {
+                  ParserCommandLine parser;
+                  parser.SetShowError(false);
+                  parser.SetShortFormatOfArg("ab:");
+                  parser.AddFormatOfArg("nnz", required_argument, 'n');
+
+                  for (std::size_t pass = 0; pass < 500 && !mismatch; ++pass)
+                  {
+                        const std::string id = std::to_string(t * 1000 + pass);
+                        parser.Parser("prog file" + id + " -ab=" + id + " -nnz " + id + " -q");
+                        bool ok = parser.Option['a'] && parser.Option['b'].ParamOption.size() == 1 &&
+                                  parser.Option['b'].ParamOption[0] == id && parser.Option['n'].ParamOption[0] == id &&
+                                  parser.NonOption.size() == 1 && parser.NonOption[0] == "file" + id &&
+                                  parser.ErrorOption.size() == 1 && parser.ErrorOption[0].optopt == "-q";
+                        if (!ok)
+                              mismatch = true;
+                  }
+            });
+      for (auto& worker : workers)
+            worker.join();
+
+      ASSERT_TRUE(!mismatch);
+}
+
+TEST(matrix, dump_window)
+{
+      roro_lib::matrix<int, 0> m;
+      m[1][1] = 5;
+      m[2][3] = -7;
+
+      std::ostringstream window;
+      roro_lib::dump_window(m, { 1, 1 }, { 2, 3 }, window);
+      ASSERT_TRUE(window.str() == "5 0 0\n0 0 -7\n");
+
+      // как в демо: разделитель и после последнего значения строки
+      roro_lib::dump_options grid;
+      grid.trailing_separator = true;
+      window.str("");
+      roro_lib::dump_window(m, { 1, 1 }, { 2, 3 }, window, grid);
+      ASSERT_TRUE(window.str() == "5 0 0 \n0 0 -7 \n");
+
+      // окно трехмерной матрицы: строка на каждую пару ведущих координат
+      roro_lib::matrix<long long, 0, 3> cube;
+      cube[0][1][2] = 9;
+      std::string text;
+      roro_lib::dump_window(cube, { 0, 0, 1 }, { 0, 1, 2 }, [&](const char* data, std::size_t size) { text.append(data, size); });
+      ASSERT_TRUE(text == "0 0\n0 9\n");
+}
+
+TEST(matrix, dump_coordinates_parallel)
+{
+      roro_lib::matrix<int, 0> m;
+      std::mt19937 gen(5);
+      for (int n = 0; n < 20000; ++n)
+            m[gen() % 1000][gen() % 1000] = static_cast<int>(gen() % 100) - 50;
+
+      // маленький буфер: много частей и много вызовов записи
+      roro_lib::dump_options options;
+      options.buffer_size = 4096;
+      std::string sequential;
+      std::size_t writes = 0;
+      roro_lib::dump_coordinates(m, [&](const char* data, std::size_t size) {
+            sequential.append(data, size);
+            ++writes;
+      }, options);
+      ASSERT_TRUE(writes > 1 && writes < m.size() / 10);
+
+      std::map<std::pair<std::size_t, std::size_t>, int> cells;
+      std::istringstream in(sequential);
+      std::size_t x, y;
+      int v;
+      while (in >> x >> y >> v)
+            cells[{ x, y }] = v;
+      ASSERT_TRUE(cells.size() == m.size());
+      for (const auto& [row, column, value] : m)
+            ASSERT_TRUE(cells.at({ row, column }) == value);
+
+      for (std::size_t threads : { 2, 4 })
+      {
+            options.threads = threads;
+            std::ostringstream parallel;
+            roro_lib::dump_coordinates(m, parallel, options);
+            ASSERT_TRUE(parallel.str() == sequential);
+      }
+
+      options.threads = 1;
+      options.coordinate_separator = 'x';
+      options.reverse_coordinates = true;
+      roro_lib::matrix<int, 0> one;
+      one[3][8] = 1;
+      std::ostringstream math_order;
+      roro_lib::dump_coordinates(one, math_order, options);
+      ASSERT_TRUE(math_order.str() == "8x3 1\n");
+}